@@ -0,0 +1,123 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <mutex>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include "../Topology/cpu_topology.h"
+
+/*
+    连接读写缓冲的内存池
+    缓冲按大小分级：SLAB_SIZE(4KB)、8KB、16KB、32KB、64KB。
+    - 全局池：每个级别一个加锁的空闲链表
+    - 线程缓存：每个线程每个级别缓存最多THREAD_CACHE_SIZE个缓冲，命中时不加锁；
+      缓存满时把一半归还全局池，缓存空时从全局池批量取回
+    连接只在有数据需要处理时持有缓冲，空闲时归还，内存占用随活跃流量而不是MAX_FD变化。
+    全局池按NUMA节点分片，线程只与自己所在节点(cpu_topology::current_node)的分片交换缓冲，
+    远端节点上的线程释放的缓冲不会流到本节点，未固定CPU的线程都使用0号分片。
+*/
+class buffer_pool{
+public:
+    static const size_t SLAB_SIZE = 4096;
+    static const int CLASS_COUNT = 5;
+    static const size_t MAX_SIZE = SLAB_SIZE << ( CLASS_COUNT - 1 );
+    static const int THREAD_CACHE_SIZE = 64;
+
+    static buffer_pool& instance(){
+        static buffer_pool pool;
+        return pool;
+    }
+
+    // 返回容纳size字节的最小级别，超出MAX_SIZE返回-1
+    static int size_class(size_t size){
+        int cls = 0;
+        while( cls < CLASS_COUNT && ( SLAB_SIZE << cls ) < size ){
+            ++cls;
+        }
+        return cls < CLASS_COUNT ? cls : -1;
+    }
+
+    static size_t class_size(int cls){ return SLAB_SIZE << cls; }
+
+    char* acquire(int cls){
+        thread_cache& cache = local_cache();
+        std::vector<char*>& local = cache.free[cls];
+        if( local.empty() ){
+            refill(cls, local);
+        }
+        if( !local.empty() ){
+            char* buf = local.back();
+            local.pop_back();
+            return buf;
+        }
+        return (char*)aligned_alloc( 64, class_size( cls ) );
+    }
+
+    void release(int cls, char* buf){
+        if( !buf ){
+            return;
+        }
+        thread_cache& cache = local_cache();
+        std::vector<char*>& local = cache.free[cls];
+        if( (int)local.size() >= THREAD_CACHE_SIZE ){
+            spill(cls, local);
+        }
+        local.push_back(buf);
+    }
+
+private:
+    struct global_class{
+        std::mutex mutex;
+        std::vector<char*> free;
+    };
+
+    // 线程退出时把缓存的缓冲归还全局池
+    struct thread_cache{
+        std::vector<char*> free[CLASS_COUNT];
+        ~thread_cache(){
+            for( int cls = 0; cls < CLASS_COUNT; ++cls ){
+                while( !free[cls].empty() ){
+                    buffer_pool::instance().spill(cls, free[cls]);
+                }
+            }
+        }
+    };
+
+    buffer_pool(){}
+    ~buffer_pool(){
+        for( int node = 0; node < cpu_topology::MAX_NODES; ++node ){
+            for( int cls = 0; cls < CLASS_COUNT; ++cls ){
+                for( char* buf : m_classes[node][cls].free ){
+                    free( buf );
+                }
+            }
+        }
+    }
+
+    static thread_cache& local_cache(){
+        static thread_local thread_cache cache;
+        return cache;
+    }
+
+    void refill(int cls, std::vector<char*>& local){
+        global_class& g = m_classes[cpu_topology::current_node()][cls];
+        std::lock_guard<std::mutex> lock(g.mutex);
+        size_t n = std::min( g.free.size(), (size_t)THREAD_CACHE_SIZE / 2 );
+        local.insert( local.end(), g.free.end() - n, g.free.end() );
+        g.free.resize( g.free.size() - n );
+    }
+
+    void spill(int cls, std::vector<char*>& local){
+        size_t n = ( local.size() + 1 ) / 2;
+        global_class& g = m_classes[cpu_topology::current_node()][cls];
+        std::lock_guard<std::mutex> lock(g.mutex);
+        g.free.insert( g.free.end(), local.end() - n, local.end() );
+        local.resize( local.size() - n );
+    }
+
+    global_class m_classes[cpu_topology::MAX_NODES][CLASS_COUNT];
+};
+
+#endif
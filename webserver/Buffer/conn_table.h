@@ -0,0 +1,123 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+
+/*
+    按描述符索引的连接对象表
+    - 槽位数组只保存指针，用calloc分配，没有连接的描述符对应的页从不被访问，不占用物理内存
+    - 连接对象在accept时才分配：按SLAB_OBJECTS个一组从slab中切出，关闭后放回空闲链表给之后的连接复用。
+      slab不归还系统，内存占用随同时存在的连接数的峰值增长，而不是随MAX_FD
+    - 关闭分两步：描述符关闭之前detach()摘下槽位(之后同一个描述符号马上可以分配给新连接)，
+      对象的清理全部完成后recycle()放回空闲链表
+    分配和回收只发生在建立和关闭连接时，用一把锁保护空闲链表
+*/
+template <typename T>
+class conn_table{
+public:
+    static const int SLAB_OBJECTS = 64;
+
+    explicit conn_table( int capacity ): m_capacity( capacity ), m_allocated( 0 ){
+        m_slots = static_cast<std::atomic<T*>*>( calloc( capacity, sizeof( std::atomic<T*> ) ) );
+        if( !m_slots ){
+            throw std::bad_alloc();
+        }
+    }
+
+    ~conn_table(){
+        for( T* slab : m_slabs ){
+            for( int i = 0; i < SLAB_OBJECTS; ++i ){
+                slab[i].~T();
+            }
+            free( slab );
+        }
+        free( m_slots );
+    }
+
+    conn_table( const conn_table& ) = delete;
+    conn_table& operator=( const conn_table& ) = delete;
+
+    int capacity() const { return m_capacity; }
+
+    // 描述符当前对应的连接，没有时返回nullptr
+    T* get( int fd ) const {
+        if( fd < 0 || fd >= m_capacity ){
+            return nullptr;
+        }
+        return m_slots[fd].load( std::memory_order_acquire );
+    }
+
+    // 为新接受的描述符分配一个连接对象，对象保留上一次使用时的状态，由调用者初始化
+    T* acquire( int fd ){
+        if( fd < 0 || fd >= m_capacity ){
+            return nullptr;
+        }
+        T* obj;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if( m_free.empty() && !grow() ){
+                return nullptr;
+            }
+            obj = m_free.back();
+            m_free.pop_back();
+        }
+        m_slots[fd].store( obj, std::memory_order_release );
+        return obj;
+    }
+
+    // 把连接对象拥有的另一个描述符(反向代理的上游连接)也映射到它，事件循环按描述符找到连接后再区分是哪一个
+    void attach( int fd, T* obj ){
+        if( fd >= 0 && fd < m_capacity ){
+            m_slots[fd].store( obj, std::memory_order_release );
+        }
+    }
+
+    // 关闭描述符之前调用。槽位已经属于新连接时不动它
+    void detach( int fd, T* obj ){
+        if( fd >= 0 && fd < m_capacity ){
+            m_slots[fd].compare_exchange_strong( obj, nullptr, std::memory_order_acq_rel );
+        }
+    }
+
+    // 对象不再被访问之后调用
+    void recycle( T* obj ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_free.push_back( obj );
+    }
+
+    // 已经创建的连接对象个数
+    size_t allocated() const { return m_allocated.load( std::memory_order_relaxed ); }
+
+private:
+    bool grow(){
+        size_t align = alignof( T ) > 64 ? alignof( T ) : 64;
+        T* slab = static_cast<T*>( aligned_alloc( align, sizeof( T ) * SLAB_OBJECTS ) );
+        if( !slab ){
+            return false;
+        }
+        for( int i = 0; i < SLAB_OBJECTS; ++i ){
+            new ( &slab[i] ) T();
+        }
+        m_slabs.push_back( slab );
+        // 倒序压入，先分配低地址的对象
+        for( int i = SLAB_OBJECTS - 1; i >= 0; --i ){
+            m_free.push_back( &slab[i] );
+        }
+        m_allocated.fetch_add( SLAB_OBJECTS, std::memory_order_relaxed );
+        return true;
+    }
+
+    int m_capacity;
+    std::atomic<T*>* m_slots;
+    std::mutex m_mutex;
+    std::vector<T*> m_free;
+    std::vector<T*> m_slabs;
+    std::atomic<size_t> m_allocated;
+};
+
+#endif
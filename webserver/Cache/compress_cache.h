@@ -0,0 +1,331 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include "file_cache.h"
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#ifdef WEBSERVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WEBSERVER_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/*
+    响应体的内容编码，按优先级从低到高排列
+*/
+enum content_encoding{ ENCODING_IDENTITY = 0, ENCODING_GZIP, ENCODING_BR, ENCODING_COUNT };
+static_assert(ENCODING_COUNT == cached_file::HEADER_BLOCKS, "每种编码对应一份缓存的响应头");
+
+inline const char* encoding_name(content_encoding encoding){
+    static const char* names[ENCODING_COUNT] = { "identity", "gzip", "br" };
+    return names[encoding];
+}
+
+/*
+    解析Accept-Encoding，返回客户端接受的编码位图(1 << content_encoding)
+    q=0表示拒绝该编码，"*"表示接受所有没有单独列出的编码
+*/
+inline unsigned accepted_encodings(const char* value){
+    unsigned accepted = 0, refused = 0, any = 0;
+    while(*value){
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t,;");
+        if(len == 0){
+            break;
+        }
+        const char* token = value;
+        value += len;
+        bool zero = false;
+        const char* end = value + strcspn(value, ",");
+        const char* q = value;
+        while((q = strchr(q, ';')) && q < end){
+            ++q;
+            q += strspn(q, " \t");
+            if((q[0] == 'q' || q[0] == 'Q') && q[1] == '='){
+                zero = atof(q + 2) <= 0;
+            }
+        }
+        value = end;
+        unsigned bits = 0;
+        if((len == 4 && strncasecmp(token, "gzip", 4) == 0) || (len == 6 && strncasecmp(token, "x-gzip", 6) == 0)){
+            bits = 1u << ENCODING_GZIP;
+        }else if(len == 2 && strncasecmp(token, "br", 2) == 0){
+            bits = 1u << ENCODING_BR;
+        }else if(len == 1 && token[0] == '*'){
+            any = zero ? 0 : ~0u;
+            continue;
+        }
+        if(zero){
+            refused |= bits;
+        }else{
+            accepted |= bits;
+        }
+    }
+    return (accepted | (any & ~refused)) & ~(1u << ENCODING_IDENTITY) & ((1u << ENCODING_COUNT) - 1);
+}
+
+/*
+    压缩版本缓存
+    对每个可压缩的文件按编码保存一个压缩版本，优先使用文档目录中预先压缩好的同名.br/.gz文件，
+    没有时在第一次请求时压缩(需要编译时定义WEBSERVER_HAVE_ZLIB / WEBSERVER_HAVE_BROTLI并链接-lz / -lbrotlienc)。
+    - 压缩结果放在匿名映射中，包装成cached_file，与普通文件一样通过shared_ptr在发送期间保持有效
+    - 以原文件的路径为键，用inode、大小和修改时间判断原文件是否变化，变化后丢弃旧的压缩版本
+    - 是否存在同名的预压缩文件在原文件的每个版本中只探测一次，预压缩文件本身由file_cache缓存和监视
+    - 压缩版本的总字节数受容量限制，按LRU淘汰
+*/
+class compress_cache{
+public:
+    static const size_t DEFAULT_CAPACITY = 16 * 1024 * 1024;
+    static const size_t MIN_COMPRESS_SIZE = 256;    // 更小的文件压缩收益抵不上响应头的开销
+    static const size_t ENTRY_OVERHEAD = 128;
+
+    static compress_cache& instance(){
+        static compress_cache cache;
+        return cache;
+    }
+
+    void set_capacity(size_t bytes){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = bytes;
+        evict_locked();
+    }
+
+    /*
+        在客户端接受的编码中选择file的一个压缩版本
+        找到时out指向压缩后的文件并返回其编码，否则返回ENCODING_IDENTITY，out不变
+    */
+    content_encoding acquire(const cached_file_ptr& file, unsigned accepted, cached_file_ptr& out){
+        for(int e = ENCODING_COUNT - 1; e > ENCODING_IDENTITY; --e){
+            content_encoding encoding = (content_encoding)e;
+            if(!(accepted & (1u << encoding))){
+                continue;
+            }
+            if(precompressed(file, encoding, out) || compressed(file, encoding, out)){
+                return encoding;
+            }
+        }
+        return ENCODING_IDENTITY;
+    }
+
+private:
+    enum VARIANT_STATE{ VARIANT_UNKNOWN = 0, VARIANT_PRESENT, VARIANT_ABSENT };
+
+    struct entry{
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        VARIANT_STATE sibling[ENCODING_COUNT];      // 同名的预压缩文件
+        VARIANT_STATE compressed[ENCODING_COUNT];   // 运行时压缩，ABSENT表示压缩后没有变小
+        cached_file_ptr variant[ENCODING_COUNT];
+        std::list<std::string>::iterator lru;
+        size_t cost;
+    };
+
+    compress_cache(): m_capacity(DEFAULT_CAPACITY), m_size(0){}
+
+    static const char* suffix(content_encoding encoding){
+        return encoding == ENCODING_BR ? ".br" : ".gz";
+    }
+
+    // 返回file对应的条目，原文件已经变化时清空旧的条目。调用者持有锁
+    entry& lookup_locked(const cached_file_ptr& file){
+        auto it = m_entries.find(file->path);
+        if(it == m_entries.end()){
+            m_lru.push_front(file->path);
+            entry& e = m_entries[file->path];
+            reset(e, file);
+            e.lru = m_lru.begin();
+            e.cost = ENTRY_OVERHEAD + file->path.size();
+            m_size += e.cost;
+            // 新条目在LRU头部，不会被淘汰；其他条目被删除不影响e的引用
+            evict_locked();
+            return e;
+        }
+        entry& e = it->second;
+        m_lru.splice(m_lru.begin(), m_lru, e.lru);
+        if(e.ino != file->st.st_ino || e.size != file->st.st_size
+            || e.mtime.tv_sec != file->st.st_mtim.tv_sec || e.mtime.tv_nsec != file->st.st_mtim.tv_nsec){
+            m_size -= e.cost;
+            reset(e, file);
+            e.cost = ENTRY_OVERHEAD + file->path.size();
+            m_size += e.cost;
+        }
+        return e;
+    }
+
+    static void reset(entry& e, const cached_file_ptr& file){
+        e.ino = file->st.st_ino;
+        e.size = file->st.st_size;
+        e.mtime = file->st.st_mtim;
+        for(int i = 0; i < ENCODING_COUNT; ++i){
+            e.sibling[i] = VARIANT_UNKNOWN;
+            e.compressed[i] = VARIANT_UNKNOWN;
+            e.variant[i].reset();
+        }
+    }
+
+    // 文档目录中的同名预压缩文件，由file_cache缓存，命中时没有系统调用
+    bool precompressed(const cached_file_ptr& file, content_encoding encoding, cached_file_ptr& out){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(lookup_locked(file).sibling[encoding] == VARIANT_ABSENT){
+                return false;
+            }
+        }
+        std::string path = file->path + suffix(encoding);
+        cached_file_ptr sibling;
+        bool found = file_cache::instance().acquire(path.c_str(), sibling) == 0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entry& e = lookup_locked(file);
+        e.sibling[encoding] = found ? VARIANT_PRESENT : VARIANT_ABSENT;
+        if(found){
+            out = sibling;
+        }
+        return found;
+    }
+
+    // 运行时压缩的版本，第一次请求时在锁外压缩，并发请求可能重复压缩，只保留一份
+    bool compressed(const cached_file_ptr& file, content_encoding encoding, cached_file_ptr& out){
+        if(!can_compress(encoding) || !file->address || (size_t)file->st.st_size < MIN_COMPRESS_SIZE){
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry& e = lookup_locked(file);
+            if(e.compressed[encoding] == VARIANT_ABSENT){
+                return false;
+            }
+            if(e.variant[encoding]){
+                out = e.variant[encoding];
+                return true;
+            }
+        }
+        std::shared_ptr<cached_file> variant = compress(file, encoding);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entry& e = lookup_locked(file);
+        if(!variant){
+            e.compressed[encoding] = VARIANT_ABSENT;
+            return false;
+        }
+        if(!e.variant[encoding]){
+            size_t cost = ((size_t)variant->st.st_size + 4095) & ~(size_t)4095;
+            if(cost > m_capacity / 8){
+                // 太大的压缩结果只用于本次响应
+                out = variant;
+                return true;
+            }
+            variant->cached = true;
+            e.variant[encoding] = variant;
+            e.compressed[encoding] = VARIANT_PRESENT;
+            e.cost += cost;
+            m_size += cost;
+            out = variant;
+            evict_locked();
+            return true;
+        }
+        out = e.variant[encoding];
+        return true;
+    }
+
+    static bool can_compress(content_encoding encoding){
+#ifdef WEBSERVER_HAVE_ZLIB
+        if(encoding == ENCODING_GZIP) return true;
+#endif
+#ifdef WEBSERVER_HAVE_BROTLI
+        if(encoding == ENCODING_BR) return true;
+#endif
+        (void)encoding;
+        return false;
+    }
+
+    // 把原文件压缩到匿名映射中，压缩后没有变小时返回nullptr
+    static std::shared_ptr<cached_file> compress(const cached_file_ptr& file, content_encoding encoding){
+        size_t len = file->st.st_size;
+        size_t bound = 0;
+#ifdef WEBSERVER_HAVE_ZLIB
+        if(encoding == ENCODING_GZIP) bound = compressBound(len) + 32;     // gzip头和尾
+#endif
+#ifdef WEBSERVER_HAVE_BROTLI
+        if(encoding == ENCODING_BR) bound = BrotliEncoderMaxCompressedSize(len);
+#endif
+        if(bound == 0){
+            return nullptr;
+        }
+        void* address = mmap(0, bound, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(address == MAP_FAILED){
+            return nullptr;
+        }
+        size_t size = 0;
+#ifdef WEBSERVER_HAVE_ZLIB
+        if(encoding == ENCODING_GZIP){
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            // windowBits加16输出gzip格式
+            if(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK){
+                zs.next_in = (Bytef*)file->address;
+                zs.avail_in = len;
+                zs.next_out = (Bytef*)address;
+                zs.avail_out = bound;
+                if(deflate(&zs, Z_FINISH) == Z_STREAM_END){
+                    size = zs.total_out;
+                }
+                deflateEnd(&zs);
+            }
+        }
+#endif
+#ifdef WEBSERVER_HAVE_BROTLI
+        if(encoding == ENCODING_BR){
+            size_t out_size = bound;
+            // 质量5在压缩率和首次请求的压缩耗时之间折中
+            if(BrotliEncoderCompress(5, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                                     (const uint8_t*)file->address, &out_size, (uint8_t*)address)){
+                size = out_size;
+            }
+        }
+#endif
+        if(size == 0 || size >= len - len / 8){
+            munmap(address, bound);
+            return nullptr;
+        }
+        // 缩小映射，释放多余的页
+        void* shrunk = mremap(address, bound, size, 0);
+        if(shrunk == MAP_FAILED){
+            munmap(address, bound);
+            return nullptr;
+        }
+        mprotect(shrunk, size, PROT_READ);
+        std::shared_ptr<cached_file> variant = std::make_shared<cached_file>();
+        variant->path = file->path + suffix(encoding);
+        variant->st = file->st;
+        variant->st.st_size = size;
+        variant->address = (char*)shrunk;
+        return variant;
+    }
+
+    void evict_locked(){
+        // 最近使用的条目不淘汰，它可能正在被调用者引用
+        while(m_size > m_capacity && m_lru.size() > 1){
+            auto it = m_entries.find(m_lru.back());
+            m_size -= it->second.cost;
+            m_lru.pop_back();
+            m_entries.erase(it);
+        }
+    }
+
+private:
+    std::unordered_map<std::string, entry> m_entries;
+    std::list<std::string> m_lru;   // 头部为最近使用
+    size_t m_capacity;
+    size_t m_size;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+
+/*
+    一个文件版本的响应头中不随请求变化的部分(Content-Type到Accept-Ranges)序列化后的结果，
+    由第一个发送它的连接填充，之后的200/206响应直接复制
+*/
+struct header_block{
+    static const size_t CAPACITY = 240;
+    enum { EMPTY, FILLING, READY };
+    std::atomic<int> state;
+    unsigned short len;
+    char data[CAPACITY];
+
+    header_block(): state(EMPTY), len(0){}
+};
+
+struct cached_file{
+    static const int HEADER_BLOCKS = 3;     // 原文件、gzip、br各一份
+
+    std::string path;
+    struct stat st;
+    char* address;  // mmap的起始地址，空文件和大文件为nullptr
+    int fd;         // 大文件的只读描述符，供sendfile使用，其余为-1
+    bool cached;    // 是否被缓存持有(过大的文件只为本次请求映射)
+    mutable header_block headers[HEADER_BLOCKS];    // 按发送的编码索引，条目失效时随之丢弃
+    // 条目已经离开缓存(文件变化或者被淘汰)，之后不再收到文件变化的通知，由它生成的完整响应不能再使用
+    mutable std::atomic<bool> stale;
+
+    cached_file(): address(nullptr), fd(-1), cached(false), stale(false){}
+    ~cached_file(){
+        if(address){
+            munmap(address, st.st_size);
+        }
+        if(fd != -1){
+            close(fd);
+        }
+    }
+    cached_file(const cached_file&) = delete;
+    cached_file& operator=(const cached_file&) = delete;
+};
+typedef std::shared_ptr<const cached_file> cached_file_ptr;
+
+/*
+    所有工作线程共享的文件缓存
+    以解析后的完整路径为键，保存文件的struct stat元数据和只读内存映射。
+    命中时不需要任何文件系统调用(stat/open/mmap/munmap)。
+    - 引用计数：映射由shared_ptr管理，条目被淘汰或失效后，正在发送该文件的连接仍持有引用，
+      最后一个引用释放时才munmap
+    - 容量：按文件字节数计算，超出预算时按LRU淘汰
+    - 大文件：不小于sendfile阈值的文件不做映射，只缓存打开的文件描述符，由sendfile发送。
+      这类条目按一页计入预算，另外按个数限制在RLIMIT_NOFILE的1/4以内，避免占满描述符和inotify监视
+    - 失效：每个缓存的文件都注册了inotify监视，文件被修改、删除或移动时立即从缓存中移除
+*/
+class file_cache{
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+    static const size_t DEFAULT_SENDFILE_THRESHOLD = 256 * 1024;
+    static const size_t FD_ENTRY_COST = 4096;  // 只缓存描述符的条目按一页计入预算
+    static const size_t DEFAULT_MAX_FD_ENTRIES = 1024;  // 无法读取RLIMIT_NOFILE时的上限
+
+    static file_cache& instance(){
+        static file_cache cache;
+        return cache;
+    }
+
+    // 设置缓存的字节预算，单个文件超过预算的1/8时不进入缓存
+    void set_capacity(size_t bytes){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = bytes;
+        m_max_entry = bytes / 8;
+        evict_locked();
+    }
+
+    // 不小于该大小的文件只打开不映射，响应时使用sendfile零拷贝发送
+    void set_sendfile_threshold(size_t bytes){
+        m_sendfile_threshold = bytes;
+    }
+
+    // inotify文件描述符，需要由事件循环监听其可读事件并调用process_events()
+    int inotify_fd() const { return m_inotify_fd; }
+
+    /*
+        获取path对应的文件
+        成功返回0并填充out；失败返回errno风格的错误码：
+            ENOENT  文件不存在
+            EACCES  其他用户不可读
+            EISDIR  是目录或不是普通文件
+    */
+    int acquire(const char* path, cached_file_ptr& out){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(path);
+            if(it != m_entries.end()){
+                // 命中，移动到LRU链表头部
+                touch_locked(it->second);
+                out = it->second.file;
+                return 0;
+            }
+        }
+        return load(path, out);
+    }
+
+    /*
+        只获取文件的元数据，供条件请求在发送304之前判断文件是否变化
+        命中时out为缓存的文件；未命中时只做一次stat，不打开也不映射文件，out为空。错误码与acquire()相同
+    */
+    int lookup(const char* path, struct stat& st, cached_file_ptr& out){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(path);
+            if(it != m_entries.end()){
+                touch_locked(it->second);
+                out = it->second.file;
+                st = out->st;
+                return 0;
+            }
+        }
+        if(::stat(path, &st) < 0){
+            return ENOENT;
+        }
+        return check_stat(st);
+    }
+
+    /*
+        读取inotify事件，使被修改的文件失效
+        事件队列溢出(IN_Q_OVERFLOW，wd为-1)时内核丢弃了事件，无法知道哪些文件变化了，清空整个缓存。
+        由这些条目生成的完整响应和压缩版本随stale标记一起失效
+    */
+    void process_events(){
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        for(;;){
+            ssize_t len = read(m_inotify_fd, buf, sizeof(buf));
+            if(len <= 0){
+                break;
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(char* p = buf; p < buf + len; ){
+                struct inotify_event* event = (struct inotify_event*)p;
+                if(event->mask & IN_Q_OVERFLOW){
+                    flush_locked();
+                }else{
+                    invalidate_watch_locked(event->wd, (event->mask & IN_IGNORED) != 0);
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+private:
+    struct entry{
+        cached_file_ptr file;
+        std::list<std::string>::iterator lru;
+        std::list<std::string>::iterator fd_lru;    // 只缓存描述符的条目在m_fd_lru中的位置
+        int wd;
+        size_t cost;
+    };
+
+    // 正在stat/mmap的文件：同一个文件的并发加载共用一个监视
+    struct loading{
+        int count = 0;
+        bool changed = false;   // 加载期间收到过事件
+    };
+
+    file_cache(): m_capacity(DEFAULT_CAPACITY), m_max_entry(DEFAULT_CAPACITY / 8),
+        m_sendfile_threshold(DEFAULT_SENDFILE_THRESHOLD), m_size(0), m_max_fd_entries(DEFAULT_MAX_FD_ENTRIES){
+        // 描述符的其余部分留给连接、监听socket和代理的上游连接
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY){
+            m_max_fd_entries = limit.rlim_cur / 4 > 0 ? limit.rlim_cur / 4 : 1;
+        }
+        // inotify不可用时(例如达到系统限制)，不缓存任何文件，每次请求都重新映射
+        m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    ~file_cache(){
+        if(m_inotify_fd != -1){
+            close(m_inotify_fd);
+        }
+    }
+
+    /*
+        先注册监视并在m_loading中登记，再stat和mmap。这期间读到的该监视的事件记在m_loading中，
+        加载完成后发现有事件就不放入缓存，只供本次请求使用；检查m_loading和插入条目在同一次加锁中完成，
+        之后的事件都能在m_watches中找到新条目。因此缓存中的条目不会比它之后的最后一个事件更旧
+    */
+    int load(const char* path, cached_file_ptr& out){
+        int wd = -1;
+        if(m_inotify_fd != -1){
+            wd = inotify_add_watch(m_inotify_fd, path,
+                IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+        }
+        if(wd != -1){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_loading[wd].count;
+        }
+
+        std::shared_ptr<cached_file> file = std::make_shared<cached_file>();
+        file->path = path;
+        int err = open_file(file.get());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool changed = finish_loading_locked(wd);
+        if(err != 0){
+            release_watch_locked(wd);
+            return err;
+        }
+
+        size_t cost = file->address ? file->st.st_size : FD_ENTRY_COST;
+        if(wd == -1 || changed || cost > m_max_entry){
+            release_watch_locked(wd);
+            out = file;
+            return 0;
+        }
+
+        auto it = m_entries.find(file->path);
+        if(it != m_entries.end()){
+            // 其他线程已经加载了同一个文件
+            out = it->second.file;
+            return 0;
+        }
+        file->cached = true;
+        m_lru.push_front(file->path);
+        entry& e = m_entries[file->path];
+        e.file = file;
+        e.lru = m_lru.begin();
+        if(file->fd != -1){
+            m_fd_lru.push_front(file->path);
+            e.fd_lru = m_fd_lru.begin();
+        }
+        e.wd = wd;
+        e.cost = cost;
+        m_watches[wd].push_back(file->path);
+        m_size += cost;
+        evict_locked();
+        out = file;
+        return 0;
+    }
+
+    int open_file(cached_file* file){
+        if(stat(file->path.c_str(), &file->st) < 0){
+            return ENOENT;
+        }
+        int err = check_stat(file->st);
+        if(err != 0){
+            return err;
+        }
+        if(file->st.st_size == 0){
+            return 0;
+        }
+        int fd = open(file->path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            return errno == ENOENT ? ENOENT : EACCES;
+        }
+        if((size_t)file->st.st_size >= m_sendfile_threshold){
+            file->fd = fd;
+            return 0;
+        }
+        void* address = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(address == MAP_FAILED){
+            return EACCES;
+        }
+        file->address = (char*)address;
+        return 0;
+    }
+
+    static int check_stat(const struct stat& st){
+        // 判断访问权限
+        if(!(st.st_mode & S_IROTH)){
+            return EACCES;
+        }
+        if(!S_ISREG(st.st_mode)){
+            return EISDIR;
+        }
+        return 0;
+    }
+
+    // 结束一次加载，返回加载期间是否收到了该监视的事件
+    bool finish_loading_locked(int wd){
+        if(wd == -1){
+            return false;
+        }
+        auto it = m_loading.find(wd);
+        bool changed = it->second.changed;
+        if(--it->second.count == 0){
+            m_loading.erase(it);
+        }
+        return changed;
+    }
+
+    // 监视没有被缓存条目使用，也没有其他线程正在加载时才移除
+    void release_watch_locked(int wd){
+        if(wd != -1 && m_watches.find(wd) == m_watches.end() && m_loading.find(wd) == m_loading.end()){
+            inotify_rm_watch(m_inotify_fd, wd);
+        }
+    }
+
+    void touch_locked(entry& e){
+        m_lru.splice(m_lru.begin(), m_lru, e.lru);
+        if(e.file->fd != -1){
+            m_fd_lru.splice(m_fd_lru.begin(), m_fd_lru, e.fd_lru);
+        }
+    }
+
+    // 从缓存中删除条目，不处理它的监视
+    void erase_locked(std::unordered_map<std::string, entry>::iterator it){
+        it->second.file->stale.store(true, std::memory_order_release);
+        m_size -= it->second.cost;
+        m_lru.erase(it->second.lru);
+        if(it->second.file->fd != -1){
+            m_fd_lru.erase(it->second.fd_lru);
+        }
+        m_entries.erase(it);
+    }
+
+    void remove_locked(std::unordered_map<std::string, entry>::iterator it){
+        int wd = it->second.wd;
+        auto w = m_watches.find(wd);
+        if(w != m_watches.end()){
+            std::vector<std::string>& paths = w->second;
+            for(size_t i = 0; i < paths.size(); ++i){
+                if(paths[i] == it->first){
+                    paths[i] = paths.back();
+                    paths.pop_back();
+                    break;
+                }
+            }
+            if(paths.empty()){
+                m_watches.erase(w);
+                release_watch_locked(wd);
+            }
+        }
+        erase_locked(it);
+    }
+
+    void invalidate_watch_locked(int wd, bool ignored){
+        auto l = m_loading.find(wd);
+        if(l != m_loading.end()){
+            l->second.changed = true;
+        }
+        auto w = m_watches.find(wd);
+        if(w == m_watches.end()){
+            return;
+        }
+        std::vector<std::string> paths;
+        paths.swap(w->second);
+        m_watches.erase(w);
+        for(size_t i = 0; i < paths.size(); ++i){
+            auto it = m_entries.find(paths[i]);
+            if(it != m_entries.end()){
+                erase_locked(it);
+            }
+        }
+        if(!ignored){
+            release_watch_locked(wd);
+        }
+    }
+
+    // 丢弃所有条目和监视，正在进行的加载也不再放入缓存
+    void flush_locked(){
+        for(auto& l : m_loading){
+            l.second.changed = true;
+        }
+        for(auto& e : m_entries){
+            e.second.file->stale.store(true, std::memory_order_release);
+        }
+        m_entries.clear();
+        m_lru.clear();
+        m_fd_lru.clear();
+        m_size = 0;
+        std::unordered_map<int, std::vector<std::string>> watches;
+        watches.swap(m_watches);
+        for(auto& w : watches){
+            release_watch_locked(w.first);
+        }
+    }
+
+    void evict_locked(){
+        while(m_size > m_capacity && !m_lru.empty()){
+            remove_locked(m_entries.find(m_lru.back()));
+        }
+        // 描述符条目超过上限时淘汰其中最久未使用的
+        while(m_fd_lru.size() > m_max_fd_entries){
+            remove_locked(m_entries.find(m_fd_lru.back()));
+        }
+    }
+
+private:
+    std::unordered_map<std::string, entry> m_entries;
+    std::list<std::string> m_lru;                           // 头部为最近使用
+    std::list<std::string> m_fd_lru;                        // 只缓存描述符的条目，顺序与m_lru相同
+    std::unordered_map<int, std::vector<std::string>> m_watches;    // inotify wd -> 路径
+    std::unordered_map<int, loading> m_loading;             // inotify wd -> 正在进行的加载
+    size_t m_capacity;
+    size_t m_max_entry;
+    size_t m_sendfile_threshold;
+    size_t m_size;
+    size_t m_max_fd_entries;
+    int m_inotify_fd;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "file_cache.h"
+#include "compress_cache.h"
+#include <string>
+#include <string_view>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+    完整响应缓存
+    小文件的200响应(状态行、头部和响应体)按发送的格式保存在一块连续的内存中，以路径和客户端接受的编码为键。
+    命中的请求在reactor线程中用一次send回复，不经过线程池，也不查找文件缓存、不格式化响应头
+    - 只缓存静态文件处理函数对GET请求的keep-alive响应，条件请求、Range等仍由正常的路径处理
+    - 失效：条目引用生成它的文件缓存条目，文件缓存丢弃它们(文件变化或被淘汰)时响应随之失效，在下一次查找时删除
+    - 响应放在匿名映射中，包装成cached_file，一次发送不完时由连接持有引用，与文件一样在本批发送完毕后释放
+    - 容量按页计算，超出时按LRU淘汰
+*/
+class response_cache{
+public:
+    static const size_t DEFAULT_CAPACITY = 8 * 1024 * 1024;
+    static const size_t MAX_RESPONSE = 16 * 1024;   // 更大的文件由writev/sendfile发送，合并成一块的收益不明显
+    static const size_t ENTRY_OVERHEAD = 128;
+
+    static response_cache& instance(){
+        static response_cache cache;
+        return cache;
+    }
+
+    void set_capacity(size_t bytes){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = bytes;
+        evict_locked();
+    }
+
+    // 没有任何条目时快速路径不需要解析请求
+    bool empty() const { return m_count.load(std::memory_order_relaxed) == 0; }
+
+    size_t size(){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    /*
+        查找path在客户端接受的编码为accepted时的响应
+        找到时out指向完整的响应(st_size为总长度)并返回响应体的编码，否则返回-1。已经失效的条目在这里删除
+    */
+    int acquire(std::string_view path, unsigned accepted, cached_file_ptr& out){
+        std::string key = make_key(path, accepted);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if(it == m_entries.end()){
+            return -1;
+        }
+        if(stale(it->second)){
+            remove_locked(it);
+            return -1;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        out = it->second.response;
+        return it->second.encoding;
+    }
+
+    /*
+        保存一个响应：head是状态行和头部，body是file的内容(可能是origin的压缩版本)
+        同一个键已经有有效的条目时什么都不做，未命中的并发请求只保留一份
+    */
+    void insert(std::string_view path, unsigned accepted, content_encoding encoding, const char* head, size_t head_len,
+                const char* body, size_t body_len, const cached_file_ptr& origin, const cached_file_ptr& file){
+        size_t len = head_len + body_len;
+        if(len > MAX_RESPONSE){
+            return;
+        }
+        std::string key = make_key(path, accepted);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(key);
+            if(it != m_entries.end() && !stale(it->second)){
+                return;
+            }
+        }
+        void* address = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(address == MAP_FAILED){
+            return;
+        }
+        memcpy(address, head, head_len);
+        if(body_len > 0){
+            memcpy((char*)address + head_len, body, body_len);
+        }
+        mprotect(address, len, PROT_READ);
+        std::shared_ptr<cached_file> response = std::make_shared<cached_file>();
+        response->path = file->path;
+        memset(&response->st, 0, sizeof(response->st));
+        response->st.st_size = len;
+        response->address = (char*)address;
+        response->cached = true;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if(it != m_entries.end()){
+            if(!stale(it->second)){
+                return;
+            }
+            remove_locked(it);
+        }
+        entry e;
+        e.response = response;
+        e.origin = origin;
+        e.file = file;
+        e.encoding = encoding;
+        e.cost = ((len + 4095) & ~(size_t)4095) + ENTRY_OVERHEAD + key.size();
+        // 文件在生成响应之后已经变化
+        if(stale(e)){
+            return;
+        }
+        m_lru.push_front(key);
+        e.lru = m_lru.begin();
+        m_size += e.cost;
+        m_entries.emplace(std::move(key), std::move(e));
+        m_count.store(m_entries.size(), std::memory_order_relaxed);
+        evict_locked();
+    }
+
+private:
+    struct entry{
+        cached_file_ptr response;
+        cached_file_ptr origin;     // 原文件，压缩版本也随它失效
+        cached_file_ptr file;       // 响应体来自的文件：原文件、预压缩文件或运行时压缩的版本
+        content_encoding encoding;
+        std::list<std::string>::iterator lru;
+        size_t cost;
+    };
+
+    response_cache(): m_capacity(DEFAULT_CAPACITY), m_size(0), m_count(0){}
+
+    // 路径中不会出现'\0'，用它分隔编码的位图
+    static std::string make_key(std::string_view path, unsigned accepted){
+        std::string key;
+        key.reserve(path.size() + 2);
+        key.append(path.data(), path.size());
+        key.push_back('\0');
+        key.push_back((char)accepted);
+        return key;
+    }
+
+    static bool stale(const entry& e){
+        return e.origin->stale.load(std::memory_order_acquire) || e.file->stale.load(std::memory_order_acquire);
+    }
+
+    void remove_locked(std::unordered_map<std::string, entry>::iterator it){
+        m_size -= it->second.cost;
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+        m_count.store(m_entries.size(), std::memory_order_relaxed);
+    }
+
+    void evict_locked(){
+        while(m_size > m_capacity && !m_lru.empty()){
+            remove_locked(m_entries.find(m_lru.back()));
+        }
+    }
+
+private:
+    std::unordered_map<std::string, entry> m_entries;
+    std::list<std::string> m_lru;   // 头部为最近使用
+    size_t m_capacity;
+    size_t m_size;
+    std::atomic<size_t> m_count;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <sys/types.h>
+#include "hpack.h"
+#include "../Cache/file_cache.h"
+
+/*
+    HTTP/2(RFC 9113)明文连接(h2c)的帧格式和会话状态
+    - 连接以客户端前言(prior knowledge)或HTTP/1.1的Upgrade: h2c切换到HTTP/2，之后读缓冲中是帧
+    - 请求的头部块解码后填入连接的解析字段，复用HTTP/1的路由和文件发送路径，
+      响应的HEADERS写入控制帧缓冲，响应体以DATA帧的形式在各个流之间轮流发送，受双方的流量控制窗口限制
+    - 会话只保存协议状态，帧的收发由http_conn完成
+*/
+namespace h2{
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t PREFACE_LEN = sizeof( PREFACE ) - 1;
+static const size_t FRAME_HEADER_LEN = 9;
+
+enum FRAME_TYPE{
+    FRAME_DATA = 0,
+    FRAME_HEADERS,
+    FRAME_PRIORITY,
+    FRAME_RST_STREAM,
+    FRAME_SETTINGS,
+    FRAME_PUSH_PROMISE,
+    FRAME_PING,
+    FRAME_GOAWAY,
+    FRAME_WINDOW_UPDATE,
+    FRAME_CONTINUATION,
+};
+
+enum FRAME_FLAG{
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20,
+};
+
+enum ERROR_CODE{
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    ENHANCE_YOUR_CALM = 0xb,
+};
+
+enum SETTING{
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+static const uint32_t DEFAULT_WINDOW = 65535;
+static const uint32_t MAX_WINDOW = 0x7fffffff;
+static const uint32_t DEFAULT_MAX_FRAME = 16384;    // 我们不通告更大的帧，对方的帧也不能超过它
+static const uint32_t MAX_FRAME_LIMIT = 16777215;
+static const uint32_t MAX_CONCURRENT_STREAMS = 100;
+static const size_t MAX_HEADER_BLOCK = 64 * 1024;   // HEADERS+CONTINUATION累积的上限
+static const size_t MAX_REQUEST_BODY = 1024 * 1024;
+static const uint32_t WINDOW_UPDATE_THRESHOLD = DEFAULT_WINDOW / 2;    // 消费了一半窗口时归还
+
+struct frame_header{
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+};
+
+inline uint32_t read_u32( const uint8_t* p ){
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+inline void write_u32( char* p, uint32_t v ){
+    p[0] = (char)( v >> 24 );
+    p[1] = (char)( v >> 16 );
+    p[2] = (char)( v >> 8 );
+    p[3] = (char)v;
+}
+
+inline frame_header read_frame_header( const uint8_t* p ){
+    frame_header h;
+    h.length = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    h.type = p[3];
+    h.flags = p[4];
+    h.stream_id = read_u32( p + 5 ) & MAX_WINDOW;
+    return h;
+}
+
+inline void write_frame_header( char* p, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id ){
+    p[0] = (char)( length >> 16 );
+    p[1] = (char)( length >> 8 );
+    p[2] = (char)length;
+    p[3] = (char)type;
+    p[4] = (char)flags;
+    write_u32( p + 5, stream_id & MAX_WINDOW );
+}
+
+// 把一个完整的帧追加到out
+inline void append_frame( std::string& out, uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t len ){
+    char header[ FRAME_HEADER_LEN ];
+    write_frame_header( header, len, type, flags, stream_id );
+    out.append( header, FRAME_HEADER_LEN );
+    out.append( payload, len );
+}
+
+// base64url(不带填充)，HTTP2-Settings头部中的SETTINGS载荷用它编码
+inline bool base64url_decode( const char* s, std::string& out ){
+    uint32_t acc = 0;
+    int bits = 0;
+    for( ; *s && *s != ' ' && *s != '\t' && *s != '='; ++s ){
+        char c = *s;
+        int v;
+        if( c >= 'A' && c <= 'Z' ) v = c - 'A';
+        else if( c >= 'a' && c <= 'z' ) v = c - 'a' + 26;
+        else if( c >= '0' && c <= '9' ) v = c - '0' + 52;
+        else if( c == '-' ) v = 62;
+        else if( c == '_' ) v = 63;
+        else return false;
+        acc = acc << 6 | v;
+        bits += 6;
+        if( bits >= 8 ){
+            bits -= 8;
+            out.push_back( (char)( acc >> bits ) );
+        }
+    }
+    return true;
+}
+
+/*
+    一个流。请求的头部以"name: value\0"逐行保存，与HTTP/1读缓冲中解析后的格式相同，
+    处理函数通过request_view按需查找。响应体来自映射的内存(文件、匿名映射或静态数据)或者文件描述符(sendfile)
+*/
+struct stream{
+    uint32_t id = 0;
+    bool request_done = false;      // 收到了END_STREAM
+    bool responding = false;        // 响应头已经生成，响应体还没有全部发出
+    int64_t send_window = DEFAULT_WINDOW;
+    uint32_t recv_unacked = 0;      // 收到但还没有用WINDOW_UPDATE归还的字节
+    uint64_t request_time = 0;
+
+    std::string method;
+    std::string path;
+    std::string authority;
+    std::string headers;
+    std::string body;
+
+    cached_file_ptr file;       // 持有响应体所在的文件，直到最后一个DATA帧发送完毕
+    std::string owned;          // 处理函数生成的响应体
+    const char* data = nullptr; // 内存中的响应体的下一个字节，为nullptr时从fd发送
+    int fd = -1;
+    off_t offset = 0;
+    size_t remaining = 0;       // 还没有放进DATA帧的字节数
+};
+
+struct session{
+    hpack::decoder decoder;
+    std::vector<std::unique_ptr<stream>> streams;   // 打开的流，数量很少，线性查找
+    std::vector<std::unique_ptr<stream>> finished;  // 已经结束的流，本批发送完毕后释放
+    uint32_t last_stream_id = 0;    // 对方打开过的最大的流
+    size_t next = 0;                // 轮转发送DATA帧的起点
+
+    int64_t send_window = DEFAULT_WINDOW;       // 连接级的发送窗口
+    uint32_t recv_unacked = 0;
+    uint32_t peer_initial_window = DEFAULT_WINDOW;
+    uint32_t peer_max_frame = DEFAULT_MAX_FRAME;
+
+    std::string control;        // 等待发送的控制帧和HEADERS帧，按生成顺序
+    std::string sending;        // 当前批正在发送的控制帧，iovec引用它
+    std::string block;          // 跨CONTINUATION累积的头部块
+    uint32_t block_stream = 0;  // 不为0时下一帧必须是该流的CONTINUATION
+    bool block_end_stream = false;
+    std::string encode;         // 编码响应头的临时缓冲
+
+    bool preface_received = false;
+    bool goaway_received = false;
+    bool goaway_sent = false;
+
+    stream* find( uint32_t id ) const {
+        for( const std::unique_ptr<stream>& s : streams ){
+            if( s->id == id ){
+                return s.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // 移除的流可能还有DATA帧在当前批中，延迟到本批发送完毕再释放
+    void remove( uint32_t id ){
+        for( size_t i = 0; i < streams.size(); ++i ){
+            if( streams[i]->id == id ){
+                finished.push_back( std::move( streams[i] ) );
+                streams.erase( streams.begin() + i );
+                return;
+            }
+        }
+    }
+
+    void settings(){
+        char payload[ 6 ];
+        payload[0] = 0;
+        payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+        write_u32( payload + 2, MAX_CONCURRENT_STREAMS );
+        append_frame( control, FRAME_SETTINGS, 0, 0, payload, sizeof( payload ) );
+    }
+
+    void window_update( uint32_t stream_id, uint32_t increment ){
+        char payload[ 4 ];
+        write_u32( payload, increment );
+        append_frame( control, FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof( payload ) );
+    }
+
+    void rst_stream( uint32_t stream_id, ERROR_CODE code ){
+        char payload[ 4 ];
+        write_u32( payload, code );
+        append_frame( control, FRAME_RST_STREAM, 0, stream_id, payload, sizeof( payload ) );
+    }
+
+    void goaway( ERROR_CODE code ){
+        char payload[ 8 ];
+        write_u32( payload, last_stream_id );
+        write_u32( payload + 4, code );
+        append_frame( control, FRAME_GOAWAY, 0, 0, payload, sizeof( payload ) );
+        goaway_sent = true;
+    }
+
+    // 头部块按对方的最大帧长拆成HEADERS和若干CONTINUATION
+    void headers( uint32_t stream_id, const std::string& block, bool end_stream ){
+        size_t pos = 0;
+        uint8_t type = FRAME_HEADERS;
+        do{
+            size_t len = std::min( block.size() - pos, (size_t)peer_max_frame );
+            uint8_t flags = ( pos + len == block.size() ? FLAG_END_HEADERS : 0 )
+                | ( type == FRAME_HEADERS && end_stream ? FLAG_END_STREAM : 0 );
+            append_frame( control, type, flags, stream_id, block.data() + pos, len );
+            pos += len;
+            type = FRAME_CONTINUATION;
+        }while( pos < block.size() );
+    }
+
+    // 响应体还有可以在窗口内发送的数据。升级的连接在收到客户端前言之前只发送控制帧和HEADERS，
+    // 有的客户端在101之后只缓冲很少的数据
+    bool sendable() const {
+        if( !preface_received || send_window <= 0 ){
+            return false;
+        }
+        for( const std::unique_ptr<stream>& s : streams ){
+            if( s->responding && s->remaining > 0 && s->send_window > 0 ){
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
+
+#endif
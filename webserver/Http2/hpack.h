@@ -0,0 +1,362 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <deque>
+
+/*
+    HPACK(RFC 7541)：HTTP/2的头部压缩
+    - 解码：静态表、动态表(大小受SETTINGS_HEADER_TABLE_SIZE限制)、前缀整数和Huffman编码的字符串。
+      Huffman解码树在编译期由码表生成，逐位查找
+    - 编码：只用于响应头。名字在静态表中时引用其下标，值按字面量发送且不进入动态表，
+      :status的常见取值直接引用静态表；响应头大多是一次性的值(ETag、长度、日期)，不值得维护编码端的动态表
+*/
+namespace hpack{
+
+struct static_entry{
+    const char* name;
+    const char* value;
+};
+
+// 下标从1开始
+static constexpr static_entry static_table[] = {
+    { "", "" },
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+    { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+    { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+    { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+    { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+    { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+    { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+    { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+    { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+    { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+    { "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+    { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+    { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+    { "www-authenticate", "" },
+};
+static const size_t STATIC_TABLE_SIZE = sizeof( static_table ) / sizeof( static_table[0] ) - 1;
+
+// RFC 7541附录B的Huffman码表：{ 码字, 位数 }，最后一项是EOS
+struct huffman_code{
+    uint32_t code;
+    uint8_t bits;
+};
+static constexpr huffman_code huffman_codes[ 257 ] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// 由码表生成的二叉解码树：内部节点的两个孩子，叶子保存符号
+struct huffman_tree{
+    static const int NODES = 256;   // 257个叶子的满二叉树有256个内部节点
+    // 大于等于0是内部节点的下标，小于0是叶子：-1 - 符号
+    int16_t child[ NODES ][ 2 ];
+    constexpr huffman_tree(): child{}{
+        for( int i = 0; i < NODES; ++i ){
+            child[i][0] = child[i][1] = 0;
+        }
+        int count = 1;
+        for( int sym = 0; sym < 257; ++sym ){
+            int node = 0;
+            for( int b = huffman_codes[sym].bits - 1; b > 0; --b ){
+                int bit = ( huffman_codes[sym].code >> b ) & 1;
+                if( child[node][bit] == 0 ){
+                    child[node][bit] = count++;
+                }
+                node = child[node][bit];
+            }
+            child[node][ huffman_codes[sym].code & 1 ] = -1 - sym;
+        }
+    }
+};
+static constexpr huffman_tree huffman_decode_tree{};
+
+// 解码Huffman字符串，追加到out。填充必须是EOS的前缀(全1)且不超过7位
+inline bool huffman_decode( const uint8_t* p, size_t len, std::string& out ){
+    int node = 0;
+    int depth = 0;      // 当前未完成的码字已经读入的位数
+    bool all_ones = true;
+    for( size_t i = 0; i < len; ++i ){
+        for( int b = 7; b >= 0; --b ){
+            int bit = ( p[i] >> b ) & 1;
+            int next = huffman_decode_tree.child[node][bit];
+            all_ones = all_ones && bit;
+            ++depth;
+            if( next < 0 ){
+                int sym = -1 - next;
+                if( sym == 256 ){
+                    return false;
+                }
+                out.push_back( (char)sym );
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }else if( next == 0 ){
+                return false;
+            }else{
+                node = next;
+            }
+        }
+    }
+    return depth < 8 && all_ones;
+}
+
+// 前缀整数：n是前缀的位数。返回消耗的字节数，数据不完整或溢出时返回0
+inline size_t decode_int( const uint8_t* p, const uint8_t* end, int n, uint32_t& value ){
+    if( p >= end ){
+        return 0;
+    }
+    uint32_t max = ( 1u << n ) - 1;
+    value = p[0] & max;
+    if( value < max ){
+        return 1;
+    }
+    const uint8_t* q = p + 1;
+    int shift = 0;
+    while( q < end ){
+        uint8_t b = *q++;
+        if( shift > 21 ){
+            return 0;
+        }
+        value += (uint32_t)( b & 0x7f ) << shift;
+        shift += 7;
+        if( !( b & 0x80 ) ){
+            return q - p;
+        }
+    }
+    return 0;
+}
+
+inline void encode_int( std::string& out, uint8_t first, int n, uint32_t value ){
+    uint32_t max = ( 1u << n ) - 1;
+    if( value < max ){
+        out.push_back( (char)( first | value ) );
+        return;
+    }
+    out.push_back( (char)( first | max ) );
+    value -= max;
+    while( value >= 128 ){
+        out.push_back( (char)( ( value & 0x7f ) | 0x80 ) );
+        value >>= 7;
+    }
+    out.push_back( (char)value );
+}
+
+class decoder{
+public:
+    static const uint32_t DEFAULT_TABLE_SIZE = 4096;    // 我们通告的SETTINGS_HEADER_TABLE_SIZE
+
+    decoder(): m_size( 0 ), m_max_size( DEFAULT_TABLE_SIZE ){}
+
+    /*
+        解码一个完整的头部块，每个头部调用一次on_header(name, value)。
+        name和value只在回调期间有效(动态表随后可能淘汰它们)。出现压缩错误时返回false，连接必须关闭
+    */
+    template <typename F>
+    bool decode( const uint8_t* p, size_t len, F&& on_header ){
+        const uint8_t* end = p + len;
+        bool first = true;
+        while( p < end ){
+            uint8_t b = *p;
+            uint32_t index;
+            size_t n;
+            if( b & 0x80 ){
+                // 索引的头部
+                if( !( n = decode_int( p, end, 7, index ) ) || index == 0 ){
+                    return false;
+                }
+                p += n;
+                std::string_view name, value;
+                if( !lookup( index, name, value ) ){
+                    return false;
+                }
+                on_header( name, value );
+            }else if( ( b & 0xe0 ) == 0x20 ){
+                // 动态表大小更新，只能出现在头部块的开头
+                if( !first || !( n = decode_int( p, end, 5, index ) ) || index > DEFAULT_TABLE_SIZE ){
+                    return false;
+                }
+                p += n;
+                m_max_size = index;
+                evict( 0 );
+                continue;
+            }else{
+                // 字面量：带增量索引(01)、不索引(0000)、永不索引(0001)
+                bool indexing = ( b & 0xc0 ) == 0x40;
+                int prefix = indexing ? 6 : 4;
+                if( !( n = decode_int( p, end, prefix, index ) ) ){
+                    return false;
+                }
+                p += n;
+                m_name.clear();
+                m_value.clear();
+                if( index ){
+                    std::string_view name, value;
+                    if( !lookup( index, name, value ) ){
+                        return false;
+                    }
+                    m_name.assign( name.data(), name.size() );
+                }else if( !( n = decode_string( p, end, m_name ) ) ){
+                    return false;
+                }else{
+                    p += n;
+                }
+                if( !( n = decode_string( p, end, m_value ) ) ){
+                    return false;
+                }
+                p += n;
+                on_header( std::string_view( m_name ), std::string_view( m_value ) );
+                if( indexing ){
+                    insert( m_name, m_value );
+                }
+            }
+            first = false;
+        }
+        return true;
+    }
+
+private:
+    struct entry{
+        std::string name;
+        std::string value;
+    };
+
+    size_t decode_string( const uint8_t* p, const uint8_t* end, std::string& out ){
+        uint32_t len;
+        size_t n = decode_int( p, end, 7, len );
+        if( !n || len > (size_t)( end - p - n ) ){
+            return 0;
+        }
+        if( p[0] & 0x80 ){
+            if( !huffman_decode( p + n, len, out ) ){
+                return 0;
+            }
+        }else{
+            out.assign( (const char*)p + n, len );
+        }
+        return n + len;
+    }
+
+    bool lookup( uint32_t index, std::string_view& name, std::string_view& value ) const {
+        if( index <= STATIC_TABLE_SIZE ){
+            name = static_table[index].name;
+            value = static_table[index].value;
+            return true;
+        }
+        index -= STATIC_TABLE_SIZE + 1;
+        if( index >= m_entries.size() ){
+            return false;
+        }
+        name = m_entries[index].name;
+        value = m_entries[index].value;
+        return true;
+    }
+
+    // 新条目插在最前面(下标最小)，超出大小时从最旧的一端淘汰
+    void insert( const std::string& name, const std::string& value ){
+        size_t size = name.size() + value.size() + 32;
+        if( size > m_max_size ){
+            m_entries.clear();
+            m_size = 0;
+            return;
+        }
+        evict( size );
+        m_entries.push_front( entry{ name, value } );
+        m_size += size;
+    }
+
+    void evict( size_t incoming ){
+        while( !m_entries.empty() && m_size + incoming > m_max_size ){
+            m_size -= m_entries.back().name.size() + m_entries.back().value.size() + 32;
+            m_entries.pop_back();
+        }
+    }
+
+    std::deque<entry> m_entries;
+    size_t m_size;
+    size_t m_max_size;
+    std::string m_name;     // 字面量头部的临时存储
+    std::string m_value;
+};
+
+// 静态表中名字为name的第一个下标，没有时返回0
+inline uint32_t static_name_index( std::string_view name ){
+    for( uint32_t i = 1; i <= STATIC_TABLE_SIZE; ++i ){
+        if( name == static_table[i].name ){
+            return i;
+        }
+    }
+    return 0;
+}
+
+// :status，常见的几个直接引用静态表
+inline void encode_status( std::string& out, int status ){
+    for( uint32_t i = 8; i <= 14; ++i ){
+        const char* v = static_table[i].value;
+        if( status == ( v[0] - '0' ) * 100 + ( v[1] - '0' ) * 10 + ( v[2] - '0' ) ){
+            encode_int( out, 0x80, 7, i );
+            return;
+        }
+    }
+    char digits[ 4 ] = { (char)( '0' + status / 100 % 10 ), (char)( '0' + status / 10 % 10 ), (char)( '0' + status % 10 ), 0 };
+    encode_int( out, 0x00, 4, 8 );
+    encode_int( out, 0x00, 7, 3 );
+    out.append( digits, 3 );
+}
+
+// 不索引的字面量头部。name必须是小写；name_index为静态表中的下标，0表示名字也按字面量发送
+inline void encode_header( std::string& out, uint32_t name_index, std::string_view name, std::string_view value ){
+    encode_int( out, 0x00, 4, name_index );
+    if( !name_index ){
+        encode_int( out, 0x00, 7, name.size() );
+        out.append( name.data(), name.size() );
+    }
+    encode_int( out, 0x00, 7, value.size() );
+    out.append( value.data(), value.size() );
+}
+
+inline void encode_header( std::string& out, std::string_view name, std::string_view value ){
+    encode_header( out, static_name_index( name ), name, value );
+}
+
+}
+
+#endif
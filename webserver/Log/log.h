@@ -0,0 +1,368 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/*
+    异步日志
+    - 每个写日志的线程有一个自己的环形缓冲(单生产者单消费者，无锁)，热路径上只做一次格式化和两次原子操作，
+      不加锁也不进入内核；缓冲满时丢弃并计数，绝不阻塞工作线程
+    - 后台线程定期把所有环形缓冲中的记录格式化时间戳后批量write到日志文件
+    - 级别低于LOG_COMPILE_LEVEL的日志在编译期去掉，参数也不会求值；运行时还可以用set_level提高级别
+    - 访问日志以二进制字段记录(地址、状态码、字节数等)，由后台线程格式化为key=value的结构化行
+*/
+enum log_level{ LOG_LEVEL_DEBUG = 0, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR, LOG_LEVEL_ACCESS };
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 一条访问日志，字符串字段(方法名、编码名)必须是静态字符串
+struct access_record{
+    uint32_t addr;          // 网络字节序
+    uint16_t port;          // 网络字节序
+    uint16_t status;
+    uint64_t bytes;         // 响应的总字节数(头部和正文)
+    uint32_t duration_us;   // 从开始解析请求到响应就绪
+    const char* method;
+    const char* encoding;
+};
+
+class async_log{
+public:
+    static const int RING_SIZE = 1024;          // 每个线程的记录数，必须是2的幂
+    static const int TEXT_SIZE = 232;           // 一条记录中正文的最大长度
+    static const int FLUSH_INTERVAL_MS = 50;
+    static const int OUTPUT_BUFFER = 64 * 1024;
+
+    static async_log& instance(){
+        static async_log log;
+        return log;
+    }
+
+    async_log( const async_log& ) = delete;
+    async_log& operator=( const async_log& ) = delete;
+
+    // 打开日志文件，path为nullptr时写到标准错误。访问日志默认关闭
+    bool open_error_log( const char* path ){ return reopen( m_error_fd, path ); }
+    bool open_access_log( const char* path ){ return reopen( m_access_fd, path ); }
+    bool access_enabled() const { return m_access_fd.load( std::memory_order_relaxed ) != -1; }
+
+    void set_level( log_level level ){ m_level.store( level, std::memory_order_relaxed ); }
+    bool enabled( log_level level ) const { return level >= m_level.load( std::memory_order_relaxed ); }
+
+    void start(){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( !m_flusher.joinable() ){
+            m_stop = false;
+            m_flusher = std::thread( [this]{ run(); } );
+        }
+    }
+
+    // 停止后台线程，退出前写出所有剩余的记录
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if( !m_flusher.joinable() ){
+                return;
+            }
+            m_stop = true;
+        }
+        m_wakeup.notify_one();
+        m_flusher.join();
+    }
+
+    void write( log_level level, const char* format, ... ) __attribute__(( format( printf, 3, 4 ) )){
+        record* r = claim();
+        if( !r ){
+            return;
+        }
+        va_list args;
+        va_start( args, format );
+        int len = vsnprintf( r->text, TEXT_SIZE, format, args );
+        va_end( args );
+        r->level = level;
+        r->len = len < 0 ? 0 : ( len >= TEXT_SIZE ? TEXT_SIZE - 1 : len );
+        publish();
+    }
+
+    void access( const access_record& fields, const char* path ){
+        access( fields, path, strnlen( path, TEXT_SIZE - 1 ) );
+    }
+
+    // 路径不以'\0'结尾(例如仍在读缓冲中)时给出长度
+    void access( const access_record& fields, const char* path, size_t len ){
+        record* r = claim();
+        if( !r ){
+            return;
+        }
+        r->level = LOG_LEVEL_ACCESS;
+        r->access = fields;
+        len = std::min( len, (size_t)TEXT_SIZE - 1 );
+        memcpy( r->text, path, len );
+        r->len = len;
+        publish();
+    }
+
+    // 因为环形缓冲已满而丢弃的记录数
+    uint64_t dropped() const { return m_dropped.load( std::memory_order_relaxed ); }
+
+private:
+    struct record{
+        uint64_t time_ns;       // CLOCK_REALTIME
+        uint8_t level;
+        uint16_t len;
+        access_record access;
+        char text[ TEXT_SIZE ];
+    };
+
+    // 单生产者单消费者的环形缓冲，head只由后台线程修改，tail只由所属线程修改
+    struct ring{
+        alignas( 64 ) std::atomic<uint32_t> head;
+        alignas( 64 ) std::atomic<uint32_t> tail;
+        std::atomic<bool> retired;     // 所属线程已经退出，取空后释放
+        record records[ RING_SIZE ];
+
+        ring(): head( 0 ), tail( 0 ), retired( false ){}
+    };
+
+    // 线程退出时把自己的环形缓冲标记为退休
+    struct ring_owner{
+        ring* r = nullptr;
+        ~ring_owner(){
+            if( r ){
+                r->retired.store( true, std::memory_order_release );
+            }
+        }
+    };
+
+    async_log(): m_error_fd( STDERR_FILENO ), m_access_fd( -1 ), m_level( LOG_LEVEL_INFO ), m_dropped( 0 ),
+                 m_stop( false ), m_cached_second( -1 ){}
+
+    ~async_log(){
+        stop();
+        for( ring* r : m_rings ){
+            delete r;
+        }
+        close_fd( m_error_fd.load() );
+        close_fd( m_access_fd.load() );
+    }
+
+    static void close_fd( int fd ){
+        if( fd > STDERR_FILENO ){
+            close( fd );
+        }
+    }
+
+    bool reopen( std::atomic<int>& target, const char* path ){
+        int fd = STDERR_FILENO;
+        if( path ){
+            fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+            if( fd < 0 ){
+                return false;
+            }
+        }
+        std::lock_guard<std::mutex> lock( m_output_mutex );
+        close_fd( target.exchange( fd ) );
+        return true;
+    }
+
+    ring* local_ring(){
+        static thread_local ring_owner owner;
+        if( !owner.r ){
+            owner.r = new ring;
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_rings.push_back( owner.r );
+        }
+        return owner.r;
+    }
+
+    // 取得本线程下一个空闲记录，缓冲已满时返回nullptr
+    record* claim(){
+        ring* r = local_ring();
+        uint32_t tail = r->tail.load( std::memory_order_relaxed );
+        if( tail - r->head.load( std::memory_order_acquire ) >= RING_SIZE ){
+            m_dropped.fetch_add( 1, std::memory_order_relaxed );
+            return nullptr;
+        }
+        record* rec = &r->records[ tail & ( RING_SIZE - 1 ) ];
+        struct timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        rec->time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        return rec;
+    }
+
+    void publish(){
+        ring* r = local_ring();
+        r->tail.store( r->tail.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    void run(){
+        std::vector<char> error_out, access_out;
+        error_out.reserve( OUTPUT_BUFFER );
+        access_out.reserve( OUTPUT_BUFFER );
+        for( ;; ){
+            bool stopping;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_wakeup.wait_for( lock, std::chrono::milliseconds( FLUSH_INTERVAL_MS ), [this]{ return m_stop; } );
+                stopping = m_stop;
+            }
+            drain( error_out, access_out );
+            if( stopping ){
+                return;
+            }
+        }
+    }
+
+    // 取出所有线程的记录；退休的环形缓冲取空后释放
+    void drain( std::vector<char>& error_out, std::vector<char>& access_out ){
+        std::vector<ring*> rings;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            rings = m_rings;
+        }
+        for( ring* r : rings ){
+            bool retired = r->retired.load( std::memory_order_acquire );
+            uint32_t head = r->head.load( std::memory_order_relaxed );
+            uint32_t tail = r->tail.load( std::memory_order_acquire );
+            for( ; head != tail; ++head ){
+                const record& rec = r->records[ head & ( RING_SIZE - 1 ) ];
+                format( rec, rec.level == LOG_LEVEL_ACCESS ? access_out : error_out );
+                if( error_out.size() + access_out.size() >= OUTPUT_BUFFER ){
+                    flush( error_out, access_out );
+                }
+                r->head.store( head + 1, std::memory_order_release );
+            }
+            if( retired ){
+                std::lock_guard<std::mutex> lock( m_mutex );
+                for( size_t i = 0; i < m_rings.size(); ++i ){
+                    if( m_rings[i] == r ){
+                        m_rings.erase( m_rings.begin() + i );
+                        break;
+                    }
+                }
+                delete r;
+            }
+        }
+        flush( error_out, access_out );
+        uint64_t dropped = m_dropped.exchange( 0, std::memory_order_relaxed );
+        if( dropped ){
+            char line[ 64 ];
+            int len = snprintf( line, sizeof( line ), "WARN  log: %llu records dropped\n", (unsigned long long)dropped );
+            error_out.insert( error_out.end(), line, line + len );
+            flush( error_out, access_out );
+        }
+    }
+
+    void flush( std::vector<char>& error_out, std::vector<char>& access_out ){
+        std::lock_guard<std::mutex> lock( m_output_mutex );
+        write_all( m_error_fd.load(), error_out );
+        write_all( m_access_fd.load(), access_out );
+    }
+
+    static void write_all( int fd, std::vector<char>& out ){
+        size_t done = 0;
+        while( fd != -1 && done < out.size() ){
+            ssize_t n = ::write( fd, out.data() + done, out.size() - done );
+            if( n < 0 && errno == EINTR ){
+                continue;
+            }
+            if( n <= 0 ){
+                break;
+            }
+            done += n;
+        }
+        out.clear();
+    }
+
+    // 2026-10-17T01:49:26.123456Z，同一秒内的日期部分只格式化一次
+    void append_time( std::vector<char>& out, uint64_t time_ns ){
+        time_t second = time_ns / 1000000000ULL;
+        if( second != m_cached_second ){
+            struct tm tm;
+            gmtime_r( &second, &tm );
+            strftime( m_cached_date, sizeof( m_cached_date ), "%Y-%m-%dT%H:%M:%S", &tm );
+            m_cached_second = second;
+        }
+        char buf[ 40 ];
+        int len = snprintf( buf, sizeof( buf ), "%s.%06uZ ", m_cached_date, (unsigned)( time_ns % 1000000000ULL / 1000 ) );
+        out.insert( out.end(), buf, buf + len );
+    }
+
+    void format( const record& rec, std::vector<char>& out ){
+        static const char* names[] = { "DEBUG ", "INFO  ", "WARN  ", "ERROR ", "" };
+        append_time( out, rec.time_ns );
+        if( rec.level != LOG_LEVEL_ACCESS ){
+            out.insert( out.end(), names[ rec.level ], names[ rec.level ] + strlen( names[ rec.level ] ) );
+            out.insert( out.end(), rec.text, rec.text + rec.len );
+            out.push_back( '\n' );
+            return;
+        }
+        const access_record& a = rec.access;
+        char ip[ INET_ADDRSTRLEN ];
+        struct in_addr addr;
+        addr.s_addr = a.addr;
+        inet_ntop( AF_INET, &addr, ip, sizeof( ip ) );
+        char buf[ 160 ];
+        int len = snprintf( buf, sizeof( buf ), "client=%s:%u method=%s path=\"", ip, ntohs( a.port ), a.method );
+        out.insert( out.end(), buf, buf + len );
+        // 路径来自客户端，引号、反斜杠和控制字符转义后再写入，保证一行一条记录
+        for( int i = 0; i < rec.len; ++i ){
+            unsigned char c = rec.text[i];
+            if( c == '"' || c == '\\' || c < 0x20 || c >= 0x7f ){
+                len = snprintf( buf, sizeof( buf ), "\\x%02x", c );
+                out.insert( out.end(), buf, buf + len );
+            }else{
+                out.push_back( c );
+            }
+        }
+        len = snprintf( buf, sizeof( buf ), "\" status=%u bytes=%llu encoding=%s duration_us=%u\n",
+                        a.status, (unsigned long long)a.bytes, a.encoding, a.duration_us );
+        out.insert( out.end(), buf, buf + len );
+    }
+
+    std::atomic<int> m_error_fd;
+    std::atomic<int> m_access_fd;
+    std::atomic<int> m_level;
+    std::atomic<uint64_t> m_dropped;
+
+    std::mutex m_mutex;                 // 保护m_rings和m_stop
+    std::condition_variable m_wakeup;
+    std::vector<ring*> m_rings;
+    std::thread m_flusher;
+    bool m_stop;
+
+    std::mutex m_output_mutex;          // 切换日志文件与写出互斥
+    time_t m_cached_second;             // 以下两项只由后台线程使用
+    char m_cached_date[ 32 ];
+};
+
+// 级别低于LOG_COMPILE_LEVEL时整条语句在编译期被去掉
+#define LOG_AT( level, ... ) \
+    do{ \
+        if( ( level ) >= LOG_COMPILE_LEVEL && async_log::instance().enabled( level ) ){ \
+            async_log::instance().write( level, __VA_ARGS__ ); \
+        } \
+    }while( 0 )
+
+#define LOG_DEBUG( ... ) LOG_AT( LOG_LEVEL_DEBUG, __VA_ARGS__ )
+#define LOG_INFO( ... ) LOG_AT( LOG_LEVEL_INFO, __VA_ARGS__ )
+#define LOG_WARN( ... ) LOG_AT( LOG_LEVEL_WARN, __VA_ARGS__ )
+#define LOG_ERROR( ... ) LOG_AT( LOG_LEVEL_ERROR, __VA_ARGS__ )
+
+#endif
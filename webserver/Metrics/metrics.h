@@ -0,0 +1,269 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+/*
+    服务器内部的计数器和延迟直方图，以Prometheus文本格式输出
+    - 分片：每个线程固定使用一个分片(按线程创建顺序轮流分配)，分片按缓存行对齐，
+      热路径上的累加是对本线程分片的relaxed原子加，线程之间不共享缓存行；输出时把所有分片相加
+    - 直方图：HDR风格的对数-线性分桶，以微秒计，每个2的幂区间再分成8个子桶，相对误差不超过12.5%，
+      覆盖1微秒到约12天。Prometheus的bucket在2的幂边界输出(与子桶边界重合，不需要插值)，
+      另外按子桶精度估算p50/p90/p99/p999
+*/
+enum metric_counter{
+    COUNTER_ACCEPTED,
+    COUNTER_BYTES_IN,
+    COUNTER_BYTES_OUT,
+    COUNTER_STATUS_200,
+    COUNTER_STATUS_206,
+    COUNTER_STATUS_304,
+    COUNTER_STATUS_400,
+    COUNTER_STATUS_403,
+    COUNTER_STATUS_404,
+    COUNTER_STATUS_405,
+    COUNTER_STATUS_416,
+    COUNTER_STATUS_500,
+    COUNTER_STATUS_OTHER,   // 处理函数返回的其他状态码
+    COUNTER_TLS_FULL,       // 完整的TLS握手
+    COUNTER_TLS_RESUMED,    // 恢复会话的TLS握手
+    COUNTER_TLS_FAILED,
+    COUNTER_KTLS_SEND,      // 发送方向交给内核TLS的连接
+    COUNTER_UPSTREAM_NEW,   // 代理新建的上游连接
+    COUNTER_UPSTREAM_REUSED,    // 从空闲池中取出的上游连接
+    COUNTER_UPSTREAM_ERRORS,
+    COUNTER_RESPONSE_CACHE_HITS,    // 在reactor线程中由响应缓存直接回复的请求
+    COUNTER_COUNT
+};
+
+enum metric_histogram{
+    HISTOGRAM_PARSE,            // 从开始解析请求行到确定响应(含查找文件)
+    HISTOGRAM_POOL_WAIT,        // 任务在线程池队列中等待的时间
+    HISTOGRAM_LAST_BYTE,        // 从开始解析请求行到响应的最后一个字节交给内核
+    HISTOGRAM_COUNT
+};
+
+// 输出时附加的瞬时值，由调用者提供
+struct metric_gauge{
+    const char* name;
+    const char* help;
+    double value;
+};
+
+class metrics{
+public:
+    static const int SHARDS = 16;
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXPONENT = 39;         // 超过2^40微秒的值计入最后一个桶
+    static const int BUCKETS = ( MAX_EXPONENT - SUB_BITS + 2 ) * SUB_BUCKETS;
+
+    static metrics& instance(){
+        static metrics m;
+        return m;
+    }
+
+    metrics( const metrics& ) = delete;
+    metrics& operator=( const metrics& ) = delete;
+
+    void add( metric_counter c, uint64_t n = 1 ){
+        local().counters[c].fetch_add( n, std::memory_order_relaxed );
+    }
+
+    void observe( metric_histogram h, uint64_t us ){
+        histogram& hist = local().histograms[h];
+        hist.buckets[ bucket_of( us ) ].fetch_add( 1, std::memory_order_relaxed );
+        hist.sum.fetch_add( us, std::memory_order_relaxed );
+    }
+
+    // 值v(微秒)所在的桶：小于8的值各占一个桶，之后每个2的幂区间8个桶
+    static int bucket_of( uint64_t v ){
+        if( v < (uint64_t)SUB_BUCKETS ){
+            return (int)v;
+        }
+        int e = 63 - __builtin_clzll( v );
+        if( e > MAX_EXPONENT ){
+            return BUCKETS - 1;
+        }
+        return ( e - SUB_BITS + 1 ) * SUB_BUCKETS + (int)( ( v >> ( e - SUB_BITS ) ) & ( SUB_BUCKETS - 1 ) );
+    }
+
+    // 桶的上界(不含)
+    static uint64_t bucket_upper( int b ){
+        if( b < SUB_BUCKETS ){
+            return b + 1;
+        }
+        int e = b / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t m = b % SUB_BUCKETS;
+        return ( SUB_BUCKETS + m + 1 ) << ( e - SUB_BITS );
+    }
+
+    void render( std::string& out, const metric_gauge* gauges, int gauge_count ) const{
+        uint64_t counters[ COUNTER_COUNT ] = { 0 };
+        for( const shard& s : m_shards ){
+            for( int c = 0; c < COUNTER_COUNT; ++c ){
+                counters[c] += s.counters[c].load( std::memory_order_relaxed );
+            }
+        }
+        const char* last_name = nullptr;
+        for( int c = 0; c < COUNTER_COUNT; ++c ){
+            const counter_info& info = counter_table[c];
+            if( !last_name || strcmp( last_name, info.name ) != 0 ){
+                append( out, "# HELP %s %s\n# TYPE %s counter\n", info.name, info.help, info.name );
+                last_name = info.name;
+            }
+            if( info.label ){
+                append( out, "%s{%s} %llu\n", info.name, info.label, (unsigned long long)counters[c] );
+            }else{
+                append( out, "%s %llu\n", info.name, (unsigned long long)counters[c] );
+            }
+        }
+        for( int h = 0; h < HISTOGRAM_COUNT; ++h ){
+            render_histogram( out, (metric_histogram)h );
+        }
+        for( int g = 0; g < gauge_count; ++g ){
+            append( out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n",
+                    gauges[g].name, gauges[g].help, gauges[g].name, gauges[g].name, gauges[g].value );
+        }
+    }
+
+private:
+    struct histogram{
+        std::atomic<uint64_t> buckets[ BUCKETS ];
+        std::atomic<uint64_t> sum;
+    };
+
+    struct alignas( 64 ) shard{
+        std::atomic<uint64_t> counters[ COUNTER_COUNT ];
+        histogram histograms[ HISTOGRAM_COUNT ];
+    };
+
+    struct counter_info{
+        const char* name;
+        const char* help;
+        const char* label;
+    };
+
+    struct histogram_info{
+        const char* name;
+        const char* help;
+    };
+
+    static constexpr counter_info counter_table[ COUNTER_COUNT ] = {
+        { "webserver_accepted_connections_total", "Accepted TCP connections.", nullptr },
+        { "webserver_received_bytes_total", "Bytes read from client sockets.", nullptr },
+        { "webserver_sent_bytes_total", "Bytes written to client sockets, including sendfile.", nullptr },
+        { "webserver_responses_total", "Responses by status code.", "code=\"200\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"206\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"304\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"400\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"403\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"404\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"405\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"416\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"500\"" },
+        { "webserver_responses_total", "Responses by status code.", "code=\"other\"" },
+        { "webserver_tls_handshakes_total", "TLS handshakes by outcome.", "result=\"full\"" },
+        { "webserver_tls_handshakes_total", "TLS handshakes by outcome.", "result=\"resumed\"" },
+        { "webserver_tls_handshakes_total", "TLS handshakes by outcome.", "result=\"failed\"" },
+        { "webserver_ktls_send_connections_total", "TLS connections whose record encryption was offloaded to the kernel.", nullptr },
+        { "webserver_upstream_connections_total", "Upstream connections used by proxied requests, by origin.", "origin=\"new\"" },
+        { "webserver_upstream_connections_total", "Upstream connections used by proxied requests, by origin.", "origin=\"pool\"" },
+        { "webserver_upstream_errors_total", "Proxied requests that failed because of the upstream.", nullptr },
+        { "webserver_response_cache_hits_total", "Requests answered from the full-response cache on the reactor thread.", nullptr },
+    };
+
+    static constexpr histogram_info histogram_table[ HISTOGRAM_COUNT ] = {
+        { "webserver_request_parse_seconds", "Time from the request line to a ready response, including file lookup." },
+        { "webserver_pool_queue_wait_seconds", "Time a connection task waited in the thread pool queue." },
+        { "webserver_time_to_last_byte_seconds", "Time from the request line to the last response byte handed to the kernel." },
+    };
+
+    metrics(): m_next_shard( 0 ){
+        for( shard& s : m_shards ){
+            for( auto& c : s.counters ){
+                c.store( 0, std::memory_order_relaxed );
+            }
+            for( histogram& h : s.histograms ){
+                for( auto& b : h.buckets ){
+                    b.store( 0, std::memory_order_relaxed );
+                }
+                h.sum.store( 0, std::memory_order_relaxed );
+            }
+        }
+    }
+
+    shard& local(){
+        static thread_local int index = m_next_shard.fetch_add( 1, std::memory_order_relaxed ) % SHARDS;
+        return m_shards[ index ];
+    }
+
+    static void append( std::string& out, const char* format, ... ) __attribute__(( format( printf, 2, 3 ) )){
+        char buf[ 512 ];
+        va_list args;
+        va_start( args, format );
+        int len = vsnprintf( buf, sizeof( buf ), format, args );
+        va_end( args );
+        if( len > 0 ){
+            out.append( buf, len < (int)sizeof( buf ) ? len : sizeof( buf ) - 1 );
+        }
+    }
+
+    void render_histogram( std::string& out, metric_histogram h ) const{
+        uint64_t buckets[ BUCKETS ] = { 0 };
+        uint64_t sum = 0, count = 0;
+        for( const shard& s : m_shards ){
+            for( int b = 0; b < BUCKETS; ++b ){
+                buckets[b] += s.histograms[h].buckets[b].load( std::memory_order_relaxed );
+            }
+            sum += s.histograms[h].sum.load( std::memory_order_relaxed );
+        }
+        for( int b = 0; b < BUCKETS; ++b ){
+            count += buckets[b];
+        }
+        const char* name = histogram_table[h].name;
+        append( out, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_table[h].help, name );
+        // 2的幂边界：1us, 2us, 4us ... 约67秒
+        uint64_t cumulative = 0;
+        int b = 0;
+        for( int k = 0; k <= 26; ++k ){
+            uint64_t le = 1ULL << k;
+            while( b < BUCKETS && bucket_upper( b ) <= le ){
+                cumulative += buckets[ b++ ];
+            }
+            append( out, "%s_bucket{le=\"%g\"} %llu\n", name, le / 1e6, (unsigned long long)cumulative );
+        }
+        append( out, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.6f\n%s_count %llu\n",
+                name, (unsigned long long)count, name, sum / 1e6, name, (unsigned long long)count );
+
+        // 子桶精度的分位数，取所在桶的上界
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        append( out, "# HELP %s_quantile Estimated quantiles of %s.\n# TYPE %s_quantile gauge\n", name, name, name );
+        for( double q : quantiles ){
+            double value = 0;
+            if( count > 0 ){
+                uint64_t rank = (uint64_t)( q * count + 0.5 );
+                rank = rank == 0 ? 1 : rank;
+                uint64_t seen = 0;
+                for( int i = 0; i < BUCKETS; ++i ){
+                    seen += buckets[i];
+                    if( seen >= rank ){
+                        value = bucket_upper( i ) / 1e6;
+                        break;
+                    }
+                }
+            }
+            append( out, "%s_quantile{quantile=\"%g\"} %.6f\n", name, q, value );
+        }
+    }
+
+    shard m_shards[ SHARDS ];
+    std::atomic<int> m_next_shard;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+/*
+    HTTP报文扫描器
+    find_char2()在[p, end)中查找两个字符中任意一个第一次出现的位置，找不到时返回end。
+    主状态机用它一次检查16~32个字节来寻找行尾(\r \n)、冒号和空白，而不是逐字节判断。
+    实现按CPU能力在运行时选择：AVX2(32字节) > SSE4.2(16字节) > 标量。
+    classify_header()用编译期生成的哈希表把头部字段名映射为枚举，代替一串strncasecmp。
+*/
+namespace http_scan{
+
+typedef const char* (*find_fn)(const char*, const char*, char, char);
+
+inline const char* find_char2_scalar(const char* p, const char* end, char a, char b){
+    for( ; p < end; ++p ){
+        if( *p == a || *p == b ){
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+__attribute__((target("sse4.2")))
+inline const char* find_char2_sse42(const char* p, const char* end, char a, char b){
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for( ; end - p >= 16; p += 16 ){
+        __m128i data = _mm_loadu_si128((const __m128i*)p);
+        // 显式长度比较，请求中出现的'\0'不会提前结束扫描
+        int idx = _mm_cmpestri(set, 2, data, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if( idx < 16 ){
+            return p + idx;
+        }
+    }
+    return find_char2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+inline const char* find_char2_avx2(const char* p, const char* end, char a, char b){
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for( ; end - p >= 32; p += 32 ){
+        __m256i data = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, va), _mm256_cmpeq_epi8(data, vb));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if( mask ){
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_char2_sse42(p, end, a, b);
+}
+#endif
+
+inline find_fn select_find_char2(){
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx2") ){
+        return find_char2_avx2;
+    }
+    if( __builtin_cpu_supports("sse4.2") ){
+        return find_char2_sse42;
+    }
+#endif
+    return find_char2_scalar;
+}
+
+// 进程启动时选择一次实现
+inline const find_fn find_char2_impl = select_find_char2();
+
+inline const char* find_char2(const char* p, const char* end, char a, char b){
+    // 短区间直接标量扫描，省去间接调用
+    if( end - p < 16 ){
+        return find_char2_scalar(p, end, a, b);
+    }
+    return find_char2_impl(p, end, a, b);
+}
+
+inline const char* find_line_end(const char* p, const char* end){
+    return find_char2(p, end, '\r', '\n');
+}
+
+/*
+    已知的头部字段
+*/
+enum HEADER{
+    HEADER_UNKNOWN = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_UPGRADE,
+    HEADER_HTTP2_SETTINGS,
+    HEADER_KEEP_ALIVE,          // 以下是反向代理不转发的逐跳字段
+    HEADER_PROXY_CONNECTION,
+    HEADER_TE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_COUNT
+};
+
+struct header_name{
+    const char* name;
+    size_t len;
+    HEADER id;
+};
+
+// 按枚举值的顺序排列
+static constexpr header_name known_headers[] = {
+    { "connection", 10, HEADER_CONNECTION },
+    { "content-length", 14, HEADER_CONTENT_LENGTH },
+    { "host", 4, HEADER_HOST },
+    { "accept-encoding", 15, HEADER_ACCEPT_ENCODING },
+    { "if-none-match", 13, HEADER_IF_NONE_MATCH },
+    { "if-modified-since", 17, HEADER_IF_MODIFIED_SINCE },
+    { "range", 5, HEADER_RANGE },
+    { "if-range", 8, HEADER_IF_RANGE },
+    { "upgrade", 7, HEADER_UPGRADE },
+    { "http2-settings", 14, HEADER_HTTP2_SETTINGS },
+    { "keep-alive", 10, HEADER_KEEP_ALIVE },
+    { "proxy-connection", 16, HEADER_PROXY_CONNECTION },
+    { "te", 2, HEADER_TE },
+    { "transfer-encoding", 17, HEADER_TRANSFER_ENCODING },
+};
+
+constexpr unsigned char lower(unsigned char c){
+    return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+}
+
+// 不区分大小写的FNV-1a哈希
+constexpr uint32_t hash_name(const char* s, size_t len){
+    uint32_t h = 2166136261u;
+    for( size_t i = 0; i < len; ++i ){
+        h = ( h ^ lower((unsigned char)s[i]) ) * 16777619u;
+    }
+    return h;
+}
+
+static const size_t HEADER_TABLE_SIZE = 64;    // 2的幂，线性探测
+static_assert(sizeof(known_headers) / sizeof(known_headers[0]) == HEADER_COUNT - 1, "known_headers out of sync with HEADER");
+static_assert(HEADER_COUNT < HEADER_TABLE_SIZE, "header table too small");
+
+struct header_table{
+    HEADER slots[HEADER_TABLE_SIZE];
+};
+
+constexpr header_table build_header_table(){
+    header_table t{};
+    for( const header_name& h : known_headers ){
+        size_t i = hash_name(h.name, h.len) & ( HEADER_TABLE_SIZE - 1 );
+        while( t.slots[i] != HEADER_UNKNOWN ){
+            i = ( i + 1 ) & ( HEADER_TABLE_SIZE - 1 );
+        }
+        t.slots[i] = h.id;
+    }
+    return t;
+}
+
+static constexpr header_table header_lookup = build_header_table();
+
+// 根据字段名(不含冒号)返回头部字段的枚举值，命中时只需要一次哈希和一次比较
+inline HEADER classify_header(const char* name, size_t len){
+    size_t i = hash_name(name, len) & ( HEADER_TABLE_SIZE - 1 );
+    for( ;; i = ( i + 1 ) & ( HEADER_TABLE_SIZE - 1 ) ){
+        HEADER id = header_lookup.slots[i];
+        if( id == HEADER_UNKNOWN ){
+            return HEADER_UNKNOWN;
+        }
+        const header_name& h = known_headers[id - 1];
+        if( h.len == len && strncasecmp(h.name, name, len) == 0 ){
+            return id;
+        }
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "../Parser/http_scan.h"
+
+/*
+    反向代理的上游
+    - 由命令行的-u prefix=address配置：路径以prefix开头的请求转发给address，多个前缀时最长的优先。
+      address是host:port(TCP)或unix:/path(Unix域socket)，启动时解析一次
+    - 每个上游一个keep-alive连接池：响应完整读完且上游没有要求关闭的连接放回池中，之后的请求直接复用，
+      省去connect和TCP握手。空闲连接不注册在任何epoll中，取出时用MSG_PEEK确认对方没有关闭
+    - 池被所有reactor共享，只在取出和放回时加锁
+*/
+static const size_t UPSTREAM_MAX_IDLE = 64;        // 每个上游最多保留的空闲连接
+static const size_t UPSTREAM_HEAD_LIMIT = 16384;   // 上游响应头的上限
+
+class upstream{
+public:
+    upstream( std::string prefix, std::string name, const sockaddr_storage& addr, socklen_t addr_len )
+        : m_prefix( std::move( prefix ) ), m_name( std::move( name ) ), m_addr( addr ), m_addr_len( addr_len ){}
+
+    ~upstream(){
+        for( int fd : m_idle ){
+            close( fd );
+        }
+    }
+
+    const std::string& prefix() const { return m_prefix; }
+    const std::string& name() const { return m_name; }     // 配置中的地址，请求没有Host时用作Host
+
+    // 取出一个仍然打开的空闲连接，没有时返回-1
+    int take(){
+        for( ;; ){
+            int fd;
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                if( m_idle.empty() ){
+                    return -1;
+                }
+                fd = m_idle.back();
+                m_idle.pop_back();
+            }
+            // 空闲期间上游关闭了连接(读到EOF)或者发来了多余的数据，都不能再用
+            char c;
+            ssize_t n = recv( fd, &c, 1, MSG_PEEK | MSG_DONTWAIT );
+            if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ){
+                return fd;
+            }
+            close( fd );
+        }
+    }
+
+    // 响应完整读完的连接放回池中，池满时关闭
+    void put( int fd ){
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if( m_idle.size() < UPSTREAM_MAX_IDLE ){
+                m_idle.push_back( fd );
+                return;
+            }
+        }
+        close( fd );
+    }
+
+    // 发起非阻塞的connect，返回描述符，-1表示失败。in_progress为真时要等socket可写才知道结果
+    int connect_new( bool& in_progress ) const {
+        int fd = socket( m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+        if( fd < 0 ){
+            return -1;
+        }
+        if( m_addr.ss_family != AF_UNIX ){
+            // 请求头和请求体一次写出，响应由上游决定何时发送，不需要Nagle
+            int one = 1;
+            setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+        }
+        in_progress = false;
+        if( connect( fd, (const sockaddr*)&m_addr, m_addr_len ) < 0 ){
+            if( errno != EINPROGRESS ){
+                int err = errno;
+                close( fd );
+                errno = err;
+                return -1;
+            }
+            in_progress = true;
+        }
+        return fd;
+    }
+
+private:
+    std::string m_prefix;
+    std::string m_name;
+    sockaddr_storage m_addr;
+    socklen_t m_addr_len;
+    std::mutex m_mutex;
+    std::vector<int> m_idle;    // 后进先出，最近用过的连接最不可能已经被上游的空闲超时关闭
+};
+
+class upstream_registry{
+public:
+    static upstream_registry& instance(){
+        static upstream_registry registry;
+        return registry;
+    }
+
+    bool empty() const { return m_upstreams.empty(); }
+
+    // spec为prefix=address，失败时把原因写到error
+    bool add( const char* spec, char* error, size_t error_len ){
+        const char* eq = strchr( spec, '=' );
+        if( !eq || eq == spec || spec[0] != '/' || !eq[1] ){
+            snprintf( error, error_len, "expected /prefix=host:port or /prefix=unix:/path, got '%s'", spec );
+            return false;
+        }
+        std::string prefix( spec, eq - spec );
+        const char* address = eq + 1;
+        sockaddr_storage addr;
+        memset( &addr, 0, sizeof( addr ) );
+        socklen_t addr_len;
+        if( strncmp( address, "unix:", 5 ) == 0 ){
+            sockaddr_un* un = (sockaddr_un*)&addr;
+            const char* path = address + 5;
+            if( !*path || strlen( path ) >= sizeof( un->sun_path ) ){
+                snprintf( error, error_len, "bad unix socket path '%s'", path );
+                return false;
+            }
+            un->sun_family = AF_UNIX;
+            strcpy( un->sun_path, path );
+            addr_len = sizeof( sockaddr_un );
+        }else{
+            const char* colon = strrchr( address, ':' );
+            if( !colon || colon == address || !colon[1] ){
+                snprintf( error, error_len, "missing port in '%s'", address );
+                return false;
+            }
+            std::string host( address, colon - address );
+            addrinfo hints;
+            memset( &hints, 0, sizeof( hints ) );
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* result = nullptr;
+            int ret = getaddrinfo( host.c_str(), colon + 1, &hints, &result );
+            if( ret != 0 ){
+                snprintf( error, error_len, "cannot resolve '%s': %s", address, gai_strerror( ret ) );
+                return false;
+            }
+            memcpy( &addr, result->ai_addr, result->ai_addrlen );
+            addr_len = result->ai_addrlen;
+            freeaddrinfo( result );
+        }
+        m_upstreams.emplace_back( new upstream( std::move( prefix ), address, addr, addr_len ) );
+        return true;
+    }
+
+    // 路径匹配的最长前缀的上游，没有时返回nullptr
+    upstream* match( std::string_view path ) const {
+        upstream* best = nullptr;
+        for( const std::unique_ptr<upstream>& u : m_upstreams ){
+            const std::string& prefix = u->prefix();
+            if( path.size() >= prefix.size() && path.compare( 0, prefix.size(), prefix ) == 0
+                && ( !best || prefix.size() > best->prefix().size() ) ){
+                best = u.get();
+            }
+        }
+        return best;
+    }
+
+private:
+    upstream_registry() = default;
+
+    std::vector<std::unique_ptr<upstream>> m_upstreams;
+};
+
+/*
+    上游响应头的解析结果。转发给客户端的头部去掉了逐跳字段，Connection由连接自己生成；
+    chunked响应原样转发，代理只跟踪块的边界以确定响应在哪里结束
+*/
+struct upstream_response{
+    int status = 0;
+    bool chunked = false;
+    bool keep_alive = false;        // 响应结束后连接可以放回池中
+    int64_t content_length = -1;    // 没有Content-Length时为-1
+    std::string headers;            // 转发的头部行，每行以\r\n结尾
+};
+
+// 逐跳字段：只对一个连接有意义，代理不转发
+inline bool hop_by_hop( http_scan::HEADER id ){
+    switch( id ){
+        case http_scan::HEADER_CONNECTION:
+        case http_scan::HEADER_KEEP_ALIVE:
+        case http_scan::HEADER_PROXY_CONNECTION:
+        case http_scan::HEADER_TE:
+        case http_scan::HEADER_TRANSFER_ENCODING:
+        case http_scan::HEADER_UPGRADE:
+        case http_scan::HEADER_HTTP2_SETTINGS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline bool has_token( const char* value, const char* end, const char* token ){
+    size_t len = strlen( token );
+    for( const char* p = value; p < end; ){
+        while( p < end && ( *p == ' ' || *p == '\t' || *p == ',' ) ){
+            ++p;
+        }
+        const char* q = p;
+        while( q < end && *q != ',' && *q != ' ' && *q != '\t' ){
+            ++q;
+        }
+        if( (size_t)( q - p ) == len && strncasecmp( p, token, len ) == 0 ){
+            return true;
+        }
+        p = q;
+    }
+    return false;
+}
+
+// 解析[buf, buf+len)中的响应头：返回头部的长度(含结尾的空行)，0表示还不完整，-1表示格式错误
+inline ssize_t parse_upstream_head( const char* buf, size_t len, upstream_response& r ){
+    const char* end = buf + len;
+    const char* head_end = nullptr;
+    for( const char* p = buf; p + 3 < end; ++p ){
+        p = (const char*)memchr( p, '\r', end - p - 3 );
+        if( !p ){
+            break;
+        }
+        if( p[1] == '\n' && p[2] == '\r' && p[3] == '\n' ){
+            head_end = p + 4;
+            break;
+        }
+    }
+    if( !head_end ){
+        return 0;
+    }
+    // 状态行：HTTP/1.x NNN reason
+    if( head_end - buf < 12 || strncmp( buf, "HTTP/1.", 7 ) != 0 || buf[8] != ' ' ){
+        return -1;
+    }
+    bool http11 = buf[7] == '1';
+    int status = 0;
+    for( int i = 9; i < 12; ++i ){
+        if( buf[i] < '0' || buf[i] > '9' ){
+            return -1;
+        }
+        status = status * 10 + ( buf[i] - '0' );
+    }
+    r.status = status;
+    r.chunked = false;
+    r.content_length = -1;
+    r.headers.clear();
+    bool close = !http11;
+    const char* line = (const char*)memchr( buf, '\n', head_end - buf ) + 1;
+    while( line < head_end - 2 ){
+        const char* eol = (const char*)memchr( line, '\r', head_end - line );
+        const char* colon = (const char*)memchr( line, ':', eol - line );
+        if( !colon ){
+            return -1;
+        }
+        const char* value = colon + 1;
+        while( value < eol && ( *value == ' ' || *value == '\t' ) ){
+            ++value;
+        }
+        http_scan::HEADER id = http_scan::classify_header( line, colon - line );
+        if( id == http_scan::HEADER_CONTENT_LENGTH ){
+            char* num_end;
+            r.content_length = strtoll( value, &num_end, 10 );
+            if( num_end == value || r.content_length < 0 ){
+                return -1;
+            }
+        }else if( id == http_scan::HEADER_TRANSFER_ENCODING ){
+            r.chunked = has_token( value, eol, "chunked" );
+        }else if( id == http_scan::HEADER_CONNECTION ){
+            if( has_token( value, eol, "close" ) ){
+                close = true;
+            }else if( has_token( value, eol, "keep-alive" ) ){
+                close = false;
+            }
+        }
+        if( !hop_by_hop( id ) ){
+            r.headers.append( line, eol + 2 - line );
+        }
+        line = eol + 2;
+    }
+    if( r.chunked ){
+        // 同时出现时以Transfer-Encoding为准(RFC 9112 6.3)
+        r.content_length = -1;
+        r.headers.append( "Transfer-Encoding: chunked\r\n" );
+    }
+    // 既没有长度也不是chunked的响应以关闭连接结束
+    r.keep_alive = !close && ( r.chunked || r.content_length >= 0 );
+    return head_end - buf;
+}
+
+/*
+    跟踪chunked响应体的边界：数据原样转发，只需要知道最后一个块和尾部字段在哪里结束。
+    feed()返回属于响应体的字节数，done()之后的数据不属于这个响应
+*/
+class chunk_tracker{
+public:
+    void reset(){ m_state = SIZE; m_size = 0; m_line_empty = true; }
+    bool done() const { return m_state == DONE; }
+
+    // 返回消费的字节数，-1表示格式错误
+    ssize_t feed( const char* p, size_t len ){
+        size_t i = 0;
+        while( i < len && m_state != DONE ){
+            char c = p[i];
+            switch( m_state ){
+                case SIZE:
+                    if( c >= '0' && c <= '9' ) m_size = m_size * 16 + ( c - '0' );
+                    else if( c >= 'a' && c <= 'f' ) m_size = m_size * 16 + ( c - 'a' + 10 );
+                    else if( c >= 'A' && c <= 'F' ) m_size = m_size * 16 + ( c - 'A' + 10 );
+                    else if( c == ';' || c == ' ' || c == '\t' ) m_state = EXTENSION;
+                    else if( c == '\r' ) m_state = SIZE_LF;
+                    else return -1;
+                    if( m_size > ( (uint64_t)1 << 60 ) ){
+                        return -1;
+                    }
+                    ++i;
+                    break;
+                case EXTENSION:
+                    if( c == '\r' ) m_state = SIZE_LF;
+                    ++i;
+                    break;
+                case SIZE_LF:
+                    if( c != '\n' ){
+                        return -1;
+                    }
+                    ++i;
+                    m_state = m_size > 0 ? DATA : TRAILER;
+                    m_line_empty = true;
+                    break;
+                case DATA:{
+                    size_t n = std::min( (uint64_t)( len - i ), m_size );
+                    i += n;
+                    m_size -= n;
+                    if( m_size == 0 ){
+                        m_state = DATA_CR;
+                    }
+                    break;
+                }
+                case DATA_CR:
+                    if( c != '\r' ){
+                        return -1;
+                    }
+                    ++i;
+                    m_state = DATA_LF;
+                    break;
+                case DATA_LF:
+                    if( c != '\n' ){
+                        return -1;
+                    }
+                    ++i;
+                    m_state = SIZE;
+                    break;
+                case TRAILER:
+                    // 尾部字段逐行跳过，空行结束整个响应体
+                    ++i;
+                    if( c == '\n' ){
+                        if( m_line_empty ){
+                            m_state = DONE;
+                        }
+                        m_line_empty = true;
+                    }else if( c != '\r' ){
+                        m_line_empty = false;
+                    }
+                    break;
+                case DONE:
+                    break;
+            }
+        }
+        return i;
+    }
+
+private:
+    enum STATE { SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER, DONE };
+    STATE m_state = SIZE;
+    uint64_t m_size = 0;
+    bool m_line_empty = true;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef RESPONSE_HEADER_H
+#define RESPONSE_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    响应头的构造工具
+    - fixed_string：编译期拼接的定长字符串，固定的状态行和完整的错误响应在编译期生成，
+      发送时iovec直接指向它们，不需要写入写缓冲
+    - write_uint / write_http_date：不经过printf格式化的整数和HTTP日期输出
+*/
+namespace response_header{
+
+template <size_t N>
+struct fixed_string{
+    char data[N + 1];
+
+    constexpr fixed_string(): data{}{}
+    static constexpr size_t size(){ return N; }
+    constexpr const char* c_str() const { return data; }
+};
+
+template <size_t N>
+constexpr fixed_string<N - 1> literal(const char (&s)[N]){
+    fixed_string<N - 1> out;
+    for( size_t i = 0; i < N - 1; ++i ){
+        out.data[i] = s[i];
+    }
+    return out;
+}
+
+template <size_t A, size_t B>
+constexpr fixed_string<A + B> operator+(const fixed_string<A>& a, const fixed_string<B>& b){
+    fixed_string<A + B> out;
+    for( size_t i = 0; i < A; ++i ){
+        out.data[i] = a.data[i];
+    }
+    for( size_t i = 0; i < B; ++i ){
+        out.data[A + i] = b.data[i];
+    }
+    return out;
+}
+
+constexpr size_t digits(uint64_t v){
+    size_t n = 1;
+    while( v >= 10 ){
+        v /= 10;
+        ++n;
+    }
+    return n;
+}
+
+// 编译期的整数转字符串
+template <uint64_t V>
+constexpr fixed_string<digits(V)> number(){
+    fixed_string<digits(V)> out;
+    uint64_t v = V;
+    for( size_t i = digits(V); i > 0; --i ){
+        out.data[i - 1] = '0' + v % 10;
+        v /= 10;
+    }
+    return out;
+}
+
+/*
+    常用的状态行
+*/
+constexpr auto status_200 = literal("HTTP/1.1 200 OK\r\n");
+constexpr auto status_206 = literal("HTTP/1.1 206 Partial Content\r\n");
+constexpr auto status_304 = literal("HTTP/1.1 304 Not Modified\r\n");
+constexpr auto status_416 = literal("HTTP/1.1 416 Range Not Satisfiable\r\n");
+
+constexpr auto connection_keep_alive = literal("Connection: keep-alive\r\n\r\n");
+constexpr auto connection_close = literal("Connection: close\r\n\r\n");
+
+/*
+    完整的错误响应：状态行、头部和正文在编译期拼接好，Content-Length也在编译期计算
+*/
+template <bool KEEP_ALIVE, size_t S, size_t B>
+constexpr auto error_response(const char (&status)[S], const char (&body)[B]){
+    auto head = literal(status) + literal("Content-Length: ") + number<B - 1>()
+        + literal("\r\nContent-Type: text/html\r\n");
+    if constexpr( KEEP_ALIVE ){
+        return head + connection_keep_alive + literal(body);
+    }else{
+        return head + connection_close + literal(body);
+    }
+}
+
+// 两位一组的数字表，整数转换时每次除以100
+struct digit_pairs{
+    char data[200];
+    constexpr digit_pairs(): data{}{
+        for( int i = 0; i < 100; ++i ){
+            data[2 * i] = '0' + i / 10;
+            data[2 * i + 1] = '0' + i % 10;
+        }
+    }
+};
+static constexpr digit_pairs digit_table{};
+
+// 把v的十进制表示写到p，返回写入结束的位置。p处至少要有20字节
+inline char* write_uint(char* p, uint64_t v){
+    char tmp[20];
+    char* t = tmp + sizeof(tmp);
+    while( v >= 100 ){
+        t -= 2;
+        memcpy(t, digit_table.data + ( v % 100 ) * 2, 2);
+        v /= 100;
+    }
+    if( v >= 10 ){
+        t -= 2;
+        memcpy(t, digit_table.data + v * 2, 2);
+    }else{
+        *--t = '0' + v;
+    }
+    size_t len = tmp + sizeof(tmp) - t;
+    memcpy(p, t, len);
+    return p + len;
+}
+
+// 状态码的原因短语，处理函数可以返回任意状态码
+inline const char* reason_phrase(int status){
+    switch( status ){
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Content Too Large";
+        case 415: return "Unsupported Media Type";
+        case 416: return "Range Not Satisfiable";
+        case 422: return "Unprocessable Content";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Unknown";
+    }
+}
+
+static const size_t HTTP_DATE_LEN = 29;     // Sun, 06 Nov 1994 08:49:37 GMT
+
+// 写入IMF-fixdate格式的时间，返回写入结束的位置。不依赖locale
+inline char* write_http_date(char* p, time_t t){
+    static const char days[] = "SunMonTueWedThuFriSat";
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    memcpy(p, days + tm.tm_wday * 3, 3);
+    p[3] = ',';
+    p[4] = ' ';
+    memcpy(p + 5, digit_table.data + tm.tm_mday * 2, 2);
+    p[7] = ' ';
+    memcpy(p + 8, months + tm.tm_mon * 3, 3);
+    p[11] = ' ';
+    int year = tm.tm_year + 1900;
+    memcpy(p + 12, digit_table.data + ( year / 100 ) * 2, 2);
+    memcpy(p + 14, digit_table.data + ( year % 100 ) * 2, 2);
+    p[16] = ' ';
+    memcpy(p + 17, digit_table.data + tm.tm_hour * 2, 2);
+    p[19] = ':';
+    memcpy(p + 20, digit_table.data + tm.tm_min * 2, 2);
+    p[22] = ':';
+    memcpy(p + 23, digit_table.data + tm.tm_sec * 2, 2);
+    memcpy(p + 25, " GMT", 4);
+    return p + HTTP_DATE_LEN;
+}
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef REQUEST_VIEW_H
+#define REQUEST_VIEW_H
+
+#include <string>
+#include <string_view>
+#include <stddef.h>
+#include <strings.h>
+
+/*
+    处理函数看到的请求和用来构造响应的对象
+    - request_view：不复制任何数据，方法之外的字段都是指向连接读缓冲的string_view，
+      只在处理函数执行期间有效。头部按原始顺序保存在读缓冲中，header()按需线性查找
+    - response_writer：状态码、头部和响应体，处理函数返回后由连接序列化；
+      也可以调用file()把请求交给静态文件的发送路径(条件请求、字节范围、压缩都由它处理)
+*/
+
+// 请求方法，顺序与http_conn::METHOD相同
+enum http_method { HTTP_GET = 0, HTTP_POST, HTTP_HEAD, HTTP_PUT, HTTP_DELETE, HTTP_TRACE, HTTP_OPTIONS, HTTP_CONNECT, HTTP_PATCH, HTTP_METHOD_COUNT };
+
+// 路由注册时使用的方法位图
+enum route_methods : unsigned {
+    ROUTE_GET = 1u << HTTP_GET,
+    ROUTE_POST = 1u << HTTP_POST,
+    ROUTE_HEAD = 1u << HTTP_HEAD,
+    ROUTE_PUT = 1u << HTTP_PUT,
+    ROUTE_DELETE = 1u << HTTP_DELETE,
+    ROUTE_TRACE = 1u << HTTP_TRACE,
+    ROUTE_OPTIONS = 1u << HTTP_OPTIONS,
+    ROUTE_CONNECT = 1u << HTTP_CONNECT,
+    ROUTE_PATCH = 1u << HTTP_PATCH,
+    ROUTE_ANY = ( 1u << HTTP_METHOD_COUNT ) - 1,
+};
+
+inline const char* method_name( int method ){
+    static const char* names[ HTTP_METHOD_COUNT ] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH" };
+    return method >= 0 && method < HTTP_METHOD_COUNT ? names[ method ] : "-";
+}
+
+// 路由模式中:name和*name捕获的路径参数
+struct route_params{
+    static const int MAX_PARAMS = 8;
+    struct param{
+        std::string_view name;
+        std::string_view value;
+    };
+    param items[ MAX_PARAMS ];
+    int count = 0;
+};
+
+class request_view{
+public:
+    request_view( int method, std::string_view target, std::string_view version, const char* headers,
+                  const char* headers_end, std::string_view body, const route_params* params )
+        : m_method( method ), m_target( target ), m_version( version ), m_headers( headers ),
+          m_headers_end( headers_end ), m_body( body ), m_params( params ){
+        size_t q = target.find( '?' );
+        m_path = target.substr( 0, q );
+        m_query = q == std::string_view::npos ? std::string_view() : target.substr( q + 1 );
+    }
+
+    int method() const { return m_method; }
+    std::string_view target() const { return m_target; }    // 请求行中的原始目标，含查询串
+    std::string_view path() const { return m_path; }
+    std::string_view query() const { return m_query; }      // '?'之后的部分，没有时为空
+    std::string_view version() const { return m_version; }
+    std::string_view body() const { return m_body; }
+
+    // 路由模式中的参数，没有时返回空
+    std::string_view param( std::string_view name ) const {
+        if( m_params ){
+            for( int i = 0; i < m_params->count; ++i ){
+                if( m_params->items[i].name == name ){
+                    return m_params->items[i].value;
+                }
+            }
+        }
+        return std::string_view();
+    }
+
+    // 第一个名为name的头部的值(不区分大小写)，没有时返回空
+    std::string_view header( std::string_view name ) const {
+        // 解析时每行结尾的\r\n被替换成了\0\0，逐行跳过
+        const char* p = m_headers;
+        while( p && p < m_headers_end ){
+            std::string_view line( p );
+            if( line.size() > name.size() && line[ name.size() ] == ':'
+                && strncasecmp( p, name.data(), name.size() ) == 0 ){
+                std::string_view value = line.substr( name.size() + 1 );
+                size_t start = value.find_first_not_of( " \t" );
+                return start == std::string_view::npos ? std::string_view() : value.substr( start );
+            }
+            p += line.size();
+            while( p < m_headers_end && *p == '\0' ){
+                ++p;
+            }
+        }
+        return std::string_view();
+    }
+
+private:
+    int m_method;
+    std::string_view m_target;
+    std::string_view m_path;
+    std::string_view m_query;
+    std::string_view m_version;
+    const char* m_headers;      // 第一个头部行
+    const char* m_headers_end;  // 结束头部的空行
+    std::string_view m_body;
+    const route_params* m_params;
+};
+
+class response_writer{
+public:
+    void reset(){
+        m_status = 200;
+        m_content_type = "text/plain";
+        m_headers.clear();
+        m_body.clear();
+        m_static_body = nullptr;
+        m_static_len = 0;
+        m_file = false;
+        m_file_path.clear();
+    }
+
+    void status( int code ){ m_status = code; }
+    // type必须是静态存储的字符串
+    void content_type( const char* type ){ m_content_type = type; }
+    // 追加一个头部，Content-Length和Connection由连接生成
+    void header( std::string_view name, std::string_view value ){
+        m_headers.append( name.data(), name.size() ).append( ": ", 2 ).append( value.data(), value.size() ).append( "\r\n", 2 );
+    }
+    // 追加响应体，数据被复制
+    void write( std::string_view data ){ m_body.append( data.data(), data.size() ); }
+    std::string& body(){ return m_body; }
+    // 响应体直接引用data，不复制，必须在整个进程生命周期内有效(例如字符串常量)
+    void write_static( const char* data, size_t len ){
+        m_static_body = data;
+        m_static_len = len;
+    }
+    // 发送文档根目录下的path
+    void file( std::string_view path ){
+        m_file = true;
+        m_file_path.assign( path.data(), path.size() );
+    }
+
+    int status_code() const { return m_status; }
+    const char* content_type_value() const { return m_content_type; }
+    const std::string& headers() const { return m_headers; }
+    const char* static_body() const { return m_static_body; }
+    size_t static_length() const { return m_static_len; }
+    bool is_file() const { return m_file; }
+    const std::string& file_path() const { return m_file_path; }
+
+private:
+    int m_status = 200;
+    const char* m_content_type = "text/plain";
+    std::string m_headers;      // 序列化好的额外头部，缓冲在连接的多个请求之间复用
+    std::string m_body;
+    const char* m_static_body = nullptr;
+    size_t m_static_len = 0;
+    bool m_file = false;
+    std::string m_file_path;
+};
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef ROUTE_TRIE_H
+#define ROUTE_TRIE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <stdexcept>
+#include <string_view>
+#include "request_view.h"
+
+/*
+    路由表：方法 + 路径模式 -> 处理函数，存放在编译期构建的基数树(radix tree)中
+    - 模式由字面量、参数和通配符组成，例如/api/users/:id，以及只能放在末尾的*path。
+      :name匹配一个非空的路径段；*name匹配剩余的全部路径(可以为空)，只能出现在末尾
+    - 字面量按字符组成基数树，公共前缀只比较一次，插入时按需分裂边
+    - 节点放在定长数组中，子节点用下标链接，整棵树可以是constexpr对象：在编译期建好，
+      放在只读数据段，所有reactor和工作线程无锁共享。模式冲突、参数过多在编译期报错
+    - 匹配优先级：字面量 > 参数 > 通配符，一条分支走不通时回溯
+    - 节点按方法保存处理函数，路径匹配而方法不匹配时返回允许的方法集合，用于405和OPTIONS
+*/
+typedef void (*route_handler)( const request_view& req, response_writer& res );
+
+struct route{
+    unsigned methods;       // route_methods的组合
+    const char* pattern;
+    route_handler handler;
+};
+
+struct route_node{
+    enum KIND { STATIC = 0, PARAM, WILDCARD };
+    KIND kind = STATIC;
+    const char* text = "";  // STATIC：边上的字面量；PARAM/WILDCARD：参数名
+    unsigned len = 0;
+    int first_child = -1;
+    int next_sibling = -1;
+    unsigned methods = 0;   // 有处理函数的方法位图
+    route_handler handlers[ HTTP_METHOD_COUNT ] = {};
+};
+
+struct route_match{
+    route_handler handler = nullptr;    // 为nullptr时看allowed
+    unsigned allowed = 0;               // 路径匹配时所有有处理函数的方法，0表示没有路径匹配
+    route_params params;
+};
+
+// 与节点数无关的只读视图，连接通过它查找路由
+class route_table{
+public:
+    constexpr route_table(): m_nodes( nullptr ){}
+    constexpr explicit route_table( const route_node* nodes ): m_nodes( nodes ){}
+
+    bool empty() const { return m_nodes == nullptr; }
+
+    void lookup( int method, std::string_view path, route_match& match ) const {
+        match.handler = nullptr;
+        match.allowed = 0;
+        match.params.count = 0;
+        if( !m_nodes ){
+            return;
+        }
+        int node = find( 0, path.data(), path.data() + path.size(), match.params );
+        if( node < 0 ){
+            return;
+        }
+        // 有GET处理函数的路径同时接受HEAD，由连接丢弃响应体
+        const route_node& n = m_nodes[node];
+        match.allowed = n.methods | ( ( n.methods & ROUTE_GET ) ? (unsigned)ROUTE_HEAD : 0u );
+        match.handler = n.handlers[ method ];
+        if( !match.handler && method == HTTP_HEAD ){
+            match.handler = n.handlers[ HTTP_GET ];
+        }
+    }
+
+private:
+    // 调用时node的边已经匹配，[p, end)是剩下的路径
+    int find( int node, const char* p, const char* end, route_params& params ) const {
+        const route_node& n = m_nodes[node];
+        if( p == end && n.methods ){
+            return node;
+        }
+        for( int c = n.first_child; c != -1; c = m_nodes[c].next_sibling ){
+            const route_node& child = m_nodes[c];
+            if( child.kind == route_node::STATIC && (size_t)( end - p ) >= child.len
+                && memcmp( p, child.text, child.len ) == 0 ){
+                int found = find( c, p + child.len, end, params );
+                if( found >= 0 ){
+                    return found;
+                }
+            }
+        }
+        for( int c = n.first_child; c != -1; c = m_nodes[c].next_sibling ){
+            const route_node& child = m_nodes[c];
+            if( child.kind == route_node::PARAM ){
+                const char* q = p;
+                while( q < end && *q != '/' ){
+                    ++q;
+                }
+                if( q == p ){
+                    continue;
+                }
+                int saved = params.count;
+                params.items[ params.count++ ] = { std::string_view( child.text, child.len ), std::string_view( p, q - p ) };
+                int found = find( c, q, end, params );
+                if( found >= 0 ){
+                    return found;
+                }
+                params.count = saved;
+            }else if( child.kind == route_node::WILDCARD && child.methods ){
+                params.items[ params.count++ ] = { std::string_view( child.text, child.len ), std::string_view( p, end - p ) };
+                return c;
+            }
+        }
+        return -1;
+    }
+
+    const route_node* m_nodes;
+};
+
+template <size_t N>
+class route_trie{
+public:
+    constexpr route_trie(){}
+
+    constexpr route_table table() const { return route_table( m_nodes ); }
+
+    constexpr void add( unsigned methods, const char* pattern, route_handler handler ){
+        if( pattern[0] != '/' ){
+            throw std::logic_error( "route pattern must start with '/'" );
+        }
+        int node = 0;
+        int params = 0;
+        const char* p = pattern;
+        while( *p ){
+            if( *p == ':' || *p == '*' ){
+                if( p[-1] != '/' ){
+                    throw std::logic_error( "route parameter must start a path segment" );
+                }
+                route_node::KIND kind = *p == ':' ? route_node::PARAM : route_node::WILDCARD;
+                const char* name = ++p;
+                while( *p && *p != '/' ){
+                    ++p;
+                }
+                if( kind == route_node::WILDCARD && *p ){
+                    throw std::logic_error( "route wildcard must be the last segment" );
+                }
+                if( ++params > route_params::MAX_PARAMS ){
+                    throw std::logic_error( "too many route parameters" );
+                }
+                node = insert_param( node, kind, name, p - name );
+                continue;
+            }
+            const char* literal = p;
+            while( *p && *p != ':' && *p != '*' ){
+                ++p;
+            }
+            node = insert_literal( node, literal, p - literal );
+        }
+        for( int m = 0; m < HTTP_METHOD_COUNT; ++m ){
+            if( methods & ( 1u << m ) ){
+                if( m_nodes[node].handlers[m] ){
+                    throw std::logic_error( "duplicate route" );
+                }
+                m_nodes[node].handlers[m] = handler;
+            }
+        }
+        m_nodes[node].methods |= methods;
+    }
+
+private:
+    constexpr int new_node( route_node::KIND kind, const char* text, unsigned len ){
+        if( m_count >= (int)N ){
+            throw std::logic_error( "route trie is full" );
+        }
+        route_node& n = m_nodes[ m_count ];
+        n.kind = kind;
+        n.text = text;
+        n.len = len;
+        return m_count++;
+    }
+
+    // 子节点追加到链表末尾，同类子节点保持注册顺序
+    constexpr void link( int parent, int child ){
+        int* slot = &m_nodes[parent].first_child;
+        while( *slot != -1 ){
+            slot = &m_nodes[*slot].next_sibling;
+        }
+        *slot = child;
+    }
+
+    constexpr int insert_param( int node, route_node::KIND kind, const char* name, unsigned len ){
+        for( int c = m_nodes[node].first_child; c != -1; c = m_nodes[c].next_sibling ){
+            if( m_nodes[c].kind == kind ){
+                if( !same( m_nodes[c].text, m_nodes[c].len, name, len ) ){
+                    throw std::logic_error( "conflicting route parameter names" );
+                }
+                return c;
+            }
+        }
+        int child = new_node( kind, name, len );
+        link( node, child );
+        return child;
+    }
+
+    constexpr int insert_literal( int node, const char* s, unsigned len ){
+        while( len > 0 ){
+            int child = -1;
+            for( int c = m_nodes[node].first_child; c != -1; c = m_nodes[c].next_sibling ){
+                if( m_nodes[c].kind == route_node::STATIC && m_nodes[c].text[0] == s[0] ){
+                    child = c;
+                    break;
+                }
+            }
+            if( child == -1 ){
+                child = new_node( route_node::STATIC, s, len );
+                link( node, child );
+                return child;
+            }
+            unsigned common = 0;
+            while( common < len && common < m_nodes[child].len && m_nodes[child].text[common] == s[common] ){
+                ++common;
+            }
+            if( common < m_nodes[child].len ){
+                split( child, common );
+            }
+            s += common;
+            len -= common;
+            node = child;
+        }
+        return node;
+    }
+
+    // 把child的边在at处一分为二，后半段连同原来的子节点和处理函数移到新节点
+    constexpr void split( int child, unsigned at ){
+        int tail = new_node( route_node::STATIC, m_nodes[child].text + at, m_nodes[child].len - at );
+        route_node& head = m_nodes[child];
+        route_node& rest = m_nodes[tail];
+        rest.first_child = head.first_child;
+        rest.methods = head.methods;
+        for( int m = 0; m < HTTP_METHOD_COUNT; ++m ){
+            rest.handlers[m] = head.handlers[m];
+            head.handlers[m] = nullptr;
+        }
+        head.len = at;
+        head.first_child = tail;
+        head.methods = 0;
+    }
+
+    static constexpr bool same( const char* a, unsigned alen, const char* b, unsigned blen ){
+        if( alen != blen ){
+            return false;
+        }
+        for( unsigned i = 0; i < alen; ++i ){
+            if( a[i] != b[i] ){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    route_node m_nodes[ N ] = {};
+    int m_count = 1;    // 0号节点是根，对应空前缀
+};
+
+// 节点数的上界：每条路由的每段字面量最多新增两个节点(分裂一个、新建一个)，每个参数一个
+template <size_t R>
+constexpr size_t route_node_bound( const route (&routes)[R] ){
+    size_t nodes = 1;
+    for( size_t i = 0; i < R; ++i ){
+        size_t params = 0;
+        for( const char* p = routes[i].pattern; *p; ++p ){
+            if( *p == ':' || *p == '*' ){
+                ++params;
+            }
+        }
+        nodes += 3 * params + 2;
+    }
+    return nodes;
+}
+
+/*
+    在编译期由静态的路由数组构建基数树：
+        static constexpr route routes[] = { { ROUTE_GET, "/users/:id", get_user }, ... };
+        static constexpr auto trie = make_route_trie<routes>();
+*/
+template <const auto& ROUTES>
+constexpr auto make_route_trie(){
+    route_trie<route_node_bound( ROUTES )> trie;
+    for( const route& r : ROUTES ){
+        trie.add( r.methods, r.pattern, r.handler );
+    }
+    return trie;
+}
+
+#endif
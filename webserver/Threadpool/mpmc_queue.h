@@ -0,0 +1,165 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+    不分配堆内存的可调用对象包装
+    可调用对象直接构造在内部固定大小的存储中，超过INLINE_SIZE的对象在编译期报错。
+    与std::function不同，它只能移动，不能复制，也没有返回值和future。
+*/
+class inline_task{
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    inline_task(): m_invoke(nullptr), m_manage(nullptr){}
+
+    template <typename F, typename Fn = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<Fn, inline_task>::value>::type>
+    inline_task(F&& f){
+        static_assert(sizeof(Fn) <= INLINE_SIZE, "callable too large for inline_task");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "callable over-aligned for inline_task");
+        static_assert(std::is_nothrow_move_constructible<Fn>::value, "callable must be nothrow movable");
+        new (m_storage) Fn(std::forward<F>(f));
+        m_invoke = [](void* p){ (*static_cast<Fn*>(p))(); };
+        // dst为空时只析构src，否则把src移动到dst后析构src
+        m_manage = [](void* dst, void* src){
+            if(dst){
+                new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            }
+            static_cast<Fn*>(src)->~Fn();
+        };
+    }
+
+    inline_task(inline_task&& other) noexcept: m_invoke(other.m_invoke), m_manage(other.m_manage){
+        if(m_manage){
+            m_manage(m_storage, other.m_storage);
+            other.m_invoke = nullptr;
+            other.m_manage = nullptr;
+        }
+    }
+
+    inline_task& operator=(inline_task&& other) noexcept{
+        if(this != &other){
+            reset();
+            m_invoke = other.m_invoke;
+            m_manage = other.m_manage;
+            if(m_manage){
+                m_manage(m_storage, other.m_storage);
+                other.m_invoke = nullptr;
+                other.m_manage = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    inline_task(const inline_task&) = delete;
+    inline_task& operator=(const inline_task&) = delete;
+
+    ~inline_task(){ reset(); }
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+
+    void operator()(){ m_invoke(m_storage); }
+
+    void reset(){
+        if(m_manage){
+            m_manage(nullptr, m_storage);
+            m_invoke = nullptr;
+            m_manage = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    void (*m_invoke)(void*);
+    void (*m_manage)(void*, void*);
+};
+
+/*
+    有界无锁多生产者多消费者环形队列(Dmitry Vyukov的算法)
+    每个槽位有一个序号：序号等于入队位置时槽位可写，等于入队位置+1时槽位可读。
+    入队和出队各只需要一次CAS和一次release存储，队列满或空时立即返回false。
+    容量必须是2的幂。
+*/
+template <typename T>
+class mpmc_queue{
+public:
+    explicit mpmc_queue(size_t capacity)
+        : m_cells(new cell[capacity]), m_mask(capacity - 1), m_enqueue_pos(0), m_dequeue_pos(0){
+        for(size_t i = 0; i < capacity; ++i){
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~mpmc_queue(){ delete [] m_cells; }
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    bool try_push(T&& value){
+        cell* c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0){
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    break;
+                }
+            }else if(diff < 0){
+                return false;   // 队列已满
+            }else{
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->value = std::move(value);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value){
+        cell* c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0){
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    break;
+                }
+            }else if(diff < 0){
+                return false;   // 队列为空
+            }else{
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(c->value);
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似判断，供休眠前检查使用。顺序一致的读取与提交方对休眠计数的检查配对，避免丢失唤醒
+    bool empty() const{
+        return m_enqueue_pos.load() == m_dequeue_pos.load();
+    }
+
+private:
+    struct cell{
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    cell* const m_cells;
+    const size_t m_mask;
+    // 入队位置和出队位置分别占据独立的缓存行
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+};
+
+#endif
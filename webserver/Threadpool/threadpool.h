@@ -10,6 +10,8 @@
 #include <memory>
 #include <stdexcept>
 #include <queue>
+#include <atomic>
+#include "mpmc_queue.h"
 
 class ThreadPool{
 public:
@@ -17,27 +19,44 @@ public:
     template <typename F, typename... Args>
     auto enqueue(F&& f, Args&&... args)
         ->std::future<typename std::result_of<F(Args...)>::type>; 
+    // 提交不关心结果的小任务：不分配堆内存、不创建future，环形队列未满时只有几次原子操作
+    template <typename F>
+    void post(F&& f);
     ~ThreadPool();           
 private:
+    static const size_t RING_CAPACITY = 4096;
+
     std::vector<std::thread> workers;
     std::queue<std::function<void()>> tasks;
+    mpmc_queue<inline_task> ring;   // post()提交的任务
 
     std::mutex queue_mutex;
     std::condition_variable condition;
+    std::atomic<int> sleepers;      // 正在等待条件变量的线程数
     bool stop;
 };
-inline ThreadPool::ThreadPool(size_t threads): stop(false){
+inline ThreadPool::ThreadPool(size_t threads): ring(RING_CAPACITY), sleepers(0), stop(false){
     for(size_t i=0; i<threads; ++i){
         workers.emplace_back(
             [this]
             {
                 for(;;){
+                    inline_task fast;
+                    if(this->ring.try_pop(fast)){
+                        fast();
+                        continue;
+                    }
                     std::function<void()> task;
                     {
                         std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock, [this]{return this->stop|| !this->tasks.empty();});
-                        if(this->stop && this->tasks.empty())
-                            return;
+                        this->sleepers.fetch_add(1);
+                        this->condition.wait(lock, [this]{return this->stop|| !this->tasks.empty() || !this->ring.empty();});
+                        this->sleepers.fetch_sub(1);
+                        if(this->tasks.empty()){
+                            if(this->stop && this->ring.empty())
+                                return;
+                            continue;
+                        }
                         task=std::move(this->tasks.front());
                         this->tasks.pop();
 
@@ -68,6 +87,33 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     return res;
 }
 
+template<typename F>
+void ThreadPool::post(F&& f)
+{
+    inline_task task(std::forward<F>(f));
+    if(!ring.try_push(std::move(task))){
+        // 环形队列已满，退回到加锁的任务队列
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if(stop){
+                throw std::runtime_error("ThreadPool stopped");
+            }
+            auto shared = std::make_shared<inline_task>(std::move(task));
+            tasks.emplace([shared]{(*shared)();});
+        }
+        condition.notify_one();
+        return;
+    }
+    // 与工作线程"先增加sleepers再检查队列"配对，保证不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers.load() > 0){
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+        }
+        condition.notify_one();
+    }
+}
+
 inline ThreadPool::~ThreadPool()
 {
     {
@@ -0,0 +1,244 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <condition_variable>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include "mpmc_queue.h"
+
+/*
+    工作窃取线程池，接口与ThreadPool::enqueue相同
+    - 每个工作线程有自己的双端队列，各自加锁，不再所有线程争用同一把锁
+    - 工作线程提交的任务放入自己队列的尾部，并从尾部取出(LIFO，缓存更友好)
+    - 外部线程(reactor)提交的任务轮流放入各个工作线程的队列
+    - 自己的队列为空时，从随机选取的其他线程队列头部窃取任务
+    - 所有队列都为空时在条件变量上休眠，只有存在休眠线程时提交任务才需要加锁唤醒
+    - post()提交的任务进入全局的无锁环形队列，不分配堆内存，工作线程在本地队列之后、窃取之前检查它
+    - on_start在每个工作线程开始取任务之前以线程编号调用，用于固定CPU等线程级的初始化
+*/
+class WorkStealingPool{
+public:
+    WorkStealingPool(size_t, std::function<void(size_t)> on_start = nullptr);
+    template <typename F, typename... Args>
+    auto enqueue(F&& f, Args&&... args)
+        ->std::future<typename std::result_of<F(Args...)>::type>;
+    // 提交不关心结果的小任务：不分配堆内存、不创建future
+    template <typename F>
+    void post(F&& f);
+    ~WorkStealingPool();
+private:
+    typedef std::function<void()> task_type;
+    static const size_t RING_CAPACITY = 4096;
+
+    // 按缓存行对齐，避免相邻队列的锁产生伪共享
+    struct alignas(64) worker_queue{
+        std::mutex mutex;
+        std::deque<task_type> tasks;
+    };
+
+    void worker_loop(size_t index);
+    void push(task_type&& task);
+    void wake_one();
+    bool pop_local(size_t index, task_type& task);
+    bool steal(size_t index, task_type& task);
+    static size_t next_random();
+    static size_t& current_index();
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<worker_queue[]> queues;
+    size_t queue_count;
+    mpmc_queue<inline_task> injector;   // post()提交的任务
+
+    std::atomic<size_t> pending;        // 所有队列中的任务总数
+    std::atomic<size_t> next_queue;     // 外部提交时轮流选择队列
+    std::atomic<int> sleepers;          // 正在休眠的工作线程数
+
+    std::mutex park_mutex;
+    std::condition_variable park_condition;
+    std::atomic<bool> stop;
+};
+
+// 当前线程在所属线程池中的编号，非工作线程为SIZE_MAX
+inline size_t& WorkStealingPool::current_index(){
+    static thread_local size_t index = SIZE_MAX;
+    return index;
+}
+
+// xorshift随机数，用于选择窃取对象
+inline size_t WorkStealingPool::next_random(){
+    static thread_local size_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+inline WorkStealingPool::WorkStealingPool(size_t threads, std::function<void(size_t)> on_start)
+    :   queues(new worker_queue[threads ? threads : 1]), queue_count(threads ? threads : 1),
+        injector(RING_CAPACITY), pending(0), next_queue(0), sleepers(0), stop(false)
+{
+    for(size_t i = 0; i < queue_count; ++i){
+        workers.emplace_back([this, i, on_start]{
+            if(on_start){
+                on_start(i);
+            }
+            worker_loop(i);
+        });
+    }
+}
+
+inline void WorkStealingPool::worker_loop(size_t index){
+    current_index() = index;
+    for(;;){
+        task_type task;
+        if(pop_local(index, task)){
+            pending.fetch_sub(1);
+            task();
+            continue;
+        }
+        inline_task fast;
+        if(injector.try_pop(fast)){
+            pending.fetch_sub(1);
+            fast();
+            continue;
+        }
+        if(steal(index, task)){
+            pending.fetch_sub(1);
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(park_mutex);
+        // sleepers与pending的读写都是顺序一致的：提交者先增加pending再检查sleepers，
+        // 工作线程先增加sleepers再检查pending，二者至少有一方能看到对方，不会丢失唤醒
+        sleepers.fetch_add(1);
+        park_condition.wait(lock, [this]{ return stop || pending.load() > 0; });
+        sleepers.fetch_sub(1);
+        if(stop && pending.load() == 0){
+            return;
+        }
+    }
+}
+
+inline bool WorkStealingPool::pop_local(size_t index, task_type& task){
+    worker_queue& q = queues[index];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if(q.tasks.empty()){
+        return false;
+    }
+    task = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+}
+
+inline bool WorkStealingPool::steal(size_t index, task_type& task){
+    size_t start = next_random();
+    for(size_t i = 0; i < queue_count; ++i){
+        size_t victim = (start + i) % queue_count;
+        if(victim == index){
+            continue;
+        }
+        worker_queue& q = queues[victim];
+        std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+        if(!lock.owns_lock() || q.tasks.empty()){
+            continue;
+        }
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+    // try_lock可能跳过了有任务的队列，pending不为0时再阻塞地检查一遍
+    if(pending.load() == 0){
+        return false;
+    }
+    for(size_t i = 0; i < queue_count; ++i){
+        size_t victim = (start + i) % queue_count;
+        if(victim == index){
+            continue;
+        }
+        worker_queue& q = queues[victim];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if(!q.tasks.empty()){
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void WorkStealingPool::push(task_type&& task){
+    size_t index = current_index();
+    if(index >= queue_count){
+        index = next_queue.fetch_add(1, std::memory_order_relaxed) % queue_count;
+    }
+    // 先增加pending再入队，pending不会小于实际的任务数
+    pending.fetch_add(1);
+    {
+        worker_queue& q = queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+    wake_one();
+}
+
+inline void WorkStealingPool::wake_one(){
+    if(sleepers.load() > 0){
+        {
+            std::lock_guard<std::mutex> lock(park_mutex);
+        }
+        park_condition.notify_one();
+    }
+}
+
+template<typename F>
+void WorkStealingPool::post(F&& f)
+{
+    inline_task task(std::forward<F>(f));
+    pending.fetch_add(1);
+    if(!injector.try_push(std::move(task))){
+        // 环形队列已满，退回到工作线程的本地队列
+        pending.fetch_sub(1);
+        auto shared = std::make_shared<inline_task>(std::move(task));
+        push([shared]{(*shared)();});
+        return;
+    }
+    wake_one();
+}
+
+//任务队列入队
+template<typename F, typename... Args>
+auto WorkStealingPool::enqueue(F&& f, Args&&... args)
+    ->std::future<typename std::result_of<F(Args...)>::type>
+{
+    using return_type = typename std::result_of<F(Args...)>::type;
+    auto task = std::make_shared<std::packaged_task<return_type()>>(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+        );
+    std::future<return_type> res = task->get_future();
+    if(stop.load()){
+        throw std::runtime_error("WorkStealingPool stopped");
+    }
+    push([task]{(*task)();});
+    return res;
+}
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(park_mutex);
+        stop = true;
+    }
+    park_condition.notify_all();
+    for(std::thread &worker:workers)
+        worker.join();
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <mutex>
+
+/*
+    定时器节点，嵌入在被管理的对象(http_conn)中，插入、刷新、取消都不分配内存
+*/
+struct timer_node{
+    timer_node* prev;
+    timer_node* next;
+    uint64_t expire;    // 到期的tick
+    void* data;         // 到期时交给回调的对象
+    unsigned holds;     // 正在处理该对象的工作线程任务数，不为0时到期推迟，由时间轮的锁保护
+
+    timer_node(): prev(nullptr), next(nullptr), expire(0), data(nullptr), holds(0){}
+    bool linked() const { return prev != nullptr; }
+};
+
+/*
+    分层时间轮
+    LEVELS层，每层SLOTS个槽，第0层每个槽是一个tick，第l层每个槽是SLOTS^l个tick。
+    定时器按到期tick与当前tick最高的不同位所在的层放入对应的槽，插入、刷新、取消都是O(1)；
+    第0层转完一圈时把上一层当前槽中的定时器重新分配到下面的层。
+    每层用一个位图记录非空的槽，供next_timeout()计算epoll_wait的等待时间。
+    reactor线程推进时间轮并处理到期的连接；单reactor模式下工作线程也会重新设置定时器，所以操作加锁。
+    锁只保护时间轮本身：工作线程在处理过程中设置的定时器可能已经到期(头部超时的截止时间是固定的)，
+    所以交给工作线程前要hold()，任务返回后release()。被hold的节点到期时推迟到下一个tick，
+    回调不会在工作线程仍在访问连接时关闭它
+*/
+class timer_wheel{
+public:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4;
+    static const uint64_t MAX_TICKS = ( 1ULL << ( SLOT_BITS * LEVELS ) ) - 1;
+
+    explicit timer_wheel( int tick_ms = 100 ): m_tick_ms( tick_ms ), m_current( now_ms() / tick_ms ), m_count( 0 ){
+        for( int l = 0; l < LEVELS; ++l ){
+            m_bitmap[l] = 0;
+            for( int s = 0; s < SLOTS; ++s ){
+                m_slots[l][s].prev = m_slots[l][s].next = &m_slots[l][s];
+            }
+        }
+    }
+
+    timer_wheel( const timer_wheel& ) = delete;
+    timer_wheel& operator=( const timer_wheel& ) = delete;
+
+    static uint64_t now_ms(){
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // 精确到微秒的单调时间，用于统计耗时(时间轮本身只需要粗粒度的时钟)
+    static uint64_t now_us(){
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // 把毫秒时间换算成tick，向上取整，保证不会提前到期
+    uint64_t deadline( int timeout_ms ) const{
+        return ( now_ms() + timeout_ms + m_tick_ms - 1 ) / m_tick_ms;
+    }
+
+    // 在timeout_ms毫秒后到期，节点已经在时间轮中时相当于刷新
+    void schedule( timer_node* node, int timeout_ms ){
+        schedule_at( node, deadline( timeout_ms ) );
+    }
+
+    // 在指定的tick到期，已经过去的tick在下一次推进时到期
+    void schedule_at( timer_node* node, uint64_t expire ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( node->linked() ){
+            unlink( node );
+        }else{
+            ++m_count;
+        }
+        node->expire = expire;
+        insert( node );
+    }
+
+    void cancel( timer_node* node ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( node->linked() ){
+            unlink( node );
+            --m_count;
+        }
+    }
+
+    // 交给工作线程之前调用：取消定时器，在对应的release()之前节点不会到期
+    void hold( timer_node* node ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( node->linked() ){
+            unlink( node );
+            --m_count;
+        }
+        ++node->holds;
+    }
+
+    // 工作线程的任务结束，不再访问对象。任务中设置的已经过期的定时器在下一次推进时到期
+    void release( timer_node* node ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        --node->holds;
+    }
+
+    // 距离下一个可能有定时器到期(或需要重新分配)的tick的毫秒数，没有定时器时返回-1
+    int next_timeout(){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( m_count == 0 ){
+            return -1;
+        }
+        // 第0层的定时器都在当前这一圈内，且位于当前槽之后
+        int low = m_current & ( SLOTS - 1 );
+        uint64_t ahead = low == SLOTS - 1 ? 0 : m_bitmap[0] >> ( low + 1 );
+        uint64_t ticks;
+        if( ahead ){
+            ticks = __builtin_ctzll( ahead ) + 1;
+        }else{
+            // 第0层在本圈内没有定时器，等到这一圈结束时重新分配上层的定时器
+            ticks = SLOTS - low;
+        }
+        uint64_t target = ( m_current + ticks ) * m_tick_ms;
+        uint64_t now = now_ms();
+        return target > now ? (int)( target - now ) : 0;
+    }
+
+    /*
+        推进到当前时间，对每个到期的定时器调用on_expire(data)。回调在锁外执行，可以调用cancel/schedule
+        被hold的节点留在时间轮中，推迟到下一个tick。hold()只在推进时间轮的线程中调用，
+        所以节点摘下后到回调执行之前不会被交给工作线程
+    */
+    template <typename F>
+    void advance( F on_expire ){
+        timer_node expired;
+        expired.prev = expired.next = &expired;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            uint64_t now = now_ms() / m_tick_ms;
+            if( m_count == 0 ){
+                m_current = now > m_current ? now : m_current;
+            }
+            while( m_current < now ){
+                ++m_current;
+                cascade();
+                timer_node& head = m_slots[0][ m_current & ( SLOTS - 1 ) ];
+                while( head.next != &head ){
+                    timer_node* node = head.next;
+                    unlink( node );
+                    if( node->holds ){
+                        node->expire = m_current + 1;
+                        insert( node );
+                        continue;
+                    }
+                    --m_count;
+                    push_back( &expired, node );
+                }
+            }
+        }
+        // 回调可能重新调度其他节点，逐个摘下后再调用
+        while( expired.next != &expired ){
+            timer_node* node = expired.next;
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = node->next = nullptr;
+            on_expire( node->data );
+        }
+    }
+
+private:
+    static void push_back( timer_node* head, timer_node* node ){
+        node->prev = head->prev;
+        node->next = head;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    void insert( timer_node* node ){
+        uint64_t expire = node->expire;
+        if( expire <= m_current ){
+            expire = m_current + 1;
+        }else if( expire - m_current > MAX_TICKS ){
+            expire = m_current + MAX_TICKS;
+        }
+        // 到期tick与当前tick在第l层以上的位都相同，放在第l层，槽号取第l层的位
+        uint64_t diff = expire ^ m_current;
+        int level = 0;
+        while( level < LEVELS - 1 && ( diff >> ( SLOT_BITS * ( level + 1 ) ) ) != 0 ){
+            ++level;
+        }
+        int slot = ( expire >> ( SLOT_BITS * level ) ) & ( SLOTS - 1 );
+        node->expire = expire;
+        push_back( &m_slots[level][slot], node );
+        m_bitmap[level] |= 1ULL << slot;
+    }
+
+    void unlink( timer_node* node ){
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        // 槽变空时清除位图中对应的位。表头在槽数组中，可以由节点所在的链表找到它
+        timer_node* neighbor = node->next;
+        if( neighbor->next == neighbor ){
+            clear_bit( neighbor );
+        }
+        node->prev = node->next = nullptr;
+    }
+
+    void clear_bit( timer_node* head ){
+        for( int l = 0; l < LEVELS; ++l ){
+            if( head >= m_slots[l] && head < m_slots[l] + SLOTS ){
+                m_bitmap[l] &= ~( 1ULL << ( head - m_slots[l] ) );
+                return;
+            }
+        }
+    }
+
+    // 当前tick到达第l层一个槽的起点时，把该槽的定时器重新插入下面的层
+    void cascade(){
+        for( int l = 1; l < LEVELS; ++l ){
+            if( ( m_current & ( ( 1ULL << ( SLOT_BITS * l ) ) - 1 ) ) != 0 ){
+                return;
+            }
+            int slot = ( m_current >> ( SLOT_BITS * l ) ) & ( SLOTS - 1 );
+            timer_node& head = m_slots[l][slot];
+            while( head.next != &head ){
+                timer_node* node = head.next;
+                unlink( node );
+                insert( node );
+            }
+        }
+    }
+
+    const int m_tick_ms;
+    uint64_t m_current;     // 已经处理完的tick
+    size_t m_count;
+    timer_node m_slots[LEVELS][SLOTS];     // 每个槽是一个带表头的双向循环链表
+    uint64_t m_bitmap[LEVELS];
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+#ifdef WEBSERVER_HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+/*
+    TLS终止(需要编译时定义WEBSERVER_HAVE_OPENSSL并链接-lssl -lcrypto，否则tls_context::init()总是失败)
+    - 所有连接共享一个SSL_CTX：服务器端会话缓存和TLS 1.3会话票据都在其中，任何reactor接受的连接都能恢复会话
+    - 握手完成后OpenSSL尝试把记录层交给内核(kTLS，TCP_ULP "tls")。发送方向交给内核后，
+      连接继续用writev直接引用文件映射、用sendfile发送大文件，加密在内核中完成，不经过用户空间的复制；
+      内核不支持时退回SSL_write，文件内容先读到用户空间再加密
+    - 接收始终经过SSL_read，由OpenSSL处理内核交付的控制消息(警报、KeyUpdate)
+    - ALPN优先选择h2，连接直接进入HTTP/2，不需要前言之外的协商
+*/
+enum TLS_STATUS { TLS_DONE = 0, TLS_WANT_READ, TLS_WANT_WRITE, TLS_CLOSED, TLS_ERROR };
+static const size_t TLS_RECORD_SIZE = 16384;    // 一个记录的最大明文长度
+
+#ifdef WEBSERVER_HAVE_OPENSSL
+
+class tls_context{
+public:
+    static tls_context& instance(){
+        static tls_context ctx;
+        return ctx;
+    }
+
+    bool enabled() const { return m_ctx != nullptr; }
+    SSL_CTX* get() const { return m_ctx; }
+
+    // 加载证书链和私钥，失败时把OpenSSL的错误信息写到error
+    bool init( const char* cert_file, const char* key_file, char* error, size_t error_len ){
+        SSL_CTX* ctx = SSL_CTX_new( TLS_server_method() );
+        if( !ctx ){
+            return fail( nullptr, error, error_len );
+        }
+        SSL_CTX_set_min_proto_version( ctx, TLS1_2_VERSION );
+        SSL_CTX_set_options( ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE );
+        // 部分写入：一次SSL_write可以只发出前面几个记录；重试时缓冲的地址可以不同(由iovec重新收集)
+        SSL_CTX_set_mode( ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS );
+        if( SSL_CTX_use_certificate_chain_file( ctx, cert_file ) != 1
+            || SSL_CTX_use_PrivateKey_file( ctx, key_file, SSL_FILETYPE_PEM ) != 1
+            || SSL_CTX_check_private_key( ctx ) != 1 ){
+            return fail( ctx, error, error_len );
+        }
+        // 会话恢复：TLS 1.2的会话ID缓存和两个版本的会话票据，票据密钥由OpenSSL在进程内生成
+        static const unsigned char session_context[] = "webserver";
+        SSL_CTX_set_session_id_context( ctx, session_context, sizeof( session_context ) - 1 );
+        SSL_CTX_set_session_cache_mode( ctx, SSL_SESS_CACHE_SERVER );
+        SSL_CTX_sess_set_cache_size( ctx, SESSION_CACHE_SIZE );
+        SSL_CTX_set_timeout( ctx, SESSION_TIMEOUT_S );
+        SSL_CTX_set_alpn_select_cb( ctx, select_alpn, nullptr );
+        m_ctx = ctx;
+        return true;
+    }
+
+private:
+    static const long SESSION_CACHE_SIZE = 20480;
+    static const long SESSION_TIMEOUT_S = 3600;
+
+    tls_context(): m_ctx( nullptr ){}
+
+    static bool fail( SSL_CTX* ctx, char* error, size_t error_len ){
+        ERR_error_string_n( ERR_get_error(), error, error_len );
+        if( ctx ){
+            SSL_CTX_free( ctx );
+        }
+        return false;
+    }
+
+    static int select_alpn( SSL*, const unsigned char** out, unsigned char* outlen,
+                            const unsigned char* in, unsigned int inlen, void* ){
+        static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+        if( SSL_select_next_proto( (unsigned char**)out, outlen, protocols, sizeof( protocols ) - 1, in, inlen )
+            != OPENSSL_NPN_NEGOTIATED ){
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    SSL_CTX* m_ctx;
+};
+
+// 一个连接的TLS状态，嵌入在连接对象中，连接关闭后复用
+class tls_session{
+public:
+    tls_session(): m_ssl( nullptr ), m_handshaking( false ), m_want_write( false ), m_kernel_send( false ), m_failed( false ){}
+    ~tls_session(){ reset(); }
+
+    bool active() const { return m_ssl != nullptr; }
+    bool handshaking() const { return m_handshaking; }
+    bool want_write() const { return m_want_write; }    // 握手在等待socket可写
+    // 发送方向的记录层已经交给内核，socket上的sendmsg/sendfile就是加密的
+    bool kernel_send() const { return m_kernel_send; }
+    // 响应必须经过SSL_write，在用户空间加密
+    bool user_send() const { return m_ssl && !m_kernel_send; }
+
+    bool start( int fd ){
+        m_ssl = SSL_new( tls_context::instance().get() );
+        if( !m_ssl || SSL_set_fd( m_ssl, fd ) != 1 ){
+            reset();
+            return false;
+        }
+        SSL_set_accept_state( m_ssl );
+        m_handshaking = true;
+        m_want_write = false;
+        m_kernel_send = false;
+        m_failed = false;
+        return true;
+    }
+
+    int handshake(){
+        int ret = SSL_do_handshake( m_ssl );
+        if( ret == 1 ){
+            m_handshaking = false;
+            m_want_write = false;
+            m_kernel_send = BIO_get_ktls_send( SSL_get_wbio( m_ssl ) );
+            return TLS_DONE;
+        }
+        int status = status_of( ret );
+        m_want_write = status == TLS_WANT_WRITE;
+        return status;
+    }
+
+    bool resumed() const { return SSL_session_reused( m_ssl ) == 1; }
+
+    bool h2_selected() const {
+        const unsigned char* proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected( m_ssl, &proto, &len );
+        return len == 2 && memcmp( proto, "h2", 2 ) == 0;
+    }
+
+    // 返回读到的字节数，0或-1时status给出原因
+    ssize_t read( void* buf, size_t len, int& status ){
+        int ret = SSL_read( m_ssl, buf, (int)len );
+        if( ret > 0 ){
+            return ret;
+        }
+        status = status_of( ret );
+        return status == TLS_CLOSED ? 0 : -1;
+    }
+
+    // 与非阻塞socket的write相同：需要等待socket时返回-1且errno为EAGAIN。
+    // 重试时必须给出同样的数据(地址可以不同)，已经加密但没有发出的记录先发送
+    ssize_t write( const void* buf, size_t len ){
+        int ret = SSL_write( m_ssl, buf, (int)std::min( len, (size_t)INT_MAX ) );
+        if( ret > 0 ){
+            return ret;
+        }
+        int status = status_of( ret );
+        errno = status == TLS_WANT_WRITE || status == TLS_WANT_READ ? EAGAIN : EPIPE;
+        return -1;
+    }
+
+    // 尽力发送close_notify，不等待对方的回应。出现过致命错误的连接不能再发送
+    void shutdown(){
+        if( m_ssl && !m_handshaking && !m_failed ){
+            SSL_shutdown( m_ssl );
+        }
+    }
+
+    void reset(){
+        if( m_ssl ){
+            SSL_free( m_ssl );
+            m_ssl = nullptr;
+        }
+        m_handshaking = false;
+        m_want_write = false;
+        m_kernel_send = false;
+        m_failed = false;
+        ERR_clear_error();
+    }
+
+private:
+    int status_of( int ret ){
+        switch( SSL_get_error( m_ssl, ret ) ){
+            case SSL_ERROR_WANT_READ:
+                return TLS_WANT_READ;
+            case SSL_ERROR_WANT_WRITE:
+                return TLS_WANT_WRITE;
+            case SSL_ERROR_ZERO_RETURN:
+                return TLS_CLOSED;
+            default:
+                // 错误留在线程的错误队列中会影响之后其他连接的SSL_get_error
+                ERR_clear_error();
+                m_failed = true;
+                return TLS_ERROR;
+        }
+    }
+
+    SSL* m_ssl;
+    bool m_handshaking;
+    bool m_want_write;
+    bool m_kernel_send;
+    bool m_failed;
+};
+
+#else
+
+// 没有OpenSSL时的空实现：init()失败，连接永远不会启用TLS
+class tls_context{
+public:
+    static tls_context& instance(){
+        static tls_context ctx;
+        return ctx;
+    }
+    bool enabled() const { return false; }
+    bool init( const char*, const char*, char* error, size_t error_len ){
+        snprintf( error, error_len, "built without OpenSSL (define WEBSERVER_HAVE_OPENSSL)" );
+        return false;
+    }
+};
+
+class tls_session{
+public:
+    bool active() const { return false; }
+    bool handshaking() const { return false; }
+    bool want_write() const { return false; }
+    bool start( int ){ return false; }
+    int handshake(){ return TLS_ERROR; }
+    bool resumed() const { return false; }
+    bool kernel_send() const { return false; }
+    bool user_send() const { return false; }
+    bool h2_selected() const { return false; }
+    ssize_t read( void*, size_t, int& status ){ status = TLS_ERROR; return -1; }
+    ssize_t write( const void*, size_t ){ errno = EPIPE; return -1; }
+    void shutdown(){}
+    void reset(){}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+
+/*
+    CPU拓扑和线程放置
+    - 从sysfs读取每个CPU所在的NUMA节点、物理封装和物理核，只考虑本进程允许使用的CPU
+      (sched_getaffinity，包含taskset和容器cpuset的限制)
+    - 放置顺序：节点依次分配；同一节点内先用每个物理核的第一个超线程，再用其余的超线程。
+      单reactor+线程池时reactor和前面的工作线程落在同一个节点上，请求不跨节点传递
+    - pin()把当前线程固定到一个CPU并记下它的节点，内存池按节点分开空闲链表；
+      缓冲由固定后的线程第一次写入，物理页按first-touch分配在本节点
+*/
+struct cpu_info{
+    int cpu;
+    int node;
+    int package;
+    int core;
+};
+
+class cpu_topology{
+public:
+    static const int MAX_NODES = 8;     // 节点号对它取模，内存池按这个数目分片
+
+    static const cpu_topology& instance(){
+        static cpu_topology topology;
+        return topology;
+    }
+
+    int cpu_count() const { return (int)m_order.size(); }
+    int node_count() const { return m_node_count; }
+
+    // 第index个放置的线程使用的CPU，线程比CPU多时循环
+    const cpu_info& placement( size_t index ) const { return m_order[ index % m_order.size() ]; }
+
+    // 把当前线程固定到info.cpu上，失败(例如CPU已经下线)时线程保持不固定
+    static bool pin( const cpu_info& info ){
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( info.cpu, &set );
+        if( pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) != 0 ){
+            return false;
+        }
+        current_node_ref() = info.node % MAX_NODES;
+        return true;
+    }
+
+    // 当前线程所在的节点，没有固定的线程为0
+    static int current_node(){ return current_node_ref(); }
+
+private:
+    cpu_topology(): m_node_count( 0 ){
+        cpu_set_t allowed;
+        CPU_ZERO( &allowed );
+        bool restricted = sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0;
+        std::vector<int> online = read_cpu_list( "/sys/devices/system/cpu/online" );
+        if( online.empty() ){
+            long n = sysconf( _SC_NPROCESSORS_ONLN );
+            for( long i = 0; i < n; ++i ){
+                online.push_back( (int)i );
+            }
+        }
+        std::vector<int> node_of = read_nodes();
+        char path[ 128 ];
+        for( int cpu : online ){
+            if( restricted && ( cpu >= CPU_SETSIZE || !CPU_ISSET( cpu, &allowed ) ) ){
+                continue;
+            }
+            cpu_info info;
+            info.cpu = cpu;
+            info.node = cpu < (int)node_of.size() && node_of[cpu] >= 0 ? node_of[cpu] : 0;
+            snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu );
+            info.package = read_int( path, 0 );
+            snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu );
+            info.core = read_int( path, cpu );
+            m_order.push_back( info );
+        }
+        if( m_order.empty() ){
+            m_order.push_back( cpu_info{ 0, 0, 0, 0 } );
+        }
+        std::sort( m_order.begin(), m_order.end(), []( const cpu_info& a, const cpu_info& b ){
+            if( a.node != b.node ) return a.node < b.node;
+            if( a.package != b.package ) return a.package < b.package;
+            if( a.core != b.core ) return a.core < b.core;
+            return a.cpu < b.cpu;
+        } );
+        // 每个节点内，物理核的第一个超线程排在所有兄弟超线程之前
+        std::vector<cpu_info> order;
+        size_t begin = 0;
+        while( begin < m_order.size() ){
+            size_t end = begin;
+            while( end < m_order.size() && m_order[end].node == m_order[begin].node ){
+                ++end;
+            }
+            std::vector<cpu_info> siblings;
+            for( size_t i = begin; i < end; ++i ){
+                bool first = i == begin || m_order[i].package != m_order[i - 1].package || m_order[i].core != m_order[i - 1].core;
+                ( first ? order : siblings ).push_back( m_order[i] );
+            }
+            order.insert( order.end(), siblings.begin(), siblings.end() );
+            m_node_count++;
+            begin = end;
+        }
+        m_order.swap( order );
+    }
+
+    static int& current_node_ref(){
+        static thread_local int node = 0;
+        return node;
+    }
+
+    static int read_int( const char* path, int fallback ){
+        FILE* f = fopen( path, "r" );
+        if( !f ){
+            return fallback;
+        }
+        int value;
+        if( fscanf( f, "%d", &value ) != 1 ){
+            value = fallback;
+        }
+        fclose( f );
+        return value;
+    }
+
+    // 解析"0-3,8-11"格式的CPU列表
+    static std::vector<int> read_cpu_list( const char* path ){
+        std::vector<int> cpus;
+        FILE* f = fopen( path, "r" );
+        if( !f ){
+            return cpus;
+        }
+        char line[ 4096 ];
+        if( fgets( line, sizeof( line ), f ) ){
+            char* p = line;
+            while( *p >= '0' && *p <= '9' ){
+                int first = (int)strtol( p, &p, 10 );
+                int last = first;
+                if( *p == '-' ){
+                    last = (int)strtol( p + 1, &p, 10 );
+                }
+                for( int cpu = first; cpu <= last; ++cpu ){
+                    cpus.push_back( cpu );
+                }
+                if( *p == ',' ){
+                    ++p;
+                }
+            }
+        }
+        fclose( f );
+        return cpus;
+    }
+
+    // CPU号 -> 节点号，没有NUMA信息(内核未开启或容器中没有挂载)时为空
+    static std::vector<int> read_nodes(){
+        std::vector<int> node_of;
+        DIR* dir = opendir( "/sys/devices/system/node" );
+        if( !dir ){
+            return node_of;
+        }
+        struct dirent* entry;
+        char path[ 128 ];
+        while( ( entry = readdir( dir ) ) != NULL ){
+            int node;
+            if( sscanf( entry->d_name, "node%d", &node ) != 1 ){
+                continue;
+            }
+            snprintf( path, sizeof( path ), "/sys/devices/system/node/node%d/cpulist", node );
+            for( int cpu : read_cpu_list( path ) ){
+                if( cpu >= (int)node_of.size() ){
+                    node_of.resize( cpu + 1, -1 );
+                }
+                node_of[cpu] = node;
+            }
+        }
+        closedir( dir );
+        return node_of;
+    }
+
+    std::vector<cpu_info> m_order;      // 放置顺序
+    int m_node_count;
+};
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+/*
+    io_uring的最小封装，直接使用系统调用，不依赖liburing
+    - 提交队列(SQ)和完成队列(CQ)映射到用户空间，准备好的SQE在下一次enter()时一次性提交，
+      同一个系统调用里等待完成事件，并用EXT_ARG带上定时器的超时
+    - 提供缓冲环(provided buffer ring)：多次触发的recv从环中取缓冲，数据处理完后归还。
+      注册后先用一次recv自检，有的内核注册成功却取不到环中的缓冲，这时退回用PROVIDE_BUFFERS请求归还缓冲
+    - 只允许创建它的线程使用(SINGLE_ISSUER)，不加锁
+*/
+class io_ring{
+public:
+    io_ring(): m_fd( -1 ), m_sq_ptr( nullptr ), m_cq_ptr( nullptr ), m_sqes( nullptr ), m_sq_size( 0 ), m_cq_size( 0 ),
+               m_sqe_size( 0 ), m_pending( 0 ), m_buf_ring( nullptr ), m_buf_base( nullptr ), m_buf_count( 0 ),
+               m_buf_size( 0 ), m_buf_ring_size( 0 ), m_buf_legacy( false ){}
+
+    ~io_ring(){
+        if( m_buf_ring ){
+            munmap( m_buf_ring, m_buf_ring_size );
+        }
+        if( m_buf_base ){
+            munmap( m_buf_base, (size_t)m_buf_count * m_buf_size );
+        }
+        if( m_sqes ){
+            munmap( m_sqes, m_sqe_size );
+        }
+        if( m_cq_ptr && m_cq_ptr != m_sq_ptr ){
+            munmap( m_cq_ptr, m_cq_map_size );
+        }
+        if( m_sq_ptr ){
+            munmap( m_sq_ptr, m_sq_map_size );
+        }
+        if( m_fd != -1 ){
+            close( m_fd );
+        }
+    }
+
+    io_ring( const io_ring& ) = delete;
+    io_ring& operator=( const io_ring& ) = delete;
+
+    // 创建队列。新内核上推迟任务处理到enter()，旧内核上退回默认设置；失败返回-errno
+    int init( unsigned entries ){
+        struct io_uring_params p;
+        static const unsigned flag_sets[] = {
+            IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+            IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN,
+            IORING_SETUP_CQSIZE,
+        };
+        for( unsigned flags : flag_sets ){
+            memset( &p, 0, sizeof( p ) );
+            p.flags = flags;
+            p.cq_entries = entries * 4;
+            m_fd = (int)syscall( __NR_io_uring_setup, entries, &p );
+            if( m_fd >= 0 || errno != EINVAL ){
+                break;
+            }
+        }
+        if( m_fd < 0 ){
+            return -errno;
+        }
+        // 需要EXT_ARG(带超时的等待)和NODROP(完成队列满时不丢事件)
+        if( !( p.features & IORING_FEAT_EXT_ARG ) || !( p.features & IORING_FEAT_NODROP ) ){
+            return -ENOSYS;
+        }
+        m_sq_map_size = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+        m_cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof( struct io_uring_cqe );
+        if( p.features & IORING_FEAT_SINGLE_MMAP ){
+            m_sq_map_size = m_cq_map_size = m_sq_map_size > m_cq_map_size ? m_sq_map_size : m_cq_map_size;
+        }
+        m_sq_ptr = mmap( 0, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+        if( m_sq_ptr == MAP_FAILED ){
+            m_sq_ptr = nullptr;
+            return -errno;
+        }
+        if( p.features & IORING_FEAT_SINGLE_MMAP ){
+            m_cq_ptr = m_sq_ptr;
+        }else{
+            m_cq_ptr = mmap( 0, m_cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING );
+            if( m_cq_ptr == MAP_FAILED ){
+                m_cq_ptr = nullptr;
+                return -errno;
+            }
+        }
+        m_sqe_size = p.sq_entries * sizeof( struct io_uring_sqe );
+        m_sqes = (struct io_uring_sqe*)mmap( 0, m_sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+        if( m_sqes == MAP_FAILED ){
+            m_sqes = nullptr;
+            return -errno;
+        }
+        char* sq = (char*)m_sq_ptr;
+        char* cq = (char*)m_cq_ptr;
+        m_sq_head = (std::atomic<unsigned>*)( sq + p.sq_off.head );
+        m_sq_tail = (std::atomic<unsigned>*)( sq + p.sq_off.tail );
+        m_sq_mask = *(unsigned*)( sq + p.sq_off.ring_mask );
+        m_sq_array = (unsigned*)( sq + p.sq_off.array );
+        m_cq_head = (std::atomic<unsigned>*)( cq + p.cq_off.head );
+        m_cq_tail = (std::atomic<unsigned>*)( cq + p.cq_off.tail );
+        m_cq_mask = *(unsigned*)( cq + p.cq_off.ring_mask );
+        m_cqes = (struct io_uring_cqe*)( cq + p.cq_off.cqes );
+        m_sq_size = p.sq_entries;
+        m_cq_size = p.cq_entries;
+        // SQE与数组下标一一对应，之后只需要移动tail
+        for( unsigned i = 0; i < m_sq_size; ++i ){
+            m_sq_array[i] = i;
+        }
+        return 0;
+    }
+
+    /*
+        注册一个提供缓冲的环：count个size字节的缓冲，count必须是2的幂。
+        内核为多次触发的recv从中选择缓冲，完成事件中带缓冲编号
+    */
+    int register_buffers( unsigned short group, unsigned count, unsigned size ){
+        m_buf_ring_size = count * sizeof( struct io_uring_buf );
+        void* ring = mmap( 0, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( ring == MAP_FAILED ){
+            return -errno;
+        }
+        m_buf_ring = (struct io_uring_buf_ring*)ring;
+        void* base = mmap( 0, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( base == MAP_FAILED ){
+            return -errno;
+        }
+        m_buf_base = (char*)base;
+        m_buf_count = count;
+        m_buf_size = size;
+        m_buf_group = group;
+        m_buf_tail = 0;
+        for( unsigned i = 0; i < count; ++i ){
+            push_buffer( i );
+        }
+        publish_buffers();
+        struct io_uring_buf_reg reg;
+        memset( &reg, 0, sizeof( reg ) );
+        reg.ring_addr = (uint64_t)(uintptr_t)ring;
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if( syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) == 0 ){
+            int ret = probe_buffers();
+            if( ret >= 0 ){
+                recycle_buffer( ret );
+                publish_buffers();
+                return 0;
+            }
+            syscall( __NR_io_uring_register, m_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1 );
+        }
+        // 不支持缓冲环或自检失败：一次性提供所有缓冲，之后逐个归还
+        m_buf_legacy = true;
+        for( unsigned i = 0; i < count; ++i ){
+            m_returned.push_back( i );
+        }
+        publish_buffers();
+        int ret = probe_buffers();
+        if( ret < 0 ){
+            return ret;
+        }
+        recycle_buffer( ret );
+        publish_buffers();
+        return 0;
+    }
+
+    unsigned short buffer_group() const { return m_buf_group; }
+    const char* buffer( unsigned id ) const { return m_buf_base + (size_t)id * m_buf_size; }
+
+    // 归还缓冲，在下一次publish_buffers()后对内核可见
+    void recycle_buffer( unsigned id ){
+        if( m_buf_legacy ){
+            m_returned.push_back( id );
+        }else{
+            push_buffer( id );
+        }
+    }
+
+    // 缓冲环只需要移动tail；退回的方式把编号连续的缓冲合并成一个PROVIDE_BUFFERS请求，随下一次enter()提交
+    void publish_buffers(){
+        if( !m_buf_legacy ){
+            __atomic_store_n( &m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE );
+            return;
+        }
+        std::sort( m_returned.begin(), m_returned.end() );
+        size_t i = 0;
+        while( i < m_returned.size() ){
+            size_t j = i + 1;
+            while( j < m_returned.size() && m_returned[j] == m_returned[j - 1] + 1 ){
+                ++j;
+            }
+            struct io_uring_sqe* sqe = get_sqe();
+            if( !sqe ){
+                break;
+            }
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = (int)( j - i );
+            sqe->addr = (uint64_t)(uintptr_t)buffer( m_returned[i] );
+            sqe->len = m_buf_size;
+            sqe->off = m_returned[i];
+            sqe->buf_group = m_buf_group;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+            i = j;
+        }
+        m_returned.erase( m_returned.begin(), m_returned.begin() + i );
+    }
+
+    // 取得一个空闲的SQE，提交队列已满时先提交已经准备好的请求
+    struct io_uring_sqe* get_sqe(){
+        unsigned head = m_sq_head->load( std::memory_order_acquire );
+        unsigned tail = m_sq_tail->load( std::memory_order_relaxed ) + m_pending;
+        if( tail - head >= m_sq_size ){
+            enter( 0, -1 );
+            head = m_sq_head->load( std::memory_order_acquire );
+            tail = m_sq_tail->load( std::memory_order_relaxed ) + m_pending;
+            if( tail - head >= m_sq_size ){
+                return nullptr;
+            }
+        }
+        struct io_uring_sqe* sqe = &m_sqes[ tail & m_sq_mask ];
+        memset( sqe, 0, sizeof( *sqe ) );
+        m_pending++;
+        return sqe;
+    }
+
+    /*
+        提交所有准备好的SQE，并等待至少wait_nr个完成事件或timeout_ms毫秒(-1为不限时)。
+        返回提交的个数或-errno，超时和被信号打断不算错误
+    */
+    int enter( unsigned wait_nr, int timeout_ms ){
+        unsigned submit = m_pending;
+        if( submit ){
+            m_sq_tail->store( m_sq_tail->load( std::memory_order_relaxed ) + submit, std::memory_order_release );
+            m_pending = 0;
+        }
+        unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        memset( &arg, 0, sizeof( arg ) );
+        if( wait_nr && timeout_ms >= 0 ){
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)( timeout_ms % 1000 ) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+        int ret = (int)syscall( __NR_io_uring_enter, m_fd, submit, wait_nr, flags, &arg, sizeof( arg ) );
+        if( ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY ){
+            return -errno;
+        }
+        return ret < 0 ? 0 : ret;
+    }
+
+    // 依次处理已经到达的完成事件，返回处理的个数
+    template <typename F>
+    unsigned for_each_cqe( F on_cqe ){
+        unsigned head = m_cq_head->load( std::memory_order_relaxed );
+        unsigned tail = m_cq_tail->load( std::memory_order_acquire );
+        unsigned n = 0;
+        for( ; head != tail; ++head, ++n ){
+            on_cqe( m_cqes[ head & m_cq_mask ] );
+            // 回调可能准备新的SQE甚至提交，完成队列的head逐个推进
+            m_cq_head->store( head + 1, std::memory_order_release );
+        }
+        return n;
+    }
+
+    // 下面是准备各类请求的辅助函数
+    // 接受的连接是阻塞的：网络操作由io_uring在就绪时完成，splice到socket时在内核线程中等待发送缓冲
+    static void prep_accept_multishot( struct io_uring_sqe* sqe, int fd, uint64_t data ){
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = data;
+    }
+
+    void prep_recv_multishot( struct io_uring_sqe* sqe, int fd, uint64_t data ) const{
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = m_buf_group;
+        sqe->user_data = data;
+    }
+
+    static void prep_sendmsg( struct io_uring_sqe* sqe, int fd, const struct msghdr* msg, unsigned flags, uint64_t data ){
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->msg_flags = flags;
+        sqe->user_data = data;
+    }
+
+    // off_in为-1表示从fd_in的当前位置(管道)读取
+    static void prep_splice( struct io_uring_sqe* sqe, int fd_in, int64_t off_in, int fd_out, unsigned len, uint64_t data ){
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = fd_in;
+        sqe->splice_off_in = (uint64_t)off_in;
+        sqe->fd = fd_out;
+        sqe->off = (uint64_t)-1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->user_data = data;
+    }
+
+    static void prep_poll_multishot( struct io_uring_sqe* sqe, int fd, unsigned events, uint64_t data ){
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = data;
+    }
+
+private:
+    // 在socketpair上用一次选择缓冲的recv检查内核能否取到缓冲，返回取到的缓冲编号或-errno。
+    // 只在启动时调用，此时环上没有其他请求
+    int probe_buffers(){
+        int sv[2];
+        if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) < 0 ){
+            return -errno;
+        }
+        int ret = -EIO;
+        struct io_uring_sqe* sqe = get_sqe();
+        if( sqe && ::write( sv[1], "x", 1 ) == 1 ){
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = sv[0];
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = m_buf_group;
+            enter( 1, 1000 );
+            for_each_cqe( [&ret]( const struct io_uring_cqe& cqe ){
+                if( cqe.user_data != 0 ){
+                    return;
+                }
+                if( cqe.res == 1 && ( cqe.flags & IORING_CQE_F_BUFFER ) ){
+                    ret = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                }else if( cqe.res < 0 ){
+                    ret = cqe.res;
+                }
+            } );
+        }
+        close( sv[0] );
+        close( sv[1] );
+        return ret;
+    }
+
+    void push_buffer( unsigned id ){
+        struct io_uring_buf* buf = &m_buf_ring->bufs[ m_buf_tail & ( m_buf_count - 1 ) ];
+        buf->addr = (uint64_t)(uintptr_t)( m_buf_base + (size_t)id * m_buf_size );
+        buf->len = m_buf_size;
+        buf->bid = id;
+        m_buf_tail++;
+    }
+
+    int m_fd;
+    void* m_sq_ptr;
+    void* m_cq_ptr;
+    size_t m_sq_map_size;
+    size_t m_cq_map_size;
+    struct io_uring_sqe* m_sqes;
+    unsigned m_sq_size;
+    unsigned m_cq_size;
+    size_t m_sqe_size;
+    std::atomic<unsigned>* m_sq_head;
+    std::atomic<unsigned>* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned* m_sq_array;
+    std::atomic<unsigned>* m_cq_head;
+    std::atomic<unsigned>* m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+    unsigned m_pending;                 // 已经准备好但尚未提交的SQE个数
+
+    struct io_uring_buf_ring* m_buf_ring;
+    char* m_buf_base;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    size_t m_buf_ring_size;
+    unsigned short m_buf_group;
+    unsigned short m_buf_tail;
+    bool m_buf_legacy;                  // 使用PROVIDE_BUFFERS而不是缓冲环
+    std::vector<unsigned> m_returned;   // 退回的方式下等待归还的缓冲编号
+};
+
+#endif
@@ -0,0 +1,185 @@
+// 连接处理路径微基准：在socketpair上驱动一个真实的http_conn，分别统计read()、process()(解析请求、
+// 查找文件、生成响应)和write()(sendmsg/sendfile)的耗时，不经过网络栈和事件循环
+// 编译: make conn_bench (或 g++ -std=c++17 -O2 -I.. conn_bench.cpp ../http_conn.cpp -o conn_bench -pthread)
+// 运行: ./conn_bench [每组迭代次数]
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "http_conn.h"
+
+extern const char* doc_root;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// 在临时目录中生成测试文件，作为文档根目录。修改时间设到过去：一秒之内修改过的文件只有弱ETag，
+// 运行中途变成强ETag会改变响应的长度
+static std::string make_doc_root(){
+    char dir[] = "/tmp/conn_bench.XXXXXX";
+    if( !mkdtemp( dir ) ){
+        perror( "mkdtemp" );
+        exit( 1 );
+    }
+    struct{ const char* name; size_t size; } files[] = {
+        { "/small.html", 1024 },
+        { "/medium.js", 64 * 1024 },
+    };
+    for( auto& f : files ){
+        std::string path = std::string( dir ) + f.name;
+        int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        std::string content( f.size, 'x' );
+        if( fd < 0 || ::write( fd, content.data(), content.size() ) != (ssize_t)content.size() ){
+            perror( "write" );
+            exit( 1 );
+        }
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = time( nullptr ) - 60;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        futimens( fd, times );
+        close( fd );
+    }
+    return dir;
+}
+
+static std::string browser_headers( const char* path ){
+    return std::string( "GET " ) + path + " HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "Connection: keep-alive\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+           "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+           "Sec-Fetch-Site: none\r\n"
+           "Sec-Fetch-Mode: navigate\r\n\r\n";
+}
+
+struct phase_times{
+    double read_ns = 0;
+    double process_ns = 0;
+    double write_ns = 0;
+};
+
+// 读空对端收到的数据，返回字节数
+static size_t drain( int fd, std::vector<char>& buf ){
+    size_t total = 0;
+    for( ;; ){
+        ssize_t n = recv( fd, buf.data(), buf.size(), MSG_DONTWAIT );
+        if( n <= 0 ){
+            return total;
+        }
+        total += n;
+    }
+}
+
+static phase_times run( const std::string& request, long iterations, int epollfd, timer_wheel& timers ){
+    int sv[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv ) != 0 ){
+        perror( "socketpair" );
+        exit( 1 );
+    }
+    int sndbuf = 4 * 1024 * 1024;
+    setsockopt( sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof( sndbuf ) );
+    setsockopt( sv[1], SOL_SOCKET, SO_RCVBUF, &sndbuf, sizeof( sndbuf ) );
+
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    http_conn* conn = new http_conn;
+    conn->init( sv[0], addr, epollfd, &timers );
+
+    std::vector<char> sink( 1 << 20 );
+    phase_times t;
+    size_t expected = 0;
+    for( long i = 0; i < iterations; ++i ){
+        if( send( sv[1], request.data(), request.size(), 0 ) != (ssize_t)request.size() ){
+            perror( "send" );
+            exit( 1 );
+        }
+        auto t0 = bench_clock::now();
+        if( !conn->read() ){
+            std::cerr << "read failed" << std::endl;
+            exit( 1 );
+        }
+        auto t1 = bench_clock::now();
+        conn->process();
+        auto t2 = bench_clock::now();
+        if( !conn->write() ){
+            std::cerr << "write failed" << std::endl;
+            exit( 1 );
+        }
+        auto t3 = bench_clock::now();
+        t.read_ns += std::chrono::duration<double, std::nano>( t1 - t0 ).count();
+        t.process_ns += std::chrono::duration<double, std::nano>( t2 - t1 ).count();
+        t.write_ns += std::chrono::duration<double, std::nano>( t3 - t2 ).count();
+
+        // 第一次的响应长度作为基准，之后每次都必须相同
+        size_t got = drain( sv[1], sink );
+        while( expected != 0 && got < expected ){
+            // socket是非阻塞的，发送缓冲满时write()停在等待EPOLLOUT：对端读走后继续发送剩余的部分
+            auto t4 = bench_clock::now();
+            if( !conn->write() ){
+                std::cerr << "write failed" << std::endl;
+                exit( 1 );
+            }
+            t.write_ns += std::chrono::duration<double, std::nano>( bench_clock::now() - t4 ).count();
+            size_t n = drain( sv[1], sink );
+            if( n == 0 ){
+                break;
+            }
+            got += n;
+        }
+        if( expected == 0 ){
+            expected = got;
+        }else if( got != expected ){
+            std::cerr << "response size changed: " << got << " != " << expected << std::endl;
+            exit( 1 );
+        }
+    }
+    conn->close_conn();
+    close( sv[1] );
+    delete conn;
+    t.read_ns /= iterations;
+    t.process_ns /= iterations;
+    t.write_ns /= iterations;
+    return t;
+}
+
+int main( int argc, char* argv[] ){
+    long iterations = argc > 1 ? atol( argv[1] ) : 200000;
+    static std::string root = make_doc_root();
+    doc_root = root.c_str();
+    int epollfd = epoll_create1( 0 );
+    timer_wheel timers;
+
+    std::string pipelined;
+    for( int i = 0; i < http_conn::MAX_PIPELINE; ++i ){
+        pipelined += browser_headers( "/small.html" );
+    }
+    struct{ const char* name; std::string request; int responses; } sets[] = {
+        { "404 curl", "GET /missing HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: curl/7.88.1\r\nAccept: */*\r\n\r\n", 1 },
+        { "200 1KB", browser_headers( "/small.html" ), 1 },
+        { "200 64KB", browser_headers( "/medium.js" ), 1 },
+        { "pipeline x16", pipelined, http_conn::MAX_PIPELINE },
+    };
+    std::cout << "iterations: " << iterations << "  (ns per response)" << std::endl;
+    std::cout << std::setw( 14 ) << "request" << std::setw( 10 ) << "read" << std::setw( 10 ) << "process"
+              << std::setw( 10 ) << "write" << std::setw( 10 ) << "total" << std::endl;
+    for( auto& set : sets ){
+        phase_times t = run( set.request, iterations / set.responses, epollfd, timers );
+        double n = set.responses;
+        std::cout << std::setw( 14 ) << set.name << std::fixed << std::setprecision( 1 )
+                  << std::setw( 10 ) << t.read_ns / n << std::setw( 10 ) << t.process_ns / n
+                  << std::setw( 10 ) << t.write_ns / n
+                  << std::setw( 10 ) << ( t.read_ns + t.process_ns + t.write_ns ) / n << std::endl;
+    }
+    close( epollfd );
+    return 0;
+}
@@ -0,0 +1,405 @@
+// HTTP负载生成器(类似wrk/wrk2)：每个线程一个epoll循环，管理一组keep-alive连接，每个连接同时只有一个请求
+// - 闭环(默认)：收到响应后立即发送下一个请求，测量最大吞吐量
+// - 开环(-R rate)：请求按固定速率排定发送时刻，延迟从排定时刻算起。服务器变慢时客户端不会随之放慢，
+//   排队等待的时间也计入延迟，避免协调遗漏(coordinated omission)让尾延迟看起来比实际好
+// 编译: make loadgen (或 g++ -std=c++17 -O2 -I.. loadgen.cpp -o loadgen -pthread)
+// 运行: ./loadgen [-c 连接数] [-t 线程数] [-d 秒] [-R 每秒请求数] [-H 头部] host port [path ...]
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "Metrics/metrics.h"
+
+static uint64_t now_us(){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct options{
+    int connections = 64;
+    int threads = 1;
+    int duration = 10;
+    double rate = 0;                // 0表示闭环
+    std::vector<std::string> paths;
+    std::string headers;
+    sockaddr_in addr;
+    std::string host;
+};
+
+// 复用metrics的对数-线性分桶，线程各自统计，结束后合并
+struct latency_histogram{
+    std::vector<uint64_t> buckets = std::vector<uint64_t>( metrics::BUCKETS );
+    uint64_t count = 0;
+    uint64_t max = 0;
+    double sum = 0;
+
+    void record( uint64_t us ){
+        buckets[ metrics::bucket_of( us ) ]++;
+        count++;
+        sum += us;
+        max = us > max ? us : max;
+    }
+    void merge( const latency_histogram& o ){
+        for( int i = 0; i < metrics::BUCKETS; ++i ){
+            buckets[i] += o.buckets[i];
+        }
+        count += o.count;
+        sum += o.sum;
+        max = o.max > max ? o.max : max;
+    }
+    uint64_t percentile( double p ) const{
+        uint64_t rank = (uint64_t)( p / 100 * count + 0.5 );
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for( int i = 0; i < metrics::BUCKETS; ++i ){
+            seen += buckets[i];
+            if( seen >= rank ){
+                uint64_t upper = metrics::bucket_upper( i );
+                return upper > max ? max : upper;
+            }
+        }
+        return max;
+    }
+};
+
+struct thread_result{
+    latency_histogram latency;
+    uint64_t responses = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t reconnects = 0;
+    uint64_t status[6] = { 0 };     // 按百位分类，[0]为无法识别
+};
+
+// 一个连接：发送请求、按Content-Length接收响应
+struct connection{
+    int fd = -1;
+    size_t path_index = 0;
+    std::string request;
+    size_t sent = 0;
+    std::string response;           // 只保存响应头
+    size_t received = 0;            // 本次响应已经收到的字节数
+    size_t header_len = 0;          // 为0表示头部尚未收完
+    size_t body_len = 0;
+    bool close_after = false;
+    bool busy = false;              // 有请求正在进行
+    uint64_t intended = 0;          // 开环：排定的发送时刻；闭环：实际发送时刻
+    uint64_t interval = 0;          // 开环：两次请求的间隔(微秒)
+};
+
+class worker{
+public:
+    worker( const options& opt, int connections, uint64_t deadline )
+        : m_opt( opt ), m_conns( connections ), m_deadline( deadline ){}
+
+    void run( thread_result& result ){
+        m_result = &result;
+        m_epollfd = epoll_create1( 0 );
+        uint64_t start = now_us();
+        for( size_t i = 0; i < m_conns.size(); ++i ){
+            connection& c = m_conns[i];
+            c.path_index = i % m_opt.paths.size();
+            if( m_opt.rate > 0 ){
+                // 每个连接分担总速率，起始时刻错开，避免所有连接同时发送
+                double per_conn = m_opt.rate / m_opt.threads / m_conns.size();
+                c.interval = (uint64_t)( 1e6 / per_conn );
+                c.intended = start + c.interval * i / m_conns.size();
+            }
+            open_connection( c );
+        }
+        std::vector<epoll_event> events( 256 );
+        for( ;; ){
+            uint64_t now = now_us();
+            if( now >= m_deadline ){
+                break;
+            }
+            int timeout = (int)( ( m_deadline - now ) / 1000 ) + 1;
+            if( m_opt.rate > 0 ){
+                timeout = start_due_requests( now, timeout );
+            }
+            int n = epoll_wait( m_epollfd, events.data(), events.size(), timeout );
+            for( int i = 0; i < n; ++i ){
+                connection& c = m_conns[ events[i].data.u64 ];
+                if( events[i].events & ( EPOLLERR | EPOLLHUP ) ){
+                    fail( c );
+                    continue;
+                }
+                if( events[i].events & EPOLLOUT ){
+                    send_request( c );
+                }
+                if( events[i].events & EPOLLIN ){
+                    receive( c );
+                }
+            }
+        }
+        for( connection& c : m_conns ){
+            if( c.fd != -1 ){
+                close( c.fd );
+            }
+        }
+        close( m_epollfd );
+    }
+
+private:
+    void open_connection( connection& c ){
+        c.fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+        int one = 1;
+        setsockopt( c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+        if( connect( c.fd, (const sockaddr*)&m_opt.addr, sizeof( m_opt.addr ) ) != 0 && errno != EINPROGRESS ){
+            m_result->errors++;
+            close( c.fd );
+            c.fd = -1;
+            return;
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = &c - m_conns.data();
+        epoll_ctl( m_epollfd, EPOLL_CTL_ADD, c.fd, &ev );
+        if( m_opt.rate == 0 ){
+            begin_request( c, now_us() );
+        }else if( c.busy ){
+            // 重连前的请求没有完成，从它原来的排定时刻重新发送
+            begin_request( c, c.intended );
+        }
+    }
+
+    // 开环：发送所有已经到达排定时刻的请求，返回到下一个排定时刻的等待时间
+    int start_due_requests( uint64_t now, int timeout ){
+        for( connection& c : m_conns ){
+            if( c.busy || c.fd == -1 ){
+                continue;
+            }
+            if( c.intended <= now ){
+                begin_request( c, c.intended );
+            }else{
+                int wait = (int)( ( c.intended - now ) / 1000 );
+                timeout = wait < timeout ? wait : timeout;
+            }
+        }
+        return timeout;
+    }
+
+    void begin_request( connection& c, uint64_t intended ){
+        c.request = "GET " + m_opt.paths[ c.path_index ] + " HTTP/1.1\r\nHost: " + m_opt.host + "\r\n" + m_opt.headers + "\r\n";
+        c.path_index = ( c.path_index + 1 ) % m_opt.paths.size();
+        c.sent = 0;
+        c.response.clear();
+        c.received = 0;
+        c.header_len = 0;
+        c.busy = true;
+        c.intended = intended;
+        send_request( c );
+    }
+
+    void send_request( connection& c ){
+        while( c.sent < c.request.size() ){
+            ssize_t n = send( c.fd, c.request.data() + c.sent, c.request.size() - c.sent, MSG_NOSIGNAL );
+            if( n < 0 ){
+                if( errno == EAGAIN || errno == ENOTCONN ){
+                    watch( c, EPOLLIN | EPOLLOUT );
+                    return;
+                }
+                fail( c );
+                return;
+            }
+            c.sent += n;
+        }
+        watch( c, EPOLLIN );
+    }
+
+    void watch( connection& c, uint32_t events ){
+        epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = &c - m_conns.data();
+        epoll_ctl( m_epollfd, EPOLL_CTL_MOD, c.fd, &ev );
+    }
+
+    void receive( connection& c ){
+        char buf[ 64 * 1024 ];
+        for( ;; ){
+            ssize_t n = recv( c.fd, buf, sizeof( buf ), 0 );
+            if( n == 0 || ( n < 0 && errno != EAGAIN ) ){
+                fail( c );
+                return;
+            }
+            if( n < 0 ){
+                return;
+            }
+            m_result->bytes += n;
+            c.received += n;
+            // 只保留头部，响应体只计数
+            if( c.header_len == 0 ){
+                c.response.append( buf, n );
+                if( !parse_header( c ) ){
+                    continue;
+                }
+            }
+            if( c.received >= c.header_len + c.body_len ){
+                complete( c );
+                return;
+            }
+        }
+    }
+
+    bool parse_header( connection& c ){
+        size_t end = c.response.find( "\r\n\r\n" );
+        if( end == std::string::npos ){
+            return false;
+        }
+        c.header_len = end + 4;
+        c.body_len = 0;
+        c.close_after = false;
+        int code = 0;
+        if( c.response.compare( 0, 9, "HTTP/1.1 " ) == 0 ){
+            code = atoi( c.response.c_str() + 9 );
+        }
+        m_result->status[ code >= 100 && code < 600 ? code / 100 : 0 ]++;
+        size_t pos = 0;
+        while( ( pos = c.response.find( "\r\n", pos ) ) != std::string::npos && pos < end ){
+            const char* line = c.response.c_str() + pos + 2;
+            if( strncasecmp( line, "Content-Length:", 15 ) == 0 ){
+                c.body_len = strtoull( line + 15, nullptr, 10 );
+            }else if( strncasecmp( line, "Connection: close", 17 ) == 0 ){
+                c.close_after = true;
+            }
+            pos += 2;
+        }
+        return true;
+    }
+
+    void complete( connection& c ){
+        uint64_t now = now_us();
+        m_result->latency.record( now - c.intended );
+        m_result->responses++;
+        c.busy = false;
+        if( m_opt.rate > 0 ){
+            c.intended += c.interval;
+        }
+        // 重新连接后闭环模式会立即发送下一个请求
+        if( c.close_after ){
+            reconnect( c );
+        }else if( m_opt.rate == 0 ){
+            begin_request( c, now );
+        }
+    }
+
+    void fail( connection& c ){
+        m_result->errors++;
+        reconnect( c );
+    }
+
+    void reconnect( connection& c ){
+        if( c.fd != -1 ){
+            epoll_ctl( m_epollfd, EPOLL_CTL_DEL, c.fd, nullptr );
+            close( c.fd );
+            c.fd = -1;
+        }
+        m_result->reconnects++;
+        open_connection( c );
+    }
+
+    const options& m_opt;
+    std::vector<connection> m_conns;
+    uint64_t m_deadline;
+    int m_epollfd = -1;
+    thread_result* m_result = nullptr;
+};
+
+static void usage( const char* name ){
+    std::cerr << "usage: " << name << " [-c connections] [-t threads] [-d seconds] [-R requests_per_second] [-H header] host port [path ...]" << std::endl;
+    exit( 1 );
+}
+
+int main( int argc, char* argv[] ){
+    options opt;
+    int c;
+    while( ( c = getopt( argc, argv, "c:t:d:R:H:" ) ) != -1 ){
+        switch( c ){
+            case 'c': opt.connections = atoi( optarg ); break;
+            case 't': opt.threads = atoi( optarg ); break;
+            case 'd': opt.duration = atoi( optarg ); break;
+            case 'R': opt.rate = atof( optarg ); break;
+            case 'H': opt.headers += std::string( optarg ) + "\r\n"; break;
+            default: usage( argv[0] );
+        }
+    }
+    if( argc - optind < 2 || opt.connections < opt.threads || opt.threads < 1 ){
+        usage( argv[0] );
+    }
+    opt.host = argv[ optind ];
+    addrinfo hints, *res;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if( getaddrinfo( argv[ optind ], argv[ optind + 1 ], &hints, &res ) != 0 ){
+        std::cerr << "cannot resolve " << argv[ optind ] << std::endl;
+        return 1;
+    }
+    memcpy( &opt.addr, res->ai_addr, sizeof( opt.addr ) );
+    freeaddrinfo( res );
+    for( int i = optind + 2; i < argc; ++i ){
+        opt.paths.push_back( argv[i] );
+    }
+    if( opt.paths.empty() ){
+        opt.paths.push_back( "/" );
+    }
+
+    uint64_t start = now_us();
+    uint64_t deadline = start + (uint64_t)opt.duration * 1000000;
+    std::vector<thread_result> results( opt.threads );
+    std::vector<std::thread> threads;
+    for( int t = 0; t < opt.threads; ++t ){
+        int share = opt.connections / opt.threads + ( t < opt.connections % opt.threads ? 1 : 0 );
+        threads.emplace_back( [&opt, &results, share, deadline, t]{
+            worker w( opt, share, deadline );
+            w.run( results[t] );
+        } );
+    }
+    for( std::thread& t : threads ){
+        t.join();
+    }
+    double elapsed = ( now_us() - start ) / 1e6;
+
+    thread_result total;
+    for( thread_result& r : results ){
+        total.latency.merge( r.latency );
+        total.responses += r.responses;
+        total.bytes += r.bytes;
+        total.errors += r.errors;
+        total.reconnects += r.reconnects;
+        for( int i = 0; i < 6; ++i ){
+            total.status[i] += r.status[i];
+        }
+    }
+    const latency_histogram& l = total.latency;
+    std::cout << opt.connections << " connections, " << opt.threads << " threads, " << opt.duration << "s, "
+              << ( opt.rate > 0 ? "open loop at " + std::to_string( (long)opt.rate ) + " req/s (latency from intended send time)"
+                                : std::string( "closed loop" ) ) << std::endl;
+    std::cout << std::fixed << std::setprecision( 1 );
+    std::cout << "  requests/sec: " << total.responses / elapsed
+              << "   transfer/sec: " << total.bytes / elapsed / ( 1024 * 1024 ) << " MB" << std::endl;
+    std::cout << "  latency (us)  mean " << ( l.count ? l.sum / l.count : 0 )
+              << "  p50 " << l.percentile( 50 ) << "  p90 " << l.percentile( 90 ) << "  p99 " << l.percentile( 99 )
+              << "  p99.9 " << l.percentile( 99.9 ) << "  p99.99 " << l.percentile( 99.99 ) << "  max " << l.max << std::endl;
+    std::cout << "  responses " << total.responses << "  2xx " << total.status[2] << "  3xx " << total.status[3]
+              << "  4xx " << total.status[4] << "  5xx " << total.status[5]
+              << "  errors " << total.errors << "  reconnects " << total.reconnects << std::endl;
+    return 0;
+}
@@ -0,0 +1,208 @@
+// 请求解析微基准：比较原来逐字节的状态机与向量化扫描器在几组真实请求头上的耗时
+// 编译: g++ -std=c++17 -O2 -I.. parser_bench.cpp -o parser_bench
+// 运行: ./parser_bench [每组迭代次数]
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include "Parser/http_scan.h"
+
+struct parsed{
+    const char* url;
+    const char* host;
+    long content_length;
+    bool linger;
+};
+
+// 原来的实现：逐字节寻找\r\n，strpbrk切分请求行，strncasecmp依次比较头部字段名
+static bool parse_legacy(char* buf, size_t len, parsed& out){
+    size_t checked = 0, start = 0;
+    bool request_line = true;
+    out = parsed{nullptr, nullptr, 0, false};
+    for(;;){
+        for( ; checked < len; ++checked ){
+            if( buf[checked] == '\r' && checked + 1 < len && buf[checked + 1] == '\n' ){
+                break;
+            }
+        }
+        if( checked >= len ){
+            return false;
+        }
+        buf[checked++] = '\0';
+        buf[checked++] = '\0';
+        char* text = buf + start;
+        start = checked;
+        if( request_line ){
+            char* url = strpbrk(text, " \t");
+            if( !url ) return false;
+            *url++ = '\0';
+            char* version = strpbrk(url, " \t");
+            if( !version ) return false;
+            *version++ = '\0';
+            out.url = url;
+            request_line = false;
+        }else if( text[0] == '\0' ){
+            return true;
+        }else if( strncasecmp(text, "Connection:", 11) == 0 ){
+            text += 11;
+            text += strspn(text, " \t");
+            out.linger = strcasecmp(text, "keep-alive") == 0;
+        }else if( strncasecmp(text, "Content-Length:", 15) == 0 ){
+            text += 15;
+            text += strspn(text, " \t");
+            out.content_length = atol(text);
+        }else if( strncasecmp(text, "Host:", 5) == 0 ){
+            text += 5;
+            text += strspn(text, " \t");
+            out.host = text;
+        }
+    }
+}
+
+// 向量化扫描：find指定扫描实现，头部字段名通过哈希表识别
+static bool parse_vector(char* buf, size_t len, parsed& out, http_scan::find_fn find){
+    char* p = buf;
+    char* end = buf + len;
+    bool request_line = true;
+    out = parsed{nullptr, nullptr, 0, false};
+    for(;;){
+        char* cr = (char*)find(p, end, '\r', '\n');
+        if( cr + 1 >= end || cr[0] != '\r' || cr[1] != '\n' ){
+            return false;
+        }
+        cr[0] = cr[1] = '\0';
+        char* text = p;
+        p = cr + 2;
+        if( request_line ){
+            char* url = (char*)find(text, cr, ' ', '\t');
+            if( url == cr ) return false;
+            *url++ = '\0';
+            char* version = (char*)find(url, cr, ' ', '\t');
+            if( version == cr ) return false;
+            *version++ = '\0';
+            out.url = url;
+            request_line = false;
+        }else if( text == cr ){
+            return true;
+        }else{
+            const char* colon = find(text, cr, ':', ':');
+            if( colon == cr ) return false;
+            char* value = (char*)colon + 1;
+            value += strspn(value, " \t");
+            switch( http_scan::classify_header(text, colon - text) ){
+                case http_scan::HEADER_CONNECTION:
+                    out.linger = strcasecmp(value, "keep-alive") == 0;
+                    break;
+                case http_scan::HEADER_CONTENT_LENGTH:
+                    out.content_length = atol(value);
+                    break;
+                case http_scan::HEADER_HOST:
+                    out.host = value;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static std::string curl_request(){
+    return "GET /index.html HTTP/1.1\r\n"
+           "Host: 127.0.0.1:9006\r\n"
+           "User-Agent: curl/7.88.1\r\n"
+           "Accept: */*\r\n\r\n";
+}
+
+static std::string browser_request(){
+    return "GET /images/image1.jpg HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "Connection: keep-alive\r\n"
+           "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+           "sec-ch-ua-mobile: ?0\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+           "sec-ch-ua-platform: \"Linux\"\r\n"
+           "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "Sec-Fetch-Mode: no-cors\r\n"
+           "Sec-Fetch-Dest: image\r\n"
+           "Referer: https://www.example.com/index.html\r\n"
+           "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+           "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+           "If-None-Match: \"1a2b3c-10701-65f1c2d3\"\r\n"
+           "If-Modified-Since: Fri, 17 May 2024 05:34:43 GMT\r\n\r\n";
+}
+
+static std::string cookie_request(){
+    std::string cookie;
+    for( int i = 0; i < 60; ++i ){
+        cookie += "session_" + std::to_string(i) + "=0123456789abcdef0123456789abcdef0123456789abcdef; ";
+    }
+    return "GET /api/profile HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "Connection: keep-alive\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+           "Accept: application/json\r\n"
+           "Cookie: " + cookie + "\r\n"
+           "Content-Length: 0\r\n\r\n";
+}
+
+template <typename Parse>
+static double run(const std::string& request, long iterations, Parse parse){
+    std::vector<char> buf(request.size());
+    parsed out;
+    long ok = 0;
+    auto start = std::chrono::steady_clock::now();
+    for( long i = 0; i < iterations; ++i ){
+        // 解析会把\r\n改成\0，每次重新复制，两种实现都付出同样的复制开销
+        memcpy(buf.data(), request.data(), request.size());
+        ok += parse(buf.data(), buf.size(), out);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    if( ok != iterations ){
+        std::cerr << "parse failed" << std::endl;
+        exit(1);
+    }
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]){
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    struct{ const char* name; std::string request; } sets[] = {
+        { "curl", curl_request() },
+        { "browser", browser_request() },
+        { "cookie", cookie_request() },
+    };
+    struct{ const char* name; http_scan::find_fn fn; bool supported; } impls[] = {
+        { "scalar", http_scan::find_char2_scalar, true },
+#ifdef HTTP_SCAN_X86
+        { "sse4.2", http_scan::find_char2_sse42, (bool)__builtin_cpu_supports("sse4.2") },
+        { "avx2", http_scan::find_char2_avx2, (bool)__builtin_cpu_supports("avx2") },
+#endif
+    };
+    std::cout << "iterations: " << iterations << "  (ns/request)" << std::endl;
+    std::cout << std::setw(10) << "headers" << std::setw(8) << "bytes" << std::setw(10) << "legacy";
+    for( auto& impl : impls ){
+        std::cout << std::setw(10) << impl.name;
+    }
+    std::cout << std::endl;
+    for( auto& set : sets ){
+        std::cout << std::setw(10) << set.name << std::setw(8) << set.request.size() << std::fixed << std::setprecision(1)
+                  << std::setw(10) << run(set.request, iterations, parse_legacy);
+        for( auto& impl : impls ){
+            if( !impl.supported ){
+                std::cout << std::setw(10) << "-";
+                continue;
+            }
+            http_scan::find_fn fn = impl.fn;
+            std::cout << std::setw(10) << run(set.request, iterations,
+                [fn](char* b, size_t n, parsed& o){ return parse_vector(b, n, o, fn); });
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// 线程池扩展性测试：比较ThreadPool(单锁队列)与WorkStealingPool在1~64个线程下的吞吐量，
+// 以及enqueue()与不分配内存的post()的提交开销
+// 编译: g++ -std=c++17 -O2 -I.. pool_bench.cpp -o pool_bench -pthread
+// 运行: ./pool_bench [每轮任务数]
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#include "Threadpool/threadpool.h"
+#include "Threadpool/work_stealing_pool.h"
+
+// 每个任务做少量计算，模拟解析一个请求的开销
+static void spin_work(){
+    volatile unsigned x = 0;
+    for(int i = 0; i < 200; ++i){
+        x += i * 2654435761u;
+    }
+}
+
+// 等待所有任务完成
+static void wait_done(std::atomic<long>& done, long total){
+    while(done.load(std::memory_order_acquire) < total){
+        std::this_thread::yield();
+    }
+}
+
+// 外部提交：一个线程(相当于reactor)提交所有任务，use_post为true时使用不分配内存的post()
+template <typename Pool>
+static double bench_external(size_t threads, long tasks, bool use_post){
+    Pool pool(threads);
+    std::atomic<long> done(0);
+    std::atomic<long>* counter = &done;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < tasks; ++i){
+        if(use_post){
+            pool.post([counter]{ spin_work(); counter->fetch_add(1, std::memory_order_release); });
+        }else{
+            pool.enqueue([counter]{ spin_work(); counter->fetch_add(1, std::memory_order_release); });
+        }
+    }
+    wait_done(done, tasks);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return tasks / elapsed.count();
+}
+
+// 嵌套提交：任务在工作线程中继续派生子任务，形成一棵二叉树
+template <typename Pool>
+static void fork_task(Pool* pool, std::atomic<long>* done, int depth){
+    spin_work();
+    if(depth > 0){
+        pool->enqueue([pool, done, depth]{ fork_task(pool, done, depth - 1); });
+        pool->enqueue([pool, done, depth]{ fork_task(pool, done, depth - 1); });
+    }
+    done->fetch_add(1, std::memory_order_release);
+}
+
+template <typename Pool>
+static double bench_fork(size_t threads, int depth){
+    Pool pool(threads);
+    std::atomic<long> done(0);
+    long total = (1L << (depth + 1)) - 1;
+    auto start = std::chrono::steady_clock::now();
+    pool.enqueue([&pool, &done, depth]{ fork_task(&pool, &done, depth); });
+    wait_done(done, total);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count();
+}
+
+int main(int argc, char* argv[]){
+    long tasks = argc > 1 ? atol(argv[1]) : 200000;
+    int depth = 0;
+    while((2L << depth) - 1 < tasks){
+        ++depth;
+    }
+    std::cout << "tasks per run: " << tasks << ", hardware threads: "
+              << std::thread::hardware_concurrency() << std::endl;
+    std::cout << std::setw(8) << "threads"
+              << std::setw(18) << "ThreadPool ext"
+              << std::setw(18) << "ThreadPool post"
+              << std::setw(18) << "Stealing ext"
+              << std::setw(18) << "Stealing post"
+              << std::setw(18) << "ThreadPool fork"
+              << std::setw(18) << "Stealing fork" << "   (tasks/s)" << std::endl;
+    for(size_t threads = 1; threads <= 64; threads *= 2){
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(0)
+                  << std::setw(18) << bench_external<ThreadPool>(threads, tasks, false)
+                  << std::setw(18) << bench_external<ThreadPool>(threads, tasks, true)
+                  << std::setw(18) << bench_external<WorkStealingPool>(threads, tasks, false)
+                  << std::setw(18) << bench_external<WorkStealingPool>(threads, tasks, true)
+                  << std::setw(18) << bench_fork<ThreadPool>(threads, depth - 1)
+                  << std::setw(18) << bench_fork<WorkStealingPool>(threads, depth - 1)
+                  << std::endl;
+    }
+    return 0;
+}
@@ -5,53 +5,159 @@ void removefd( int epollfd, int fd ) ;
 void modfd(int epollfd, int fd, int ev) ;
 
 // 定义HTTP响应的一些状态信息
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+// 错误响应在编译期拼接成完整的报文(状态行、头部、正文)，保持连接与关闭连接各一份
+static constexpr char error_400_form[] = "Your request has bad syntax or is inherently impossible to satisfy.\n";
+static constexpr char error_403_form[] = "You do not have permission to get file from this server.\n";
+static constexpr char error_404_form[] = "The requested file was not found on this server.\n";
+static constexpr char error_500_form[] = "There was an unusual problem serving the requested file.\n";
+static constexpr char error_416_form[] = "The requested range is not satisfiable.\n";
+static constexpr char error_413_form[] = "The request body is too large.\n";
+static constexpr char error_501_form[] = "Transfer-Encoding is not supported for requests.\n";
+
+static constexpr auto error_400_response = response_header::error_response<false>( "HTTP/1.1 400 Bad Request\r\n", error_400_form );
+static constexpr auto error_403_keep_alive = response_header::error_response<true>( "HTTP/1.1 403 Forbidden\r\n", error_403_form );
+static constexpr auto error_403_close = response_header::error_response<false>( "HTTP/1.1 403 Forbidden\r\n", error_403_form );
+static constexpr auto error_404_keep_alive = response_header::error_response<true>( "HTTP/1.1 404 Not Found\r\n", error_404_form );
+static constexpr auto error_404_close = response_header::error_response<false>( "HTTP/1.1 404 Not Found\r\n", error_404_form );
+static constexpr auto error_500_response = response_header::error_response<false>( "HTTP/1.1 500 Internal Error\r\n", error_500_form );
+// 请求体的边界无法确定，这两个错误之后都关闭连接
+static constexpr auto error_413_response = response_header::error_response<false>( "HTTP/1.1 413 Payload Too Large\r\n", error_413_form );
+static constexpr auto error_501_response = response_header::error_response<false>( "HTTP/1.1 501 Not Implemented\r\n", error_501_form );
 
 const char* doc_root = "/home/jyt/lck/lckwebserver/resources";
 
+// 按扩展名确定Content-Type，compressible表示值得压缩(图片、字体、音视频本身已经压缩过)
+struct mime_type{
+    const char* extension;
+    const char* type;
+    bool compressible;
+};
+static const mime_type mime_types[] = {
+    { "html", "text/html", true },
+    { "htm", "text/html", true },
+    { "css", "text/css", true },
+    { "js", "application/javascript", true },
+    { "mjs", "application/javascript", true },
+    { "json", "application/json", true },
+    { "map", "application/json", true },
+    { "xml", "application/xml", true },
+    { "txt", "text/plain", true },
+    { "csv", "text/csv", true },
+    { "svg", "image/svg+xml", true },
+    { "ico", "image/x-icon", true },
+    { "wasm", "application/wasm", true },
+    { "ttf", "font/ttf", true },
+    { "otf", "font/otf", true },
+    { "woff", "font/woff", false },
+    { "woff2", "font/woff2", false },
+    { "png", "image/png", false },
+    { "jpg", "image/jpeg", false },
+    { "jpeg", "image/jpeg", false },
+    { "gif", "image/gif", false },
+    { "webp", "image/webp", false },
+    { "avif", "image/avif", false },
+    { "pdf", "application/pdf", false },
+    { "mp3", "audio/mpeg", false },
+    { "mp4", "video/mp4", false },
+    { "webm", "video/webm", false },
+    { "zip", "application/zip", false },
+    { "gz", "application/gzip", false },
+};
+static const mime_type default_mime_type = { "", "application/octet-stream", false };
+
+static const mime_type& lookup_mime_type( const char* path ){
+    const char* dot = strrchr( path, '.' );
+    if( !dot || strchr( dot, '/' ) ){
+        return default_mime_type;
+    }
+    for( const mime_type& m : mime_types ){
+        if( strcasecmp( dot + 1, m.extension ) == 0 ){
+            return m;
+        }
+    }
+    return default_mime_type;
+}
+
+// 按状态码累加响应数
+static void count_response( int status )
+{
+    metric_counter c;
+    switch ( status ) {
+        case 200: c = COUNTER_STATUS_200; break;
+        case 206: c = COUNTER_STATUS_206; break;
+        case 304: c = COUNTER_STATUS_304; break;
+        case 400: c = COUNTER_STATUS_400; break;
+        case 403: c = COUNTER_STATUS_403; break;
+        case 404: c = COUNTER_STATUS_404; break;
+        case 405: c = COUNTER_STATUS_405; break;
+        case 416: c = COUNTER_STATUS_416; break;
+        case 500: c = COUNTER_STATUS_500; break;
+        default: c = COUNTER_STATUS_OTHER; break;
+    }
+    metrics::instance().add( c );
+}
+
 // 所有的客户数
-int http_conn::m_user_count = 0;
-// 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count( 0 );
+int http_conn::m_timeouts[ TIMEOUT_COUNT ] = { 10000, 30000, 30000, 60000, 60000 };
+conn_table<http_conn>* http_conn::m_conns = nullptr;
+
+// 没有调用set_routes()时使用的路由表：统计数据，其余路径都是静态文件
+static constexpr route default_routes[] = {
+    { ROUTE_GET | ROUTE_HEAD, http_conn::METRICS_PATH, http_conn::metrics_page },
+    { ROUTE_GET | ROUTE_HEAD, "/*path", http_conn::static_files },
+};
+static constexpr auto default_route_trie = make_route_trie<default_routes>();
+route_table http_conn::m_routes = default_route_trie.table();
 
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in& addr){
+void http_conn::init(int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* timers){
+    m_epollfd = epollfd;
+    m_ring = nullptr;
+    init_socket( sockfd, addr, timers );
+    // 启用了TLS：先完成握手，ClientHello到达时由read()推进
+    if( tls_context::instance().enabled() ){
+        if( !m_tls.start( sockfd ) ){
+            LOG_WARN( "fd %d cannot create tls session", sockfd );
+            close_conn();
+            return;
+        }
+        // 记录逐个写入socket，关闭Nagle，否则最后一个不满的报文要等对方的延迟确认
+        int one = 1;
+        setsockopt( sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    }
+}
+
+// io_uring后端：连接不注册到epoll，提交一个多次触发的recv，之后到达的数据都以完成事件送来
+void http_conn::init(int sockfd, const sockaddr_in& addr, io_ring* ring, timer_wheel* timers){
+    m_epollfd = -1;
+    m_ring = ring;
+    m_generation = ( m_generation + 1 ) & 0xffffff;
+    init_socket( sockfd, addr, timers );
+    if( !arm_recv() ){
+        close_conn();
+    }
+}
+
+void http_conn::init_socket( int sockfd, const sockaddr_in& addr, timer_wheel* timers ){
+    m_timers = timers;
     m_sockfd=sockfd;
     m_address = addr;
 
-    /*
-        端口复用
-        什么是端口复用?
-            默认情况下，一个端口在一段时间内不能被重复使用（端口不复用），这是为了防止新的连接收到属于之前连接的数据包。因为我们认为，一个端口和一个IP地址是绑定的。
-            但是，有时候需要多个套接字绑定到同一个端口号，比如一个服务器应用程序可能会 fork 出多个子进程，每个子进程都需要能够接受到该端口的连接
-            通过设置套接字的 SO_REUSEADDR 选项，可以让多个套接字绑定到同一个端口，前提是它们绑定到不同的IP地址，或者它们的协议族、类型和协议不同。
-        setsocket函数设置套接字属性(不仅仅能够设置端口复用)
-        int setsockopt(int sockfd, int level, int optname, const void *optval, socket_t optlen);
-            sockfd 文件描述符
-            level 级别 --SOL_SOCKET（端口复用的级别）
-            optname	选项的名称
-    		    - SO_REUSEADDR
-    		    - SI_REUSEPORT
-            optval 指向一个变量的指针，该变量包含了要设置的选项的值
-            optlen 指向一个 socklen_t 类型变量的指针，该变量指定了 optval 缓冲区的大小。
-        该函数调用成功时，返回0，失败则返回-1，并设置errno来表示错误原因。
-    */
-    int reuse = 1;
-    if (setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1){
-        throw std::runtime_error("setsockopt");
-    }   
-
-    addfd(m_epollfd, sockfd, true);
+    if( !m_ring ){
+        addfd(m_epollfd, sockfd, true);
+    }
     m_user_count++;
+    m_pipefd[0] = m_pipefd[1] = -1;
+    m_send_ops = 0;
+    m_recv_armed = false;
+    m_send_failed = false;
+    m_closing = false;
     init();
+    // 连接建立后必须在头部超时内发来完整的请求头
+    m_timer.data = this;
+    m_header_deadline = m_timers->deadline( m_timeouts[ TIMEOUT_HEADER ] );
+    arm_read_timer();
 }
 
 
@@ -98,10 +204,8 @@ void addfd( int epollfd, int fd, bool one_shot){
     */
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
 
-    // 设置文件描述符非阻塞
-    setnonblocking(fd);  
-
-
+    // 这里不再用fcntl设置非阻塞：调用者必须在创建描述符时就指定(accept4、socket的SOCK_NONBLOCK，inotify_init1的IN_NONBLOCK)，
+    // 否则read/write会阻塞在工作线程或reactor中
 }
 
 int setnonblocking( int fd ) {
@@ -118,24 +222,27 @@ int setnonblocking( int fd ) {
 
 void http_conn::init(){
 
-    memset(m_read_buf, 0, sizeof(m_read_buf)); 
+    m_read_buf = nullptr;
+    m_read_size = 0;
+    m_read_class = 0;
+    m_write_slab_count = 0;
+    m_write_buf = nullptr;
     m_read_idx = 0;
     m_checked_idx = 0;
     m_start_line = 0;
+    m_request_start = 0;
+    init_request();
 
-    m_check_state =  CHECK_STATE_REQUESTLINE;
-    m_method = GET;
-    memset(m_real_file, 0, sizeof(m_real_file));  
-    m_url = nullptr;
-    m_version = nullptr;
-
-    m_host = nullptr;
-    m_content_length = 0;
-    m_linger = false;   //默认不保持连接 Connection : keep-alive 保持连接
-    
-    memset(m_write_buf, 0, sizeof(m_write_buf));
     m_write_idx = 0;
-    m_file_address = nullptr;
+    m_iv_count = 0;
+    m_iv_index = 0;
+    m_batch_count = 0;
+    m_close_after_batch = false;
+    m_more_input = false;
+    m_reprocess = false;
+    m_file_seg_count = 0;
+    m_file_seg_index = 0;
+    m_pipe_bytes = 0;
 
     bytes_to_send = 0;
     bytes_have_send = 0;
@@ -151,12 +258,235 @@ void http_conn::init(){
     */
 }
 
+// 读缓冲中的数据不清空，流水线上后续请求的字节保留在m_request_start之后
+void http_conn::init_request(){
+    m_check_state =  CHECK_STATE_REQUESTLINE;
+    m_method = GET;
+    m_request_time = 0;
+    m_real_file[0] = '\0';
+    m_url = nullptr;
+    m_version = nullptr;
+
+    m_host = nullptr;
+    m_accept_encoding = 0;
+    m_if_none_match = nullptr;
+    m_if_modified_since = -1;
+    m_range = nullptr;
+    m_if_range = nullptr;
+    m_header_start = nullptr;
+    m_header_end = nullptr;
+    m_body = nullptr;
+    m_upgrade_h2c = false;
+    m_h2_settings = nullptr;
+    m_upstream = nullptr;
+    m_static_route = false;
+    m_range_count = 0;
+    m_etag[0] = '\0';
+    m_etag_weak = false;
+    m_last_modified = 0;
+    m_content_type = "text/html";
+    m_vary = false;
+    m_content_encoding = ENCODING_IDENTITY;
+    m_content_length = 0;
+    m_has_content_length = false;
+    m_linger = true;    //HTTP/1.1默认保持连接，Connection: close 关闭连接
+    m_header_deadline = 0;
+    m_file.reset();
+    m_origin.reset();
+    m_file_address = nullptr;
+}
+
+// 丢弃已经处理完的请求，把正在解析的请求移动到读缓冲开头，已经解析出的指针随之平移
+void http_conn::compact_read_buffer(){
+    int delta = m_request_start;
+    if( delta == 0 ){
+        return;
+    }
+    memmove( m_read_buf, m_read_buf + delta, m_read_idx - delta );
+    rebase_read_buffer( m_read_buf, delta );
+}
+
+// 空闲连接没有读缓冲，有数据到达时才从内存池获取。
+// 缓冲已满时先丢弃已经处理完的流水线请求，仍然不够时换成更大的缓冲，达到上限后放弃
+bool http_conn::reserve_read_space(){
+    if( !m_read_buf ){
+        m_read_class = 0;
+        m_read_buf = buffer_pool::instance().acquire( m_read_class );
+        m_read_size = buffer_pool::class_size( m_read_class );
+        if( !m_read_buf ){
+            return false;
+        }
+    }
+    if( m_read_idx >= m_read_size ){
+        compact_read_buffer();
+        if( m_read_idx >= m_read_size && !grow_read_buffer() ){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool http_conn::feed( const char* data, size_t len ){
+    metrics::instance().add( COUNTER_BYTES_IN, len );
+    while( len > 0 ){
+        if( !reserve_read_space() ){
+            // HTTP/2：多次触发的recv不能暂停，缓冲满时先处理其中完整的帧(发送期间也可以，
+            // 处理帧只追加控制帧和新的流)，腾出的空间继续接收
+            if( !m_h2 || !m_read_buf || !h2_receive() ){
+                return false;
+            }
+            compact_read_buffer();
+            if( m_read_idx >= m_read_size ){
+                return false;
+            }
+            continue;
+        }
+        size_t n = std::min( len, (size_t)( m_read_size - m_read_idx ) );
+        memcpy( m_read_buf + m_read_idx, data, n );
+        m_read_idx += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool http_conn::grow_read_buffer(){
+    if( m_read_class + 1 >= buffer_pool::CLASS_COUNT ){
+        return false;
+    }
+    char* buf = buffer_pool::instance().acquire( m_read_class + 1 );
+    if( !buf ){
+        return false;
+    }
+    memcpy( buf, m_read_buf, m_read_idx );
+    char* old = m_read_buf;
+    rebase_read_buffer( buf, 0 );
+    buffer_pool::instance().release( m_read_class, old );
+    m_read_class++;
+    m_read_size = buffer_pool::class_size( m_read_class );
+    return true;
+}
+
+// 读缓冲中的数据已经被复制到new_buf并整体前移了shift字节，修正下标和指向请求内容的指针
+void http_conn::rebase_read_buffer( char* new_buf, int shift ){
+    if( m_url ) m_url = new_buf + ( m_url - m_read_buf ) - shift;
+    if( m_version ) m_version = new_buf + ( m_version - m_read_buf ) - shift;
+    if( m_host ) m_host = new_buf + ( m_host - m_read_buf ) - shift;
+    if( m_if_none_match ) m_if_none_match = new_buf + ( m_if_none_match - m_read_buf ) - shift;
+    if( m_range ) m_range = new_buf + ( m_range - m_read_buf ) - shift;
+    if( m_if_range ) m_if_range = new_buf + ( m_if_range - m_read_buf ) - shift;
+    if( m_header_start ) m_header_start = new_buf + ( m_header_start - m_read_buf ) - shift;
+    if( m_header_end ) m_header_end = new_buf + ( m_header_end - m_read_buf ) - shift;
+    if( m_h2_settings ) m_h2_settings = new_buf + ( m_h2_settings - m_read_buf ) - shift;
+    if( m_body ) m_body = new_buf + ( m_body - m_read_buf ) - shift;
+    m_read_buf = new_buf;
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start -= shift;
+}
+
+void http_conn::release_buffers( bool read_too ){
+    for( int i = 0; i < m_write_slab_count; ++i ){
+        buffer_pool::instance().release( 0, m_write_slabs[i] );
+    }
+    m_write_slab_count = 0;
+    m_write_buf = nullptr;
+    m_write_idx = 0;
+    if( read_too && m_read_buf ){
+        buffer_pool::instance().release( m_read_class, m_read_buf );
+        m_read_buf = nullptr;
+        m_read_size = 0;
+        m_read_class = 0;
+    }
+}
+
+// 写缓冲、iovec和sendfile段都要能容纳一个最大的响应
+bool http_conn::has_write_space() const{
+    if( m_iv_count + RESPONSE_IOVS > IOV_CAPACITY || m_file_seg_count + MAX_RANGES > MAX_FILE_SEGMENTS ){
+        return false;
+    }
+    return m_write_slab_count < MAX_WRITE_SLABS || WRITE_BUFFER_SIZE - m_write_idx >= RESPONSE_RESERVE;
+}
+
+// 当前slab剩余空间不足时换一个新的slab，之前写入的内容已经由iovec引用，不需要移动
+bool http_conn::reserve_write_space( int bytes ){
+    if( m_write_buf && WRITE_BUFFER_SIZE - m_write_idx >= bytes ){
+        return true;
+    }
+    if( m_write_slab_count >= MAX_WRITE_SLABS ){
+        return false;
+    }
+    char* slab = buffer_pool::instance().acquire( 0 );
+    if( !slab ){
+        return false;
+    }
+    m_write_slabs[ m_write_slab_count++ ] = slab;
+    m_write_buf = slab;
+    m_write_idx = 0;
+    return true;
+}
+
 //关闭连接
 void http_conn::close_conn(){
+    if( m_ring ){
+        // io_uring后端：描述符上可能还有在途的请求(至少有recv)，shutdown让它们尽快完成，
+        // 全部完成后才关闭描述符，在此之前描述符号不会被新连接复用
+        if( m_sockfd != -1 && !m_closing ){
+            m_closing = true;
+            m_user_count--;
+            cancel_timer();
+            shutdown( m_sockfd, SHUT_RDWR );
+            release_uring();
+        }
+        return;
+    }
     if(m_sockfd != -1){
+        // 先从连接表中摘下，描述符关闭后可能马上被其他reactor接受的新连接使用
+        if( m_conns ){
+            m_conns->detach( m_sockfd, this );
+        }
+        // close_notify让客户端区分正常关闭和截断
+        m_tls.shutdown();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count-- ;
+        cancel_timer();
+        release_resources();
+        // 之后不能再访问本对象
+        if( m_conns ){
+            m_conns->recycle( this );
+        }
+    }
+}
+
+void http_conn::release_resources(){
+    delete m_h2;
+    m_h2 = nullptr;
+    m_tls.reset();
+    proxy_release( false );
+    unmap();
+    release_buffers( true );
+    if( m_pipefd[0] != -1 ){
+        close( m_pipefd[0] );
+        close( m_pipefd[1] );
+        m_pipefd[0] = m_pipefd[1] = -1;
+    }
+}
+
+void http_conn::release_uring(){
+    if( m_send_ops > 0 || m_recv_armed ){
+        return;
+    }
+    if( m_conns ){
+        m_conns->detach( m_sockfd, this );
+    }
+    close( m_sockfd );
+    m_sockfd = -1;
+    m_closing = false;
+    release_resources();
+    if( m_conns ){
+        m_conns->recycle( this );
     }
 }
 // 从epoll中移除监听的文件描述符
@@ -166,15 +496,22 @@ void removefd(int epollfd, int fd){
 }
 //读取用户请求
 bool http_conn::read(){
-    //如果缓冲区中已经读取的字符的下一个位置大于缓冲区的大小
-    if( m_read_idx >= READ_BUFFER_SIZE){
-        return false;
+    if( m_tls.active() ){
+        return tls_read();
     }
     int bytes_read = 0;
     while (true)
     {
-        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        //连接空闲时不持有读缓冲，缓冲区已满时整理或扩大，达到上限后放弃
+        if( !reserve_read_space() ){
+            // HTTP/2的帧不超过16KB，缓冲满时其中一定有完整的帧，先处理它们，剩下的数据留在socket中
+            if( m_h2 && m_read_buf ){
+                break;
+            }
+            return false;
+        }
+        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是m_read_size - m_read_idx
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
         if(bytes_read == -1){
             if( errno == EAGAIN || errno == EWOULDBLOCK){
                 //没有数据
@@ -185,43 +522,175 @@ bool http_conn::read(){
             return false;
         }
         m_read_idx += bytes_read;
+        metrics::instance().add( COUNTER_BYTES_IN, bytes_read );
     }
     return true;
 }
 //线程池中的线程处理客户端http请求
+// 流水线：循环解析读缓冲中所有完整的请求，把它们的响应合并成一批，按请求顺序发送
 void http_conn::process(){
-    //该线程 通过 主状态机 解析客户端的http请求
-    HTTP_CODE read_ret = process_read();
-    std::cout<<"read_ret: "<<read_ret<<std::endl;
-    //如果请求不完整，需要继续读取客户数据
-    if( read_ret == NO_REQUEST){
+    m_more_input = false;
+    m_reprocess = false;
+    if( m_tls.handshaking() ){
+        // 握手还没有完成，等待它需要的事件；握手时间计入头部超时
+        arm_read_timer();
+        modfd( m_epollfd, m_sockfd, m_tls.want_write() ? EPOLLOUT : EPOLLIN );
+        return;
+    }
+    if( m_h2 ){
+        h2_process();
+        return;
+    }
+    for(;;){
+        // 等待本批之前的响应发送完毕才转发的请求(已经解析完，仍然在读缓冲中)
+        if( m_upstream && m_batch_count == 0 ){
+            proxy_start();
+            return;
+        }
+        if( !has_write_space() ){
+            m_more_input = m_request_start < m_read_idx;
+            break;
+        }
+        // 以客户端前言开头的连接直接使用HTTP/2(prior knowledge)
+        if( m_check_state == CHECK_STATE_REQUESTLINE && m_checked_idx == m_request_start
+            && m_read_idx > m_request_start && m_read_buf[ m_request_start ] == 'P' ){
+            int preface = h2_preface_state();
+            if( preface == 0 ){
+                break;
+            }
+            if( preface > 0 ){
+                if( m_batch_count > 0 ){
+                    // 先发送之前的HTTP/1.1响应
+                    m_more_input = true;
+                    break;
+                }
+                LOG_DEBUG( "fd %d switching to http/2 by prior knowledge", m_sockfd );
+                m_h2 = new h2::session();
+                m_h2->settings();
+                h2_process();
+                return;
+            }
+        }
+        //该线程 通过 主状态机 解析客户端的http请求
+        HTTP_CODE read_ret = process_read();
+        LOG_DEBUG( "fd %d process_read: %d", m_sockfd, read_ret );
+        //如果请求不完整，需要继续读取客户数据
+        if( read_ret == NO_REQUEST){
+            break;
+        }
+
+        // 生成响应
+        metrics::instance().observe( HISTOGRAM_PARSE, timer_wheel::now_us() - m_request_time );
+        // 没有请求体的Upgrade: h2c请求：回复101，响应在HTTP/2的流1上发送
+        if( m_upgrade_h2c && m_h2_settings && read_ret != BAD_REQUEST && read_ret != NOT_IMPLEMENTED && read_ret != PROXY_REQUEST
+            && m_content_length == 0 && h2_upgrade( read_ret ) ){
+            return;
+        }
+        // 转发的请求独占连接：本批还有响应时先发送它们，之后再由循环开头转发
+        if( read_ret == PROXY_REQUEST ){
+            if( m_batch_count == 0 ){
+                proxy_start();
+                return;
+            }
+            m_more_input = true;
+            break;
+        }
+        if ( !queue_response( read_ret ) ) {
+            close_conn();
+            return;
+        }
+        // 要求关闭连接的响应之后的请求不再处理
+        if( m_close_after_batch ){
+            break;
+        }
+        if( m_batch_count >= MAX_PIPELINE ){
+            m_more_input = m_request_start < m_read_idx;
+            break;
+        }
+    }
+    // 先设置定时器再重新注册事件，modfd之后连接可能马上被reactor线程处理
+    if( m_batch_count == 0 ){
+        arm_read_timer();
         //在里面设置了边缘触发模式和ONESHOT
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        if( !m_ring ){
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
         return;
     }
+    arm_timer( TIMEOUT_WRITE );
+    if( m_ring ){
+        submit_write();
+    }else{
+        modfd( m_epollfd, m_sockfd, EPOLLOUT);
+    }
+}
 
-    // 生成响应
-    bool write_ret = process_write( read_ret );
+// 生成响应加入本批，然后丢弃已经处理完的请求，为解析下一个请求重置状态
+bool http_conn::queue_response( HTTP_CODE ret ){
+    size_t queued = bytes_to_send;
+    bool write_ret = reserve_write_space() && process_write( ret );
     if ( !write_ret ) {
-        std::cout<<"!write_ret"<<std::endl;
-        close_conn();
+        LOG_WARN( "fd %d failed to build response for %d", m_sockfd, ret );
+        return false;
+    }
+    m_batch_times[ m_batch_count - 1 ] = m_request_time;
+    count_response( response_status( ret ) );
+    if ( async_log::instance().access_enabled() ) {
+        log_access( ret, bytes_to_send - queued );
+    }
+    m_request_start = m_start_line;
+    m_close_after_batch = !m_linger;
+    init_request();
+    return true;
+}
+
+void http_conn::cancel_timer(){
+    m_timers->cancel( &m_timer );
+}
+
+void http_conn::hold_timer(){
+    m_timers->hold( &m_timer );
+}
+
+void http_conn::release_timer(){
+    m_timers->release( &m_timer );
+}
+
+void http_conn::arm_timer( TIMEOUT type ){
+    m_timers->schedule( &m_timer, m_timeouts[ type ] );
+}
+
+void http_conn::arm_read_timer(){
+    if( m_check_state == CHECK_STATE_CONTENT ){
+        arm_timer( TIMEOUT_BODY );
+        return;
+    }
+    // 已经收到请求的一部分(或刚建立连接)：头部超时从第一个字节算起，慢速发送不会刷新它
+    if( m_read_idx > m_request_start && m_header_deadline == 0 ){
+        m_header_deadline = m_timers->deadline( m_timeouts[ TIMEOUT_HEADER ] );
     }
-    modfd( m_epollfd, m_sockfd, EPOLLOUT);
+    if( m_header_deadline != 0 ){
+        m_timers->schedule_at( &m_timer, m_header_deadline );
+        return;
+    }
+    arm_timer( TIMEOUT_IDLE );
 }
 // 主状态机，解析请求
 http_conn::HTTP_CODE http_conn::process_read(){
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_RESOURCE;
     char* text = 0;
+    // 解析请求体时不按行解析，避免把请求体中的\r\n当作行结束
     while(((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK))
-                || ((line_status = parse_line()) == LINE_OK)){
+                || ((m_check_state != CHECK_STATE_CONTENT) && (line_status = parse_line()) == LINE_OK)){
         //获取一行数据 
         text = get_line();  // { return m_read_buf + m_start_line; }
         m_start_line = m_checked_idx;
-        printf( "got 1 http line: %s\n", text );
+        LOG_DEBUG( "fd %d got 1 http line: %s", m_sockfd, text );
 
         switch( m_check_state ){
             case CHECK_STATE_REQUESTLINE:{
+                m_request_time = timer_wheel::now_us();
                 ret = parse_request_line( text );
                 if( ret == BAD_REQUEST){
                     return BAD_REQUEST;
@@ -230,14 +699,14 @@ http_conn::HTTP_CODE http_conn::process_read(){
             }
             case CHECK_STATE_HEADER:{
                 ret = parse_headers( text );
-                if ( ret == BAD_REQUEST ) {
-                    return BAD_REQUEST;
-                } else if ( ret == GET_REQUEST ) {
+                if ( ret == GET_REQUEST ) {
                     return do_request();
+                } else if ( ret != NO_REQUEST ) {
+                    return ret;
                 }
                 break;
             }
-            //GET 方法：通常不包含请求体，所有的数据都通过 URL 参数传递。
+            // 带Content-Length的请求(POST、PUT等)：等待请求体全部到达
             case CHECK_STATE_CONTENT:{
                 ret = parse_content( text );
                 if ( ret == GET_REQUEST ) {
@@ -251,6 +720,9 @@ http_conn::HTTP_CODE http_conn::process_read(){
             }
         }
     }
+    if( line_status == LINE_BAD ){
+        return BAD_REQUEST;
+    }
     // 请求不完整，继续读取客户端数据
     return NO_REQUEST;
 }
@@ -263,7 +735,12 @@ http_conn::LINE_STATUS http_conn::parse_line(){
         返回http_conn::LINE_STATUS枚举对象，代表从状态机的三种可能状态  1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     */
     char temp;
-    for( ;m_checked_idx < m_read_idx; ++m_checked_idx){
+    while( m_checked_idx < m_read_idx ){
+        // 向量化扫描，一次跳过16~32个既不是'\r'也不是'\n'的字节
+        m_checked_idx = http_scan::find_line_end( m_read_buf + m_checked_idx, m_read_buf + m_read_idx ) - m_read_buf;
+        if( m_checked_idx >= m_read_idx ){
+            break;
+        }
         temp = m_read_buf[m_checked_idx];
         if (temp == '\r'){
             //如果当前读到的的字符是'\r', 且是缓冲区中最后一个字符
@@ -272,14 +749,17 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             }
             //如果读到\r\n，把\r\n改为\0\0
             else if( m_read_buf[ m_checked_idx + 1 ] == '\n' ){
+                m_line_end = m_read_buf + m_checked_idx;
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
         }
-        else if(temp == '\n'){
+        else {
+            // 单独的'\n'，或者上一次恰好停在'\r'之后
             if( (m_checked_idx > 1)&&( m_read_buf[ m_checked_idx - 1] ) == '\r' ){
+                m_line_end = m_read_buf + m_checked_idx - 1;
                 m_read_buf[ m_checked_idx-1 ] = '\0';
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 return LINE_OK;
@@ -298,23 +778,25 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
         GET /index.html HTTP/1.1
     */
     //strpbrk用于搜索字符串中任何一个特定字符集的任意字符第一次出现的位置。在这里，字符集是" \t"，即空格或制表符
-    m_url = strpbrk(text, " \t");
-    if(! m_url){
+    m_url = (char*)http_scan::find_char2( text, m_line_end, ' ', '\t' );
+    if( m_url == m_line_end ){
         return BAD_REQUEST;
     }
     *m_url++ = '\0';    // 将空格字符替换为字符串结束符
     // GET /index.html HTTP/1.1  -->   GET\0/index.html HTTP/1.1
-    //获取请求方法(只支持GET)
+    //获取请求方法，是否有对应的处理函数由路由决定
     char* method = text;
-    if( strcasecmp(method, "GET") == 0 ){
-        m_method = GET;
+    int m = 0;
+    while( m < HTTP_METHOD_COUNT && strcasecmp( method, method_name( m ) ) != 0 ){
+        ++m;
     }
-    else{
+    if( m == HTTP_METHOD_COUNT ){
         return BAD_REQUEST;
     }
+    m_method = (METHOD)m;
     // /index.html HTTP/1.1
-    m_version = strpbrk( m_url, " \t" );
-    if (!m_version) {
+    m_version = (char*)http_scan::find_char2( m_url, m_line_end, ' ', '\t' );
+    if ( m_version == m_line_end ) {
         return BAD_REQUEST;
     }
     //判断版本号是不是HTTP/1.1
@@ -335,6 +817,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
     if ( !m_url || m_url[0] != '/' ) {
         return BAD_REQUEST;
     }
+    m_header_start = m_read_buf + m_start_line;
     m_check_state = CHECK_STATE_HEADER; // 检查状态变成检查头
     return NO_REQUEST;
 }
@@ -347,10 +830,15 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text){
         回车符 换行符
     */
     //遇到空行，表示头部字段解析完毕
-    if(text[0] =='\0'||text == " \t"){
+    if(text[0] =='\0'){
+        m_header_end = text;
         //  如果HTTP有消息体，则还需要读取m_content_length字节的消息体
         //  状态机转移到CHECK_STATE_CONTENT状态
         if ( m_content_length != 0 ){
+            // 整个请求(头部和请求体)必须能放进读缓冲
+            if ( m_content_length > (size_t)( MAX_READ_BUFFER_SIZE - ( m_checked_idx - m_request_start ) ) ) {
+                return PAYLOAD_TOO_LARGE;
+            }
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
@@ -358,37 +846,103 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text){
         return GET_REQUEST;
     } 
     
-    else if( strncasecmp(text, "Connection:", 11) == 0){
-        // 处理Connection 头部字段  Connection: keep-alive
-        text += 11;
-        //strspn函数是一个字符串函数，它的作用是返回在一个字符串中连续包含另一个字符串中所有字符的最长起始子串的长度。
-        text += strspn(text, " \t");
-        if( strcasecmp( text, "keep-alive") == 0){
-            m_linger = true;
-        }
-    }
-    else if ( strncasecmp( text , "Content_length:" , 15) == 0 ){
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol(text);
-    } else if (strncasecmp(text, "Host:", 5) == 0){
-        // 处理Host头部字段
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    }
-    else {
-        printf("oop! unknow header %s\n", text);
+
+    // 找到冒号，用哈希表识别字段名，而不是依次strncasecmp比较
+    const char* colon = http_scan::find_char2( text, m_line_end, ':', ':' );
+    if( colon == m_line_end ){
+        return BAD_REQUEST;
+    }
+    http_scan::HEADER header = http_scan::classify_header( text, colon - text );
+    char* value = (char*)colon + 1;
+    //strspn函数是一个字符串函数，它的作用是返回在一个字符串中连续包含另一个字符串中所有字符的最长起始子串的长度。
+    value += strspn( value, " \t" );
+    switch( header ){
+        case http_scan::HEADER_CONNECTION:
+            // 处理Connection 头部字段  Connection: keep-alive
+            if( strcasecmp( value, "keep-alive") == 0){
+                m_linger = true;
+            }else if( strcasecmp( value, "close") == 0){
+                m_linger = false;
+            }
+            break;
+        case http_scan::HEADER_CONTENT_LENGTH:{
+            // 处理Content-Length头部字段，流水线依赖它确定请求体的边界：
+            // 只接受一个全部由数字组成的值，重复(即使值相同)、带符号或列表都返回400
+            if( m_has_content_length || !isdigit( (unsigned char)value[0] ) ){
+                return BAD_REQUEST;
+            }
+            char* end;
+            errno = 0;
+            long long length = strtoll( value, &end, 10 );
+            end += strspn( end, " \t" );
+            if( *end != '\0' || errno == ERANGE ){
+                return BAD_REQUEST;
+            }
+            if( length > MAX_READ_BUFFER_SIZE ){
+                return PAYLOAD_TOO_LARGE;
+            }
+            m_content_length = length;
+            m_has_content_length = true;
+            break;
+        }
+        case http_scan::HEADER_TRANSFER_ENCODING:
+            // 不支持分块的请求体。忽略它会把请求体当作流水线上的下一个请求，所以直接拒绝
+            return NOT_IMPLEMENTED;
+        case http_scan::HEADER_HOST:
+            // 处理Host头部字段
+            m_host = value;
+            break;
+        case http_scan::HEADER_ACCEPT_ENCODING:
+            m_accept_encoding = accepted_encodings( value );
+            break;
+        case http_scan::HEADER_IF_NONE_MATCH:
+            m_if_none_match = value;
+            break;
+        case http_scan::HEADER_RANGE:
+            m_range = value;
+            break;
+        case http_scan::HEADER_IF_RANGE:
+            m_if_range = value;
+            break;
+        case http_scan::HEADER_UPGRADE:
+            // Upgrade: h2c，可能与其他协议一起列出
+            for( const char* p = value; *p; ){
+                p += strspn( p, " \t," );
+                size_t n = strcspn( p, " \t," );
+                if( n == 3 && strncasecmp( p, "h2c", 3 ) == 0 ){
+                    m_upgrade_h2c = true;
+                }
+                p += n;
+            }
+            break;
+        case http_scan::HEADER_HTTP2_SETTINGS:
+            m_h2_settings = value;
+            break;
+        case http_scan::HEADER_IF_MODIFIED_SINCE:{
+            // 只接受IMF-fixdate格式，无法解析时忽略该字段
+            struct tm tm;
+            memset( &tm, 0, sizeof( tm ) );
+            const char* end = strptime( value, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+            if( end && *end == '\0' ){
+                m_if_modified_since = timegm( &tm );
+            }
+            break;
+        }
+        default:
+            LOG_DEBUG( "oop! unknow header %s", text );
+            break;
     }
     return NO_REQUEST; 
 }
 
 // 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
+// 请求体之后可能紧跟着流水线上的下一个请求，所以不在请求体末尾写入'\0'
 http_conn::HTTP_CODE http_conn::parse_content( char* text){
-    if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
+    if ( (size_t)( m_read_idx - m_checked_idx ) >= m_content_length )
     {
-        text[ m_content_length ] = '\0';
+        m_body = m_read_buf + m_checked_idx;
+        m_checked_idx += m_content_length;
+        m_start_line = m_checked_idx;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -421,175 +975,874 @@ bool http_conn::process_write(HTTP_CODE ret){
         回车符 换行符
         响应正文
     */
-    std::cout<<"ret: "<<ret<<std::endl;
-    std::cout<<"INTERNAL_ERROR: "<<INTERNAL_ERROR<<std::endl;
-    std::cout<<"BAD_REQUEST: "<<BAD_REQUEST<<std::endl;
-    std::cout<<"NO_RESOURCE: "<<NO_RESOURCE<<std::endl;
-    std::cout<<"FORBIDDEN_REQUEST: "<<FORBIDDEN_REQUEST<<std::endl;
-    std::cout<<"FILE_REQUEST: "<<FILE_REQUEST<<std::endl;
+    int start = m_write_idx;
     switch (ret)
     {
         case INTERNAL_ERROR:
-            add_status_line( 500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) ) {
-                return false;
-            }
+            m_linger = false;
+            add_canned( error_500_response.c_str(), error_500_response.size() );
             break;
         case BAD_REQUEST:
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) ) {
-                return false;
-            }
+            // 无法确定出错请求的边界，发送完响应后关闭连接
+            m_linger = false;
+            add_canned( error_400_response.c_str(), error_400_response.size() );
+            break;
+        case PAYLOAD_TOO_LARGE:
+            m_linger = false;
+            add_canned( error_413_response.c_str(), error_413_response.size() );
+            break;
+        case NOT_IMPLEMENTED:
+            m_linger = false;
+            add_canned( error_501_response.c_str(), error_501_response.size() );
             break;
         case NO_RESOURCE:
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) ) {
-                return false;
+            if ( m_linger ) {
+                add_canned( error_404_keep_alive.c_str(), error_404_keep_alive.size() );
+            } else {
+                add_canned( error_404_close.c_str(), error_404_close.size() );
             }
             break;
         case FORBIDDEN_REQUEST:
-            add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
-            if ( ! add_content( error_403_form ) ) {
+            if ( m_linger ) {
+                add_canned( error_403_keep_alive.c_str(), error_403_keep_alive.size() );
+            } else {
+                add_canned( error_403_close.c_str(), error_403_close.size() );
+            }
+            break;
+        case NOT_MODIFIED:
+            // 304没有响应体，也不需要打开文件
+            if ( ! ( add_bytes( response_header::status_304 ) && add_validators()
+                     && ( !m_vary || add_bytes( "Vary: Accept-Encoding\r\n", 23 ) )
+                     && add_linger() && add_blank_line() ) ) {
+                return false;
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            if ( ! ( add_bytes( response_header::status_416 ) && add_bytes( "Content-Range: bytes */", 23 )
+                     && add_uint( m_file_stat.st_size ) && add_bytes( "\r\n", 2 )
+                     && add_headers( sizeof( error_416_form ) - 1 ) && add_content( error_416_form ) ) ) {
                 return false;
             }
             break;
         case FILE_REQUEST:
-            std::cout<<"FILE_REQUEST"<<std::endl;
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-
+            if ( ! add_file_response() ) {
+                return false;
+            }
+            cache_response( start );
+            m_batch_files[ m_batch_count++ ] = std::move( m_file );
+            m_origin.reset();
+            return true;
+        case DYNAMIC_REQUEST:
+            if ( ! add_dynamic_response() ) {
+                return false;
+            }
+            // 放不进写缓冲的响应体在一个匿名映射中，随本批一起释放
+            m_batch_files[ m_batch_count++ ] = std::move( m_file );
             return true;
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_iov( m_write_buf + start, m_write_idx - start );
+    m_batch_count++;
     return true;
 }
 
-// 向写缓冲中添加状态行
-bool http_conn::add_status_line(int status, const char* title){
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
-}
-
-// 往写缓冲中写入待发送的数据
-bool http_conn::add_response( const char* format, ...){
-    if( m_write_idx >= WRITE_BUFFER_SIZE ) {
-        return false;
-    }
-    va_list arg_list;
-    va_start( arg_list, format );
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
-        return false;
+// 错误响应不写入写缓冲，iovec直接指向编译期生成的报文；HEAD请求只发送到空行为止
+bool http_conn::add_canned( const char* response, size_t len )
+{
+    if ( m_method == HEAD ) {
+        len = strstr( response, "\r\n\r\n" ) + 4 - response;
     }
-    m_write_idx += len;
-    va_end( arg_list );
+    add_iov( response, len );
     return true;
 }
 
-// 向写缓冲中添加头部行
-bool http_conn::add_headers(size_t content_len){
+// multipart/byteranges中每一部分之前的分隔行和部分头
+static const char byteranges_part_prefix[] = "\r\n--";
+static const char byteranges_part_type[] = "\r\nContent-Type: ";
+static const char byteranges_part_range[] = "\r\nContent-Range: bytes ";
+static const char byteranges_end_suffix[] = "--\r\n";
+static const size_t BOUNDARY_LEN = 16;
 
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+// 进程启动时随机生成的分隔符，文件内容恰好包含它的概率可以忽略
+static const char* byteranges_boundary()
+{
+    static char boundary[ BOUNDARY_LEN + 1 ] = { 0 };
+    static std::once_flag once;
+    std::call_once( once, []{
+        unsigned long long r = 0;
+        if ( getrandom( &r, sizeof( r ), 0 ) != sizeof( r ) ) {
+            r = (unsigned long long)time( nullptr ) * 6364136223846793005ULL + getpid();
+        }
+        snprintf( boundary, sizeof( boundary ), "%016llx", r );
+    } );
+    return boundary;
 }
 
-bool http_conn::add_content_length(size_t content_len){
-    return add_response( "Content-Length: %d\r\n", content_len );
+// 一个部分头的长度：\r\n--boundary\r\nContent-Type: type\r\nContent-Range: bytes first-last/size\r\n\r\n
+static size_t byteranges_part_length( const char* content_type, long long first, long long last, long long size )
+{
+    return sizeof( byteranges_part_prefix ) - 1 + BOUNDARY_LEN + sizeof( byteranges_part_type ) - 1 + strlen( content_type )
+        + sizeof( byteranges_part_range ) - 1 + response_header::digits( first ) + 1 + response_header::digits( last )
+        + 1 + response_header::digits( size ) + 4;
 }
 
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+bool http_conn::add_byteranges_part( int index, const char* boundary )
+{
+    return add_bytes( byteranges_part_prefix, sizeof( byteranges_part_prefix ) - 1 ) && add_bytes( boundary, BOUNDARY_LEN )
+        && add_bytes( byteranges_part_type, sizeof( byteranges_part_type ) - 1 ) && add_bytes( m_content_type, strlen( m_content_type ) )
+        && add_bytes( byteranges_part_range, sizeof( byteranges_part_range ) - 1 ) && add_uint( m_ranges[index].first )
+        && add_bytes( "-", 1 ) && add_uint( m_ranges[index].last ) && add_bytes( "/", 1 )
+        && add_uint( m_file_stat.st_size ) && add_bytes( "\r\n\r\n", 4 );
 }
 
-bool http_conn::add_linger(){
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+// 文件响应：整个文件(200)、单个范围(206)或多个范围(206 multipart/byteranges)，文件内容都不复制
+bool http_conn::add_file_response()
+{
+    long long size = m_file_stat.st_size;
+    if ( m_range_count > 1 ) {
+        // 先计算所有部分头的长度得到Content-Length；当前批的写缓冲放不下全部部分头时忽略Range，发送整个文件
+        const char* boundary = byteranges_boundary();
+        size_t content_length = sizeof( byteranges_part_prefix ) - 1 + BOUNDARY_LEN + sizeof( byteranges_end_suffix ) - 1;
+        size_t part_headers = content_length;
+        for ( int i = 0; i < m_range_count; ++i ) {
+            size_t len = byteranges_part_length( m_content_type, m_ranges[i].first, m_ranges[i].last, size );
+            part_headers += len;
+            content_length += len + ( m_ranges[i].last - m_ranges[i].first + 1 );
+        }
+        if ( reserve_write_space( part_headers + RESPONSE_RESERVE ) ) {
+            static const char multipart_type[] = "Content-Type: multipart/byteranges; boundary=";
+            int start = m_write_idx;
+            if ( ! ( add_bytes( response_header::status_206 ) && add_content_length( content_length )
+                     && add_bytes( multipart_type, sizeof( multipart_type ) - 1 ) && add_bytes( boundary, BOUNDARY_LEN )
+                     && add_bytes( "\r\n", 2 ) && add_content_encoding() && add_validators() && add_linger() && add_blank_line() ) ) {
+                return false;
+            }
+            for ( int i = 0; i < m_range_count; ++i ) {
+                if ( ! add_byteranges_part( i, boundary ) ) {
+                    return false;
+                }
+                add_iov( m_write_buf + start, m_write_idx - start );
+                start = m_write_idx;
+                add_body( m_ranges[i].first, m_ranges[i].last - m_ranges[i].first + 1 );
+            }
+            if ( ! ( add_bytes( byteranges_part_prefix, sizeof( byteranges_part_prefix ) - 1 ) && add_bytes( boundary, BOUNDARY_LEN )
+                     && add_bytes( byteranges_end_suffix, sizeof( byteranges_end_suffix ) - 1 ) ) ) {
+                return false;
+            }
+            add_iov( m_write_buf + start, m_write_idx - start );
+            return true;
+        }
+        m_range_count = 0;
+    }
+
+    int start = m_write_idx;
+    off_t offset = 0;
+    size_t len = size;
+    if ( m_range_count == 1 ) {
+        offset = m_ranges[0].first;
+        len = m_ranges[0].last - m_ranges[0].first + 1;
+        if ( ! ( add_bytes( response_header::status_206 ) && add_bytes( "Content-Range: bytes ", 21 )
+                 && add_uint( m_ranges[0].first ) && add_bytes( "-", 1 ) && add_uint( m_ranges[0].last )
+                 && add_bytes( "/", 1 ) && add_uint( size ) && add_bytes( "\r\n", 2 ) ) ) {
+            return false;
+        }
+    } else if ( ! add_bytes( response_header::status_200 ) ) {
+        return false;
+    }
+    // 常见的200/206响应：状态行、Content-Length之后是复制来的缓存头部和固定的Connection行
+    if ( ! ( add_content_length( len ) && add_representation_headers() && add_linger() && add_blank_line() ) ) {
+        return false;
+    }
+    add_iov( m_write_buf + start, m_write_idx - start );
+    add_body( offset, len );
+    return true;
 }
 
+// 映射到内存的文件直接引用映射；大文件没有映射，记录一个sendfile段，在它之前的iovec发送完后从文件偏移处直接发送
+void http_conn::add_body( off_t offset, size_t len )
+{
+    // HEAD的响应头与GET相同，但没有响应体
+    if ( len == 0 || m_method == HEAD ) {
+        return;
+    }
+    if ( m_file_address ) {
+        add_iov( m_file_address + offset, len );
+        return;
+    }
+    add_file_segment( m_file->fd, offset, len );
+}
 
-bool http_conn::add_blank_line()
+void http_conn::add_file_segment( int fd, off_t offset, size_t len )
 {
-    return add_response( "%s", "\r\n" );
+    file_segment& seg = m_file_segs[ m_file_seg_count++ ];
+    seg.iv_index = m_iv_count;
+    seg.fd = fd;
+    seg.offset = offset;
+    seg.len = len;
+    bytes_to_send += len;
+}
+
+/*
+    解析Range: bytes=0-499, 500-, -200
+    返回可满足的范围个数，0表示没有一个范围落在文件内(416)；
+    语法错误、不是bytes单位或范围超过MAX_RANGES个时返回-1，忽略Range
+*/
+int http_conn::parse_ranges( off_t size )
+{
+    const char* p = m_range;
+    if ( strncasecmp( p, "bytes=", 6 ) != 0 ) {
+        return -1;
+    }
+    p += 6;
+    int count = 0;
+    for ( ;; ) {
+        p += strspn( p, " \t" );
+        long long first = -1, last = -1;
+        char* end;
+        if ( *p >= '0' && *p <= '9' ) {
+            errno = 0;
+            first = strtoll( p, &end, 10 );
+            if ( errno == ERANGE ) {
+                return -1;
+            }
+            p = end;
+        }
+        if ( *p++ != '-' ) {
+            return -1;
+        }
+        if ( *p >= '0' && *p <= '9' ) {
+            errno = 0;
+            last = strtoll( p, &end, 10 );
+            if ( errno == ERANGE ) {
+                return -1;
+            }
+            p = end;
+        }
+        p += strspn( p, " \t" );
+        if ( ( *p != ',' && *p != '\0' ) || ( first == -1 && last == -1 )
+             || ( first != -1 && last != -1 && last < first ) ) {
+            return -1;
+        }
+        bool satisfiable;
+        if ( first == -1 ) {
+            // 后缀范围：最后last个字节
+            satisfiable = last > 0 && size > 0;
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        } else {
+            satisfiable = first < size;
+            if ( last == -1 || last >= size ) {
+                last = size - 1;
+            }
+        }
+        if ( satisfiable ) {
+            if ( count == MAX_RANGES ) {
+                return -1;
+            }
+            m_ranges[ count ].first = first;
+            m_ranges[ count ].last = last;
+            count++;
+        }
+        if ( *p == '\0' ) {
+            return count;
+        }
+        p++;
+    }
+}
+
+// If-Range中的ETag用强比较，日期必须与Last-Modified完全相同；不匹配时忽略Range发送整个文件
+bool http_conn::if_range_matches() const
+{
+    if ( !m_if_range ) {
+        return true;
+    }
+    if ( m_if_range[0] == '"' ) {
+        size_t len = strlen( m_etag );
+        return !m_etag_weak && strncmp( m_if_range + 1, m_etag, len ) == 0
+            && m_if_range[ len + 1 ] == '"' && m_if_range[ len + 2 ] == '\0';
+    }
+    if ( strncmp( m_if_range, "W/", 2 ) == 0 ) {
+        return false;
+    }
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    const char* end = strptime( m_if_range, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+    return end && *end == '\0' && !m_etag_weak && timegm( &tm ) == m_last_modified;
+}
+
+// 把一块待发送的内存追加到本批的iovec数组，与前一块相邻时直接合并
+void http_conn::add_iov( const char* base, size_t len )
+{
+    bytes_to_send += len;
+    if ( len == 0 ) {
+        return;
+    }
+    // 两块内存之间插着sendfile段时不能合并
+    bool segment_between = m_file_seg_count > 0 && m_file_segs[ m_file_seg_count - 1 ].iv_index == m_iv_count;
+    if ( m_iv_count > 0 && !segment_between ) {
+        struct iovec& last = m_iv[ m_iv_count - 1 ];
+        if ( (const char*)last.iov_base + last.iov_len == base ) {
+            last.iov_len += len;
+            return;
+        }
+    }
+    m_iv[ m_iv_count ].iov_base = (void*)base;
+    m_iv[ m_iv_count ].iov_len = len;
+    m_iv_count++;
+}
+
+// 往写缓冲中写入待发送的数据
+bool http_conn::add_bytes( const char* data, size_t len ){
+    if( (size_t)( WRITE_BUFFER_SIZE - m_write_idx ) < len ) {
+        return false;
+    }
+    memcpy( m_write_buf + m_write_idx, data, len );
+    m_write_idx += len;
+    return true;
+}
+
+bool http_conn::add_uint( uint64_t value ){
+    if( WRITE_BUFFER_SIZE - m_write_idx < 20 ) {
+        return false;
+    }
+    m_write_idx = response_header::write_uint( m_write_buf + m_write_idx, value ) - m_write_buf;
+    return true;
+}
+
+// 向写缓冲中添加头部行
+bool http_conn::add_headers(size_t content_len){
+
+    return add_content_length(content_len) && add_content_type()
+        && add_content_encoding() && add_validators() && add_accept_ranges() && add_linger() && add_blank_line();
+}
+
+bool http_conn::add_content_length(size_t content_len){
+    return add_bytes( "Content-Length: ", 16 ) && add_uint( content_len ) && add_bytes( "\r\n", 2 );
+}
+
+bool http_conn::add_content_type() {
+    return add_bytes( "Content-Type: ", 14 ) && add_bytes( m_content_type, strlen( m_content_type ) )
+        && add_bytes( "\r\n", 2 );
+}
+
+// 压缩版本带Content-Encoding；可压缩的类型都带Vary，让缓存按Accept-Encoding区分版本
+bool http_conn::add_content_encoding() {
+    if( m_content_encoding != ENCODING_IDENTITY ) {
+        const char* name = encoding_name( m_content_encoding );
+        if( ! ( add_bytes( "Content-Encoding: ", 18 ) && add_bytes( name, strlen( name ) ) && add_bytes( "\r\n", 2 ) ) ) {
+            return false;
+        }
+    }
+    return !m_vary || add_bytes( "Vary: Accept-Encoding\r\n", 23 );
+}
+
+// ETag和Last-Modified。压缩版本的ETag带编码后缀，与原文件的表示区分开
+bool http_conn::add_validators() {
+    if( m_etag[0] == '\0' ) {
+        return true;
+    }
+    char etag[ ETAG_VALUE_LEN ];
+    size_t len = format_etag( etag );
+    char date[ response_header::HTTP_DATE_LEN ];
+    response_header::write_http_date( date, m_last_modified );
+    return add_bytes( "ETag: ", 6 ) && add_bytes( etag, len )
+        && add_bytes( "\r\nLast-Modified: ", 17 ) && add_bytes( date, sizeof( date ) ) && add_bytes( "\r\n", 2 );
+}
+
+size_t http_conn::format_etag( char* out ) const {
+    const char* suffix = "";
+    if( m_content_encoding == ENCODING_GZIP ) {
+        suffix = "-gz";
+    } else if( m_content_encoding == ENCODING_BR ) {
+        suffix = "-br";
+    }
+    char* p = out;
+    if( m_etag_weak ) {
+        memcpy( p, "W/", 2 );
+        p += 2;
+    }
+    *p++ = '"';
+    size_t len = strlen( m_etag );
+    memcpy( p, m_etag, len );
+    p += len;
+    len = strlen( suffix );
+    memcpy( p, suffix, len );
+    p += len;
+    *p++ = '"';
+    return p - out;
+}
+
+// 文件的原始表示支持字节范围请求
+bool http_conn::add_accept_ranges() {
+    if( m_etag[0] == '\0' || m_content_encoding != ENCODING_IDENTITY ) {
+        return true;
+    }
+    return add_bytes( "Accept-Ranges: bytes\r\n", 22 );
+}
+
+/*
+    这些头部只由文件版本(类型、编码、ETag、修改时间)决定，第一次发送时序列化到文件缓存条目中，
+    之后同一版本的响应直接复制。弱ETag的文件还可能在同一秒内变化，不缓存
+*/
+bool http_conn::add_representation_headers() {
+    header_block* block = ( m_origin && !m_etag_weak ) ? &m_origin->headers[ m_content_encoding ] : nullptr;
+    if( block && block->state.load( std::memory_order_acquire ) == header_block::READY ) {
+        return add_bytes( block->data, block->len );
+    }
+    int start = m_write_idx;
+    if( ! ( add_content_type() && add_content_encoding() && add_validators() && add_accept_ranges() ) ) {
+        return false;
+    }
+    size_t len = m_write_idx - start;
+    int expected = header_block::EMPTY;
+    if( block && len <= header_block::CAPACITY
+        && block->state.compare_exchange_strong( expected, header_block::FILLING, std::memory_order_acquire ) ) {
+        memcpy( block->data, m_write_buf + start, len );
+        block->len = len;
+        block->state.store( header_block::READY, std::memory_order_release );
+    }
+    return true;
+}
+
+void http_conn::set_validators( const struct stat& st ) {
+    snprintf( m_etag, sizeof( m_etag ), "%lx-%lx-%lx",
+              (unsigned long)st.st_ino, (unsigned long)st.st_size, (unsigned long)st.st_mtime );
+    m_etag_weak = time( nullptr ) - st.st_mtime < 1;
+    m_last_modified = st.st_mtime;
+}
+
+// If-None-Match优先，存在时忽略If-Modified-Since
+bool http_conn::not_modified() const {
+    if( m_if_none_match ) {
+        return etag_matches( m_if_none_match );
+    }
+    return m_if_modified_since != -1 && m_last_modified <= m_if_modified_since;
+}
+
+/*
+    弱比较：忽略W/前缀。客户端缓存的可能是某个压缩版本，比较时去掉编码后缀，
+    原文件没有变化时它缓存的任何一种表示都仍然有效
+*/
+bool http_conn::etag_matches( const char* list ) const {
+    size_t etag_len = strlen( m_etag );
+    const char* p = list;
+    while( *p ) {
+        p += strspn( p, " \t," );
+        if( *p == '*' ) {
+            return true;
+        }
+        if( strncmp( p, "W/", 2 ) == 0 ) {
+            p += 2;
+        }
+        if( *p != '"' ) {
+            return false;
+        }
+        const char* tag = ++p;
+        const char* end = strchr( tag, '"' );
+        if( !end ) {
+            return false;
+        }
+        size_t len = end - tag;
+        if( len == etag_len + 3 && ( strncmp( end - 3, "-gz", 3 ) == 0 || strncmp( end - 3, "-br", 3 ) == 0 ) ) {
+            len = etag_len;
+        }
+        if( len == etag_len && strncmp( tag, m_etag, len ) == 0 ) {
+            return true;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+bool http_conn::add_linger(){
+    static const char keep_alive[] = "Connection: keep-alive\r\n";
+    static const char close[] = "Connection: close\r\n";
+    return m_linger ? add_bytes( keep_alive, sizeof( keep_alive ) - 1 ) : add_bytes( close, sizeof( close ) - 1 );
+}
+
+
+bool http_conn::add_blank_line()
+{
+    return add_bytes( "\r\n", 2 );
 }
 
 
 bool http_conn::add_content( const char* content )
 {
-    return add_response( "%s", content );
+    return add_bytes( content, strlen( content ) );
 }
 
 
 
 
-// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+int http_conn::response_status( HTTP_CODE ret ) const
+{
+    switch ( ret ) {
+        case FILE_REQUEST: return m_range_count > 0 ? 206 : 200;
+        case DYNAMIC_REQUEST: return m_response.status_code();
+        case NOT_MODIFIED: return 304;
+        case BAD_REQUEST: return 400;
+        case FORBIDDEN_REQUEST: return 403;
+        case NO_RESOURCE: return 404;
+        case RANGE_NOT_SATISFIABLE: return 416;
+        case PAYLOAD_TOO_LARGE: return 413;
+        case NOT_IMPLEMENTED: return 501;
+        case PROXY_REQUEST: return m_proxy_response.status;
+        default: return 500;
+    }
+}
+
+// 访问日志只复制几个字段和路径，格式化由日志线程完成
+void http_conn::log_access( HTTP_CODE ret, size_t bytes )
+{
+    access_record r;
+    r.addr = m_address.sin_addr.s_addr;
+    r.port = m_address.sin_port;
+    r.status = response_status( ret );
+    r.bytes = bytes;
+    r.duration_us = m_request_time ? timer_wheel::now_us() - m_request_time : 0;
+    r.method = method_name( m_method );
+    r.encoding = encoding_name( m_content_encoding );
+    async_log::instance().access( r, m_url ? m_url : "-" );
+}
+
+/*
+    完整的200响应(头部在写缓冲中，响应体是映射的文件)复制到响应缓存。
+    条件与serve_cached()的快速路径对应：只有GET、keep-alive、整个文件，弱ETag的文件还可能变化，不缓存
+*/
+void http_conn::cache_response( int start )
+{
+    if ( !m_static_route || m_method != GET || m_h2 || m_range_count > 0 || !m_linger || m_etag_weak
+         || !m_origin || !m_origin->cached || !m_file->cached ) {
+        return;
+    }
+    size_t body = m_file_stat.st_size;
+    size_t head = m_write_idx - start;
+    if ( ( body > 0 && !m_file_address ) || head + body > response_cache::MAX_RESPONSE ) {
+        return;
+    }
+    std::string_view target( m_url );
+    response_cache::instance().insert( target.substr( 0, target.find( '?' ) ), m_accept_encoding, m_content_encoding,
+                                       m_write_buf + start, head, m_file_address, body, m_origin, m_file );
+}
+
+// 把文件缓存返回的错误码转换为请求的处理结果
+static http_conn::HTTP_CODE file_status( int err )
+{
+    switch( err ) {
+        case 0:
+            return http_conn::FILE_REQUEST;
+        case ENOENT:
+            return http_conn::NO_RESOURCE;
+        // 判断访问权限
+        case EACCES:
+            return http_conn::FORBIDDEN_REQUEST;
+        // 判断是否是目录
+        default:
+            return http_conn::BAD_REQUEST;
+    }
+}
+
+/*
+    得到一个完整、正确的HTTP请求后，按方法和路径(不含查询串)在路由表中查找处理函数。
+    处理函数通过request_view读取请求，把响应写入m_response，或者把请求交给静态文件的发送路径
+*/
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    std::string_view target( m_url );
+    std::string_view path = target.substr( 0, target.find( '?' ) );
+    // 反向代理的前缀优先于路由表
+    if( upstream* up = upstream_registry::instance().match( path ) ) {
+        if( m_h2 ) {
+            // 转发只实现了HTTP/1.1连接，HTTP/2的流不能独占连接等待上游
+            m_response.reset();
+            m_response.status( 502 );
+            m_response.content_type( "text/html" );
+            m_response.write( "This resource is proxied and is only available over HTTP/1.1.\n" );
+            return DYNAMIC_REQUEST;
+        }
+        m_upstream = up;
+        return PROXY_REQUEST;
+    }
+    route_match match;
+    m_routes.lookup( m_method, path, match );
+    if( !match.handler ) {
+        return match.allowed ? method_not_allowed( match.allowed ) : NO_RESOURCE;
+    }
+    m_static_route = match.handler == static_files;
+    m_response.reset();
+    request_view req( m_method, target, m_version, m_header_start, m_header_end,
+                      std::string_view( m_body ? m_body : "", m_body ? m_content_length : 0 ), &match.params );
+    match.handler( req, m_response );
+    if( m_response.is_file() ) {
+        return file_request( m_response.file_path().c_str() );
+    }
+    return DYNAMIC_REQUEST;
+}
+
+/*
+    路径是否停留在文档根目录之内：任何一段都不能是"."或".."，按百分号编码写成的点(%2e、%2E)也算，
+    否则拼接到doc_root之后可能指向根目录之外的文件(GET /../../etc/passwd)。
+    路径本身不做解码，所以"..."这样的段和其他编码字符只是普通的文件名
+*/
+static bool path_inside_root( const char* path )
+{
+    if( path[0] != '/' ) {
+        return false;
+    }
+    for( const char* p = path; *p; ) {
+        // p指向段前的'/'
+        ++p;
+        int dots = 0;
+        bool other = false;
+        while( *p && *p != '/' ) {
+            if( *p == '.' ) {
+                ++dots;
+                ++p;
+            } else if( p[0] == '%' && p[1] == '2' && ( p[2] == 'e' || p[2] == 'E' ) ) {
+                ++dots;
+                p += 3;
+            } else {
+                other = true;
+                ++p;
+            }
+        }
+        if( !other && ( dots == 1 || dots == 2 ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 当目标文件存在、对所有用户可读，且不是目录时，从文件缓存中取得其
+// 内存映射m_file_address，并告诉调用者获取文件成功
+http_conn::HTTP_CODE http_conn::file_request( const char* path )
+{
+    if( !path_inside_root( path ) ) {
+        LOG_DEBUG( "fd %d rejected path outside document root: %s", m_sockfd, path );
+        return BAD_REQUEST;
+    }
     // "/home/jyt/lck/lckwebserver/resources"
     strcpy(m_real_file, doc_root);
     int len = strlen( doc_root );
-    strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
-    if ( stat( m_real_file, &m_file_stat ) < 0 ) {
-        return NO_RESOURCE;
+    strncpy( m_real_file + len, path, FILENAME_LEN - len - 1 );
+    // 通过共享的文件缓存获取文件的元数据和内存映射，命中时不需要任何系统调用
+    // 条件请求先只取元数据，文件没有变化时直接回复304，未缓存的文件也不需要打开和映射
+    bool conditional = m_if_none_match || m_if_modified_since != -1;
+    HTTP_CODE ret = file_status( conditional ? file_cache::instance().lookup( m_real_file, m_file_stat, m_file )
+                                             : file_cache::instance().acquire( m_real_file, m_file ) );
+    if( ret != FILE_REQUEST ) {
+        return ret;
     }
-        // 判断访问权限
-    if ( ! ( m_file_stat.st_mode & S_IROTH ) ) {
-        return FORBIDDEN_REQUEST;
+    const mime_type& type = lookup_mime_type( m_real_file );
+    m_content_type = type.type;
+    m_vary = type.compressible;
+    set_validators( m_file ? m_file->st : m_file_stat );
+    if( conditional ) {
+        if( not_modified() ) {
+            m_file.reset();
+            return NOT_MODIFIED;
+        }
+        if( !m_file ) {
+            ret = file_status( file_cache::instance().acquire( m_real_file, m_file ) );
+            if( ret != FILE_REQUEST ) {
+                return ret;
+            }
+            // 在stat和打开之间文件可能被替换，验证器以实际发送的版本为准
+            set_validators( m_file->st );
+        }
+    }
+    // 字节范围只作用于原文件，有效的Range请求不压缩；Range只对GET有意义
+    if( m_range && m_method == GET ) {
+        int count = if_range_matches() ? parse_ranges( m_file->st.st_size ) : -1;
+        if( count == 0 ) {
+            m_file_stat = m_file->st;
+            m_file.reset();
+            m_content_type = "text/html";
+            m_vary = false;
+            m_etag[0] = '\0';
+            return RANGE_NOT_SATISFIABLE;
+        }
+        m_range_count = count > 0 ? count : 0;
+    }
+    m_origin = m_file;
+    // 可压缩的类型按Accept-Encoding选择预压缩文件或缓存的压缩版本
+    if( m_vary && m_accept_encoding && m_range_count == 0 ) {
+        cached_file_ptr variant;
+        m_content_encoding = compress_cache::instance().acquire( m_file, m_accept_encoding, variant );
+        if( m_content_encoding != ENCODING_IDENTITY ) {
+            m_file = std::move( variant );
+        }
     }
+    m_file_stat = m_file->st;
+    m_file_address = m_file->address;
+    return FILE_REQUEST;
+}
 
-    // 判断是否是目录
-    if ( S_ISDIR( m_file_stat.st_mode ) ) {
-        return BAD_REQUEST;
+// 路径存在但没有该方法的处理函数：Allow列出可用的方法，OPTIONS请求据此回复204
+http_conn::HTTP_CODE http_conn::method_not_allowed( unsigned allowed )
+{
+    allowed |= ROUTE_OPTIONS;
+    char list[ 96 ];
+    size_t len = 0;
+    for( int m = 0; m < HTTP_METHOD_COUNT; ++m ) {
+        if( allowed & ( 1u << m ) ) {
+            len += snprintf( list + len, sizeof( list ) - len, len ? ", %s" : "%s", method_name( m ) );
+        }
+    }
+    m_response.reset();
+    m_response.header( "Allow", std::string_view( list, len ) );
+    if( m_method == OPTIONS ) {
+        m_response.status( 204 );
+    } else {
+        m_response.status( 405 );
+        m_response.content_type( "text/html" );
+        m_response.write( "The requested method is not allowed for this resource.\n" );
     }
+    return DYNAMIC_REQUEST;
+}
 
-     // 以只读方式打开文件
-    int fd = open( m_real_file, O_RDONLY );
-    // 创建内存映射
-    std::cout<< m_real_file<<std::endl;
-    m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
-    return FILE_REQUEST;
+// 把一段内存复制到匿名映射中，包装成一个不进入缓存的文件，之后与普通文件走同样的发送路径
+static cached_file_ptr memory_file( const std::string& data, const char* name )
+{
+    void* address = mmap( 0, data.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( address == MAP_FAILED ) {
+        return nullptr;
+    }
+    memcpy( address, data.data(), data.size() );
+    std::shared_ptr<cached_file> page = std::make_shared<cached_file>();
+    page->path = name;
+    memset( &page->st, 0, sizeof( page->st ) );
+    page->st.st_size = data.size();
+    page->address = (char*)address;
+    return page;
+}
+
+/*
+    处理函数的响应：状态行、Content-Length、Content-Type、处理函数添加的头部和Connection写入写缓冲。
+    响应体放得下时直接复制到头部之后，静态响应体由iovec直接引用，较大的响应体复制到匿名映射中
+*/
+bool http_conn::add_dynamic_response()
+{
+    int status = m_response.status_code();
+    const std::string& body = m_response.body();
+    const char* data = m_response.static_body() ? m_response.static_body() : body.data();
+    size_t len = m_response.static_body() ? m_response.static_length() : body.size();
+    // 1xx、204和304没有响应体，也没有Content-Length
+    bool has_body = status >= 200 && status != 204 && status != 304;
+    m_content_type = m_response.content_type_value();
+    const char* reason = response_header::reason_phrase( status );
+    size_t head = 9 + 3 + 1 + strlen( reason ) + 2 + 16 + 20 + 2 + 14 + strlen( m_content_type ) + 2
+        + m_response.headers().size() + 24 + 2;
+    if ( !reserve_write_space( head + RESPONSE_RESERVE ) ) {
+        // 处理函数添加的头部超过了一个slab
+        LOG_WARN( "fd %d response headers too large (%zu bytes)", m_sockfd, head );
+        m_linger = false;
+        m_response.status( 500 );
+        return add_canned( error_500_response.c_str(), error_500_response.size() );
+    }
+    int start = m_write_idx;
+    if ( ! ( add_bytes( "HTTP/1.1 ", 9 ) && add_uint( status ) && add_bytes( " ", 1 )
+             && add_bytes( reason, strlen( reason ) ) && add_bytes( "\r\n", 2 )
+             && ( !has_body || ( add_content_length( len ) && add_content_type() ) )
+             && add_bytes( m_response.headers().data(), m_response.headers().size() )
+             && add_linger() && add_blank_line() ) ) {
+        return false;
+    }
+    if ( !has_body || m_method == HEAD || len == 0 ) {
+        add_iov( m_write_buf + start, m_write_idx - start );
+        return true;
+    }
+    if ( m_response.static_body() ) {
+        add_iov( m_write_buf + start, m_write_idx - start );
+        add_iov( data, len );
+        return true;
+    }
+    if ( (size_t)( WRITE_BUFFER_SIZE - m_write_idx ) >= len + RESPONSE_RESERVE ) {
+        add_bytes( data, len );
+        add_iov( m_write_buf + start, m_write_idx - start );
+        return true;
+    }
+    m_file = memory_file( body, "dynamic" );
+    if ( !m_file ) {
+        return false;
+    }
+    add_iov( m_write_buf + start, m_write_idx - start );
+    add_iov( m_file->address, len );
+    return true;
 }
 
+void http_conn::static_files( const request_view& req, response_writer& res )
+{
+    res.file( req.path() );
+}
 
+// Prometheus文本格式的统计数据
+void http_conn::metrics_page( const request_view&, response_writer& res )
+{
+    metric_gauge gauges[] = {
+        { "webserver_open_connections", "Currently open client connections.", (double)m_user_count.load() },
+        { "webserver_connection_objects", "Connection objects allocated so far; they are reused after close.",
+          m_conns ? (double)m_conns->allocated() : 0.0 },
+        { "webserver_dropped_log_records", "Log records dropped because a thread's log ring was full.",
+          (double)async_log::instance().dropped() },
+        { "webserver_response_cache_bytes", "Bytes charged to the full-response cache, rounded up to pages.",
+          (double)response_cache::instance().size() },
+    };
+    std::string& body = res.body();
+    body.reserve( 16 * 1024 );
+    metrics::instance().render( body, gauges, sizeof( gauges ) / sizeof( gauges[0] ) );
+    res.content_type( "text/plain; version=0.0.4" );
+}
 
-// 写HTTP响应
+// 写HTTP响应，一次发送本批所有响应
 bool http_conn::write()
 {
-    int temp = 0;
-    
-    if ( bytes_to_send == 0 ) {
-        // 将要发送的字节为0，这一次响应结束。
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+    ssize_t temp = 0;
+
+    if ( m_tls.handshaking() ) {
+        // 握手在等待socket可写。完成后由调用者再次process()：HTTP/2要先发送SETTINGS
+        if ( !tls_handshake() ) {
+            return false;
+        }
+        if ( m_tls.handshaking() ) {
+            modfd( m_epollfd, m_sockfd, m_tls.want_write() ? EPOLLOUT : EPOLLIN );
+        } else {
+            m_reprocess = true;
+        }
         return true;
     }
+    if ( m_upstream_fd != -1 ) {
+        // 反向代理：客户端可以继续接收响应体了
+        return proxy_relay();
+    }
+    if ( bytes_to_send == 0 ) {
+        // 将要发送的字节为0，这一批响应结束。
+        return finish_batch();
+    }
 
     while(1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 下一个sendfile段之前的内存块先用sendmsg发送，然后发送该段，依次交替
+        file_segment* seg = m_file_seg_index < m_file_seg_count ? &m_file_segs[ m_file_seg_index ] : nullptr;
+        int iv_limit = seg ? seg->iv_index : m_iv_count;
+        bool vector_write = m_iv_index < iv_limit;
+        if ( vector_write ) {
+            // 分散写。后面还有sendfile段时用MSG_MORE让响应头和文件的第一段合并成一个报文
+            struct msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = m_iv + m_iv_index;
+            msg.msg_iovlen = iv_limit - m_iv_index;
+            temp = m_tls.user_send() ? tls_send_iov( iv_limit ) : sendmsg( m_sockfd, &msg, seg ? MSG_MORE : 0 );
+        } else {
+            temp = m_tls.user_send() ? tls_send_file( *seg ) : send_file_body( *seg );
+        }
         if ( temp <= -1 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
+                arm_timer( TIMEOUT_WRITE );
                 modfd( m_epollfd, m_sockfd, EPOLLOUT );
                 return true;
             }
@@ -598,45 +1851,1682 @@ bool http_conn::write()
         }
 
         bytes_have_send += temp;
+        metrics::instance().add( COUNTER_BYTES_OUT, temp );
         bytes_to_send -= temp;
 
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
-        {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        if ( vector_write ) {
+            consume_iov( temp, iv_limit );
+        } else if ( seg->len == 0 && m_pipe_bytes == 0 ) {
+            m_file_seg_index++;
         }
 
-        if (bytes_to_send <= 0)
+        if (bytes_to_send == 0)
         {
             // 没有数据要发送了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            return finish_batch();
+        }
 
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
+    }
+}
+
+// 一批响应发送完毕：释放文件引用，保留读缓冲中尚未处理的请求
+bool http_conn::finish_batch()
+{
+    uint64_t now = timer_wheel::now_us();
+    for ( int i = 0; i < m_batch_count; ++i ) {
+        metrics::instance().observe( HISTOGRAM_LAST_BYTE, now - m_batch_times[i] );
+    }
+    unmap();
+    release_buffers( false );
+    m_iv_count = 0;
+    m_iv_index = 0;
+    m_batch_count = 0;
+    m_file_seg_count = 0;
+    m_file_seg_index = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    if ( m_h2 ) {
+        // 最后一个DATA帧已经发出的流在这里才释放文件；还有可以发送的帧时由调用者再次process()
+        m_h2->sending.clear();
+        m_h2->finished.clear();
+        m_more_input = !m_h2->control.empty() || m_h2->sendable();
+    }
+
+    if ( m_close_after_batch ) {
+        return false;
+    }
+    compact_read_buffer();
+    // 没有残留的请求数据时把读缓冲也归还内存池，空闲连接不占用缓冲
+    if ( m_read_idx == 0 ) {
+        release_buffers( true );
+    }
+    // 读缓冲中还有完整的请求时不会再有EPOLLIN事件，由调用者再次调用process()
+    m_reprocess = m_more_input;
+    m_more_input = false;
+    if ( !m_reprocess ) {
+        arm_read_timer();
+        if ( !m_ring ) {
+            modfd( m_epollfd, m_sockfd, EPOLLIN );
         }
+    }
+    return true;
+}
 
+// 跳过已经发送完的内存块，调整发送了一部分的内存块
+void http_conn::consume_iov( size_t sent, int iv_limit )
+{
+    while ( m_iv_index < iv_limit && sent >= m_iv[ m_iv_index ].iov_len ) {
+        sent -= m_iv[ m_iv_index ].iov_len;
+        m_iv_index++;
+    }
+    if ( sent > 0 ) {
+        m_iv[ m_iv_index ].iov_base = (char*)m_iv[ m_iv_index ].iov_base + sent;
+        m_iv[ m_iv_index ].iov_len -= sent;
     }
 }
 
-// 对内存映射区执行munmap操作
-void http_conn::unmap() {
-    if( m_file_address )
-    {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address = 0;
+bool http_conn::arm_recv()
+{
+    struct io_uring_sqe* sqe = m_ring->get_sqe();
+    if ( !sqe ) {
+        return false;
+    }
+    m_ring->prep_recv_multishot( sqe, m_sockfd, uring_data( URING_RECV, m_sockfd, m_generation ) );
+    m_recv_armed = true;
+    return true;
+}
+
+void http_conn::on_recv( int res, const char* data, bool more )
+{
+    if ( !more ) {
+        m_recv_armed = false;
+    }
+    if ( m_closing ) {
+        release_uring();
+        return;
+    }
+    if ( res == -ENOBUFS ) {
+        // 缓冲环暂时用完，多次触发的recv已经终止，重新提交
+        if ( !arm_recv() ) {
+            close_conn();
+        }
+        return;
+    }
+    if ( res <= 0 || !feed( data, res ) || ( !more && !arm_recv() ) ) {
+        close_conn();
+        return;
+    }
+    // 发送上一批响应期间到达的请求先留在读缓冲中，发送完毕后再处理
+    if ( bytes_to_send == 0 ) {
+        process();
+    }
+}
+
+/*
+    io_uring后端的发送：每一轮把下一段数据准备成一条链接的请求链，
+    sendmsg发送下一个文件段之前的内存块，然后文件 -> 管道 -> socket两次splice(io_uring没有sendfile)。
+    sendmsg带MSG_WAITALL，要么全部发出要么出错；链中一个请求不完整时后面的请求被取消，
+    整条链完成后on_send()根据已经记录的进度提交下一轮
+*/
+static const size_t URING_SPLICE_CHUNK = 64 * 1024;    // 不超过管道的默认容量
+
+void http_conn::submit_write()
+{
+    if ( bytes_to_send == 0 ) {
+        send_done();
+        return;
+    }
+    file_segment* seg = m_file_seg_index < m_file_seg_count ? &m_file_segs[ m_file_seg_index ] : nullptr;
+    int iv_limit = seg ? seg->iv_index : m_iv_count;
+    struct io_uring_sqe* sqe;
+    if ( m_pipe_bytes > 0 ) {
+        // 上一轮进入管道的数据没有全部写入socket
+        if ( !( sqe = m_ring->get_sqe() ) ) {
+            close_conn();
+            return;
+        }
+        io_ring::prep_splice( sqe, m_pipefd[0], -1, m_sockfd, m_pipe_bytes, uring_data( URING_SPLICE_OUT, m_sockfd, m_generation ) );
+        m_send_ops++;
+        return;
     }
-}
\ No newline at end of file
+    if ( m_iv_index < iv_limit ) {
+        memset( &m_send_msg, 0, sizeof( m_send_msg ) );
+        m_send_msg.msg_iov = m_iv + m_iv_index;
+        m_send_msg.msg_iovlen = iv_limit - m_iv_index;
+        if ( !( sqe = m_ring->get_sqe() ) ) {
+            close_conn();
+            return;
+        }
+        io_ring::prep_sendmsg( sqe, m_sockfd, &m_send_msg, MSG_NOSIGNAL | MSG_WAITALL | ( seg ? MSG_MORE : 0 ),
+                               uring_data( URING_SEND, m_sockfd, m_generation ) );
+        if ( seg ) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        m_send_ops++;
+    }
+    if ( seg ) {
+        // 管道是阻塞的，splice在内核的工作线程中等待
+        if ( m_pipefd[0] == -1 && pipe2( m_pipefd, O_CLOEXEC ) < 0 ) {
+            m_pipefd[0] = m_pipefd[1] = -1;
+            close_conn();
+            return;
+        }
+        unsigned chunk = std::min( seg->len, URING_SPLICE_CHUNK );
+        if ( !( sqe = m_ring->get_sqe() ) ) {
+            close_conn();
+            return;
+        }
+        io_ring::prep_splice( sqe, seg->fd, seg->offset, m_pipefd[1], chunk, uring_data( URING_SPLICE_IN, m_sockfd, m_generation ) );
+        sqe->flags |= IOSQE_IO_LINK;
+        m_send_ops++;
+        if ( !( sqe = m_ring->get_sqe() ) ) {
+            close_conn();
+            return;
+        }
+        io_ring::prep_splice( sqe, m_pipefd[0], -1, m_sockfd, chunk, uring_data( URING_SPLICE_OUT, m_sockfd, m_generation ) );
+        m_send_ops++;
+    }
+}
+
+void http_conn::on_send( URING_OP op, int res )
+{
+    m_send_ops--;
+    if ( res < 0 ) {
+        // 前一个请求不完整导致的取消不算错误，下一轮重新提交
+        if ( res != -ECANCELED ) {
+            m_send_failed = true;
+        }
+    } else if ( !m_closing ) {
+        file_segment* seg = m_file_seg_index < m_file_seg_count ? &m_file_segs[ m_file_seg_index ] : nullptr;
+        switch ( op ) {
+        case URING_SEND:
+            consume_iov( res, seg ? seg->iv_index : m_iv_count );
+            break;
+        case URING_SPLICE_IN:
+            // 返回0说明文件在发送过程中被截断
+            if ( res == 0 ) {
+                m_send_failed = true;
+            }
+            seg->offset += res;
+            seg->len -= res;
+            m_pipe_bytes += res;
+            break;
+        case URING_SPLICE_OUT:
+            m_pipe_bytes -= res;
+            if ( seg->len == 0 && m_pipe_bytes == 0 ) {
+                m_file_seg_index++;
+            }
+            break;
+        default:
+            break;
+        }
+        if ( op != URING_SPLICE_IN ) {
+            bytes_have_send += res;
+            bytes_to_send -= res;
+            metrics::instance().add( COUNTER_BYTES_OUT, res );
+        }
+    }
+    if ( m_send_ops > 0 ) {
+        return;
+    }
+    if ( m_closing ) {
+        release_uring();
+        return;
+    }
+    if ( m_send_failed ) {
+        m_send_failed = false;
+        close_conn();
+        return;
+    }
+    // 取得了进展，刷新写超时
+    arm_timer( TIMEOUT_WRITE );
+    submit_write();
+}
+
+void http_conn::send_done()
+{
+    if ( !finish_batch() ) {
+        close_conn();
+        return;
+    }
+    // 发送期间收到的数据留在读缓冲中；HTTP/2还可能有等待窗口的DATA帧
+    if ( m_read_idx > m_request_start || m_reprocess ) {
+        process();
+    }
+}
+
+// 用sendfile从段的偏移处发送文件，数据不经过用户空间。
+// 内核不支持对该文件使用sendfile时退化为经过管道的splice
+ssize_t http_conn::send_file_body( file_segment& seg )
+{
+    if ( m_pipefd[0] == -1 ) {
+        ssize_t ret = sendfile( m_sockfd, seg.fd, &seg.offset, seg.len );
+        if ( ret >= 0 || ( errno != EINVAL && errno != ENOSYS ) ) {
+            // 返回0说明文件在发送过程中被截断，作为错误处理
+            if ( ret == 0 ) {
+                errno = EIO;
+                return -1;
+            }
+            if ( ret > 0 ) {
+                seg.len -= ret;
+            }
+            return ret;
+        }
+        if ( pipe2( m_pipefd, O_NONBLOCK | O_CLOEXEC ) < 0 ) {
+            m_pipefd[0] = m_pipefd[1] = -1;
+            return -1;
+        }
+    }
+    return splice_file_body( seg );
+}
+
+// 文件 -> 管道 -> socket。管道中剩余的数据属于当前段，EAGAIN后从管道继续发送
+ssize_t http_conn::splice_file_body( file_segment& seg )
+{
+    if ( m_pipe_bytes == 0 ) {
+        ssize_t in = splice( seg.fd, &seg.offset, m_pipefd[1], NULL,
+                             seg.len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if ( in <= 0 ) {
+            if ( in == 0 ) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        m_pipe_bytes = in;
+        seg.len -= in;
+    }
+    ssize_t out = splice( m_pipefd[0], NULL, m_sockfd, NULL, m_pipe_bytes,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE );
+    if ( out > 0 ) {
+        m_pipe_bytes -= out;
+    }
+    return out;
+}
+
+// 释放对文件缓存条目的引用，最后一个引用释放时才会执行munmap
+void http_conn::unmap() {
+    m_file.reset();
+    m_origin.reset();
+    m_file_address = 0;
+    for ( int i = 0; i < m_batch_count; ++i ) {
+        m_batch_files[ i ].reset();
+    }
+}
+
+// ---- HTTP/2(h2c) ----
+
+static char h2_version[] = "HTTP/2.0";
+
+int http_conn::h2_preface_state() const
+{
+    size_t n = std::min( (size_t)( m_read_idx - m_request_start ), h2::PREFACE_LEN );
+    if ( n == 0 ) {
+        return 0;
+    }
+    if ( memcmp( m_read_buf + m_request_start, h2::PREFACE, n ) != 0 ) {
+        return -1;
+    }
+    return n == h2::PREFACE_LEN ? 1 : 0;
+}
+
+/*
+    HTTP/1.1的升级：101之后服务器先发送SETTINGS，原请求成为半关闭的流1，
+    客户端随后发送前言。HTTP2-Settings中是客户端的SETTINGS载荷，视为已经收到，不需要确认
+*/
+bool http_conn::h2_upgrade( HTTP_CODE ret )
+{
+    std::string settings;
+    if ( !h2::base64url_decode( m_h2_settings, settings ) || settings.size() % 6 != 0 ) {
+        return false;
+    }
+    m_h2 = new h2::session();
+    if ( h2_apply_settings( (const uint8_t*)settings.data(), settings.size() ) != h2::NO_ERROR ) {
+        delete m_h2;
+        m_h2 = nullptr;
+        return false;
+    }
+    LOG_DEBUG( "fd %d upgrading to http/2", m_sockfd );
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    add_iov( switching, sizeof( switching ) - 1 );
+    m_request_start = m_start_line;
+    m_h2->settings();
+    std::unique_ptr<h2::stream> s( new h2::stream() );
+    s->id = 1;
+    s->request_done = true;
+    s->request_time = m_request_time;
+    s->send_window = m_h2->peer_initial_window;
+    m_h2->last_stream_id = 1;
+    h2::stream& first = *s;
+    m_h2->streams.push_back( std::move( s ) );
+    h2_respond( first, ret );
+    h2_process();
+    return true;
+}
+
+void http_conn::h2_process()
+{
+    h2::session& h = *m_h2;
+    if ( !h.goaway_sent && !h2_receive() ) {
+        // 连接错误：GOAWAY发送完毕后关闭，不再处理任何流
+        h.streams.clear();
+        m_close_after_batch = true;
+    }
+    if ( h.goaway_sent ) {
+        m_close_after_batch = true;
+        m_request_start = m_checked_idx = m_start_line = m_read_idx;
+    }
+    compact_read_buffer();
+    h2_fill_batch();
+    if ( h.goaway_received && h.streams.empty() ) {
+        m_close_after_batch = true;
+    }
+    if ( bytes_to_send == 0 ) {
+        if ( m_close_after_batch ) {
+            close_conn();
+            return;
+        }
+        if ( m_read_idx == 0 ) {
+            release_buffers( true );
+        }
+        arm_read_timer();
+        if ( !m_ring ) {
+            modfd( m_epollfd, m_sockfd, EPOLLIN );
+        }
+        return;
+    }
+    arm_timer( TIMEOUT_WRITE );
+    if ( m_ring ) {
+        submit_write();
+    } else {
+        modfd( m_epollfd, m_sockfd, EPOLLOUT );
+    }
+}
+
+bool http_conn::h2_receive()
+{
+    h2::session& h = *m_h2;
+    int pos = m_request_start;
+    bool ok = true;
+    if ( !h.preface_received ) {
+        int state = h2_preface_state();
+        if ( state == 0 ) {
+            return true;
+        }
+        if ( state < 0 ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        pos += h2::PREFACE_LEN;
+        h.preface_received = true;
+    }
+    const uint8_t* buf = (const uint8_t*)m_read_buf;
+    while ( ok && m_read_idx - pos >= (int)h2::FRAME_HEADER_LEN ) {
+        h2::frame_header fh = h2::read_frame_header( buf + pos );
+        if ( fh.length > h2::DEFAULT_MAX_FRAME ) {
+            ok = h2_error( h2::FRAME_SIZE_ERROR );
+            break;
+        }
+        if ( m_read_idx - pos < (int)( h2::FRAME_HEADER_LEN + fh.length ) ) {
+            break;
+        }
+        ok = h2_on_frame( fh, buf + pos + h2::FRAME_HEADER_LEN );
+        pos += h2::FRAME_HEADER_LEN + fh.length;
+    }
+    m_request_start = m_checked_idx = m_start_line = pos;
+    return ok;
+}
+
+bool http_conn::h2_on_frame( const h2::frame_header& fh, const uint8_t* p )
+{
+    h2::session& h = *m_h2;
+    // 头部块必须连续，中间不能插入其他帧
+    if ( h.block_stream && ( fh.type != h2::FRAME_CONTINUATION || fh.stream_id != h.block_stream ) ) {
+        return h2_error( h2::PROTOCOL_ERROR );
+    }
+    switch ( fh.type ) {
+    case h2::FRAME_DATA:
+        return h2_on_data( fh, p );
+    case h2::FRAME_HEADERS:
+        return h2_on_headers( fh, p );
+    case h2::FRAME_CONTINUATION:
+        if ( !h.block_stream ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        if ( h.block.size() + fh.length > h2::MAX_HEADER_BLOCK ) {
+            return h2_error( h2::ENHANCE_YOUR_CALM );
+        }
+        h.block.append( (const char*)p, fh.length );
+        if ( fh.flags & h2::FLAG_END_HEADERS ) {
+            uint32_t id = h.block_stream;
+            h.block_stream = 0;
+            bool ok = h2_end_headers( id, (const uint8_t*)h.block.data(), h.block.size(), h.block_end_stream );
+            h.block.clear();
+            return ok;
+        }
+        return true;
+    case h2::FRAME_PRIORITY:
+        // 不按优先级调度，只检查格式
+        if ( fh.stream_id == 0 ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        if ( fh.length != 5 ) {
+            h.rst_stream( fh.stream_id, h2::FRAME_SIZE_ERROR );
+            h.remove( fh.stream_id );
+        }
+        return true;
+    case h2::FRAME_RST_STREAM:
+        if ( fh.stream_id == 0 || fh.stream_id > h.last_stream_id ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        if ( fh.length != 4 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        h.remove( fh.stream_id );
+        return true;
+    case h2::FRAME_SETTINGS: {
+        if ( fh.stream_id != 0 ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        if ( fh.flags & h2::FLAG_ACK ) {
+            return fh.length == 0 || h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        if ( fh.length % 6 != 0 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        h2::ERROR_CODE code = h2_apply_settings( p, fh.length );
+        if ( code != h2::NO_ERROR ) {
+            return h2_error( code );
+        }
+        h2::append_frame( h.control, h2::FRAME_SETTINGS, h2::FLAG_ACK, 0, nullptr, 0 );
+        return true;
+    }
+    case h2::FRAME_PING:
+        if ( fh.stream_id != 0 ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        if ( fh.length != 8 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        if ( !( fh.flags & h2::FLAG_ACK ) ) {
+            h2::append_frame( h.control, h2::FRAME_PING, h2::FLAG_ACK, 0, (const char*)p, 8 );
+        }
+        return true;
+    case h2::FRAME_GOAWAY:
+        // 已经打开的流照常完成，之后关闭连接
+        if ( fh.stream_id != 0 ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        h.goaway_received = true;
+        return true;
+    case h2::FRAME_WINDOW_UPDATE: {
+        if ( fh.length != 4 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        uint32_t increment = h2::read_u32( p ) & h2::MAX_WINDOW;
+        if ( fh.stream_id == 0 ) {
+            if ( increment == 0 ) {
+                return h2_error( h2::PROTOCOL_ERROR );
+            }
+            h.send_window += increment;
+            return h.send_window <= h2::MAX_WINDOW || h2_error( h2::FLOW_CONTROL_ERROR );
+        }
+        h2::stream* s = h.find( fh.stream_id );
+        if ( s ) {
+            s->send_window += increment;
+            if ( increment == 0 || s->send_window > h2::MAX_WINDOW ) {
+                h.rst_stream( fh.stream_id, increment == 0 ? h2::PROTOCOL_ERROR : h2::FLOW_CONTROL_ERROR );
+                h.remove( fh.stream_id );
+            }
+        }
+        return true;
+    }
+    case h2::FRAME_PUSH_PROMISE:
+        // 客户端不能推送
+        return h2_error( h2::PROTOCOL_ERROR );
+    default:
+        // 未知类型的帧必须忽略
+        return true;
+    }
+}
+
+h2::ERROR_CODE http_conn::h2_apply_settings( const uint8_t* p, size_t len )
+{
+    h2::session& h = *m_h2;
+    for ( size_t i = 0; i + 6 <= len; i += 6 ) {
+        uint16_t id = (uint16_t)( p[i] << 8 | p[i + 1] );
+        uint32_t value = h2::read_u32( p + i + 2 );
+        switch ( id ) {
+        case h2::SETTINGS_ENABLE_PUSH:
+            if ( value > 1 ) {
+                return h2::PROTOCOL_ERROR;
+            }
+            break;
+        case h2::SETTINGS_INITIAL_WINDOW_SIZE:
+            // 新的初始窗口按差值作用于所有打开的流
+            if ( value > h2::MAX_WINDOW ) {
+                return h2::FLOW_CONTROL_ERROR;
+            }
+            for ( const std::unique_ptr<h2::stream>& s : h.streams ) {
+                s->send_window += (int64_t)value - h.peer_initial_window;
+            }
+            h.peer_initial_window = value;
+            break;
+        case h2::SETTINGS_MAX_FRAME_SIZE:
+            if ( value < h2::DEFAULT_MAX_FRAME || value > h2::MAX_FRAME_LIMIT ) {
+                return h2::PROTOCOL_ERROR;
+            }
+            h.peer_max_frame = value;
+            break;
+        default:
+            // 响应头不使用动态表，HEADER_TABLE_SIZE不影响编码；其余的设置与服务器无关
+            break;
+        }
+    }
+    return h2::NO_ERROR;
+}
+
+bool http_conn::h2_error( h2::ERROR_CODE code )
+{
+    LOG_DEBUG( "fd %d http/2 connection error %d", m_sockfd, (int)code );
+    if ( !m_h2->goaway_sent ) {
+        m_h2->goaway( code );
+    }
+    return false;
+}
+
+bool http_conn::h2_on_headers( const h2::frame_header& fh, const uint8_t* p )
+{
+    h2::session& h = *m_h2;
+    if ( fh.stream_id == 0 ) {
+        return h2_error( h2::PROTOCOL_ERROR );
+    }
+    size_t len = fh.length;
+    size_t pad = 0;
+    if ( fh.flags & h2::FLAG_PADDED ) {
+        if ( len < 1 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        pad = p[0];
+        p++;
+        len--;
+    }
+    if ( fh.flags & h2::FLAG_PRIORITY ) {
+        if ( len < 5 ) {
+            return h2_error( h2::FRAME_SIZE_ERROR );
+        }
+        p += 5;
+        len -= 5;
+    }
+    if ( pad > len ) {
+        return h2_error( h2::PROTOCOL_ERROR );
+    }
+    len -= pad;
+    bool end_stream = fh.flags & h2::FLAG_END_STREAM;
+    if ( !( fh.flags & h2::FLAG_END_HEADERS ) ) {
+        h.block.assign( (const char*)p, len );
+        h.block_stream = fh.stream_id;
+        h.block_end_stream = end_stream;
+        return true;
+    }
+    return h2_end_headers( fh.stream_id, p, len, end_stream );
+}
+
+/*
+    一个完整的头部块：新的流或者已有流上的trailers。拒绝的流也要解码，HPACK的动态表在两端必须保持一致。
+    请求头按"name: value\0"保存，没有请求体(END_STREAM)时马上处理
+*/
+bool http_conn::h2_end_headers( uint32_t id, const uint8_t* block, size_t len, bool end_stream )
+{
+    h2::session& h = *m_h2;
+    h2::stream* s = h.find( id );
+    std::unique_ptr<h2::stream> fresh;
+    if ( !s ) {
+        if ( id % 2 == 0 || id <= h.last_stream_id ) {
+            return h2_error( id % 2 == 0 ? h2::PROTOCOL_ERROR : h2::STREAM_CLOSED );
+        }
+        h.last_stream_id = id;
+        fresh.reset( new h2::stream() );
+        fresh->id = id;
+        fresh->send_window = h.peer_initial_window;
+        s = fresh.get();
+    }
+    bool trailers = !fresh;
+    bool ok = h.decoder.decode( block, len, [&]( std::string_view name, std::string_view value ) {
+        if ( trailers ) {
+            return;
+        }
+        if ( name == ":method" ) {
+            s->method.assign( value.data(), value.size() );
+        } else if ( name == ":path" ) {
+            s->path.assign( value.data(), value.size() );
+        } else if ( name == ":authority" ) {
+            s->authority.assign( value.data(), value.size() );
+        } else if ( !name.empty() && name[0] != ':' ) {
+            s->headers.append( name.data(), name.size() ).append( ": ", 2 ).append( value.data(), value.size() ).push_back( '\0' );
+        }
+    } );
+    if ( !ok ) {
+        return h2_error( h2::COMPRESSION_ERROR );
+    }
+    if ( trailers ) {
+        if ( s->request_done || !end_stream ) {
+            h.rst_stream( id, h2::PROTOCOL_ERROR );
+            h.remove( id );
+            return true;
+        }
+        s->request_done = true;
+        h2_dispatch( *s );
+        return true;
+    }
+    if ( h.streams.size() >= h2::MAX_CONCURRENT_STREAMS ) {
+        h.rst_stream( id, h2::REFUSED_STREAM );
+        return true;
+    }
+    s->request_time = timer_wheel::now_us();
+    h.streams.push_back( std::move( fresh ) );
+    if ( end_stream ) {
+        s->request_done = true;
+        h2_dispatch( *s );
+    }
+    return true;
+}
+
+// 请求体复制到流中，连接和流的接收窗口消费一半后用WINDOW_UPDATE归还
+bool http_conn::h2_on_data( const h2::frame_header& fh, const uint8_t* p )
+{
+    h2::session& h = *m_h2;
+    if ( fh.stream_id == 0 ) {
+        return h2_error( h2::PROTOCOL_ERROR );
+    }
+    h.recv_unacked += fh.length;
+    if ( h.recv_unacked >= h2::WINDOW_UPDATE_THRESHOLD ) {
+        h.window_update( 0, h.recv_unacked );
+        h.recv_unacked = 0;
+    }
+    h2::stream* s = h.find( fh.stream_id );
+    if ( !s || s->request_done ) {
+        if ( fh.stream_id > h.last_stream_id ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        h.rst_stream( fh.stream_id, h2::STREAM_CLOSED );
+        h.remove( fh.stream_id );
+        return true;
+    }
+    size_t len = fh.length;
+    if ( fh.flags & h2::FLAG_PADDED ) {
+        if ( len < 1 || (size_t)p[0] >= len ) {
+            return h2_error( h2::PROTOCOL_ERROR );
+        }
+        len -= 1 + p[0];
+        p++;
+    }
+    if ( s->body.size() + len > h2::MAX_REQUEST_BODY ) {
+        h.rst_stream( fh.stream_id, h2::CANCEL );
+        h.remove( fh.stream_id );
+        return true;
+    }
+    s->body.append( (const char*)p, len );
+    if ( fh.flags & h2::FLAG_END_STREAM ) {
+        s->request_done = true;
+        h2_dispatch( *s );
+        return true;
+    }
+    s->recv_unacked += fh.length;
+    if ( s->recv_unacked >= h2::WINDOW_UPDATE_THRESHOLD ) {
+        h.window_update( fh.stream_id, s->recv_unacked );
+        s->recv_unacked = 0;
+    }
+    return true;
+}
+
+// 把流上的请求填入解析字段，之后与HTTP/1.1的请求一样经过路由和文件发送路径
+void http_conn::h2_dispatch( h2::stream& s )
+{
+    m_request_time = s.request_time;
+    HTTP_CODE ret = BAD_REQUEST;
+    int method = -1;
+    for ( int m = 0; m < HTTP_METHOD_COUNT; ++m ) {
+        if ( s.method == method_name( m ) ) {
+            method = m;
+        }
+    }
+    if ( method >= 0 && method != CONNECT && !s.path.empty() && s.path[0] == '/' ) {
+        m_method = (METHOD)method;
+        m_url = &s.path[0];
+        m_version = h2_version;
+        m_host = s.authority.empty() ? nullptr : &s.authority[0];
+        ret = GET_REQUEST;
+        char* end = &s.headers[0] + s.headers.size();
+        for ( char* line = &s.headers[0]; line < end; line += strlen( line ) + 1 ) {
+            m_line_end = line + strlen( line );
+            HTTP_CODE header_ret = parse_headers( line );
+            if ( header_ret != NO_REQUEST ) {
+                ret = header_ret;
+                break;
+            }
+        }
+        // 连接的生命周期由HTTP/2管理，Connection等逐跳头部不起作用
+        m_linger = true;
+        if ( ret == GET_REQUEST ) {
+            m_header_start = s.headers.empty() ? nullptr : &s.headers[0];
+            m_header_end = end;
+            m_content_length = s.body.size();
+            m_body = s.body.data();
+            ret = do_request();
+        }
+    }
+    metrics::instance().observe( HISTOGRAM_PARSE, timer_wheel::now_us() - m_request_time );
+    h2_respond( s, ret );
+}
+
+// HTTP/2禁止的逐跳头部，处理函数添加的这些头部不转发
+static bool h2_connection_header( std::string_view name )
+{
+    static const char* names[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade" };
+    for ( const char* n : names ) {
+        if ( name == n ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 处理函数的头部是"Name: value\r\n"格式，HTTP/2要求名字小写
+static void h2_handler_headers( std::string& out, const std::string& headers )
+{
+    std::string name;
+    size_t pos = 0;
+    while ( pos < headers.size() ) {
+        size_t eol = headers.find( "\r\n", pos );
+        if ( eol == std::string::npos ) {
+            eol = headers.size();
+        }
+        size_t colon = headers.find( ':', pos );
+        if ( colon < eol ) {
+            name.assign( headers, pos, colon - pos );
+            for ( char& c : name ) {
+                c = http_scan::lower( (unsigned char)c );
+            }
+            size_t value = headers.find_first_not_of( " \t", colon + 1 );
+            if ( value > eol ) {
+                value = eol;
+            }
+            if ( !h2_connection_header( name ) ) {
+                hpack::encode_header( out, name, std::string_view( headers.data() + value, eol - value ) );
+            }
+        }
+        pos = eol + 2;
+    }
+}
+
+/*
+    响应头编码成HEADERS帧放入控制帧缓冲，响应体的来源记在流中，由h2_fill_batch()切成DATA帧。
+    多个字节范围需要multipart/byteranges，这里发送整个文件；没有响应体的流在HEADERS上结束
+*/
+void http_conn::h2_respond( h2::stream& s, HTTP_CODE ret )
+{
+    h2::session& h = *m_h2;
+    std::string& out = h.encode;
+    out.clear();
+    const char* data = nullptr;
+    size_t len = 0;
+    char number[ 64 ];
+    if ( ret == FILE_REQUEST && m_range_count > 1 ) {
+        m_range_count = 0;
+    }
+    int status = response_status( ret );
+    hpack::encode_status( out, status );
+    switch ( ret ) {
+    case FILE_REQUEST: {
+        off_t offset = 0;
+        len = m_file_stat.st_size;
+        if ( m_range_count == 1 ) {
+            offset = m_ranges[0].first;
+            len = m_ranges[0].last - m_ranges[0].first + 1;
+        }
+        hpack::encode_header( out, "content-length", std::string_view( number, response_header::write_uint( number, len ) - number ) );
+        hpack::encode_header( out, "content-type", m_content_type );
+        if ( m_content_encoding != ENCODING_IDENTITY ) {
+            hpack::encode_header( out, "content-encoding", encoding_name( m_content_encoding ) );
+        }
+        if ( m_vary ) {
+            hpack::encode_header( out, "vary", "accept-encoding" );
+        }
+        if ( m_etag[0] ) {
+            char etag[ ETAG_VALUE_LEN ];
+            hpack::encode_header( out, "etag", std::string_view( etag, format_etag( etag ) ) );
+            char date[ response_header::HTTP_DATE_LEN ];
+            response_header::write_http_date( date, m_last_modified );
+            hpack::encode_header( out, "last-modified", std::string_view( date, sizeof( date ) ) );
+            if ( m_content_encoding == ENCODING_IDENTITY ) {
+                hpack::encode_header( out, "accept-ranges", "bytes" );
+            }
+        }
+        if ( m_range_count == 1 ) {
+            int n = snprintf( number, sizeof( number ), "bytes %lld-%lld/%lld", (long long)m_ranges[0].first,
+                              (long long)m_ranges[0].last, (long long)m_file_stat.st_size );
+            hpack::encode_header( out, "content-range", std::string_view( number, n ) );
+        }
+        if ( m_file_address ) {
+            data = m_file_address + offset;
+        } else {
+            s.fd = m_file ? m_file->fd : -1;
+            s.offset = offset;
+        }
+        s.file = std::move( m_file );
+        m_origin.reset();
+        break;
+    }
+    case NOT_MODIFIED:
+        if ( m_vary ) {
+            hpack::encode_header( out, "vary", "accept-encoding" );
+        }
+        if ( m_etag[0] ) {
+            char etag[ ETAG_VALUE_LEN ];
+            hpack::encode_header( out, "etag", std::string_view( etag, format_etag( etag ) ) );
+            char date[ response_header::HTTP_DATE_LEN ];
+            response_header::write_http_date( date, m_last_modified );
+            hpack::encode_header( out, "last-modified", std::string_view( date, sizeof( date ) ) );
+        }
+        break;
+    case DYNAMIC_REQUEST:
+        if ( status >= 200 && status != 204 && status != 304 ) {
+            if ( m_response.static_body() ) {
+                data = m_response.static_body();
+                len = m_response.static_length();
+            } else {
+                s.owned.swap( m_response.body() );
+                data = s.owned.data();
+                len = s.owned.size();
+            }
+            hpack::encode_header( out, "content-length", std::string_view( number, response_header::write_uint( number, len ) - number ) );
+            hpack::encode_header( out, "content-type", m_response.content_type_value() );
+        }
+        h2_handler_headers( out, m_response.headers() );
+        break;
+    default: {
+        const char* form = error_500_form;
+        if ( ret == RANGE_NOT_SATISFIABLE ) {
+            int n = snprintf( number, sizeof( number ), "bytes */%lld", (long long)m_file_stat.st_size );
+            hpack::encode_header( out, "content-range", std::string_view( number, n ) );
+            form = error_416_form;
+        } else if ( ret == BAD_REQUEST ) {
+            form = error_400_form;
+        } else if ( ret == PAYLOAD_TOO_LARGE ) {
+            form = error_413_form;
+        } else if ( ret == NOT_IMPLEMENTED ) {
+            form = error_501_form;
+        } else if ( ret == FORBIDDEN_REQUEST ) {
+            form = error_403_form;
+        } else if ( ret == NO_RESOURCE ) {
+            form = error_404_form;
+        }
+        data = form;
+        len = strlen( form );
+        hpack::encode_header( out, "content-length", std::string_view( number, response_header::write_uint( number, len ) - number ) );
+        hpack::encode_header( out, "content-type", "text/html" );
+        break;
+    }
+    }
+    if ( m_method == HEAD ) {
+        len = 0;
+    }
+    h.headers( s.id, out, len == 0 );
+    count_response( status );
+    if ( async_log::instance().access_enabled() ) {
+        log_access( ret, len );
+    }
+    init_request();
+    if ( len > 0 ) {
+        s.data = data;
+        s.remaining = len;
+        s.responding = true;
+        return;
+    }
+    metrics::instance().observe( HISTOGRAM_LAST_BYTE, timer_wheel::now_us() - s.request_time );
+    h.remove( s.id );
+}
+
+/*
+    一批帧：先是所有等待的控制帧和HEADERS帧，然后各个流轮流发送一个DATA帧，
+    直到窗口用完、本批达到H2_BATCH_BYTES或iovec/sendfile段用完。
+    DATA帧的帧头写入写缓冲，载荷直接引用文件映射或者作为sendfile段，不复制
+*/
+void http_conn::h2_fill_batch()
+{
+    h2::session& h = *m_h2;
+    if ( !h.control.empty() ) {
+        h.sending.swap( h.control );
+        h.control.clear();
+        add_iov( h.sending.data(), h.sending.size() );
+    }
+    size_t budget = H2_BATCH_BYTES;
+    bool progress = h.preface_received;
+    while ( progress && budget > 0 && h.send_window > 0 && !h.streams.empty() ) {
+        progress = false;
+        size_t count = h.streams.size();
+        for ( size_t n = 0; n < count && budget > 0 && h.send_window > 0 && !h.streams.empty(); ++n ) {
+            size_t k = h.next % h.streams.size();
+            h2::stream& s = *h.streams[k];
+            h.next = k + 1;
+            if ( !s.responding || s.send_window <= 0 ) {
+                continue;
+            }
+            if ( m_iv_count + 2 > IOV_CAPACITY || ( !s.data && m_file_seg_count >= MAX_FILE_SEGMENTS )
+                 || !reserve_write_space( h2::FRAME_HEADER_LEN ) ) {
+                budget = 0;
+                break;
+            }
+            size_t len = std::min( { s.remaining, (size_t)s.send_window, (size_t)h.send_window, (size_t)h.peer_max_frame, budget } );
+            bool last = len == s.remaining;
+            h2::write_frame_header( m_write_buf + m_write_idx, len, h2::FRAME_DATA, last ? h2::FLAG_END_STREAM : 0, s.id );
+            add_iov( m_write_buf + m_write_idx, h2::FRAME_HEADER_LEN );
+            m_write_idx += h2::FRAME_HEADER_LEN;
+            if ( s.data ) {
+                add_iov( s.data, len );
+                s.data += len;
+            } else {
+                add_file_segment( s.fd, s.offset, len );
+                s.offset += len;
+            }
+            s.remaining -= len;
+            s.send_window -= len;
+            h.send_window -= len;
+            budget -= len;
+            progress = true;
+            if ( last ) {
+                // 文件引用随流保留到本批发送完毕
+                metrics::instance().observe( HISTOGRAM_LAST_BYTE, timer_wheel::now_us() - s.request_time );
+                h.finished.push_back( std::move( h.streams[k] ) );
+                h.streams.erase( h.streams.begin() + k );
+                h.next = k;
+            }
+        }
+    }
+}
+
+/*
+    TLS。握手完成后OpenSSL尝试为发送方向启用kTLS：成功时write()的sendmsg和sendfile照常工作，
+    下面的两个函数只在内核不支持时使用，每次最多加密一个记录长度的数据
+*/
+static thread_local char tls_record[ TLS_RECORD_SIZE ];
+
+bool http_conn::tls_handshake()
+{
+    int status = m_tls.handshake();
+    if ( status == TLS_WANT_READ || status == TLS_WANT_WRITE ) {
+        return true;
+    }
+    if ( status != TLS_DONE ) {
+        LOG_DEBUG( "fd %d tls handshake failed", m_sockfd );
+        metrics::instance().add( COUNTER_TLS_FAILED );
+        return false;
+    }
+    metrics::instance().add( m_tls.resumed() ? COUNTER_TLS_RESUMED : COUNTER_TLS_FULL );
+    if ( m_tls.kernel_send() ) {
+        metrics::instance().add( COUNTER_KTLS_SEND );
+    } else {
+        // 内核没有tls模块(或不支持协商出的密码套件)：只提示一次
+        static std::atomic<bool> warned( false );
+        if ( !warned.exchange( true, std::memory_order_relaxed ) ) {
+            LOG_WARN( "kernel tls unavailable, encrypting responses in user space" );
+        }
+    }
+    LOG_DEBUG( "fd %d tls established%s, %s, %s", m_sockfd, m_tls.resumed() ? " (resumed)" : "",
+               m_tls.kernel_send() ? "ktls" : "user space encryption", m_tls.h2_selected() ? "h2" : "http/1.1" );
+    if ( m_tls.h2_selected() ) {
+        // ALPN选择了h2：不需要升级，客户端接下来发送前言
+        m_h2 = new h2::session();
+        m_h2->settings();
+    }
+    return true;
+}
+
+// 解密后的数据按recv完成事件的方式追加到读缓冲。读到WANT_READ为止，OpenSSL内部不会留下没有交出的明文
+bool http_conn::tls_read()
+{
+    if ( m_tls.handshaking() ) {
+        if ( !tls_handshake() ) {
+            return false;
+        }
+        if ( m_tls.handshaking() ) {
+            return true;
+        }
+    }
+    for ( ;; ) {
+        int status = TLS_ERROR;
+        ssize_t n = m_tls.read( tls_record, sizeof( tls_record ), status );
+        if ( n > 0 ) {
+            if ( !feed( tls_record, n ) ) {
+                return false;
+            }
+            continue;
+        }
+        // 0：收到close_notify
+        return n < 0 && ( status == TLS_WANT_READ || status == TLS_WANT_WRITE );
+    }
+}
+
+// 小的内存块(响应头、帧头)收集成一个记录；单个较大的内存块(文件映射)直接交给SSL_write，不复制
+ssize_t http_conn::tls_send_iov( int iv_limit )
+{
+    const char* data = (const char*)m_iv[ m_iv_index ].iov_base;
+    size_t len = m_iv[ m_iv_index ].iov_len;
+    if ( len < TLS_RECORD_SIZE && m_iv_index + 1 < iv_limit ) {
+        len = 0;
+        for ( int i = m_iv_index; i < iv_limit && len < TLS_RECORD_SIZE; ++i ) {
+            size_t n = std::min( m_iv[i].iov_len, TLS_RECORD_SIZE - len );
+            memcpy( tls_record + len, m_iv[i].iov_base, n );
+            len += n;
+        }
+        data = tls_record;
+    }
+    return m_tls.write( data, len );
+}
+
+// 文件段读到用户空间再加密。EAGAIN之后重新读出同样的数据，满足SSL_write重试的要求
+ssize_t http_conn::tls_send_file( file_segment& seg )
+{
+    ssize_t in = pread( seg.fd, tls_record, std::min( seg.len, TLS_RECORD_SIZE ), seg.offset );
+    if ( in <= 0 ) {
+        if ( in == 0 ) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    ssize_t out = m_tls.write( tls_record, in );
+    if ( out > 0 ) {
+        seg.offset += out;
+        seg.len -= out;
+    }
+    return out;
+}
+
+/*
+    反向代理。请求在process()中解析完毕后转发：之后的事件都在reactor线程中处理，
+    客户端描述符在此期间不等待读事件，流水线上后续的请求留在读缓冲中，响应结束后再处理
+*/
+static const size_t PROXY_PIPE_CHUNK = 64 * 1024;   // 一次splice进管道的上限，等于默认的管道容量
+
+void http_conn::proxy_start()
+{
+    // 请求行和头部：逐跳字段不转发，上游连接的keep-alive由代理自己管理(HTTP/1.1默认保持连接)
+    m_proxy_out.clear();
+    m_proxy_out.append( method_name( m_method ) ).append( " " ).append( m_url ).append( " HTTP/1.1\r\n" );
+    bool has_host = false;
+    std::string_view forwarded_for;
+    const char* p = m_header_start;
+    while ( p && p < m_header_end ) {
+        std::string_view line( p );
+        size_t colon = line.find( ':' );
+        http_scan::HEADER id = http_scan::classify_header( p, colon );
+        if ( colon == 15 && strncasecmp( p, "x-forwarded-for", 15 ) == 0 ) {
+            forwarded_for = line.substr( 16 );
+            forwarded_for.remove_prefix( std::min( forwarded_for.find_first_not_of( " \t" ), forwarded_for.size() ) );
+        } else if ( !hop_by_hop( id ) && id != http_scan::HEADER_CONTENT_LENGTH ) {
+            has_host |= id == http_scan::HEADER_HOST;
+            m_proxy_out.append( line ).append( "\r\n" );
+        }
+        p += line.size();
+        while ( p < m_header_end && *p == '\0' ) {
+            ++p;
+        }
+    }
+    if ( !has_host ) {
+        m_proxy_out.append( "Host: " ).append( m_upstream->name() ).append( "\r\n" );
+    }
+    // 请求体的长度由代理自己写出，与实际转发的字节数一致；客户端的Content-Length不转发。
+    // 带Transfer-Encoding或者Content-Length有歧义的请求在解析时已经被拒绝，不会到达这里
+    if ( m_has_content_length ) {
+        m_proxy_out.append( "Content-Length: " ).append( std::to_string( m_content_length ) ).append( "\r\n" );
+    }
+    char addr[ INET_ADDRSTRLEN ];
+    inet_ntop( AF_INET, &m_address.sin_addr, addr, sizeof( addr ) );
+    m_proxy_out.append( "X-Forwarded-For: " );
+    if ( !forwarded_for.empty() ) {
+        m_proxy_out.append( forwarded_for ).append( ", " );
+    }
+    m_proxy_out.append( addr ).append( m_tls.active() ? "\r\nX-Forwarded-Proto: https\r\n\r\n" : "\r\nX-Forwarded-Proto: http\r\n\r\n" );
+    m_proxy_sent = 0;
+    m_proxy_pos = m_proxy_len = 0;
+    m_proxy_bytes = 0;
+    m_proxy_response.status = 0;
+    // 响应头和响应体分别从上游到达，分开写出；关闭Nagle，避免第二次写等待客户端的延迟确认
+    int nodelay = 1;
+    setsockopt( m_sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof( nodelay ) );
+    if ( !proxy_connect( false ) && !proxy_fail( 502 ) ) {
+        close_conn();
+    }
+}
+
+bool http_conn::proxy_connect( bool fresh )
+{
+    int fd = fresh ? -1 : m_upstream->take();
+    bool in_progress = false;
+    m_upstream_reused = fd != -1;
+    if ( fd == -1 ) {
+        fd = m_upstream->connect_new( in_progress );
+        if ( fd < 0 ) {
+            LOG_WARN( "upstream %s: connect failed: %s", m_upstream->name().c_str(), strerror( errno ) );
+            metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+            return false;
+        }
+    }
+    metrics::instance().add( m_upstream_reused ? COUNTER_UPSTREAM_REUSED : COUNTER_UPSTREAM_NEW );
+    m_upstream_fd = fd;
+    m_proxy_state = in_progress ? PROXY_CONNECT : PROXY_SEND;
+    // 先登记描述符和定时器，注册到epoll之后事件可能马上在reactor线程中处理
+    if ( m_conns ) {
+        m_conns->attach( fd, this );
+    }
+    arm_timer( TIMEOUT_UPSTREAM );
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLOUT | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    epoll_ctl( m_epollfd, EPOLL_CTL_ADD, fd, &event );
+    return true;
+}
+
+// 上游描述符上的事件只是唤醒，结果由各个状态的系统调用给出(connect的错误、EOF、EPIPE)
+bool http_conn::upstream_event()
+{
+    switch ( m_proxy_state ) {
+        case PROXY_CONNECT: {
+            int err = 0;
+            socklen_t len = sizeof( err );
+            if ( getsockopt( m_upstream_fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 || err != 0 ) {
+                errno = err ? err : errno;
+                return proxy_upstream_error( "connect" );
+            }
+            m_proxy_state = PROXY_SEND;
+            return proxy_send_request();
+        }
+        case PROXY_SEND:
+            return proxy_send_request();
+        case PROXY_HEAD:
+            return proxy_read_head();
+        default:
+            return proxy_relay();
+    }
+}
+
+// 请求头和读缓冲中的请求体一起用writev发出
+bool http_conn::proxy_send_request()
+{
+    size_t body_len = m_body ? m_content_length : 0;
+    size_t total = m_proxy_out.size() + body_len;
+    while ( m_proxy_sent < total ) {
+        struct iovec iv[2];
+        int count = 0;
+        if ( m_proxy_sent < m_proxy_out.size() ) {
+            iv[ count ].iov_base = &m_proxy_out[ m_proxy_sent ];
+            iv[ count++ ].iov_len = m_proxy_out.size() - m_proxy_sent;
+        }
+        if ( body_len > 0 ) {
+            size_t body_sent = m_proxy_sent > m_proxy_out.size() ? m_proxy_sent - m_proxy_out.size() : 0;
+            iv[ count ].iov_base = (char*)m_body + body_sent;
+            iv[ count++ ].iov_len = body_len - body_sent;
+        }
+        ssize_t n = writev( m_upstream_fd, iv, count );
+        if ( n < 0 ) {
+            if ( errno == EAGAIN ) {
+                arm_timer( TIMEOUT_UPSTREAM );
+                modfd( m_epollfd, m_upstream_fd, EPOLLOUT );
+                return true;
+            }
+            return proxy_upstream_error( "send" );
+        }
+        m_proxy_sent += n;
+    }
+    if ( !m_proxy_buf ) {
+        m_proxy_buf = buffer_pool::instance().acquire( buffer_pool::size_class( UPSTREAM_HEAD_LIMIT ) );
+        if ( !m_proxy_buf ) {
+            return proxy_fail( 502 );
+        }
+    }
+    m_proxy_state = PROXY_HEAD;
+    m_proxy_pos = m_proxy_len = 0;
+    arm_timer( TIMEOUT_UPSTREAM );
+    modfd( m_epollfd, m_upstream_fd, EPOLLIN );
+    return true;
+}
+
+bool http_conn::proxy_read_head()
+{
+    for ( ;; ) {
+        if ( m_proxy_len > 0 ) {
+            ssize_t head = parse_upstream_head( m_proxy_buf, m_proxy_len, m_proxy_response );
+            if ( head < 0 || ( head == 0 && m_proxy_len == UPSTREAM_HEAD_LIMIT ) ) {
+                LOG_WARN( "upstream %s sent an invalid response head", m_upstream->name().c_str() );
+                metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+                return proxy_fail( 502 );
+            }
+            if ( head > 0 ) {
+                int status = m_proxy_response.status;
+                if ( status >= 100 && status < 200 && status != 101 ) {
+                    // 中间响应(100 Continue、103 Early Hints)：请求体已经发出，丢弃它等待最终响应
+                    memmove( m_proxy_buf, m_proxy_buf + head, m_proxy_len - head );
+                    m_proxy_len -= head;
+                    continue;
+                }
+                if ( status == 101 || status < 100 ) {
+                    // Upgrade没有转发，上游不应该切换协议
+                    metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+                    return proxy_fail( 502 );
+                }
+                return proxy_begin_body( head );
+            }
+        }
+        ssize_t n = recv( m_upstream_fd, m_proxy_buf + m_proxy_len, UPSTREAM_HEAD_LIMIT - m_proxy_len, 0 );
+        if ( n > 0 ) {
+            m_proxy_len += n;
+            continue;
+        }
+        if ( n < 0 && errno == EAGAIN ) {
+            arm_timer( TIMEOUT_UPSTREAM );
+            modfd( m_epollfd, m_upstream_fd, EPOLLIN );
+            return true;
+        }
+        if ( n == 0 ) {
+            errno = ECONNRESET;
+        }
+        return proxy_upstream_error( "read" );
+    }
+}
+
+bool http_conn::proxy_begin_body( size_t head_len )
+{
+    upstream_response& r = m_proxy_response;
+    // HEAD、204、304的响应没有响应体，不论头部中的长度
+    if ( m_method == HEAD || r.status == 204 || r.status == 304 ) {
+        r.chunked = false;
+        m_proxy_remaining = 0;
+    } else if ( r.chunked ) {
+        m_chunks.reset();
+        m_proxy_remaining = -1;
+    } else {
+        m_proxy_remaining = r.content_length;
+        if ( m_proxy_remaining < 0 ) {
+            // 响应体以上游关闭连接结束，没有边界可以告诉客户端，只能同样以关闭连接结束
+            m_linger = false;
+        }
+    }
+    // 状态行沿用上游的状态码和原因短语，版本固定为HTTP/1.1
+    const char* reason = m_proxy_buf + 9;
+    const char* eol = (const char*)memchr( reason, '\r', head_len - 9 );
+    m_proxy_out.assign( "HTTP/1.1 " );
+    m_proxy_out.append( reason, eol - reason ).append( "\r\n" );
+    m_proxy_out.append( r.headers );
+    m_proxy_out.append( m_linger ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n" );
+    m_proxy_sent = 0;
+
+    // 随响应头读到的数据中属于响应体的部分留在缓冲中，先于之后的数据写给客户端
+    size_t extra = m_proxy_len - head_len;
+    size_t body = extra;
+    if ( r.chunked ) {
+        ssize_t consumed = m_chunks.feed( m_proxy_buf + head_len, extra );
+        if ( consumed < 0 ) {
+            metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+            return proxy_fail( 502 );
+        }
+        body = consumed;
+    } else if ( m_proxy_remaining >= 0 ) {
+        body = std::min( (uint64_t)extra, (uint64_t)m_proxy_remaining );
+        m_proxy_remaining -= body;
+    }
+    if ( body < extra ) {
+        // 上游在响应之后还发来了数据，连接的状态不可信
+        r.keep_alive = false;
+    }
+    m_proxy_pos = head_len;
+    m_proxy_len = head_len + body;
+
+    // 长度确定(或读到关闭)的响应体在内核中从上游socket经过管道搬到客户端socket；
+    // chunked需要看到数据才能找到结尾，用户空间加密的TLS连接必须经过SSL_write
+    m_proxy_splice = !r.chunked && !m_tls.user_send() && m_proxy_remaining != 0;
+    if ( m_proxy_splice && m_pipefd[0] == -1 && pipe2( m_pipefd, O_NONBLOCK | O_CLOEXEC ) < 0 ) {
+        m_pipefd[0] = m_pipefd[1] = -1;
+        m_proxy_splice = false;
+    }
+    m_proxy_state = PROXY_BODY;
+    return proxy_relay();
+}
+
+ssize_t http_conn::proxy_send_client( const char* data, size_t len )
+{
+    ssize_t n = m_tls.user_send() ? m_tls.write( data, len ) : send( m_sockfd, data, len, 0 );
+    if ( n > 0 ) {
+        metrics::instance().add( COUNTER_BYTES_OUT, n );
+        m_proxy_bytes += n;
+    }
+    return n;
+}
+
+int http_conn::proxy_flush()
+{
+    // 响应头和随它读到的响应体一次writev发出；TLS连接经过SSL_write，逐块发送
+    while ( m_proxy_sent < m_proxy_out.size() && m_proxy_pos < m_proxy_len && !m_tls.user_send() ) {
+        struct iovec iv[2];
+        iv[0].iov_base = &m_proxy_out[ m_proxy_sent ];
+        iv[0].iov_len = m_proxy_out.size() - m_proxy_sent;
+        iv[1].iov_base = m_proxy_buf + m_proxy_pos;
+        iv[1].iov_len = m_proxy_len - m_proxy_pos;
+        ssize_t n = writev( m_sockfd, iv, 2 );
+        if ( n < 0 ) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        metrics::instance().add( COUNTER_BYTES_OUT, n );
+        m_proxy_bytes += n;
+        size_t head = std::min( (size_t)n, iv[0].iov_len );
+        m_proxy_sent += head;
+        m_proxy_pos += n - head;
+    }
+    while ( m_proxy_sent < m_proxy_out.size() ) {
+        ssize_t n = proxy_send_client( m_proxy_out.data() + m_proxy_sent, m_proxy_out.size() - m_proxy_sent );
+        if ( n < 0 ) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        m_proxy_sent += n;
+    }
+    while ( m_proxy_pos < m_proxy_len ) {
+        ssize_t n = proxy_send_client( m_proxy_buf + m_proxy_pos, m_proxy_len - m_proxy_pos );
+        if ( n < 0 ) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        m_proxy_pos += n;
+    }
+    while ( m_pipe_bytes > 0 ) {
+        ssize_t n = splice( m_pipefd[0], NULL, m_sockfd, NULL, m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if ( n < 0 ) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        metrics::instance().add( COUNTER_BYTES_OUT, n );
+        m_proxy_bytes += n;
+        m_pipe_bytes -= n;
+    }
+    return 1;
+}
+
+bool http_conn::proxy_relay()
+{
+    for ( ;; ) {
+        int flushed = proxy_flush();
+        if ( flushed < 0 ) {
+            return false;
+        }
+        if ( flushed == 0 ) {
+            // 客户端接收得慢：上游的数据留在上游socket中，由TCP的流量控制让上游等待
+            arm_timer( TIMEOUT_WRITE );
+            modfd( m_epollfd, m_sockfd, EPOLLOUT );
+            return true;
+        }
+        if ( m_proxy_response.chunked ? m_chunks.done() : m_proxy_remaining == 0 ) {
+            return proxy_finish();
+        }
+        ssize_t n;
+        if ( m_proxy_splice ) {
+            size_t want = m_proxy_remaining > 0 ? std::min( (uint64_t)m_proxy_remaining, (uint64_t)PROXY_PIPE_CHUNK ) : PROXY_PIPE_CHUNK;
+            n = splice( m_upstream_fd, NULL, m_pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+            if ( n > 0 ) {
+                m_pipe_bytes = n;
+            }
+        } else {
+            n = recv( m_upstream_fd, m_proxy_buf, buffer_pool::class_size( buffer_pool::size_class( UPSTREAM_HEAD_LIMIT ) ), 0 );
+            if ( n > 0 ) {
+                size_t body = n;
+                if ( m_proxy_response.chunked ) {
+                    ssize_t consumed = m_chunks.feed( m_proxy_buf, n );
+                    if ( consumed < 0 ) {
+                        LOG_WARN( "upstream %s sent invalid chunked encoding", m_upstream->name().c_str() );
+                        metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+                        return false;
+                    }
+                    body = consumed;
+                } else if ( m_proxy_remaining > 0 ) {
+                    body = std::min( (uint64_t)n, (uint64_t)m_proxy_remaining );
+                }
+                if ( body < (size_t)n ) {
+                    m_proxy_response.keep_alive = false;
+                }
+                m_proxy_pos = 0;
+                m_proxy_len = body;
+                n = body;
+            }
+        }
+        if ( n > 0 ) {
+            if ( m_proxy_remaining > 0 ) {
+                m_proxy_remaining -= n;
+            }
+            continue;
+        }
+        if ( n < 0 && errno == EAGAIN ) {
+            arm_timer( TIMEOUT_UPSTREAM );
+            modfd( m_epollfd, m_upstream_fd, EPOLLIN );
+            return true;
+        }
+        if ( n == 0 && m_proxy_remaining < 0 && !m_proxy_response.chunked ) {
+            // 以关闭连接结束的响应体
+            return proxy_finish();
+        }
+        // 响应头已经发出，响应体不完整：只能关闭客户端连接让它知道响应被截断
+        if ( n == 0 ) {
+            errno = ECONNRESET;
+        }
+        return proxy_upstream_error( "read" );
+    }
+}
+
+bool http_conn::proxy_finish()
+{
+    proxy_release( m_proxy_response.keep_alive );
+    metrics::instance().observe( HISTOGRAM_LAST_BYTE, timer_wheel::now_us() - m_request_time );
+    count_response( m_proxy_response.status );
+    if ( async_log::instance().access_enabled() ) {
+        log_access( PROXY_REQUEST, m_proxy_bytes );
+    }
+    if ( !m_linger ) {
+        return false;
+    }
+    m_request_start = m_start_line;
+    init_request();
+    compact_read_buffer();
+    if ( m_read_idx == 0 ) {
+        release_buffers( true );
+    }
+    // 流水线上已经读入的请求由调用者再次process()
+    m_reprocess = m_read_idx > 0;
+    if ( !m_reprocess ) {
+        arm_read_timer();
+        modfd( m_epollfd, m_sockfd, EPOLLIN );
+    }
+    return true;
+}
+
+void http_conn::on_timeout()
+{
+    if ( m_upstream_fd != -1 && m_proxy_state != PROXY_BODY ) {
+        LOG_WARN( "upstream %s did not respond in time", m_upstream->name().c_str() );
+        metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+        if ( proxy_fail( 504 ) ) {
+            return;
+        }
+    }
+    close_conn();
+}
+
+bool http_conn::proxy_upstream_error( const char* what )
+{
+    // 池中取出的连接在收到任何响应之前失败：上游可能刚好关闭了这个空闲连接，
+    // 幂等的请求换一个新连接重试一次
+    bool idempotent = m_method != POST && m_method != PATCH && m_method != CONNECT;
+    if ( m_upstream_reused && m_proxy_state != PROXY_BODY && m_proxy_len == 0 && idempotent ) {
+        LOG_DEBUG( "upstream %s: pooled connection failed (%s), retrying", m_upstream->name().c_str(), strerror( errno ) );
+        proxy_release( false );
+        m_proxy_sent = 0;
+        return proxy_connect( true ) || proxy_fail( 502 );
+    }
+    LOG_WARN( "upstream %s: %s failed: %s", m_upstream->name().c_str(), what, strerror( errno ) );
+    metrics::instance().add( COUNTER_UPSTREAM_ERRORS );
+    if ( m_proxy_state == PROXY_BODY ) {
+        return false;
+    }
+    return proxy_fail( 502 );
+}
+
+// 以一个普通的响应结束转发的请求，之后与其他请求一样由write()发送
+bool http_conn::proxy_fail( int status )
+{
+    proxy_release( false );
+    m_response.reset();
+    m_response.status( status );
+    m_response.content_type( "text/html" );
+    m_response.write( status == 504 ? "The upstream server did not respond in time.\n"
+                                    : "The upstream server is unavailable or sent an invalid response.\n" );
+    if ( !queue_response( DYNAMIC_REQUEST ) ) {
+        return false;
+    }
+    // 流水线上后面的请求在响应发送完毕后继续处理
+    m_more_input = m_request_start < m_read_idx;
+    arm_timer( TIMEOUT_WRITE );
+    modfd( m_epollfd, m_sockfd, EPOLLOUT );
+    return true;
+}
+
+void http_conn::proxy_release( bool reuse )
+{
+    if ( m_upstream_fd != -1 ) {
+        if ( m_conns ) {
+            m_conns->detach( m_upstream_fd, this );
+        }
+        if ( reuse ) {
+            // 离开epoll后放回池中，之后可能被任何reactor取出
+            epoll_ctl( m_epollfd, EPOLL_CTL_DEL, m_upstream_fd, 0 );
+            m_upstream->put( m_upstream_fd );
+        } else {
+            close( m_upstream_fd );
+        }
+        m_upstream_fd = -1;
+    }
+    if ( m_proxy_buf ) {
+        buffer_pool::instance().release( buffer_pool::size_class( UPSTREAM_HEAD_LIMIT ), m_proxy_buf );
+        m_proxy_buf = nullptr;
+    }
+    m_proxy_pos = m_proxy_len = 0;
+}
+
+/*
+    响应缓存的快速路径，由reactor线程在读到数据后调用。读缓冲中恰好是一个完整的、没有请求体的GET请求，
+    而且响应已经缓存时，一次send回复，不交给线程池，也不经过解析器、路由和文件缓存。
+    只扫描不修改读缓冲：请求有任何需要正常路径处理的头部(条件请求、Range、Connection: close、请求体、
+    升级)或者后面还跟着请求时返回false，由process()从头解析
+*/
+bool http_conn::serve_cached()
+{
+    if ( response_cache::instance().empty() || !m_read_buf || m_h2 || m_tls.handshaking() || m_tls.user_send()
+         || m_batch_count > 0 || m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != m_request_start ) {
+        return false;
+    }
+    const char* p = m_read_buf + m_request_start;
+    const char* end = m_read_buf + m_read_idx;
+    if ( end - p < 18 || memcmp( p, "GET /", 5 ) != 0 || memcmp( end - 4, "\r\n\r\n", 4 ) != 0 ) {
+        return false;
+    }
+    // 请求行：GET path HTTP/1.1，与parse_request_line()一样以空格或制表符分隔
+    const char* path = p + 4;
+    const char* line_end = (const char*)memchr( path, '\r', end - path );
+    const char* space = http_scan::find_char2( path, line_end, ' ', '\t' );
+    if ( line_end - space != 9 || strncasecmp( space + 1, "HTTP/1.1", 8 ) != 0 || line_end[1] != '\n'
+         || memchr( path, '\n', line_end - path ) ) {
+        return false;
+    }
+    unsigned accepted = 0;
+    p = line_end + 2;
+    while ( p < end - 2 ) {
+        const char* eol = (const char*)memchr( p, '\r', end - p );
+        const char* colon = (const char*)memchr( p, ':', eol - p );
+        if ( eol[1] != '\n' || !colon || memchr( p, '\n', eol - p ) ) {
+            return false;
+        }
+        const char* value = colon + 1;
+        while ( value < eol && ( *value == ' ' || *value == '\t' ) ) {
+            ++value;
+        }
+        size_t value_len = eol - value;
+        switch ( http_scan::classify_header( p, colon - p ) ) {
+            case http_scan::HEADER_CONNECTION:
+                if ( value_len == 5 && strncasecmp( value, "close", 5 ) == 0 ) {
+                    return false;
+                }
+                break;
+            case http_scan::HEADER_ACCEPT_ENCODING: {
+                char list[ 256 ];
+                if ( value_len >= sizeof( list ) ) {
+                    return false;
+                }
+                memcpy( list, value, value_len );
+                list[ value_len ] = '\0';
+                accepted = accepted_encodings( list );
+                break;
+            }
+            case http_scan::HEADER_CONTENT_LENGTH:
+            case http_scan::HEADER_TRANSFER_ENCODING:
+            case http_scan::HEADER_RANGE:
+            case http_scan::HEADER_IF_RANGE:
+            case http_scan::HEADER_IF_NONE_MATCH:
+            case http_scan::HEADER_IF_MODIFIED_SINCE:
+            case http_scan::HEADER_UPGRADE:
+            case http_scan::HEADER_HTTP2_SETTINGS:
+                return false;
+            default:
+                break;
+        }
+        p = eol + 2;
+    }
+    std::string_view target( path, space - path );
+    cached_file_ptr response;
+    int encoding = response_cache::instance().acquire( target.substr( 0, target.find( '?' ) ), accepted, response );
+    if ( encoding < 0 ) {
+        return false;
+    }
+
+    uint64_t start = timer_wheel::now_us();
+    size_t len = response->st.st_size;
+    ssize_t sent = send( m_sockfd, response->address, len, 0 );
+    if ( sent < 0 ) {
+        if ( errno != EAGAIN ) {
+            close_conn();
+            return true;
+        }
+        sent = 0;
+    }
+    metrics::instance().add( COUNTER_RESPONSE_CACHE_HITS );
+    metrics::instance().add( COUNTER_BYTES_OUT, sent );
+    count_response( 200 );
+    if ( async_log::instance().access_enabled() ) {
+        access_record r;
+        r.addr = m_address.sin_addr.s_addr;
+        r.port = m_address.sin_port;
+        r.status = 200;
+        r.bytes = len;
+        r.duration_us = 0;
+        r.method = method_name( GET );
+        r.encoding = encoding_name( (content_encoding)encoding );
+        async_log::instance().access( r, target.data(), target.size() );
+    }
+    // 读缓冲中只有这一个请求，整个丢弃；与init_request()一样重新开始计算头部超时
+    m_read_idx = m_checked_idx = m_start_line = m_request_start = 0;
+    m_header_deadline = 0;
+    release_buffers( true );
+    if ( (size_t)sent == len ) {
+        metrics::instance().observe( HISTOGRAM_LAST_BYTE, timer_wheel::now_us() - start );
+        arm_read_timer();
+        modfd( m_epollfd, m_sockfd, EPOLLIN );
+        return true;
+    }
+    // 发送缓冲已满：剩下的部分由普通的写路径发送，本批持有缓存的响应直到发送完毕
+    add_iov( response->address + sent, len - sent );
+    m_batch_times[ m_batch_count ] = start;
+    m_batch_files[ m_batch_count++ ] = std::move( response );
+    arm_timer( TIMEOUT_WRITE );
+    modfd( m_epollfd, m_sockfd, EPOLLOUT );
+    return true;
+}
@@ -1,8 +1,24 @@
 #ifndef HTTPCONNECTION_H
 #define HTTPCONNECTION_H
 #include "Mutex/locker.h"
+#include "Cache/file_cache.h"
+#include "Cache/compress_cache.h"
+#include "Cache/response_cache.h"
+#include "Buffer/buffer_pool.h"
+#include "Buffer/conn_table.h"
+#include "Parser/http_scan.h"
+#include "Timer/timer_wheel.h"
+#include "Response/response_header.h"
+#include "Log/log.h"
+#include "Metrics/metrics.h"
+#include "Uring/io_ring.h"
+#include "Router/route_trie.h"
+#include "Http2/h2_session.h"
+#include "Tls/tls_session.h"
+#include "Proxy/upstream.h"
 #include <iostream>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <stdexcept>
@@ -10,18 +26,32 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
 #include <string.h>
 #include <signal.h>
 #include <assert.h>
 #include <stdarg.h>
-class http_conn{
+#include <atomic>
+#include <mutex>
+class alignas( 64 ) http_conn{
 public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int MAX_READ_BUFFER_SIZE = buffer_pool::MAX_SIZE;  // 读缓冲按需从内存池获取并逐级扩大，最大64KB
+    static const int WRITE_BUFFER_SIZE = buffer_pool::SLAB_SIZE;    // 写缓冲由若干个内存池中的slab串联而成
+    static const int MAX_WRITE_SLABS = 4;
+    static const int MAX_PIPELINE = 16;         // 一批最多合并发送的流水线响应数
+    static constexpr const char* METRICS_PATH = "/metrics";    // 默认路由表中返回统计数据的URL
+    static const int RESPONSE_RESERVE = 256;    // 写缓冲剩余空间少于该值时不再向本批追加响应
+    static const int MAX_RANGES = 8;            // 一个请求最多的字节范围数，更多时忽略Range发送整个文件
+    static const int RESPONSE_IOVS = 2 * MAX_RANGES + 2;    // 一个响应最多占用的iovec数
+    static const int IOV_CAPACITY = 2 * MAX_PIPELINE + RESPONSE_IOVS;
+    static const int MAX_FILE_SEGMENTS = 2 * MAX_RANGES;    // 一批中最多的sendfile段数
+    static const int ETAG_VALUE_LEN = 64 + 8;   // m_etag加上W/前缀、引号和编码后缀
+    static const size_t H2_BATCH_BYTES = 256 * 1024;        // HTTP/2一批中DATA帧载荷的上限，各个流轮流占用
 
-    //http 请求方法，这里只支持GET
-    enum METHOD{GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
+    //http 请求方法，顺序与路由表使用的http_method相同
+    enum METHOD{GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT, PATCH};
     
     /*
         解析客户端请求时，主状态机的状态
@@ -39,24 +69,104 @@ public:
         NO_RESOURCE         :   表示服务器没有资源
         FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
         FILE_REQUEST        :   文件请求,获取文件成功
+        DYNAMIC_REQUEST     :   路由的处理函数生成了响应(包括405和OPTIONS的应答)
+        NOT_MODIFIED        :   条件请求的文件没有变化，只发送304
+        RANGE_NOT_SATISFIABLE:  Range中没有一个范围落在文件内，发送416
+        PAYLOAD_TOO_LARGE   :   请求体放不进读缓冲，发送413
+        NOT_IMPLEMENTED     :   请求带有Transfer-Encoding(不支持分块的请求体)，发送501
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        PROXY_REQUEST       :   路径匹配一个上游，请求转发给它，响应由上游连接提供
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, DYNAMIC_REQUEST, NOT_MODIFIED, RANGE_NOT_SATISFIABLE, PAYLOAD_TOO_LARGE, NOT_IMPLEMENTED, INTERNAL_ERROR, CLOSED_CONNECTION, PROXY_REQUEST};
      // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN};
+    /*
+        连接的超时类型
+        TIMEOUT_HEADER  :   从建立连接或收到请求的第一个字节起，必须在这段时间内收完请求行和头部，读到数据不会延长
+        TIMEOUT_BODY    :   两次读到请求体之间的最长间隔
+        TIMEOUT_WRITE   :   两次发送取得进展之间的最长间隔
+        TIMEOUT_IDLE    :   keep-alive连接在两个请求之间空闲的最长时间
+        TIMEOUT_UPSTREAM:   反向代理等待上游(连接、接收请求、发来响应)取得进展的最长间隔
+    */
+    enum TIMEOUT { TIMEOUT_HEADER = 0, TIMEOUT_BODY, TIMEOUT_WRITE, TIMEOUT_IDLE, TIMEOUT_UPSTREAM, TIMEOUT_COUNT };
+private:
+    // 插在iovec之间、用sendfile发送的一段文件
+    struct file_segment{
+        int iv_index;       // 在m_iv[0, iv_index)全部发送完之后发送
+        int fd;
+        off_t offset;       // 文件中下一个待读取的字节
+        size_t len;         // 还没有从文件读出的字节数
+    };
+    // 请求的一个字节范围，闭区间
+    struct byte_range{
+        off_t first;
+        off_t last;
+    };
 public:
-    http_conn(){}
+    http_conn(): m_generation( 0 ), m_h2( nullptr ), m_upstream_fd( -1 ), m_proxy_buf( nullptr ){}
     ~http_conn(){}
 public:
-    void init(int sockfd, const sockaddr_in& addr);  //初始化新接受的连接
+    void init(int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* timers);  //初始化新接受的连接，epollfd和timers属于连接所在的reactor
+    static void set_timeout( TIMEOUT type, int timeout_ms ) { m_timeouts[type] = timeout_ms; }
+    void cancel_timer();    //取消定时器
+    void hold_timer();      //交给工作线程处理前调用，处理期间连接不会因超时被关闭
+    void release_timer();   //工作线程处理完毕(已经重新注册事件)后调用
     void close_conn(); //关闭连接
     void process();     //处理客户端请求
     bool read();        //非阻塞读
     bool write();       //非阻塞写
+    bool pending_request() const { return m_reprocess; }  //一批响应发送完后读缓冲中还有未解析的请求，需要再次process()
+    bool serve_cached();    //reactor线程：读缓冲中的请求命中响应缓存时直接回复，返回false时照常交给process()
+    int sockfd() const { return m_sockfd; }     //客户端的描述符，与之不同的描述符上的事件属于上游连接
+    bool upstream_event();  //反向代理：上游连接可读或可写，返回false时关闭客户端连接
+    void on_timeout();      //定时器到期：等待上游响应头时回复504，其他情况关闭连接
+
+    /*
+        路由：请求解析完毕后按方法和路径在路由表中查找处理函数。
+        静态文件也是一个处理函数(static_files)，通常以通配符*path注册在根路径下
+    */
+    static void set_routes( const route_table& routes ) { m_routes = routes; }
+    static void static_files( const request_view& req, response_writer& res );  //发送文档根目录下与路径同名的文件
+    static void metrics_page( const request_view& req, response_writer& res );  //Prometheus格式的统计数据
+
+    /*
+        io_uring后端：连接不注册到epoll，读写都由完成事件驱动，请求在reactor线程中直接处理。
+        user_data编码为 [操作:8][代数:24][描述符:32]，代数在每次接受连接时加一，用来丢弃属于旧连接的完成事件
+    */
+    enum URING_OP { URING_ACCEPT = 1, URING_RECV, URING_SEND, URING_SPLICE_IN, URING_SPLICE_OUT, URING_INOTIFY };
+    static uint64_t uring_data( URING_OP op, int fd, uint32_t generation = 0 ) {
+        return (uint64_t)op << 56 | (uint64_t)( generation & 0xffffff ) << 32 | (uint32_t)fd;
+    }
+    static URING_OP uring_op( uint64_t data ) { return (URING_OP)( data >> 56 ); }
+    static int uring_fd( uint64_t data ) { return (int)(uint32_t)data; }
+    static uint32_t uring_generation( uint64_t data ) { return ( data >> 32 ) & 0xffffff; }
+    void init(int sockfd, const sockaddr_in& addr, io_ring* ring, timer_wheel* timers);  //初始化io_uring后端接受的连接
+    uint32_t generation() const { return m_generation; }
+    void on_recv( int res, const char* data, bool more );  //多次触发的recv的一个完成事件，data是内核选择的缓冲
+    void on_send( URING_OP op, int res );   //发送链中的一个请求完成
 private:
     void init();    //初始化连接
+    void init_socket( int sockfd, const sockaddr_in& addr, timer_wheel* timers );   //两种后端共用的连接初始化
+    void init_request();    //一个请求处理完毕后，为解析同一连接上的下一个请求重置状态
+    void compact_read_buffer(); //把尚未处理完的请求移动到读缓冲的开头
+    bool grow_read_buffer();    //读缓冲已满时换成更大一级的缓冲
+    bool reserve_read_space();  //保证读缓冲中还有空闲空间
+    bool feed( const char* data, size_t len );  //把recv完成事件带来的数据追加到读缓冲
+    void rebase_read_buffer( char* new_buf, int shift );    //读缓冲移动后平移已经解析出的指针
+    void release_buffers( bool read_too );  //把写缓冲(以及读缓冲)归还内存池
+    void release_resources();   //连接关闭时释放文件引用、缓冲和管道
+    bool has_write_space() const;   //本批是否还能追加一个响应
+    bool reserve_write_space( int bytes = RESPONSE_RESERVE );   //保证当前写slab中至少有bytes字节的空间
+    bool finish_batch();    //一批响应发送完毕
+    void consume_iov( size_t sent, int iv_limit );  //跳过已经发送的内存块
+    bool arm_recv();        //io_uring：提交多次触发的recv
+    void submit_write();    //io_uring：提交下一段数据的发送链
+    void send_done();       //io_uring：一批响应全部发送完毕
+    void release_uring();   //io_uring：关闭后所有在途请求都完成时才关闭描述符
+    void arm_timer( TIMEOUT type );     //设置(或刷新)定时器
+    void arm_read_timer();  //等待客户端数据前，根据解析状态选择头部、请求体或空闲超时
     HTTP_CODE process_read(); //解析HTTP请求
     bool process_write( HTTP_CODE ret); //填充HTTP应答
 
@@ -65,58 +175,218 @@ private:
     HTTP_CODE parse_headers( char* text );
     HTTP_CODE parse_content( char* text );
     HTTP_CODE do_request();
+    HTTP_CODE file_request( const char* path );     //静态文件：条件请求、字节范围、压缩版本
+    HTTP_CODE method_not_allowed( unsigned allowed );   //路径存在但没有该方法的处理函数：405，OPTIONS回复204
     char* get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
     // 这一组函数被process_write调用以填充HTTP应答。
     void unmap();
-    bool add_response( const char* format, ... );
+    ssize_t send_file_body( file_segment& seg );
+    ssize_t splice_file_body( file_segment& seg );
+    ssize_t tls_send_iov( int iv_limit );       //没有kTLS时：把内存块收集成一个记录用SSL_write发送
+    ssize_t tls_send_file( file_segment& seg ); //没有kTLS时：文件段读到用户空间再用SSL_write发送
+    bool add_bytes( const char* data, size_t len );     //复制到写缓冲，不经过格式化
+    template <size_t N>
+    bool add_bytes( const response_header::fixed_string<N>& s ) { return add_bytes( s.c_str(), N ); }
+    bool add_uint( uint64_t value );
     bool add_content( const char* content );
     bool add_content_type();
-    bool add_status_line( int status, const char* title );
+    bool add_content_encoding();
+    bool add_validators();
+    size_t format_etag( char* out ) const;  //ETag的值(含W/前缀、引号和编码后缀)，out至少ETAG_VALUE_LEN字节
+    bool add_accept_ranges();
+    bool add_representation_headers();  //Content-Type到Accept-Ranges，优先复制文件缓存中序列化好的头部
+    bool add_byteranges_part( int index, const char* boundary );
+    void set_validators( const struct stat& st );  //由文件的元数据生成ETag和Last-Modified
+    bool not_modified() const;      //根据If-None-Match / If-Modified-Since判断客户端缓存的版本是否仍然有效
+    bool etag_matches( const char* list ) const;
+    int parse_ranges( off_t size );     //解析Range，返回可满足的范围数，-1表示忽略Range
+    bool if_range_matches() const;
+    bool add_file_response();           //200、206单范围或multipart/byteranges
+    void add_body( off_t offset, size_t len );  //追加文件的一段：映射的文件用iovec，否则用sendfile段
+    void add_file_segment( int fd, off_t offset, size_t len );  //在当前iovec之后插入一个sendfile段
+    bool add_canned( const char* response, size_t len );    //编译期生成的完整响应，iovec直接引用
+    bool add_dynamic_response();        //把处理函数填写的m_response序列化
     bool add_headers( size_t content_length );
     bool add_content_length( size_t  content_length );
     bool add_linger();
     bool add_blank_line();
+    void add_iov( const char* base, size_t len );
+    void log_access( HTTP_CODE ret, size_t bytes );     //访问日志打开时记录一条请求
+    void cache_response( int start );   //静态文件的完整200响应放进响应缓存，start是响应头在写缓冲中的起点
+    int response_status( HTTP_CODE ret ) const;
+
+    /*
+        HTTP/2(h2c)：客户端前言或Upgrade: h2c之后，读缓冲中是帧。每个流的请求头填入上面的解析字段，
+        经过同样的do_request()，响应头编码为HEADERS帧，响应体按流量控制窗口切成DATA帧，
+        帧头写入写缓冲，帧载荷仍然是文件映射的iovec或sendfile段
+    */
+    int h2_preface_state() const;   //读缓冲开头与客户端前言比较：1完整匹配，0可能匹配但数据不够，-1不是前言
+    bool h2_upgrade( HTTP_CODE ret );   //回复101并切换到HTTP/2，原请求的响应在流1上发送；HTTP2-Settings无效时返回false
+    void h2_process();      //处理收到的帧并发送下一批帧
+    bool h2_receive();      //处理读缓冲中所有完整的帧，出现连接错误时返回false(GOAWAY已经排入发送)
+    bool h2_on_frame( const h2::frame_header& fh, const uint8_t* payload );
+    bool h2_on_headers( const h2::frame_header& fh, const uint8_t* payload );
+    bool h2_on_data( const h2::frame_header& fh, const uint8_t* payload );
+    bool h2_end_headers( uint32_t stream_id, const uint8_t* block, size_t len, bool end_stream );
+    h2::ERROR_CODE h2_apply_settings( const uint8_t* payload, size_t len );
+    bool h2_error( h2::ERROR_CODE code );   //连接错误：发送GOAWAY后关闭
+    void h2_dispatch( h2::stream& s );      //请求完整后按HTTP/1的流程处理
+    void h2_respond( h2::stream& s, HTTP_CODE ret );    //生成响应头和响应体的来源，没有响应体的流随之结束
+    void h2_fill_batch();   //控制帧，然后各个流轮流的DATA帧
+
+    /*
+        TLS(-c/-k，仅epoll后端)：握手在读写事件中逐步推进，完成后按ALPN选择HTTP/1.1或HTTP/2。
+        发送方向交给kTLS时响应仍然走sendmsg/sendfile，否则经过SSL_write
+    */
+    bool tls_read();        //推进握手，然后用SSL_read读到没有数据为止
+    bool tls_handshake();   //推进握手，出错时返回false
+
+    /*
+        反向代理(-u，仅epoll后端)：请求头(去掉逐跳字段)和已经读入的请求体写给上游，上游的响应头解析后
+        改写Connection转发给客户端。有长度或以关闭结束的响应体用splice经过管道从上游socket直接搬到客户端socket，
+        chunked响应体(需要跟踪块边界)和用户空间加密的TLS连接经过缓冲复制。
+        上游描述符注册在客户端所在reactor的epoll中，任何时刻两个描述符只有一个在等待事件
+    */
+    void proxy_start();     //取得上游连接并开始发送请求，在process()中调用
+    bool proxy_connect( bool fresh );   //从池中取出或新建上游连接并注册到epoll，fresh时不使用池
+    bool proxy_send_request();
+    bool proxy_read_head();
+    bool proxy_begin_body( size_t head_len );   //发送响应头，确定响应体的边界和转发方式
+    bool proxy_relay();     //在上游和客户端之间搬运响应体，直到某一方需要等待
+    int proxy_flush();      //把已经读出的数据写给客户端：1写完，0需要等待EPOLLOUT，-1出错
+    ssize_t proxy_send_client( const char* data, size_t len );
+    bool proxy_finish();    //响应体转发完毕：连接放回池中，继续处理客户端的下一个请求
+    bool proxy_upstream_error( const char* what );
+    bool proxy_fail( int status );  //还没有向客户端发送任何数据时以502/504结束请求
+    void proxy_release( bool reuse );   //归还或关闭上游连接，释放缓冲
+    bool queue_response( HTTP_CODE ret );   //把一个请求的响应加入本批并为解析下一个请求重置状态
 private:
 
 
 
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count;   // 多个reactor线程同时增减
+    static int m_timeouts[ TIMEOUT_COUNT ]; // 各类超时的毫秒数
+    static conn_table<http_conn>* m_conns;  // 连接对象表，关闭后把对象归还给它；为nullptr时对象由调用者管理
+    static route_table m_routes;            // 所有连接共享的只读路由表
 private:
-    int m_sockfd;       //该HTTP连接的socket和对方的socket地址
-    sockaddr_in m_address;
+    /*
+        成员按访问频率排列：前面几个缓存行是每个事件(读、解析、发送、超时)都要访问的状态，
+        之后是每个请求访问一次的解析结果和响应状态，最后是只在特定路径上使用的大块数组
+    */
+    // ---- 热字段 ----
+    int m_sockfd;       //该HTTP连接的socket
+    int m_epollfd;      //该连接注册到的epoll实例，多reactor模式下每个reactor各有一个
+    io_ring* m_ring;    //io_uring后端所属reactor的环，为nullptr时使用epoll
+    timer_wheel* m_timers;  //所属reactor的时间轮
+    timer_node m_timer;     //嵌入的定时器节点，到期时reactor关闭连接
+    uint64_t m_header_deadline; //当前请求的头部必须在这个tick之前收完，0表示还没有开始接收
 
-    char m_read_buf[READ_BUFFER_SIZE];  //读缓冲区
+    char* m_read_buf;                   //读缓冲区，空闲时为nullptr
+    int m_read_size;                    //读缓冲区的大小
+    int m_read_class;                   //读缓冲区在内存池中的级别
     int m_read_idx;                     //标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
     int m_checked_idx;                  // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;                   // 当前正在解析的行的起始位置
-
+    int m_request_start;                // 当前正在解析的请求在读缓冲中的起始位置，之前的字节都已处理完
+    char* m_line_end;                   // 最近一个完整行的结尾('\r'被替换成的'\0')
     CHECK_STATE m_check_state;              // 主状态机当前所处的状态
-    METHOD m_method;                        // 请求方法
 
-    char m_real_file[ FILENAME_LEN];    //客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
+    int m_iv_count;
+    int m_iv_index;
+    int m_file_seg_count;
+    int m_file_seg_index;                   // 第一个未发送完的sendfile段
+    int m_batch_count;                      // 本批响应的个数
+    bool m_close_after_batch;               // 本批最后一个响应要求关闭连接
+    bool m_more_input;                      // 因为本批已满而停止解析，读缓冲中可能还有完整的请求
+    bool m_reprocess;                       // 本批已发送完毕且m_more_input为真
+    size_t bytes_to_send;               //将要发送的数据的字节数
+    size_t bytes_have_send;             //已经发送的数据的字节数
+    int m_pipefd[2];                        // sendfile不可用时(以及io_uring后端)splice使用的管道，按需创建，连接关闭时释放
+    size_t m_pipe_bytes;                    // 当前sendfile段已经进入管道但尚未写入socket的字节数
+
+    uint32_t m_generation;  //io_uring：连接的代数，写入user_data
+    int m_send_ops;         //io_uring：发送链中还没有完成的请求数
+    bool m_recv_armed;      //io_uring：多次触发的recv仍然有效
+    bool m_send_failed;     //io_uring：本轮发送链中有请求出错
+    bool m_closing;         //io_uring：已经关闭，等待在途的请求完成后释放描述符
+    h2::session* m_h2;      //切换到HTTP/2之后的会话状态，HTTP/1.1连接为nullptr
+    tls_session m_tls;      //监听端口启用TLS时每个连接的会话，明文连接不活动
+    int m_upstream_fd;      //反向代理：正在使用的上游连接，没有时为-1
+
+    // ---- 每个请求访问一次 ----
+    METHOD m_method;                        // 请求方法
+    uint64_t m_request_time;                // 开始解析请求行的时刻(微秒)
     char* m_url;                        //客户请求的目标文件的文件名
     char* m_version;                    //HTTP协议版本号，我们仅支持HTTP1.1
-
     char* m_host;                       //主机名
-    int m_content_length;               //HTTP请求的消息总长度
+    unsigned m_accept_encoding;         //客户端接受的内容编码，content_encoding的位图
+    char* m_if_none_match;              //If-None-Match的值，指向读缓冲
+    time_t m_if_modified_since;         //If-Modified-Since的时间，没有该字段时为-1
+    size_t m_content_length;            //HTTP请求的消息总长度
+    bool m_has_content_length;          //已经收到Content-Length，重复的字段无法确定请求体的边界
     bool m_linger;                      //HTTP请求是否要求保持连接
+    char* m_range;                          // Range的值，指向读缓冲
+    char* m_if_range;                       // If-Range的值，指向读缓冲
+    char* m_header_start;                   // 第一个头部行，处理函数按需从这里查找头部
+    char* m_header_end;                     // 结束头部的空行
+    const char* m_body;                     // 请求体，长度为m_content_length
+    bool m_upgrade_h2c;                     // Upgrade中列出了h2c
+    char* m_h2_settings;                    // HTTP2-Settings的值，指向读缓冲
+    upstream* m_upstream;                   // 路径匹配的上游，不转发的请求为nullptr
+    bool m_static_route;                    // 由static_files处理：响应只由路径和Accept-Encoding决定
 
-    char m_write_buf[WRITE_BUFFER_SIZE];    //写缓冲区
-    int m_write_idx;                        // 写缓冲区中待发送的字节数
+    char* m_write_slabs[ MAX_WRITE_SLABS ]; //写缓冲区：响应头依次写入这些slab，iovec直接指向它们，扩展时已有数据不会移动
+    int m_write_slab_count;
+    char* m_write_buf;                      //当前正在写入的slab
+    int m_write_idx;                        // 当前slab中已经写入的字节数
+    cached_file_ptr m_file;                     // 从文件缓存中获取的目标文件，持有引用直到响应发送完毕
+    cached_file_ptr m_origin;                   // 原文件的缓存条目，序列化的响应头保存在这里，发送压缩版本时也是它
     char* m_file_address;                   // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                   // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
+    const char* m_content_type;             // 响应体的MIME类型，由扩展名决定
+    bool m_vary;                            // 响应内容随Accept-Encoding变化(可压缩的类型)
+    bool m_etag_weak;                       // 文件在最近一秒内被修改过，同一秒内可能再次变化而mtime不变
+    content_encoding m_content_encoding;    // 发送的是原文件还是某个压缩版本
+    time_t m_last_modified;
+    int m_range_count;                      // 为0时发送整个文件
 
-    int bytes_to_send;                  //将要发送的数据的字节数
-    int bytes_have_send;                //已经发送的数据的字节数
+    // ---- 冷字段 ----
+    sockaddr_in m_address;              //对方的socket地址，只用于日志
+    char m_real_file[ FILENAME_LEN];    //客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
+    struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
+    char m_etag[ 64 ];                      // 原文件的ETag(不含引号和编码后缀)，为空时不发送验证器
+    byte_range m_ranges[ MAX_RANGES ];      // 要发送的字节范围(闭区间)
+    struct msghdr m_send_msg;   //io_uring：sendmsg请求引用的msghdr，完成之前必须有效
+    response_writer m_response;         // 处理函数填写的响应，字符串的容量在同一连接的请求之间复用
 
+    // 反向代理的状态，m_upstream_fd不为-1时有效
+    enum PROXY_STATE { PROXY_CONNECT, PROXY_SEND, PROXY_HEAD, PROXY_BODY };
+    PROXY_STATE m_proxy_state;
+    bool m_upstream_reused;             // 连接取自池中：可能刚好被上游关闭，收到响应之前失败时换新连接重试一次
+    bool m_proxy_splice;                // 响应体经过管道splice，否则复制到m_proxy_buf
+    char* m_proxy_buf;                  // 内存池中的缓冲：响应头，以及复制方式转发的响应体
+    size_t m_proxy_pos;                 // m_proxy_buf中[pos, len)还没有写给客户端
+    size_t m_proxy_len;
+    std::string m_proxy_out;            // 发给上游的请求头，之后是发给客户端的响应头
+    size_t m_proxy_sent;                // m_proxy_out(以及请求体)已经发出的字节数
+    int64_t m_proxy_remaining;          // 还没有从上游读出的响应体字节，-1表示chunked或者读到关闭为止
+    size_t m_proxy_bytes;               // 写给客户端的字节数，记入访问日志
+    upstream_response m_proxy_response;
+    chunk_tracker m_chunks;
+    /*
+        流水线：一次read()读到的多个请求被依次解析，它们的响应头写入同一个写缓冲，
+        与各自的文件映射一起组成一个iovec数组，用一次writev(sendmsg)发送。
+        没有映射的大文件(及其字节范围)是插在iovec之间的sendfile段，按顺序交替发送
+    */
+    struct iovec m_iv[ IOV_CAPACITY ];  // 我们将采用writev来执行写操作，m_iv_count表示被写内存块的数量，m_iv_index为第一个未发送完的内存块
+    file_segment m_file_segs[ MAX_FILE_SEGMENTS ];
+    cached_file_ptr m_batch_files[ MAX_PIPELINE ];  // 本批响应引用的文件，发送完毕后释放
+    uint64_t m_batch_times[ MAX_PIPELINE ]; // 本批各个请求开始解析的时刻，发送完毕时统计到最后一个字节的时间
 };
+static_assert( (int)http_conn::PATCH == (int)HTTP_PATCH, "http_method must follow http_conn::METHOD" );
 
 
 
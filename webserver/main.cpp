@@ -1,16 +1,63 @@
 #include "Mutex/locker.h"
-#include "Threadpool/threadpool.h"
+#include "Threadpool/work_stealing_pool.h"
 #include "http_conn.h"
+#include "Cache/file_cache.h"
+#include "Cache/compress_cache.h"
+#include "Timer/timer_wheel.h"
+#include "Log/log.h"
+#include "Metrics/metrics.h"
+#include "Uring/io_ring.h"
+#include "Topology/cpu_topology.h"
 #include <iostream>
 #include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <vector>
+#include <thread>
 
-const int THREAD_NUMBER = 4;
 const int MAX_FD = 65536;   //最大的文件描述符个数
 const int MAX_EVENT_NUMBER = 10000; //最大的事件数量
+const size_t FILE_CACHE_CAPACITY = 64 * 1024 * 1024;  //文件缓存的字节预算
+const size_t COMPRESS_CACHE_CAPACITY = 16 * 1024 * 1024;  //压缩版本缓存的字节预算
+const size_t RESPONSE_CACHE_CAPACITY = 8 * 1024 * 1024;  //小文件完整响应缓存的字节预算
+const int TIMER_TICK_MS = 100;          //时间轮的精度
+const int HEADER_TIMEOUT_MS = 10000;    //请求头必须在10秒内收完
+const int BODY_TIMEOUT_MS = 30000;      //请求体两次读到数据之间最多30秒
+const int WRITE_TIMEOUT_MS = 30000;     //响应两次发送取得进展之间最多30秒
+const int IDLE_TIMEOUT_MS = 60000;      //keep-alive连接最多空闲60秒
+const int UPSTREAM_TIMEOUT_MS = 60000;  //反向代理：上游连接两次取得进展之间最多60秒
+const unsigned URING_ENTRIES = 4096;    //io_uring提交队列的大小，完成队列是它的4倍
+const unsigned URING_BUFFERS = 1024;    //recv缓冲环中的缓冲个数(2的幂)
+const unsigned URING_BUFFER_SIZE = 4096;
+const int ACCEPT_BATCH = 256;           //一次监听socket就绪最多接受的连接数，共享监听socket时给其他reactor留机会
 
 //添加文件描述符
 extern void addfd(int epollfd, int fd, bool one_shot);
 
+// 监听socket的参数
+struct listen_options{
+    int backlog;            // 全连接队列的长度，内核会截断到net.core.somaxconn
+    int defer_accept;       // TCP_DEFER_ACCEPT的秒数：收到第一个数据包才完成accept，0为关闭
+};
+
+/*
+    一个事件循环(reactor)
+    单reactor模式：主线程监听所有事件并负责读写，请求的解析交给线程池
+    多reactor模式：每个线程一个独立的epoll循环，各自拥有监听socket(SO_REUSEPORT)，
+        或者共享一个用EPOLLEXCLUSIVE注册的监听socket，连接从accept到关闭都在同一个线程中处理
+    io_uring后端(-b uring)：事件循环换成一个io_uring实例，没有线程池，请求在reactor线程中处理
+*/
+struct reactor{
+    int listenfd;
+    int epollfd;
+    bool exclusive;         // 与其他reactor共享监听socket
+    bool watch_files;       // 是否由本reactor处理文件缓存的inotify事件
+    WorkStealingPool* pool; // 为nullptr时在本线程中处理请求
+    bool uring;             // 使用io_uring后端
+    int placement;          // 固定到cpu_topology放置顺序中的第几个CPU，-1为不固定
+};
+
 void addsig(int sig, void(handler )(int)){
 
     /*
@@ -34,39 +81,23 @@ void addsig(int sig, void(handler )(int)){
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
-int main(int argc, char* argv[]){
-    if(argc <= 1){
-        std::cout<<"usage: "<<basename(argv[0])<<" port_number"<<std::endl;
-        return 1;
-    }
-    int port = atoi( argv[1] );
-    std::cout<<port<<std::endl;
-    /*
-        下面这一行，忽略SIGPIPE信号。
-        当一个进程试图向一个已经关闭的管道或套接字写入数据时，SIGPIPE就会被发送。
-        忽略这个信号意味着当 SIGPIPE 信号发生时，进程不会被终止，而是可以继续执行，不理会这个信号。
-    */
-    addsig( SIGPIPE, SIG_IGN );
-
-    //创建线程池
-    ThreadPool* pool= nullptr;
-    try{
-        pool = new ThreadPool(THREAD_NUMBER);
-    }catch( ... ){
-        return 1;
-    }
-    //创建MAX_FD个http连接类对象
-    http_conn* users = new http_conn[ MAX_FD ];
-    
+/*
+    创建监听socket
+    reuseport为true时设置SO_REUSEPORT，多个reactor各自创建监听同一端口的socket，由内核在它们之间分发连接
+    监听socket是非阻塞的：一次就绪可以循环accept直到EAGAIN，共享时被其他reactor抢先也不会阻塞
+*/
+int create_listen_socket(int port, bool reuseport, const listen_options& options){
     /*
         调用socket函数创建一个套接字
             PF_INET：指定地址族为 Internet 协议族，通常用于 TCP/IP 网络。
             SOCK_STREAM：指定套接字类型为流式套接字，这是 TCP 使用的套接字类型。
             0：指定协议类型为默认，通常用于 TCP。
     */
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0);
+    int listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( listenfd < 0 ){
+        return -1;
+    }
 
-    int ret = 0;
     struct sockaddr_in address;
     //服务器应该监听所有可用的网络接口上的连接。
     unsigned int num = 0;
@@ -75,24 +106,145 @@ int main(int argc, char* argv[]){
     address.sin_family = AF_INET;
     address.sin_port = htons( port );
 
-    //端口复用
+    /*
+        端口复用
+        什么是端口复用?
+            默认情况下，一个端口在一段时间内不能被重复使用（端口不复用），这是为了防止新的连接收到属于之前连接的数据包。因为我们认为，一个端口和一个IP地址是绑定的。
+            但是，有时候需要多个套接字绑定到同一个端口号，比如一个服务器应用程序可能会 fork 出多个子进程，每个子进程都需要能够接受到该端口的连接
+            通过设置套接字的 SO_REUSEADDR 选项，可以让多个套接字绑定到同一个端口，前提是它们绑定到不同的IP地址，或者它们的协议族、类型和协议不同。
+        setsocket函数设置套接字属性(不仅仅能够设置端口复用)
+        int setsockopt(int sockfd, int level, int optname, const void *optval, socket_t optlen);
+            sockfd 文件描述符
+            level 级别 --SOL_SOCKET（端口复用的级别）
+            optname	选项的名称
+    		    - SO_REUSEADDR
+    		    - SI_REUSEPORT
+            optval 指向一个变量的指针，该变量包含了要设置的选项的值
+            optlen 指向一个 socklen_t 类型变量的指针，该变量指定了 optval 缓冲区的大小。
+        该函数调用成功时，返回0，失败则返回-1，并设置errno来表示错误原因。
+    */
     int reuse = 1;
     setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    ret = bind( listenfd, (struct sockaddr*)&address, sizeof(address) );
-    ret = listen( listenfd, 5 );
-    
+    if( reuseport ){
+        setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
+    // HTTP总是客户端先发送，连接在请求到达前不会唤醒reactor，也不占用连接对象
+    if( options.defer_accept > 0 ){
+        setsockopt( listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.defer_accept, sizeof(options.defer_accept));
+    }
+    if( bind( listenfd, (struct sockaddr*)&address, sizeof(address) ) < 0
+        || listen( listenfd, options.backlog ) < 0 ){
+        close( listenfd );
+        return -1;
+    }
+    return listenfd;
+}
+
+/*
+    描述符用完(EMFILE/ENFILE)时连接会一直留在监听队列中，监听socket保持就绪，事件循环将空转。
+    每个reactor预留一个描述符：这时关闭它腾出位置，接受并立即关闭队首的连接，然后重新预留
+*/
+int open_reserve_fd(){
+    return open( "/dev/null", O_RDONLY | O_CLOEXEC );
+}
+
+void shed_connection(int listenfd, int& reserve_fd){
+    if( reserve_fd != -1 ){
+        close( reserve_fd );
+    }
+    int connfd = accept4( listenfd, NULL, NULL, SOCK_CLOEXEC );
+    if( connfd >= 0 ){
+        close( connfd );
+    }
+    reserve_fd = open_reserve_fd();
+    // 描述符耗尽时每个连接都会走到这里，每秒最多记录一次
+    static thread_local uint64_t last_warning = 0;
+    static thread_local unsigned dropped = 0;
+    dropped++;
+    uint64_t now = timer_wheel::now_us();
+    if( now - last_warning >= 1000000 ){
+        LOG_WARN( "out of file descriptors, dropped %u pending connection(s)", dropped );
+        last_warning = now;
+        dropped = 0;
+    }
+}
+
+/*
+    接受监听队列中等待的连接，直到EAGAIN或达到ACCEPT_BATCH。
+    accept4直接返回非阻塞、close-on-exec的描述符，每个连接只有这一个系统调用
+*/
+template <typename F>
+void accept_connections(int listenfd, int& reserve_fd, F on_accept){
+    for( int i = 0; i < ACCEPT_BATCH; ++i ){
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        int connfd = accept4( listenfd, (struct sockaddr*)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if( connfd < 0 ){
+            if( errno == EMFILE || errno == ENFILE ){
+                shed_connection( listenfd, reserve_fd );
+                continue;
+            }
+            // 队列已空，或者共享监听socket时连接已经被其他reactor取走
+            if( errno != EAGAIN && errno != EINTR && errno != ECONNABORTED ){
+                LOG_WARN( "accept failure: %s", strerror( errno ) );
+            }
+            if( errno == EAGAIN ){
+                return;
+            }
+            continue;
+        }
+        metrics::instance().add( COUNTER_ACCEPTED );
+        on_accept( connfd, client_address );
+    }
+}
+
+//处理连接上已经读入的请求，多reactor模式下没有线程池，直接在本线程中处理
+void dispatch(reactor& r, http_conn* conn){
+    // 处理期间连接不在时间轮中，处理完后由process()重新设置定时器
+    if( r.pool ){
+        // process()在modfd之前设置的定时器可能已经到期：任务返回之前时间轮不会关闭连接
+        conn->hold_timer();
+        uint64_t posted = timer_wheel::now_us();
+        r.pool->post([conn, posted]{
+            metrics::instance().observe( HISTOGRAM_POOL_WAIT, timer_wheel::now_us() - posted );
+            conn->process();
+            conn->release_timer();
+        });
+    }else{
+        conn->cancel_timer();
+        conn->process();
+    }
+}
+
+void run_reactor(reactor& r, conn_table<http_conn>& users){
     //创建epoll事件数组 
-    epoll_event events[MAX_EVENT_NUMBER ];
+    std::vector<epoll_event> events( MAX_EVENT_NUMBER );
     /*
     // 创建一个新的epoll实例。在内核中创建了一个数据，这个数据中有两个比较重要的数据，一个是需要检
     测的文件描述符的信息（红黑树），还有一个是就绪列表，存放检测到数据发送改变的文件描述符信息（双向链表）。
     参数没有意义，随便写一个大于0的数
     */
-    int epollfd = epoll_create(777);
+    int epollfd = r.epollfd;
+    int listenfd = r.listenfd;
+    // 每个reactor一个时间轮，管理本reactor接受的连接的超时
+    timer_wheel timers( TIMER_TICK_MS );
     // 将listen socket的fd加入到epoll对象中
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd; //static变量
+    if( r.exclusive ){
+        // 共享的监听socket：EPOLLEXCLUSIVE保证一个新连接只唤醒其中一个reactor
+        epoll_event event;
+        event.data.fd = listenfd;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        epoll_ctl( epollfd, EPOLL_CTL_ADD, listenfd, &event );
+    }else{
+        addfd( epollfd, listenfd, false );
+    }
 
+    // 文件缓存的inotify描述符也加入epoll，文件被修改时使缓存失效
+    int inotifyfd = r.watch_files ? file_cache::instance().inotify_fd() : -1;
+    if( inotifyfd != -1 ){
+        addfd( epollfd, inotifyfd, false );
+    }
+    int reserve_fd = open_reserve_fd();
 
     /*
         同步I/O模型，Reactor模式
@@ -116,72 +268,469 @@ int main(int argc, char* argv[]){
                     - 成功，返回发送变化的文件描述符的个数 > 0
                     - 失败 -1
         */
-        std::cout<<"阻塞"<<std::endl;
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 最多等到下一个定时器可能到期的时刻
+        int number = epoll_wait(epollfd, events.data(), MAX_EVENT_NUMBER, timers.next_timeout());
         if ( ( number < 0 ) && ( errno != EINTR ) ) {
-            std::cout<<"epoll failure"<<std::endl;
+            LOG_ERROR( "epoll_wait failure: %s", strerror( errno ) );
             break;
         }
 
         for( int i = 0; i < number; i++ ){
-            events[i].data.fd;
             int sockfd = events[i].data.fd;
+            http_conn* conn = users.get( sockfd );
             //如果listen socket的文件描述符发生变化。
-            if(sockfd == listenfd){
-                
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-                int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-                char ipstr[INET_ADDRSTRLEN];
-                if (inet_ntop(AF_INET, &(client_address.sin_addr), ipstr, INET_ADDRSTRLEN) != NULL) {
-                    printf("The IP address is: %s\n", ipstr);
-                } else {
-                    perror("inet_ntop");
-                    exit(EXIT_FAILURE);
-                }
-
-
-                if( connfd < 0 ) {
-                    std::cout << "errno is: "<<errno<<std::endl;
-                    continue;
-                } 
-                //超出最大连接数
-                if(http_conn::m_user_count >= MAX_FD){
-                    close(connfd);
-                    continue;
-                }
-                //注册该连接
-                users[connfd].init(connfd, client_address); 
+            if(sockfd == inotifyfd){
+                file_cache::instance().process_events();
+            }else if(sockfd == listenfd){
+                accept_connections( listenfd, reserve_fd, [&]( int connfd, const sockaddr_in& client_address ){
+                    LOG_DEBUG( "accept fd %d from %s:%d", connfd, inet_ntoa( client_address.sin_addr ), ntohs( client_address.sin_port ) );
+                    //超出最大连接数
+                    if(http_conn::m_user_count >= MAX_FD){
+                        close(connfd);
+                        return;
+                    }
+                    //注册该连接，连接对象在这时才从连接表中分配
+                    http_conn* accepted = users.acquire( connfd );
+                    if( !accepted ){
+                        close( connfd );
+                        return;
+                    }
+                    accepted->init(connfd, client_address, epollfd, &timers);
+                } );
+            }else if( !conn ){
+                // 本批前面的事件已经关闭了这个连接
+                continue;
+            }else if( sockfd != conn->sockfd() ){
+                // 反向代理的上游连接：连接表中登记的是它服务的客户端连接
+                if( !conn->upstream_event() ){
+                    conn->close_conn();
+                }else if( conn->pending_request() ){
+                    dispatch( r, conn );
+                }
             }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
                 /*
                 EPOLLHUP：表示套接字处于挂起状态，即对端关闭连接或者发生了错误。
                 EPOLLRDHUP：表示读半关闭，即对端关闭了写入端，不再写入数据。
                 */
-                users[sockfd].close_conn();
+                conn->close_conn();
 
             }else if(events[i].events & EPOLLIN){
                 //EPOLLIN: 表示套接字或文件描述符可以进行读取操作
                 //循环读取客户数据，直到无数据可读或者对方关闭连接
-                if(users[sockfd].read()){
-                    //等到所有的请求内容都写到读缓冲区中, 向线程池的任务队列中加入处理sockfd客户端请求的任务
-                    pool->enqueue([&]{users[sockfd].process();});    
+                if(conn->read()){
+                    //响应已经缓存的小文件请求在reactor线程中直接回复；
+                    //否则等到所有的请求内容都写到读缓冲区中, 向线程池的任务队列中加入处理sockfd客户端请求的任务
+                    if( !conn->serve_cached() ){
+                        dispatch( r, conn );
+                    }
                 }else{
-                    users[sockfd].close_conn();
+                    conn->close_conn();
                 }
 
             }else if(events[i].events & EPOLLOUT){
 
-                if( !users[sockfd].write() ) {
-                    std::cout<<"write false"<<std::endl;
-                    users[sockfd].close_conn();
+                if( !conn->write() ) {
+                    LOG_DEBUG( "fd %d write failure, closing", sockfd );
+                    conn->close_conn();
+                }else if( conn->pending_request() ){
+                    //流水线：读缓冲中还有已经收到的请求，不会再触发EPOLLIN，直接继续处理
+                    dispatch( r, conn );
+                }
+            }
+
+        }
+        // 关闭超时的连接：请求头或请求体迟迟收不完、客户端不接收响应、keep-alive连接空闲太久、上游不响应
+        timers.advance( []( void* data ){
+            static_cast<http_conn*>( data )->on_timeout();
+        } );
+    }
+    if( reserve_fd != -1 ){
+        close( reserve_fd );
+    }
+}
+
+/*
+    io_uring后端的事件循环
+    接受连接和读取都是多次触发的请求：提交一次，之后每个新连接、每次到达的数据各产生一个完成事件，
+    recv的数据放在内核从缓冲环中选择的缓冲里，复制到连接的读缓冲后立即归还。
+    发送是链接的请求链(见http_conn::submit_write)。
+    每一轮的io_uring_enter把本轮各个连接准备的请求一次提交，并在同一个系统调用里等待完成事件或下一个定时器
+*/
+void run_uring_reactor(reactor& r, conn_table<http_conn>& users){
+    io_ring ring;
+    int ret = ring.init( URING_ENTRIES );
+    if( ret == 0 ){
+        ret = ring.register_buffers( 0, URING_BUFFERS, URING_BUFFER_SIZE );
+    }
+    if( ret < 0 ){
+        LOG_ERROR( "io_uring setup failure: %s", strerror( -ret ) );
+        return;
+    }
+    timer_wheel timers( TIMER_TICK_MS );
+    // 多次触发的请求出错或因完成队列溢出被终止时(完成事件中没有MORE标志)重新提交
+    auto arm_accept = [&]{
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        if( sqe ){
+            io_ring::prep_accept_multishot( sqe, r.listenfd, http_conn::uring_data( http_conn::URING_ACCEPT, r.listenfd ) );
+        }
+    };
+    int inotifyfd = r.watch_files ? file_cache::instance().inotify_fd() : -1;
+    auto arm_inotify = [&]{
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        if( sqe ){
+            io_ring::prep_poll_multishot( sqe, inotifyfd, POLLIN, http_conn::uring_data( http_conn::URING_INOTIFY, inotifyfd ) );
+        }
+    };
+    arm_accept();
+    if( inotifyfd != -1 ){
+        arm_inotify();
+    }
+    int reserve_fd = open_reserve_fd();
+    // 多次触发的accept不返回对端地址，只在需要记录时查询
+    bool need_peer = async_log::instance().access_enabled() || async_log::instance().enabled( LOG_LEVEL_DEBUG );
+
+    while(true){
+        ret = ring.enter( 1, timers.next_timeout() );
+        if( ret < 0 ){
+            LOG_ERROR( "io_uring_enter failure: %s", strerror( -ret ) );
+            break;
+        }
+        ring.for_each_cqe( [&]( const struct io_uring_cqe& cqe ){
+            uint64_t data = cqe.user_data;
+            int fd = http_conn::uring_fd( data );
+            bool more = cqe.flags & IORING_CQE_F_MORE;
+            http_conn::URING_OP op = http_conn::uring_op( data );
+            switch( op ){
+            case http_conn::URING_ACCEPT:{
+                if( !more ){
+                    arm_accept();
+                }
+                if( cqe.res == -EMFILE || cqe.res == -ENFILE ){
+                    shed_connection( r.listenfd, reserve_fd );
+                    break;
+                }
+                if( cqe.res < 0 ){
+                    LOG_WARN( "accept failure: %s", strerror( -cqe.res ) );
+                    break;
+                }
+                int connfd = cqe.res;
+                metrics::instance().add( COUNTER_ACCEPTED );
+                if( http_conn::m_user_count >= MAX_FD ){
+                    close( connfd );
+                    break;
+                }
+                struct sockaddr_in client_address;
+                memset( &client_address, 0, sizeof( client_address ) );
+                if( need_peer ){
+                    socklen_t client_addrlength = sizeof( client_address );
+                    getpeername( connfd, (struct sockaddr*)&client_address, &client_addrlength );
+                    LOG_DEBUG( "accept fd %d from %s:%d", connfd, inet_ntoa( client_address.sin_addr ), ntohs( client_address.sin_port ) );
+                }
+                http_conn* conn = users.acquire( connfd );
+                if( !conn ){
+                    close( connfd );
+                    break;
+                }
+                conn->init( connfd, client_address, &ring, &timers );
+                break;
+            }
+            case http_conn::URING_RECV:{
+                const char* buf = nullptr;
+                unsigned id = 0;
+                if( cqe.flags & IORING_CQE_F_BUFFER ){
+                    id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                    buf = ring.buffer( id );
+                }
+                http_conn* conn = users.get( fd );
+                if( conn && conn->generation() == http_conn::uring_generation( data ) ){
+                    conn->on_recv( cqe.res, buf, more );
+                }
+                if( buf ){
+                    ring.recycle_buffer( id );
+                }
+                break;
+            }
+            case http_conn::URING_SEND:
+            case http_conn::URING_SPLICE_IN:
+            case http_conn::URING_SPLICE_OUT:{
+                http_conn* conn = users.get( fd );
+                if( conn && conn->generation() == http_conn::uring_generation( data ) ){
+                    conn->on_send( op, cqe.res );
+                }
+                break;
+            }
+            case http_conn::URING_INOTIFY:
+                file_cache::instance().process_events();
+                if( !more ){
+                    arm_inotify();
+                }
+                break;
+            }
+        } );
+        // 本轮归还的缓冲一起对内核可见
+        ring.publish_buffers();
+        timers.advance( []( void* data ){
+            static_cast<http_conn*>( data )->close_conn();
+        } );
+    }
+    if( reserve_fd != -1 ){
+        close( reserve_fd );
+    }
+}
+
+void run_loop(reactor& r, conn_table<http_conn>& users){
+    if( r.placement >= 0 ){
+        const cpu_info& cpu = cpu_topology::instance().placement( r.placement );
+        if( !cpu_topology::pin( cpu ) ){
+            LOG_WARN( "cannot pin reactor to cpu %d", cpu.cpu );
+        }
+    }
+    if( r.uring ){
+        run_uring_reactor( r, users );
+    }else{
+        run_reactor( r, users );
+    }
+}
+
+int main(int argc, char* argv[]){
+    if(argc <= 1){
+        std::cout<<"usage: "<<basename(argv[0])<<" port_number [-r reactors] [-x] [-b epoll|uring] [-l backlog] [-D seconds] [-t threads] [-p] [-s] [-a access_log] [-e error_log] [-c cert -k key] [-u prefix=address] [-v]"<<std::endl;
+        std::cout<<"  -r reactors  启动reactors个独立的事件循环(每个线程一个，SO_REUSEPORT)，默认单reactor+线程池"<<std::endl;
+        std::cout<<"  -x           多reactor共享一个监听socket(EPOLLEXCLUSIVE)，而不是每个reactor一个"<<std::endl;
+        std::cout<<"  -b backend   事件循环的实现：epoll(默认)或uring(io_uring，请求在reactor线程中处理)"<<std::endl;
+        std::cout<<"  -l backlog   监听队列的长度，默认SOMAXCONN"<<std::endl;
+        std::cout<<"  -D seconds   TCP_DEFER_ACCEPT的秒数，默认等于请求头超时，0为关闭"<<std::endl;
+        std::cout<<"  -t threads   线程池的线程数，默认等于可用的CPU数"<<std::endl;
+        std::cout<<"  -p           把reactor和工作线程固定到CPU上，按NUMA节点和物理核依次放置"<<std::endl;
+        std::cout<<"  -s           每个reactor的监听socket设置SO_INCOMING_CPU，连接交给软中断所在CPU上的reactor(需要-r，隐含-p)"<<std::endl;
+        std::cout<<"  -a file      把访问日志写到file，默认不记录"<<std::endl;
+        std::cout<<"  -e file      把运行日志写到file，默认写到标准错误"<<std::endl;
+        std::cout<<"  -c file      PEM格式的证书链，与-k一起在监听端口上启用TLS(需要以-DWEBSERVER_HAVE_OPENSSL编译，仅epoll后端)"<<std::endl;
+        std::cout<<"  -k file      PEM格式的私钥"<<std::endl;
+        std::cout<<"  -u rule      反向代理：路径以prefix开头的请求转发到address(host:port或unix:/path)，可以重复，仅epoll后端"<<std::endl;
+        std::cout<<"  -v           输出DEBUG日志(需要以-DLOG_COMPILE_LEVEL=0编译)"<<std::endl;
+        return 1;
+    }
+    int port = atoi( argv[1] );
+    int reactor_number = 0;
+    bool shared_listener = false;
+    bool uring = false;
+    const cpu_topology& topology = cpu_topology::instance();
+    int thread_number = topology.cpu_count();
+    bool pin_threads = false;
+    bool steer_incoming = false;
+    listen_options listen_opts;
+    listen_opts.backlog = SOMAXCONN;
+    listen_opts.defer_accept = HEADER_TIMEOUT_MS / 1000;
+    int opt;
+    const char* access_log = nullptr;
+    const char* error_log = nullptr;
+    const char* cert_file = nullptr;
+    const char* key_file = nullptr;
+    while( ( opt = getopt( argc, argv, "r:xb:l:D:t:psa:e:c:k:u:v" ) ) != -1 ){
+        switch( opt ){
+            case 'r':
+                reactor_number = atoi( optarg );
+                break;
+            case 'x':
+                shared_listener = true;
+                break;
+            case 'b':
+                if( strcmp( optarg, "uring" ) == 0 ){
+                    uring = true;
+                }else if( strcmp( optarg, "epoll" ) != 0 ){
+                    std::cout<<"unknown backend: "<<optarg<<std::endl;
+                    return 1;
                 }
+                break;
+            case 'l':
+                listen_opts.backlog = atoi( optarg );
+                break;
+            case 'D':
+                listen_opts.defer_accept = atoi( optarg );
+                break;
+            case 't':
+                thread_number = atoi( optarg );
+                break;
+            case 'p':
+                pin_threads = true;
+                break;
+            case 's':
+                steer_incoming = true;
+                pin_threads = true;
+                break;
+            case 'a':
+                access_log = optarg;
+                break;
+            case 'e':
+                error_log = optarg;
+                break;
+            case 'c':
+                cert_file = optarg;
+                break;
+            case 'k':
+                key_file = optarg;
+                break;
+            case 'u':{
+                char error[ 256 ];
+                if( !upstream_registry::instance().add( optarg, error, sizeof( error ) ) ){
+                    std::cout<<"invalid upstream "<<optarg<<": "<<error<<std::endl;
+                    return 1;
+                }
+                break;
             }
+            case 'v':
+                async_log::instance().set_level( LOG_LEVEL_DEBUG );
+                break;
+            default:
+                return 1;
+        }
+    }
+    if( ( error_log && !async_log::instance().open_error_log( error_log ) )
+        || ( access_log && !async_log::instance().open_access_log( access_log ) ) ){
+        std::cout<<"cannot open log file: "<<strerror( errno )<<std::endl;
+        return 1;
+    }
+    if( ( cert_file != nullptr ) != ( key_file != nullptr ) ){
+        std::cout<<"-c and -k must be given together"<<std::endl;
+        return 1;
+    }
+    if( cert_file ){
+        // 所有reactor共享一个SSL_CTX，会话缓存和票据密钥因此对所有连接有效
+        char error[ 256 ];
+        if( !tls_context::instance().init( cert_file, key_file, error, sizeof( error ) ) ){
+            std::cout<<"cannot enable tls: "<<error<<std::endl;
+            return 1;
+        }
+    }
+    async_log::instance().start();
+    if( cert_file ){
+        if( uring ){
+            // io_uring后端直接收发socket上的数据，没有经过SSL的路径
+            LOG_WARN( "tls is not supported by the io_uring backend, using epoll" );
+            uring = false;
+        }
+    }
+    if( uring && !upstream_registry::instance().empty() ){
+        // 上游连接的事件由epoll循环分发
+        LOG_WARN( "the reverse proxy is not supported by the io_uring backend, using epoll" );
+        uring = false;
+    }
+    if( uring ){
+        // 内核不支持(或禁用了)io_uring时退回epoll
+        io_ring probe;
+        int ret = probe.init( 8 );
+        if( ret < 0 ){
+            LOG_WARN( "io_uring unavailable (%s), falling back to epoll", strerror( -ret ) );
+            uring = false;
+        }
+    }
+    if( thread_number <= 0 ){
+        thread_number = 1;
+    }
+    if( steer_incoming && ( reactor_number <= 0 || shared_listener ) ){
+        LOG_WARN( "-s needs one listening socket per reactor (-r without -x), ignored" );
+        steer_incoming = false;
+    }
+    LOG_INFO( "listening on port %d, %d %s reactor(s)", port, reactor_number > 0 ? reactor_number : 1, uring ? "io_uring" : "epoll" );
+    LOG_INFO( "%d cpu(s) on %d numa node(s)%s", topology.cpu_count(), topology.node_count(), pin_threads ? ", threads pinned" : "" );
+    /*
+        下面这一行，忽略SIGPIPE信号。
+        当一个进程试图向一个已经关闭的管道或套接字写入数据时，SIGPIPE就会被发送。
+        忽略这个信号意味着当 SIGPIPE 信号发生时，进程不会被终止，而是可以继续执行，不理会这个信号。
+    */
+    addsig( SIGPIPE, SIG_IGN );
 
+    //按描述符索引的连接表，连接对象在accept时才分配，关闭后复用
+    conn_table<http_conn> users( MAX_FD );
+    http_conn::m_conns = &users;
+    file_cache::instance().set_capacity( FILE_CACHE_CAPACITY );
+    compress_cache::instance().set_capacity( COMPRESS_CACHE_CAPACITY );
+    response_cache::instance().set_capacity( RESPONSE_CACHE_CAPACITY );
+    http_conn::set_timeout( http_conn::TIMEOUT_HEADER, HEADER_TIMEOUT_MS );
+    http_conn::set_timeout( http_conn::TIMEOUT_BODY, BODY_TIMEOUT_MS );
+    http_conn::set_timeout( http_conn::TIMEOUT_WRITE, WRITE_TIMEOUT_MS );
+    http_conn::set_timeout( http_conn::TIMEOUT_IDLE, IDLE_TIMEOUT_MS );
+    http_conn::set_timeout( http_conn::TIMEOUT_UPSTREAM, UPSTREAM_TIMEOUT_MS );
+
+    if( reactor_number <= 0 ){
+        //创建线程池，io_uring后端不使用
+        //固定CPU时reactor占放置顺序的第一个CPU，工作线程从第二个开始，同一节点的CPU先用完
+        WorkStealingPool* pool= nullptr;
+        try{
+            if( !uring ){
+                std::function<void(size_t)> on_start;
+                if( pin_threads ){
+                    on_start = [&topology]( size_t i ){
+                        if( !cpu_topology::pin( topology.placement( i + 1 ) ) ){
+                            LOG_WARN( "cannot pin worker %zu to cpu %d", i, topology.placement( i + 1 ).cpu );
+                        }
+                    };
+                }
+                pool = new WorkStealingPool( thread_number, on_start );
+            }
+        }catch( ... ){
+            return 1;
+        }
+        reactor r;
+        r.listenfd = create_listen_socket( port, false, listen_opts );
+        r.epollfd = epoll_create(777);
+        r.exclusive = false;
+        r.watch_files = true;
+        r.pool = pool;
+        r.uring = uring;
+        r.placement = pin_threads ? 0 : -1;
+        if( r.listenfd < 0 || r.epollfd < 0 ){
+            LOG_ERROR( "listen failure: %s", strerror( errno ) );
+            return 1;
+        }
+        run_loop( r, users );
+        close( r.epollfd );
+        close( r.listenfd );
+        delete pool;
+    }else{
+        std::vector<reactor> reactors( reactor_number );
+        int shared_fd = shared_listener ? create_listen_socket( port, false, listen_opts ) : -1;
+        for( int i = 0; i < reactor_number; ++i ){
+            reactors[i].listenfd = shared_listener ? shared_fd : create_listen_socket( port, true, listen_opts );
+            reactors[i].epollfd = epoll_create(777);
+            reactors[i].exclusive = shared_listener;
+            reactors[i].watch_files = ( i == 0 );
+            reactors[i].pool = nullptr;
+            reactors[i].uring = uring;
+            reactors[i].placement = pin_threads ? i : -1;
+            if( reactors[i].listenfd < 0 || reactors[i].epollfd < 0 ){
+                LOG_ERROR( "listen failure: %s", strerror( errno ) );
+                return 1;
+            }
+            /*
+                reuseport组在选择监听socket时优先SO_INCOMING_CPU等于当前CPU(处理这个SYN的软中断所在CPU)的socket(Linux 6.2起)，
+                配合网卡RSS/RPS，连接由与软中断同一个CPU上的reactor处理，socket的数据不必跨CPU/节点搬运
+            */
+            if( steer_incoming ){
+                int cpu = topology.placement( i ).cpu;
+                if( setsockopt( reactors[i].listenfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof( cpu ) ) < 0 ){
+                    LOG_WARN( "SO_INCOMING_CPU failed: %s", strerror( errno ) );
+                }
+            }
+        }
+        std::vector<std::thread> threads;
+        for( int i = 0; i < reactor_number; ++i ){
+            threads.emplace_back( [&reactors, i, &users]{ run_loop( reactors[i], users ); } );
+        }
+        for( std::thread& t : threads ){
+            t.join();
+        }
+        for( reactor& r : reactors ){
+            close( r.epollfd );
+            if( !shared_listener ){
+                close( r.listenfd );
+            }
+        }
+        if( shared_fd != -1 ){
+            close( shared_fd );
         }
     }
-    close( epollfd );
-    close( listenfd );
-    delete [] users;
-    delete pool;
+    http_conn::m_conns = nullptr;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,173 @@
+#ifndef CONN_DRIVER_H
+#define CONN_DRIVER_H
+
+// 测试用的事件循环：在socketpair上驱动一个从连接表分配的真实http_conn，对各个事件的处理与main.cpp中的
+// epoll reactor相同，请求在本线程中处理(相当于多reactor模式)。对端收到的数据按顺序解析成响应
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "http_conn.h"
+
+extern const char* doc_root;
+
+static int g_failures = 0;
+
+#define CHECK( cond ) do{ \
+        if( !( cond ) ){ \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            ++g_failures; \
+        } \
+    }while( 0 )
+
+// 在临时目录中创建文档根目录
+inline std::string make_doc_root( const char* name ){
+    std::string dir = std::string( "/tmp/" ) + name + ".XXXXXX";
+    if( !mkdtemp( &dir[0] ) ){
+        perror( "mkdtemp" );
+        exit( 1 );
+    }
+    return dir;
+}
+
+// 原地改写文件(O_TRUNC)，与编辑器保存文件一样触发IN_MODIFY
+inline void write_file( const std::string& dir, const char* name, const std::string& content ){
+    std::string path = dir + name;
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 || ::write( fd, content.data(), content.size() ) != (ssize_t)content.size() ){
+        perror( "write" );
+        exit( 1 );
+    }
+    close( fd );
+}
+
+struct http_response{
+    int status;
+    std::string head;
+    std::string body;
+};
+
+class test_conn{
+public:
+    test_conn( conn_table<http_conn>& table, timer_wheel& timers ): m_open( true ), m_cache_hits( 0 ), m_parsed( 0 ){
+        if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, m_sv ) != 0 ){
+            perror( "socketpair" );
+            exit( 1 );
+        }
+        m_epollfd = epoll_create1( EPOLL_CLOEXEC );
+        sockaddr_in addr;
+        memset( &addr, 0, sizeof( addr ) );
+        m_conn = table.acquire( m_sv[0] );
+        m_conn->init( m_sv[0], addr, m_epollfd, &timers );
+    }
+
+    ~test_conn(){
+        if( m_open ){
+            m_conn->close_conn();
+        }
+        close( m_sv[1] );
+        close( m_epollfd );
+    }
+
+    test_conn( const test_conn& ) = delete;
+    test_conn& operator=( const test_conn& ) = delete;
+
+    http_conn* conn() const { return m_conn; }
+    bool open() const { return m_open; }
+    int cache_hits() const { return m_cache_hits; }
+
+    // 客户端发送数据，然后处理事件直到连接空闲
+    void send( const std::string& data ){
+        if( ::send( m_sv[1], data.data(), data.size(), 0 ) != (ssize_t)data.size() ){
+            perror( "send" );
+            exit( 1 );
+        }
+        run();
+    }
+
+    // 取出新收到的完整响应(不支持HEAD请求的响应)
+    std::vector<http_response> responses(){
+        std::vector<http_response> out;
+        for( ;; ){
+            size_t end = m_received.find( "\r\n\r\n", m_parsed );
+            if( end == std::string::npos ){
+                break;
+            }
+            http_response r;
+            r.head = m_received.substr( m_parsed, end + 4 - m_parsed );
+            r.status = atoi( r.head.c_str() + 9 );
+            size_t length = 0;
+            const char* cl = strcasestr( r.head.c_str(), "\r\nContent-Length:" );
+            if( cl ){
+                length = strtoul( cl + 17, nullptr, 10 );
+            }
+            if( m_received.size() < end + 4 + length ){
+                break;
+            }
+            r.body = m_received.substr( end + 4, length );
+            m_parsed = end + 4 + length;
+            out.push_back( std::move( r ) );
+        }
+        return out;
+    }
+
+private:
+    // 与run_reactor()相同的事件处理，直到没有事件为止。对端一直在读，EPOLLOUT不会卡住
+    void run(){
+        epoll_event event;
+        for( int spins = 0; m_open && spins < 100000; ++spins ){
+            drain();
+            if( epoll_wait( m_epollfd, &event, 1, 0 ) != 1 ){
+                break;
+            }
+            if( event.events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ){
+                close_conn();
+            }else if( event.events & EPOLLIN ){
+                if( !m_conn->read() ){
+                    close_conn();
+                }else if( m_conn->serve_cached() ){
+                    ++m_cache_hits;
+                }else{
+                    m_conn->process();
+                }
+            }else if( event.events & EPOLLOUT ){
+                if( !m_conn->write() ){
+                    close_conn();
+                }else if( m_conn->pending_request() ){
+                    m_conn->process();
+                }
+            }
+        }
+        drain();
+    }
+
+    void close_conn(){
+        m_conn->close_conn();
+        m_open = false;
+    }
+
+    void drain(){
+        char buf[ 64 * 1024 ];
+        ssize_t n;
+        while( ( n = recv( m_sv[1], buf, sizeof( buf ), MSG_DONTWAIT ) ) > 0 ){
+            m_received.append( buf, n );
+        }
+    }
+
+    int m_sv[2];
+    int m_epollfd;
+    http_conn* m_conn;
+    bool m_open;
+    int m_cache_hits;       // serve_cached()在reactor路径上直接回复的次数
+    std::string m_received;
+    size_t m_parsed;
+};
+
+#endif
@@ -0,0 +1,166 @@
+// 流水线测试：一次发送多批请求时响应的个数和顺序、分两次到达的请求、Connection: close之后的请求不再处理，
+// 连接关闭后放回连接表的对象被下一个连接复用时不残留上一个连接的状态，
+// 以及请求体的边界(Content-Length、Transfer-Encoding)有歧义的请求被拒绝，不会把请求体当作下一个请求
+// 编译: make pipeline_test    运行: ./pipeline_test
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+#include "conn_driver.h"
+
+static const char* const FILES[][2] = {
+    { "/a.txt", "alpha\n" },
+    { "/b.html", "<p>bravo</p>\n" },
+    { "/c.js", "charlie();\n" },
+};
+
+static std::string get( const char* path, const char* extra = "" ){
+    return std::string( "GET " ) + path + " HTTP/1.1\r\nHost: test\r\n" + extra + "\r\n";
+}
+
+// 多于两批(MAX_PIPELINE)的请求一次到达：后面的批次由pending_request()继续处理，响应按请求的顺序返回
+static void test_many_batches( conn_table<http_conn>& table, timer_wheel& timers ){
+    const int count = 2 * http_conn::MAX_PIPELINE + 8;
+    std::string requests;
+    for( int i = 0; i < count; ++i ){
+        requests += i % 4 == 3 ? get( "/missing.txt" ) : get( FILES[ i % 4 ][0] );
+    }
+    test_conn c( table, timers );
+    c.send( requests );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == (size_t)count );
+    for( size_t i = 0; i < r.size(); ++i ){
+        if( i % 4 == 3 ){
+            CHECK( r[i].status == 404 );
+        }else{
+            CHECK( r[i].status == 200 );
+            CHECK( r[i].body == FILES[ i % 4 ][1] );
+        }
+    }
+    CHECK( c.open() );
+}
+
+// 请求在头部中间被拆开，后半部分和下一个请求一起到达
+static void test_split_request( conn_table<http_conn>& table, timer_wheel& timers ){
+    test_conn c( table, timers );
+    std::string first = get( FILES[0][0] );
+    c.send( first.substr( 0, 20 ) );
+    CHECK( c.responses().empty() );
+    c.send( first.substr( 20 ) + get( FILES[1][0] ) );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 2 );
+    if( r.size() == 2 ){
+        CHECK( r[0].body == FILES[0][1] );
+        CHECK( r[1].body == FILES[1][1] );
+    }
+}
+
+// Connection: close的请求是最后一个被处理的，发送完它的响应后关闭连接
+static void test_close_ends_pipeline( conn_table<http_conn>& table, timer_wheel& timers ){
+    test_conn c( table, timers );
+    c.send( get( FILES[0][0] ) + get( FILES[1][0] ) + get( FILES[2][0], "Connection: close\r\n" ) + get( FILES[0][0] ) );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 3 );
+    if( r.size() == 3 ){
+        CHECK( r[2].body == FILES[2][1] );
+        CHECK( strcasestr( r[2].head.c_str(), "Connection: close" ) != nullptr );
+    }
+    CHECK( !c.open() );
+}
+
+// 关闭时读缓冲中还有半个请求的对象被下一个连接复用，新连接的请求不受影响
+static void test_recycled_object( conn_table<http_conn>& table, timer_wheel& timers ){
+    http_conn* previous;
+    {
+        test_conn c( table, timers );
+        c.send( "GET /a.txt HTTP/1.1\r\nHost: test\r\nX-Partial: " );
+        previous = c.conn();
+    }
+    test_conn c( table, timers );
+    CHECK( c.conn() == previous );
+    c.send( get( FILES[1][0] ) + get( FILES[2][0] ) );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 2 );
+    if( r.size() == 2 ){
+        CHECK( r[0].status == 200 && r[0].body == FILES[1][1] );
+        CHECK( r[1].status == 200 && r[1].body == FILES[2][1] );
+    }
+}
+
+// 请求体的边界无法确定的请求：回复错误后关闭连接，后面的数据不会被当作下一个请求
+static void check_rejected( conn_table<http_conn>& table, timer_wheel& timers, const std::string& request, int status ){
+    test_conn c( table, timers );
+    // 紧跟的"请求"在请求体的边界被错误计算时会得到响应
+    c.send( request + get( FILES[1][0] ) );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 1 );
+    if( r.size() == 1 ){
+        CHECK( r[0].status == status );
+    }
+    CHECK( !c.open() );
+}
+
+static std::string post( const char* headers, const std::string& body = "" ){
+    return std::string( "POST /a.txt HTTP/1.1\r\nHost: test\r\n" ) + headers + "\r\n" + body;
+}
+
+static void test_request_framing( conn_table<http_conn>& table, timer_wheel& timers ){
+    // 分块的请求体不被支持：忽略Transfer-Encoding会把块的内容当作下一个请求
+    check_rejected( table, timers, post( "Transfer-Encoding: chunked\r\n", "0\r\n\r\n" ), 501 );
+    check_rejected( table, timers, post( "Content-Length: 4\r\nTransfer-Encoding: chunked\r\n", "0\r\n\r\n" ), 501 );
+    // 超过读缓冲的长度，包括会溢出int或被截断成0的值
+    check_rejected( table, timers, post( "Content-Length: 2147483647\r\n" ), 413 );
+    check_rejected( table, timers, post( "Content-Length: 4294967296\r\n" ), 413 );
+    check_rejected( table, timers, post( "Content-Length: 99999999999999999999999\r\n" ), 400 );
+    // 重复、冲突或者不是纯数字的值
+    check_rejected( table, timers, post( "Content-Length: 3\r\nContent-Length: 3\r\n", "abc" ), 400 );
+    check_rejected( table, timers, post( "Content-Length: 3\r\nContent-Length: 0\r\n", "abc" ), 400 );
+    check_rejected( table, timers, post( "Content-Length: +3\r\n", "abc" ), 400 );
+    check_rejected( table, timers, post( "Content-Length: 3, 3\r\n", "abc" ), 400 );
+    check_rejected( table, timers, post( "Content-Length: 3x\r\n", "abc" ), 400 );
+
+    // 合法的请求体，内容像一个请求也不会被解析
+    test_conn c( table, timers );
+    std::string body = get( FILES[2][0] );
+    c.send( post( ( "Content-Length: " + std::to_string( body.size() ) + " \r\n" ).c_str(), body ) + get( FILES[1][0] ) );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 2 );
+    if( r.size() == 2 ){
+        CHECK( r[0].status == 405 );
+        CHECK( r[1].status == 200 && r[1].body == FILES[1][1] );
+    }
+    CHECK( c.open() );
+}
+
+int main(){
+    static std::string root = make_doc_root( "pipeline_test" );
+    doc_root = root.c_str();
+    for( auto& f : FILES ){
+        write_file( root, f[0], f[1] );
+    }
+    conn_table<http_conn> table( 4096 );
+    http_conn::m_conns = &table;
+    timer_wheel timers;
+
+    test_many_batches( table, timers );
+    test_split_request( table, timers );
+    test_close_ends_pipeline( table, timers );
+    test_recycled_object( table, timers );
+    test_request_framing( table, timers );
+    // 同时存在的连接从未超过两个，只分配了一组对象
+    CHECK( table.allocated() == (size_t)conn_table<http_conn>::SLAB_OBJECTS );
+
+    http_conn::m_conns = nullptr;
+    for( auto& f : FILES ){
+        unlink( ( root + f[0] ).c_str() );
+    }
+    rmdir( root.c_str() );
+    if( g_failures ){
+        std::cerr << "pipeline_test: " << g_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "pipeline_test: ok" << std::endl;
+    return 0;
+}
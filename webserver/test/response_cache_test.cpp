@@ -0,0 +1,130 @@
+// 完整响应缓存测试：命中的响应与普通路径生成的相同；文件被改写(包括长度和修改时间都不变的改写)或删除后，
+// 缓存的响应不再使用，下一次请求返回新的内容；通知队列溢出丢失了事件时整个缓存失效
+// 编译: make response_cache_test    运行: ./response_cache_test
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "conn_driver.h"
+
+static std::string root;
+
+
+// 一秒之内修改过的文件只有弱ETag，不进入响应缓存，所以把修改时间设到过去
+static void set_mtime( const char* name, time_t mtime ){
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = mtime;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    if( utimensat( AT_FDCWD, ( root + name ).c_str(), times, 0 ) != 0 ){
+        perror( "utimensat" );
+        exit( 1 );
+    }
+}
+
+// 事件循环在inotify描述符可读时做同样的事
+static void file_changed(){
+    file_cache::instance().process_events();
+}
+
+static http_response fetch( test_conn& c, const char* path = "/page.html" ){
+    c.send( std::string( "GET " ) + path + " HTTP/1.1\r\nHost: test\r\n\r\n" );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 1 );
+    return r.empty() ? http_response{ 0, "", "" } : r[0];
+}
+
+int main(){
+    root = make_doc_root( "response_cache_test" );
+    doc_root = root.c_str();
+    time_t past = time( nullptr ) - 60;
+    write_file( root, "/page.html", "version one\n" );
+    set_mtime( "/page.html", past );
+
+    conn_table<http_conn> table( 4096 );
+    http_conn::m_conns = &table;
+    timer_wheel timers;
+    test_conn c( table, timers );
+
+    // 第一次由普通路径生成响应并放入缓存，第二次在reactor路径上命中，内容完全相同
+    http_response first = fetch( c );
+    CHECK( first.status == 200 && first.body == "version one\n" );
+    CHECK( c.cache_hits() == 0 );
+    http_response hit = fetch( c );
+    CHECK( c.cache_hits() == 1 );
+    CHECK( hit.head == first.head && hit.body == first.body );
+
+    // 改写成不同的长度：缓存的响应失效，由普通路径返回新内容后重新放入缓存
+    write_file( root, "/page.html", "version two, longer\n" );
+    set_mtime( "/page.html", past + 1 );
+    file_changed();
+    http_response changed = fetch( c );
+    CHECK( changed.status == 200 && changed.body == "version two, longer\n" );
+    CHECK( c.cache_hits() == 1 );
+    hit = fetch( c );
+    CHECK( c.cache_hits() == 2 );
+    CHECK( hit.body == "version two, longer\n" );
+
+    // 长度和修改时间都不变(ETag相同)的改写也要失效：失效来自文件变化的通知，而不是比较元数据
+    write_file( root, "/page.html", "VERSION TWO, LONGER\n" );
+    set_mtime( "/page.html", past + 1 );
+    file_changed();
+    changed = fetch( c );
+    CHECK( changed.body == "VERSION TWO, LONGER\n" );
+    CHECK( c.cache_hits() == 2 );
+
+    // 删除文件：不再返回缓存的响应
+    hit = fetch( c );
+    CHECK( c.cache_hits() == 3 );
+    unlink( ( root + "/page.html" ).c_str() );
+    file_changed();
+    http_response removed = fetch( c );
+    CHECK( removed.status == 404 );
+    CHECK( c.cache_hits() == 3 );
+    CHECK( c.open() );
+
+    // 轮流改写两个文件产生超过队列上限的事件(相邻的相同事件会被内核合并)，之后对第三个文件的改写的
+    // 事件被丢弃，只剩下IN_Q_OVERFLOW
+    FILE* f = fopen( "/proc/sys/fs/inotify/max_queued_events", "r" );
+    int max_events = 0;
+    if( f ){
+        if( fscanf( f, "%d", &max_events ) != 1 ){
+            max_events = 0;
+        }
+        fclose( f );
+    }
+    if( max_events > 0 && max_events <= 1 << 20 ){
+        const char* names[] = { "/one.html", "/two.html", "/three.html" };
+        for( const char* name : names ){
+            write_file( root, name, "old\n" );
+            set_mtime( name, past );
+            fetch( c, name );
+        }
+        fetch( c, "/three.html" );
+        CHECK( c.cache_hits() == 4 );
+        for( int i = 0; i < max_events; ++i ){
+            write_file( root, names[ i % 2 ], "old\n" );
+        }
+        write_file( root, "/three.html", "new\n" );
+        set_mtime( "/three.html", past );
+        file_changed();
+        http_response flushed = fetch( c, "/three.html" );
+        CHECK( flushed.body == "new\n" );
+        CHECK( c.cache_hits() == 4 );
+        for( const char* name : names ){
+            unlink( ( root + name ).c_str() );
+        }
+    }
+
+    http_conn::m_conns = nullptr;
+    rmdir( root.c_str() );
+    if( g_failures ){
+        std::cerr << "response_cache_test: " << g_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "response_cache_test: ok" << std::endl;
+    return 0;
+}
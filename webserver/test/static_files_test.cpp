@@ -0,0 +1,62 @@
+// 静态文件测试：含有"."或".."段(包括百分号编码的形式)的路径返回400，不会读到文档根目录之外的文件；
+// 只是包含点的普通文件名不受影响
+// 编译: make static_files_test    运行: ./static_files_test
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "conn_driver.h"
+
+// 400响应之后连接关闭，每个请求用一个新连接
+static int status_of( conn_table<http_conn>& table, timer_wheel& timers, const char* path ){
+    test_conn c( table, timers );
+    c.send( std::string( "GET " ) + path + " HTTP/1.1\r\nHost: test\r\n\r\n" );
+    std::vector<http_response> r = c.responses();
+    CHECK( r.size() == 1 );
+    return r.empty() ? 0 : r[0].status;
+}
+
+int main(){
+    // 文档根目录下的docs，旁边的secret.txt在根目录之外
+    std::string base = make_doc_root( "static_files_test" );
+    static std::string root = base + "/docs";
+    mkdir( root.c_str(), 0755 );
+    mkdir( ( root + "/sub" ).c_str(), 0755 );
+    doc_root = root.c_str();
+    write_file( base, "/secret.txt", "secret\n" );
+    write_file( root, "/index.html", "index\n" );
+    write_file( root, "/sub/...", "dots\n" );
+    write_file( root, "/sub/a..b", "dots\n" );
+
+    conn_table<http_conn> table( 4096 );
+    http_conn::m_conns = &table;
+    timer_wheel timers;
+    CHECK( status_of( table, timers, "/../secret.txt" ) == 400 );
+    CHECK( status_of( table, timers, "/sub/../../secret.txt" ) == 400 );
+    CHECK( status_of( table, timers, "/%2e%2e/secret.txt" ) == 400 );
+    CHECK( status_of( table, timers, "/%2E./secret.txt" ) == 400 );
+    CHECK( status_of( table, timers, "/sub/%2e/../index.html" ) == 400 );
+    CHECK( status_of( table, timers, "/./index.html" ) == 400 );
+    CHECK( status_of( table, timers, "/sub/.." ) == 400 );
+    CHECK( status_of( table, timers, "/index.html" ) == 200 );
+    CHECK( status_of( table, timers, "/sub/..." ) == 200 );
+    CHECK( status_of( table, timers, "/sub/a..b" ) == 200 );
+    CHECK( status_of( table, timers, "/%2e%2e%2e" ) == 404 );
+    http_conn::m_conns = nullptr;
+
+    const char* files[] = { "/docs/sub/...", "/docs/sub/a..b", "/docs/index.html", "/secret.txt" };
+    for( const char* f : files ){
+        unlink( ( base + f ).c_str() );
+    }
+    rmdir( ( root + "/sub" ).c_str() );
+    rmdir( root.c_str() );
+    rmdir( base.c_str() );
+    if( g_failures ){
+        std::cerr << "static_files_test: " << g_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "static_files_test: ok" << std::endl;
+    return 0;
+}